@@ -71,6 +71,9 @@ LIBRARY_DEPENDENCIES_DEFAULT = {
     'irt_support_private': [
         'platform',
         ],
+    'persistent_validation_cache': [
+        'platform',
+        ],
     'pnacl_dynloader': [
         'platform',
         ],
@@ -105,6 +108,7 @@ PLATFORM_LIBRARY_DEPENDENCIES = {
             'cpu_features',
             'validation_cache',
             'nccopy_x86_64',
+            'platform',
             ],
         },
     'arm': {
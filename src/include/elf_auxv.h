@@ -25,5 +25,7 @@
                                (overloaded for dynamic text start) */
 #define AT_ENTRY        9   /* Entry point of the executable */
 #define AT_SYSINFO      32  /* System call entry point */
+#define AT_NACL_VVAR    256 /* NaCl-specific: address of the read-only
+                               time data page (struct nacl_abi_vvar) */
 
 #endif
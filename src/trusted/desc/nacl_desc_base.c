@@ -35,6 +35,7 @@
 #include "native_client/src/trusted/desc/nacl_desc_mutex.h"
 #include "native_client/src/trusted/desc/nacl_desc_null.h"
 #include "native_client/src/trusted/desc/nacl_desc_quota.h"
+#include "native_client/src/trusted/desc/nacl_desc_shm_socket.h"
 #include "native_client/src/trusted/desc/nacl_desc_sync_socket.h"
 
 #include "native_client/src/trusted/nacl_base/nacl_refcount.h"
@@ -209,6 +210,7 @@ int (*NaClDescInternalize[NACL_DESC_TYPE_MAX])(
   NaClDescInternalizeNotImplemented,  /* quota wrapper */
   NaClDescInternalizeNotImplemented,  /* custom */
   NaClDescNullInternalize,
+  NaClDescShmSocketInternalize,
 };
 
 char const *NaClDescTypeString(enum NaClDescTypeTag type_tag) {
@@ -233,6 +235,7 @@ char const *NaClDescTypeString(enum NaClDescTypeTag type_tag) {
     MAP(NACL_DESC_QUOTA);
     MAP(NACL_DESC_CUSTOM);
     MAP(NACL_DESC_NULL);
+    MAP(NACL_DESC_SHM_SOCKET);
   }
   return "BAD TYPE TAG";
 }
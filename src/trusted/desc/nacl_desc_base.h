@@ -93,7 +93,8 @@ enum NaClDescTypeTag {
   NACL_DESC_IMC_SOCKET,
   NACL_DESC_QUOTA,
   NACL_DESC_CUSTOM,
-  NACL_DESC_NULL
+  NACL_DESC_NULL,
+  NACL_DESC_SHM_SOCKET
   /*
    * Add new NaClDesc subclasses here.
    *
@@ -101,7 +102,7 @@ enum NaClDescTypeTag {
    * also be updated to add new internalization functions.
    */
 };
-#define NACL_DESC_TYPE_MAX      (NACL_DESC_NULL + 1)
+#define NACL_DESC_TYPE_MAX      (NACL_DESC_SHM_SOCKET + 1)
 #define NACL_DESC_TYPE_END_TAG  (0xff)
 
 struct NaClInternalRealHeader {
@@ -0,0 +1,715 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * NaCl Service Runtime.  Shared memory ring buffer sockets.
+ */
+
+#include "native_client/src/trusted/desc/nacl_desc_shm_socket.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/include/build_config.h"
+#include "native_client/src/include/nacl_macros.h"
+#include "native_client/src/include/nacl_platform.h"
+#include "native_client/src/public/imc_types.h"
+#include "native_client/src/shared/imc/nacl_imc_c.h"
+#include "native_client/src/shared/platform/nacl_host_desc.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/trusted/desc/nacl_desc_effector_trusted_mem.h"
+#include "native_client/src/trusted/desc/nacl_desc_imc_shm.h"
+#include "native_client/src/trusted/desc/nrd_xfer.h"
+#include "native_client/src/trusted/service_runtime/include/bits/mman.h"
+#include "native_client/src/trusted/service_runtime/include/sys/errno.h"
+#include "native_client/src/trusted/service_runtime/include/sys/stat.h"
+#include "native_client/src/trusted/service_runtime/nacl_config.h"
+
+#if NACL_LINUX
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NACL_SHM_SOCKET_MAGIC        0x4b534d53  /* "SMSK" */
+#define NACL_SHM_SOCKET_HEADER_SIZE  NACL_MAP_PAGESIZE
+/*
+ * Each direction gets its own ring.  This must be a power of two, and
+ * large enough for the largest message NaClImcSendTypedMessage sends.
+ */
+#define NACL_SHM_SOCKET_RING_SIZE    (256 << 10)
+#define NACL_SHM_SOCKET_SHM_SIZE     (NACL_SHM_SOCKET_HEADER_SIZE + \
+                                      2 * NACL_SHM_SOCKET_RING_SIZE)
+/*
+ * A process that dies does not wake the peer's waiters, so they look at
+ * the liveness socket at least this often.
+ */
+#define NACL_SHM_SOCKET_LIVENESS_POLL_MS  100
+
+/*
+ * The ring itself is a sequence of records, each a uint32_t message
+ * length followed by the message, padded to a multiple of 4 bytes.
+ * |head| and |tail| count the bytes ever written and consumed, modulo
+ * 2^32, so head - tail is the number of bytes in use.
+ *
+ * The shm object is only ever shared between trusted processes, but
+ * the receiver still bounds-checks everything it reads from it.
+ */
+struct NaClShmSocketRing {
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  /* Futex word, bumped on every change that a waiter might wait for. */
+  volatile uint32_t seq;
+  volatile uint32_t waiters;
+  /* Futex locks, so that messages from concurrent senders don't mix. */
+  volatile uint32_t send_lock;
+  volatile uint32_t recv_lock;
+};
+
+struct NaClShmSocketShared {
+  uint32_t                  magic;
+  uint32_t                  ring_size;
+  /*
+   * Number of NaClDesc objects for each end that have been made and not
+   * destroyed, in all processes.  Only a hint: a process that dies does
+   * not drop its counts.  See NaClShmSocketPeerClosed.
+   */
+  volatile uint32_t         refs[2];
+  /* ring[i] holds the messages sent from end i. */
+  struct NaClShmSocketRing  ring[2];
+};
+
+static struct NaClDescVtbl const kNaClDescShmSocketVtbl;  /* fwd */
+
+/*
+ * The futexes are not FUTEX_PRIVATE_FLAG ones, since the peer may be
+ * in another process.
+ */
+static void NaClShmSocketFutexWait(volatile uint32_t *addr, uint32_t val,
+                                   const struct timespec *timeout) {
+  (void) syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAIT, val,
+                 timeout, NULL, 0);
+}
+
+static void NaClShmSocketFutexWake(volatile uint32_t *addr, int count) {
+  (void) syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAKE, count,
+                 NULL, NULL, 0);
+}
+
+/*
+ * A lock word is 0 when unlocked, 1 when locked and 2 when locked with
+ * possible waiters.
+ */
+static void NaClShmSocketLock(volatile uint32_t *lock) {
+  uint32_t c = __sync_val_compare_and_swap(lock, 0, 1);
+
+  if (0 == c) {
+    return;
+  }
+  if (2 != c) {
+    c = __sync_lock_test_and_set(lock, 2);
+  }
+  while (0 != c) {
+    NaClShmSocketFutexWait(lock, 2, NULL);
+    c = __sync_lock_test_and_set(lock, 2);
+  }
+}
+
+static void NaClShmSocketUnlock(volatile uint32_t *lock) {
+  if (1 != __sync_fetch_and_sub(lock, 1)) {
+    __sync_lock_release(lock);
+    NaClShmSocketFutexWake(lock, 1);
+  }
+}
+
+/*
+ * |seq| must have been read, followed by a barrier, before the caller
+ * found that it has to wait.  Any change made after that bumps |seq|,
+ * so the futex wait then returns at once.  The wait also gives up after
+ * NACL_SHM_SOCKET_LIVENESS_POLL_MS, since a peer that dies never bumps
+ * |seq|.
+ */
+static void NaClShmSocketRingWait(struct NaClShmSocketRing *ring,
+                                  uint32_t                 seq) {
+  struct timespec timeout;
+
+  timeout.tv_sec = 0;
+  timeout.tv_nsec = NACL_SHM_SOCKET_LIVENESS_POLL_MS * 1000 * 1000;
+  __sync_fetch_and_add(&ring->waiters, 1);
+  NaClShmSocketFutexWait(&ring->seq, seq, &timeout);
+  __sync_fetch_and_sub(&ring->waiters, 1);
+}
+
+static void NaClShmSocketRingNotify(struct NaClShmSocketRing *ring) {
+  __sync_fetch_and_add(&ring->seq, 1);
+  if (0 != ring->waiters) {
+    NaClShmSocketFutexWake(&ring->seq, INT_MAX);
+  }
+}
+
+/*
+ * Whether every NaClDesc for the peer end is gone.  Each end also holds
+ * one socket of a kernel socket pair, which every NaClDesc for the end
+ * shares and which travels in the messages that transfer it.  The kernel
+ * reports a hangup once the peer's socket is closed everywhere: by
+ * NaClDescs that are destroyed, by processes that die, and in messages
+ * that fail to send, are dropped or are never received.  That makes it
+ * the authority, and |refs| is only a way to skip the poll while a
+ * NaClDesc for the peer is known to exist.  The caller has waited,
+ * |waited|, if the count can be stale because a holder died.
+ */
+static int NaClShmSocketPeerClosed(struct NaClDescShmSocket *self,
+                                   int                      waited) {
+  volatile uint32_t *peer_refs = &self->shared->refs[1 - self->end];
+  struct pollfd pfd;
+
+  if (!waited && 0 != *peer_refs) {
+    return 0;
+  }
+  pfd.fd = self->h;
+  pfd.events = 0;
+  pfd.revents = 0;
+  if (1 != poll(&pfd, 1, 0) || 0 == (pfd.revents & POLLHUP)) {
+    return 0;
+  }
+  /*
+   * A NaClDesc closes its socket after dropping its count, so whatever
+   * is left of the count belongs to processes that died.  Clear it, so
+   * that later calls do not have to wait to find out.
+   */
+  *peer_refs = 0;
+  return 1;
+}
+
+static uint32_t NaClShmSocketRecordSize(uint32_t len) {
+  return (uint32_t) ((sizeof(uint32_t) + len + 3) & ~3);
+}
+
+static void NaClShmSocketCopyIn(char *data, uint32_t pos,
+                                const void *src, size_t n) {
+  uint32_t off = pos & (NACL_SHM_SOCKET_RING_SIZE - 1);
+  size_t first = NACL_SHM_SOCKET_RING_SIZE - off;
+
+  if (first > n) {
+    first = n;
+  }
+  memcpy(data + off, src, first);
+  memcpy(data, (const char *) src + first, n - first);
+}
+
+static void NaClShmSocketCopyOut(void *dst, const char *data, uint32_t pos,
+                                 size_t n) {
+  uint32_t off = pos & (NACL_SHM_SOCKET_RING_SIZE - 1);
+  size_t first = NACL_SHM_SOCKET_RING_SIZE - off;
+
+  if (first > n) {
+    first = n;
+  }
+  memcpy(dst, data + off, first);
+  memcpy((char *) dst + first, data, n - first);
+}
+
+static char *NaClShmSocketRingData(struct NaClDescShmSocket *self, int end) {
+  return ((char *) self->shared + NACL_SHM_SOCKET_HEADER_SIZE +
+          end * NACL_SHM_SOCKET_RING_SIZE);
+}
+
+static uintptr_t NaClShmSocketMapShared(struct NaClDesc *shm) {
+  return (*NACL_VTBL(NaClDesc, shm)->
+          Map)(shm,
+               NaClDescEffectorTrustedMem(),
+               NULL,
+               NACL_SHM_SOCKET_SHM_SIZE,
+               NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE,
+               NACL_ABI_MAP_SHARED,
+               0);
+}
+
+/*
+ * Takes over the caller's reference to |shm| and ownership of |h|, the
+ * end's liveness socket, on success, and counts the new NaClDesc in
+ * |refs|.
+ */
+static int NaClDescShmSocketSubclassCtor(struct NaClDescShmSocket *self,
+                                         struct NaClDesc          *shm,
+                                         NaClHandle               h,
+                                         int                      end) {
+  struct NaClDesc             *basep = (struct NaClDesc *) self;
+  struct NaClShmSocketShared  *shared;
+  uintptr_t                   addr;
+
+  if (NACL_DESC_SHM != NACL_VTBL(NaClDesc, shm)->typeTag ||
+      ((struct NaClDescImcShm *) shm)->size != NACL_SHM_SOCKET_SHM_SIZE) {
+    NaClLog(LOG_ERROR, "NaClDescShmSocketSubclassCtor: bad shm object\n");
+    return 0;
+  }
+  addr = NaClShmSocketMapShared(shm);
+  if (NaClPtrIsNegErrno(&addr)) {
+    NaClLog(LOG_ERROR, "NaClDescShmSocketSubclassCtor: map failed\n");
+    return 0;
+  }
+  shared = (struct NaClShmSocketShared *) addr;
+  if (NACL_SHM_SOCKET_MAGIC != shared->magic ||
+      NACL_SHM_SOCKET_RING_SIZE != shared->ring_size) {
+    NaClLog(LOG_ERROR, "NaClDescShmSocketSubclassCtor: bad header\n");
+    NaClHostDescUnmapUnsafe((void *) addr, NACL_SHM_SOCKET_SHM_SIZE);
+    return 0;
+  }
+  self->shm = shm;
+  self->shared = shared;
+  self->shared_size = NACL_SHM_SOCKET_SHM_SIZE;
+  self->h = h;
+  self->end = end;
+  __sync_fetch_and_add(&shared->refs[end], 1);
+  basep->base.vtbl = (struct NaClRefCountVtbl const *) &kNaClDescShmSocketVtbl;
+  return 1;
+}
+
+static void NaClDescShmSocketDtor(struct NaClRefCount *vself) {
+  struct NaClDescShmSocket *self = (struct NaClDescShmSocket *) vself;
+  struct NaClShmSocketShared *shared = self->shared;
+
+  /*
+   * Wake up a peer blocked in send or receive, so it sees the close.  The
+   * socket goes first, so that the peer sees the hangup once it wakes up
+   * if this was the last NaClDesc for the end.
+   */
+  __sync_fetch_and_sub(&shared->refs[self->end], 1);
+  (void) NaClClose(self->h);
+  self->h = NACL_INVALID_HANDLE;
+  NaClShmSocketRingNotify(&shared->ring[0]);
+  NaClShmSocketRingNotify(&shared->ring[1]);
+
+  NaClHostDescUnmapUnsafe((void *) shared, self->shared_size);
+  self->shared = NULL;
+  NaClDescUnref(self->shm);
+  self->shm = NULL;
+  vself->vtbl = (struct NaClRefCountVtbl const *) &kNaClDescVtbl;
+  (*vself->vtbl->Dtor)(vself);
+}
+
+static int NaClDescShmSocketFstat(struct NaClDesc       *vself,
+                                  struct nacl_abi_stat  *statbuf) {
+  UNREFERENCED_PARAMETER(vself);
+
+  memset(statbuf, 0, sizeof *statbuf);
+  statbuf->nacl_abi_st_mode = NACL_ABI_S_IFDSOCK;
+  return 0;
+}
+
+static int NaClDescShmSocketExternalizeSize(struct NaClDesc *vself,
+                                            size_t          *nbytes,
+                                            size_t          *nhandles) {
+  struct NaClDescShmSocket *self = (struct NaClDescShmSocket *) vself;
+  size_t shm_bytes;
+  size_t shm_handles;
+  int rv;
+
+  rv = NaClDescExternalizeSize(vself, nbytes, nhandles);
+  if (0 != rv) {
+    return rv;
+  }
+  rv = (*NACL_VTBL(NaClDesc, self->shm)->
+        ExternalizeSize)(self->shm, &shm_bytes, &shm_handles);
+  if (0 != rv) {
+    return rv;
+  }
+  *nbytes += 1 + shm_bytes;
+  *nhandles += shm_handles + 1;
+  return 0;
+}
+
+static int NaClDescShmSocketExternalize(struct NaClDesc           *vself,
+                                        struct NaClDescXferState  *xfer) {
+  struct NaClDescShmSocket *self = (struct NaClDescShmSocket *) vself;
+  int rv;
+
+  rv = NaClDescExternalize(vself, xfer);
+  if (0 != rv) {
+    return rv;
+  }
+  *xfer->next_byte++ = (char) self->end;
+  rv = (*NACL_VTBL(NaClDesc, self->shm)->Externalize)(self->shm, xfer);
+  if (0 != rv) {
+    return rv;
+  }
+  /*
+   * The copy of the liveness socket in the message keeps this end open
+   * until the message is received or dropped.
+   */
+  *xfer->next_handle++ = self->h;
+  return 0;
+}
+
+static ssize_t NaClDescShmSocketSend(struct NaClDescShmSocket *self,
+                                     struct NaClIOVec const   *iov,
+                                     size_t                   iov_length,
+                                     int                      flags) {
+  struct NaClShmSocketShared  *shared = self->shared;
+  struct NaClShmSocketRing    *ring = &shared->ring[self->end];
+  char                        *data = NaClShmSocketRingData(self, self->end);
+  size_t                      len;
+  uint32_t                    record;
+  uint32_t                    head;
+  uint32_t                    pos;
+  uint32_t                    seq;
+  uint32_t                    len32;
+  int                         waited;
+  ssize_t                     rv;
+  size_t                      i;
+
+  len = 0;
+  for (i = 0; i < iov_length; ++i) {
+    if (iov[i].length > NACL_SHM_SOCKET_RING_SIZE - sizeof len32 - len) {
+      return -NACL_ABI_EMSGSIZE;
+    }
+    len += iov[i].length;
+  }
+  len32 = (uint32_t) len;
+  record = NaClShmSocketRecordSize(len32);
+
+  NaClShmSocketLock(&ring->send_lock);
+  head = ring->head;
+  for (waited = 0;; waited = 1) {
+    seq = ring->seq;
+    __sync_synchronize();
+    if (NaClShmSocketPeerClosed(self, waited)) {
+      rv = -NACL_ABI_EPIPE;
+      goto done;
+    }
+    if (head - ring->tail > NACL_SHM_SOCKET_RING_SIZE) {
+      rv = -NACL_ABI_EIO;
+      goto done;
+    }
+    if (NACL_SHM_SOCKET_RING_SIZE - (head - ring->tail) >= record) {
+      break;
+    }
+    if (0 != (flags & NACL_DONT_WAIT)) {
+      rv = -NACL_ABI_EAGAIN;
+      goto done;
+    }
+    NaClShmSocketRingWait(ring, seq);
+  }
+
+  NaClShmSocketCopyIn(data, head, &len32, sizeof len32);
+  pos = head + sizeof len32;
+  for (i = 0; i < iov_length; ++i) {
+    NaClShmSocketCopyIn(data, pos, iov[i].base, iov[i].length);
+    pos += (uint32_t) iov[i].length;
+  }
+  /* Publish the record only once it has been written. */
+  __sync_synchronize();
+  ring->head = head + record;
+  NaClShmSocketRingNotify(ring);
+  rv = (ssize_t) len;
+
+ done:
+  NaClShmSocketUnlock(&ring->send_lock);
+  return rv;
+}
+
+/*
+ * Returns the number of bytes received, or 0 if the peer end has been
+ * closed and there are no more messages, as recvmsg does.
+ */
+static ssize_t NaClDescShmSocketRecv(struct NaClDescShmSocket *self,
+                                     struct NaClIOVec const   *iov,
+                                     size_t                   iov_length,
+                                     int                      flags,
+                                     int                      *out_flags) {
+  int                         peer = 1 - self->end;
+  struct NaClShmSocketShared  *shared = self->shared;
+  struct NaClShmSocketRing    *ring = &shared->ring[peer];
+  char                        *data = NaClShmSocketRingData(self, peer);
+  uint32_t                    tail;
+  uint32_t                    used;
+  uint32_t                    seq;
+  uint32_t                    len32;
+  uint32_t                    pos;
+  int                         closed;
+  int                         waited;
+  size_t                      remaining;
+  size_t                      n;
+  ssize_t                     rv;
+  size_t                      i;
+
+  NaClShmSocketLock(&ring->recv_lock);
+  tail = ring->tail;
+  for (waited = 0;; waited = 1) {
+    seq = ring->seq;
+    __sync_synchronize();
+    /*
+     * Check for the close before reading |head|: the peer publishes its
+     * last message before it closes.
+     */
+    closed = NaClShmSocketPeerClosed(self, waited);
+    __sync_synchronize();
+    used = ring->head - tail;
+    if (used > NACL_SHM_SOCKET_RING_SIZE) {
+      rv = -NACL_ABI_EIO;
+      goto done;
+    }
+    if (0 != used) {
+      break;
+    }
+    if (closed) {
+      rv = 0;
+      goto done;
+    }
+    if (0 != (flags & NACL_DONT_WAIT)) {
+      rv = -NACL_ABI_EAGAIN;
+      goto done;
+    }
+    NaClShmSocketRingWait(ring, seq);
+  }
+  __sync_synchronize();
+
+  NaClShmSocketCopyOut(&len32, data, tail, sizeof len32);
+  if (len32 > NACL_SHM_SOCKET_RING_SIZE - sizeof len32 ||
+      NaClShmSocketRecordSize(len32) > used) {
+    rv = -NACL_ABI_EIO;
+    goto done;
+  }
+  pos = tail + sizeof len32;
+  remaining = len32;
+  for (i = 0; i < iov_length && 0 < remaining; ++i) {
+    n = iov[i].length < remaining ? iov[i].length : remaining;
+    NaClShmSocketCopyOut(iov[i].base, data, pos, n);
+    pos += (uint32_t) n;
+    remaining -= n;
+  }
+  if (0 != remaining) {
+    *out_flags |= NACL_MESSAGE_TRUNCATED;
+  }
+  /* Let the sender reuse the space only after we are done reading it. */
+  __sync_synchronize();
+  ring->tail = tail + NaClShmSocketRecordSize(len32);
+  NaClShmSocketRingNotify(ring);
+  rv = (ssize_t) (len32 - remaining);
+
+ done:
+  NaClShmSocketUnlock(&ring->recv_lock);
+  return rv;
+}
+
+static ssize_t NaClDescShmSocketLowLevelSendMsg(
+    struct NaClDesc                *vself,
+    struct NaClMessageHeader const *dgram,
+    int                            flags) {
+  if (0 != dgram->handle_count) {
+    NaClLog(2, "NaClDescShmSocketLowLevelSendMsg: non-zero handle_count\n");
+    return -NACL_ABI_EINVAL;
+  }
+  return NaClDescShmSocketSend((struct NaClDescShmSocket *) vself,
+                               dgram->iov, dgram->iov_length, flags);
+}
+
+static ssize_t NaClDescShmSocketLowLevelRecvMsg(
+    struct NaClDesc           *vself,
+    struct NaClMessageHeader  *dgram,
+    int                       flags) {
+  if (0 != dgram->handle_count) {
+    NaClLog(2, "NaClDescShmSocketLowLevelRecvMsg: non-zero handle_count\n");
+    return -NACL_ABI_EINVAL;
+  }
+  dgram->flags = 0;
+  return NaClDescShmSocketRecv((struct NaClDescShmSocket *) vself,
+                               dgram->iov, dgram->iov_length, flags,
+                               &dgram->flags);
+}
+
+static struct NaClDescVtbl const kNaClDescShmSocketVtbl = {
+  {
+    NaClDescShmSocketDtor,
+  },
+  NaClDescMapNotImplemented,
+  NaClDescReadNotImplemented,
+  NaClDescWriteNotImplemented,
+  NaClDescSeekNotImplemented,
+  NaClDescPReadNotImplemented,
+  NaClDescPWriteNotImplemented,
+  NaClDescShmSocketFstat,
+  NaClDescFchdirNotImplemented,
+  NaClDescFchmodNotImplemented,
+  NaClDescFsyncNotImplemented,
+  NaClDescFdatasyncNotImplemented,
+  NaClDescFtruncateNotImplemented,
+  NaClDescGetdentsNotImplemented,
+  NaClDescShmSocketExternalizeSize,
+  NaClDescShmSocketExternalize,
+  NaClDescLockNotImplemented,
+  NaClDescTryLockNotImplemented,
+  NaClDescUnlockNotImplemented,
+  NaClDescWaitNotImplemented,
+  NaClDescTimedWaitAbsNotImplemented,
+  NaClDescSignalNotImplemented,
+  NaClDescBroadcastNotImplemented,
+  NaClImcSendTypedMessage,
+  NaClImcRecvTypedMessage,
+  NaClDescShmSocketLowLevelSendMsg,
+  NaClDescShmSocketLowLevelRecvMsg,
+  NaClDescConnectAddrNotImplemented,
+  NaClDescAcceptConnNotImplemented,
+  NaClDescPostNotImplemented,
+  NaClDescSemWaitNotImplemented,
+  NaClDescGetValueNotImplemented,
+  NaClDescSetMetadata,
+  NaClDescGetMetadata,
+  NaClDescSetFlags,
+  NaClDescGetFlags,
+  NaClDescIsattyNotImplemented,
+  NACL_DESC_SHM_SOCKET,
+};
+
+int NaClDescShmSocketInternalize(struct NaClDesc           **baseptr,
+                                 struct NaClDescXferState  *xfer) {
+  int                       rv;
+  struct NaClDescShmSocket  *ndssp;
+  struct NaClDesc           *shm = NULL;
+  NaClHandle                h = NACL_INVALID_HANDLE;
+  int                       end;
+
+  ndssp = malloc(sizeof *ndssp);
+  if (NULL == ndssp) {
+    return -NACL_ABI_ENOMEM;
+  }
+  if (!NaClDescInternalizeCtor((struct NaClDesc *) ndssp, xfer)) {
+    free(ndssp);
+    return -NACL_ABI_ENOMEM;
+  }
+  if (xfer->next_byte >= xfer->byte_buffer_end) {
+    rv = -NACL_ABI_EIO;
+    goto cleanup;
+  }
+  end = *xfer->next_byte++;
+  if (0 != end && 1 != end) {
+    rv = -NACL_ABI_EIO;
+    goto cleanup;
+  }
+  rv = NaClDescImcShmInternalize(&shm, xfer);
+  if (0 != rv) {
+    goto cleanup;
+  }
+  if (xfer->next_handle == xfer->handle_buffer_end) {
+    rv = -NACL_ABI_EIO;
+    goto cleanup;
+  }
+  h = *xfer->next_handle;
+  *xfer->next_handle++ = NACL_INVALID_HANDLE;
+  if (!NaClDescShmSocketSubclassCtor(ndssp, shm, h, end)) {
+    rv = -NACL_ABI_EIO;
+    goto cleanup;
+  }
+  shm = NULL;
+  h = NACL_INVALID_HANDLE;
+  *baseptr = (struct NaClDesc *) ndssp;
+  rv = 0;
+
+ cleanup:
+  if (rv < 0) {
+    if (NACL_INVALID_HANDLE != h) {
+      (void) NaClClose(h);
+    }
+    NaClDescSafeUnref(shm);
+    NaClDescUnref((struct NaClDesc *) ndssp);
+  }
+  return rv;
+}
+
+int32_t NaClDescShmSocketPair(struct NaClDesc *pair[2]) {
+  struct NaClDescImcShm       *shm;
+  struct NaClShmSocketShared  *shared;
+  struct NaClDescShmSocket    *d[2] = { NULL, NULL };
+  int                         sv[2] = { -1, -1 };
+  uintptr_t                   addr;
+  int32_t                     retval = -NACL_ABI_ENOMEM;
+  int                         i;
+
+  NACL_COMPILE_TIME_ASSERT(NACL_SHM_SOCKET_RING_SIZE >=
+                           NACL_ABI_IMC_BYTES_MAX);
+  NACL_COMPILE_TIME_ASSERT(sizeof(struct NaClShmSocketShared) <=
+                           NACL_SHM_SOCKET_HEADER_SIZE);
+
+  shm = malloc(sizeof *shm);
+  if (NULL == shm) {
+    return -NACL_ABI_ENOMEM;
+  }
+  if (!NaClDescImcShmAllocCtor(shm, NACL_SHM_SOCKET_SHM_SIZE,
+                               /* executable= */ 0)) {
+    free(shm);
+    return -NACL_ABI_ENOMEM;
+  }
+
+  addr = NaClShmSocketMapShared(&shm->base);
+  if (NaClPtrIsNegErrno(&addr)) {
+    goto cleanup;
+  }
+  shared = (struct NaClShmSocketShared *) addr;
+  memset(shared, 0, sizeof *shared);
+  shared->magic = NACL_SHM_SOCKET_MAGIC;
+  shared->ring_size = NACL_SHM_SOCKET_RING_SIZE;
+  NaClHostDescUnmapUnsafe((void *) addr, NACL_SHM_SOCKET_SHM_SIZE);
+
+  if (0 != socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv)) {
+    retval = -NACL_ABI_ENFILE;
+    goto cleanup;
+  }
+
+  for (i = 0; i < 2; ++i) {
+    d[i] = malloc(sizeof *d[i]);
+    if (NULL == d[i]) {
+      goto cleanup;
+    }
+    if (!NaClDescCtor((struct NaClDesc *) d[i])) {
+      free(d[i]);
+      d[i] = NULL;
+      goto cleanup;
+    }
+    if (!NaClDescShmSocketSubclassCtor(d[i], NaClDescRef(&shm->base), sv[i],
+                                       i)) {
+      NaClDescUnref(&shm->base);
+      NaClDescUnref((struct NaClDesc *) d[i]);
+      d[i] = NULL;
+      retval = -NACL_ABI_EIO;
+      goto cleanup;
+    }
+    sv[i] = -1;
+  }
+  pair[0] = (struct NaClDesc *) d[0];
+  pair[1] = (struct NaClDesc *) d[1];
+  d[0] = NULL;
+  d[1] = NULL;
+  retval = 0;
+
+ cleanup:
+  /* Either end's dtor wakes the other, which is not waiting yet. */
+  NaClDescSafeUnref((struct NaClDesc *) d[0]);
+  NaClDescSafeUnref((struct NaClDesc *) d[1]);
+  for (i = 0; i < 2; ++i) {
+    if (-1 != sv[i]) {
+      (void) close(sv[i]);
+    }
+  }
+  NaClDescUnref(&shm->base);
+  return retval;
+}
+
+#else  /* NACL_LINUX */
+
+int NaClDescShmSocketInternalize(struct NaClDesc           **baseptr,
+                                 struct NaClDescXferState  *xfer) {
+  return NaClDescInternalizeNotImplemented(baseptr, xfer);
+}
+
+int32_t NaClDescShmSocketPair(struct NaClDesc *pair[2]) {
+  return NaClCommonDescSocketPair(pair);
+}
+
+#endif  /* NACL_LINUX */
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * NaCl service runtime.  NaClDescShmSocket subclass of NaClDesc.
+ */
+#ifndef NATIVE_CLIENT_SRC_TRUSTED_DESC_NACL_DESC_SHM_SOCKET_H_
+#define NATIVE_CLIENT_SRC_TRUSTED_DESC_NACL_DESC_SHM_SOCKET_H_
+
+#include "native_client/src/include/portability.h"
+
+#include "native_client/src/include/nacl_base.h"
+
+#include "native_client/src/trusted/desc/nacl_desc_base.h"
+
+EXTERN_C_BEGIN
+
+struct NaClDescXferState;
+struct NaClShmSocketShared;
+
+/*
+ * A data-only connected socket whose messages are passed through a
+ * pair of ring buffers in a shared memory object rather than through
+ * the kernel.  Sending a message is a copy into the ring, and a
+ * futex wake only if the peer is blocked waiting for it; the same
+ * goes for receiving.  The message boundaries, blocking and
+ * NACL_ABI_IMC_NONBLOCK behavior are those of the
+ * NaClDescXferableDataDesc pairs made by NaClCommonDescSocketPair,
+ * and like those the descriptors may be transferred (the shm object
+ * travels in the message) but cannot themselves transfer descriptors.
+ *
+ * Each end may be held by any number of processes.  An end counts as
+ * closed once every NaClDesc for it is gone, and no message carrying a
+ * copy of it is still in flight.  This is tracked by the kernel through
+ * a socket per end that travels with every copy, so a copy in a message
+ * that fails to send or is dropped, and the NaClDescs of a process that
+ * dies, stop holding the end open.
+ *
+ * Only implemented on Linux.  Elsewhere NaClDescShmSocketPair makes an
+ * ordinary socket pair.
+ */
+struct NaClDescShmSocket {
+  struct NaClDesc             base NACL_IS_REFCOUNT_SUBCLASS;
+  struct NaClDesc             *shm;
+  struct NaClShmSocketShared  *shared;
+  size_t                      shared_size;
+  /* This end's socket of the liveness socket pair. */
+  NaClHandle                  h;
+  /* Which end of the pair this is, 0 or 1. */
+  int                         end;
+};
+
+int NaClDescShmSocketInternalize(
+    struct NaClDesc               **baseptr,
+    struct NaClDescXferState      *xfer)
+    NACL_WUR;
+
+/*
+ * Makes a connected pair, as NaClCommonDescSocketPair does.  Returns 0
+ * or a negated NaCl errno.
+ */
+int32_t NaClDescShmSocketPair(struct NaClDesc *pair[2]);
+
+EXTERN_C_END
+
+#endif  // NATIVE_CLIENT_SRC_TRUSTED_DESC_NACL_DESC_SHM_SOCKET_H_
@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Exercise NaClDescShmSocket, and compare its latency and throughput
+ * with those of the socket pairs made by NaClCommonDescSocketPair.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/include/build_config.h"
+#include "native_client/src/include/nacl_macros.h"
+#include "native_client/src/include/portability.h"
+#include "native_client/src/public/imc_types.h"
+#include "native_client/src/public/nacl_desc_custom.h"
+#include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/shared/platform/nacl_threads.h"
+#include "native_client/src/shared/platform/nacl_time.h"
+#include "native_client/src/shared/platform/platform_init.h"
+#include "native_client/src/trusted/desc/nacl_desc_base.h"
+#include "native_client/src/trusted/desc/nacl_desc_imc.h"
+#include "native_client/src/trusted/desc/nacl_desc_shm_socket.h"
+#include "native_client/src/trusted/desc/nrd_xfer.h"
+#include "native_client/src/trusted/desc/nrd_xfer_intern.h"
+#include "native_client/src/trusted/service_runtime/include/sys/errno.h"
+
+#if NACL_LINUX
+# include <signal.h>
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
+
+#define PING_PONG_ROUNDS    20000
+#define PING_PONG_BYTES     64
+#define STREAM_MESSAGES     20000
+#define STREAM_BYTES        4096
+
+static ssize_t SendBytes(struct NaClDesc *d, void *buf, size_t len,
+                         int flags) {
+  struct NaClImcMsgIoVec iov;
+  struct NaClImcTypedMsgHdr hdr;
+
+  iov.base = buf;
+  iov.length = len;
+  hdr.iov = &iov;
+  hdr.iov_length = 1;
+  hdr.ndescv = NULL;
+  hdr.ndesc_length = 0;
+  hdr.flags = 0;
+  return NaClImcSendTypedMessage(d, &hdr, flags);
+}
+
+static ssize_t RecvBytes(struct NaClDesc *d, void *buf, size_t len,
+                         int flags, int32_t *out_flags) {
+  struct NaClImcMsgIoVec iov;
+  struct NaClImcTypedMsgHdr hdr;
+  ssize_t rv;
+
+  iov.base = buf;
+  iov.length = len;
+  hdr.iov = &iov;
+  hdr.iov_length = 1;
+  hdr.ndescv = NULL;
+  hdr.ndesc_length = 0;
+  hdr.flags = 0;
+  rv = NaClImcRecvTypedMessage(d, &hdr, flags);
+  if (NULL != out_flags) {
+    *out_flags = hdr.flags;
+  }
+  return rv;
+}
+
+static void TestMessages(void) {
+  struct NaClDesc *pair[2];
+  char buf[100];
+  char big[STREAM_BYTES];
+  int32_t flags;
+  ssize_t rv;
+  size_t sent;
+
+  printf("TestMessages\n");
+  CHECK(0 == NaClDescShmSocketPair(pair));
+
+  /* Message boundaries are kept, in both directions. */
+  CHECK(5 == SendBytes(pair[0], "hello", 5, 0));
+  CHECK(3 == SendBytes(pair[0], "abc", 3, 0));
+  CHECK(2 == SendBytes(pair[1], "ok", 2, 0));
+  CHECK(5 == RecvBytes(pair[1], buf, sizeof buf, 0, &flags));
+  CHECK(0 == memcmp(buf, "hello", 5) && 0 == flags);
+  CHECK(3 == RecvBytes(pair[1], buf, sizeof buf, 0, &flags));
+  CHECK(0 == memcmp(buf, "abc", 3));
+  CHECK(2 == RecvBytes(pair[0], buf, sizeof buf, 0, &flags));
+  CHECK(0 == memcmp(buf, "ok", 2));
+
+  /* The rest of a message that does not fit is dropped. */
+  CHECK(5 == SendBytes(pair[0], "hello", 5, 0));
+  CHECK(1 == SendBytes(pair[0], "x", 1, 0));
+  CHECK(2 == RecvBytes(pair[1], buf, 2, 0, &flags));
+  CHECK(0 == memcmp(buf, "he", 2));
+  CHECK(0 != (flags & NACL_ABI_RECVMSG_DATA_TRUNCATED));
+  CHECK(1 == RecvBytes(pair[1], buf, sizeof buf, 0, &flags));
+  CHECK('x' == buf[0] && 0 == flags);
+
+  /* Non-blocking operations fail instead of waiting. */
+  CHECK(-NACL_ABI_EAGAIN == RecvBytes(pair[1], buf, sizeof buf,
+                                      NACL_ABI_IMC_NONBLOCK, NULL));
+  memset(big, 'b', sizeof big);
+  sent = 0;
+  while ((rv = SendBytes(pair[0], big, sizeof big,
+                         NACL_ABI_IMC_NONBLOCK)) > 0) {
+    ++sent;
+  }
+  CHECK(-NACL_ABI_EAGAIN == rv);
+  CHECK(sent > 0);
+  while (sent-- > 0) {
+    CHECK(STREAM_BYTES == RecvBytes(pair[1], big, sizeof big, 0, NULL));
+  }
+
+  /* Messages already sent are still delivered once the sender is gone. */
+  CHECK(5 == SendBytes(pair[0], "hello", 5, 0));
+  NaClDescUnref(pair[0]);
+  CHECK(5 == RecvBytes(pair[1], buf, sizeof buf, 0, NULL));
+  CHECK(-NACL_ABI_EIO == RecvBytes(pair[1], buf, sizeof buf, 0, NULL));
+  CHECK(-NACL_ABI_EIO == SendBytes(pair[1], "abc", 3, 0));
+  NaClDescUnref(pair[1]);
+}
+
+/*
+ * Externalizes |d| into |bytes| and |handles|, and duplicates the
+ * handles, as sending it in a message through the kernel would.
+ * Returns the number of handles.
+ */
+static size_t ExternalizeCopy(struct NaClDesc *d, char *bytes, size_t size,
+                              NaClHandle *handles) {
+  struct NaClDescXferState xfer;
+  size_t nbytes;
+  size_t nhandles;
+  size_t i;
+
+  CHECK(0 == (*NACL_VTBL(NaClDesc, d)->
+              ExternalizeSize)(d, &nbytes, &nhandles));
+  CHECK(nbytes + 1 <= size && nhandles <= NACL_ABI_IMC_DESC_MAX);
+  xfer.next_byte = bytes;
+  xfer.byte_buffer_end = bytes + size;
+  xfer.next_handle = handles;
+  xfer.handle_buffer_end = handles + NACL_ABI_IMC_DESC_MAX;
+  CHECK(0 == NaClDescExternalizeToXferBuffer(&xfer, d));
+  CHECK((size_t) (xfer.next_handle - handles) == nhandles);
+  for (i = 0; i < nhandles; ++i) {
+    handles[i] = NaClDuplicateNaClHandle(handles[i]);
+    CHECK(NACL_INVALID_HANDLE != handles[i]);
+  }
+  return nhandles;
+}
+
+static struct NaClDesc *InternalizeCopy(char *bytes, size_t size,
+                                        NaClHandle *handles,
+                                        size_t nhandles) {
+  struct NaClDescXferState xfer;
+  struct NaClDesc *copy;
+
+  xfer.next_byte = bytes;
+  xfer.byte_buffer_end = bytes + size;
+  xfer.next_handle = handles;
+  xfer.handle_buffer_end = handles + nhandles;
+  CHECK(1 == NaClDescInternalizeFromXferBuffer(&copy, &xfer));
+  return copy;
+}
+
+static void TestTransfer(void) {
+  struct NaClDesc *pair[2];
+  struct NaClDesc *copy;
+  char bytes[256];
+  NaClHandle handles[NACL_ABI_IMC_DESC_MAX];
+  size_t nhandles;
+  char buf[16];
+
+  printf("TestTransfer\n");
+  CHECK(0 == NaClDescShmSocketPair(pair));
+  nhandles = ExternalizeCopy(pair[1], bytes, sizeof bytes, handles);
+  /* Dropping the original while the copy is in flight keeps it open. */
+  NaClDescUnref(pair[1]);
+  CHECK(-NACL_ABI_EAGAIN == RecvBytes(pair[0], buf, sizeof buf,
+                                      NACL_ABI_IMC_NONBLOCK, NULL));
+
+  copy = InternalizeCopy(bytes, sizeof bytes, handles, nhandles);
+  CHECK(NACL_DESC_SHM_SOCKET == NACL_VTBL(NaClDesc, copy)->typeTag);
+
+  CHECK(4 == SendBytes(pair[0], "ping", 4, 0));
+  CHECK(4 == RecvBytes(copy, buf, sizeof buf, 0, NULL));
+  CHECK(0 == memcmp(buf, "ping", 4));
+  CHECK(4 == SendBytes(copy, "pong", 4, 0));
+  CHECK(4 == RecvBytes(pair[0], buf, sizeof buf, 0, NULL));
+  CHECK(0 == memcmp(buf, "pong", 4));
+
+  NaClDescUnref(copy);
+  CHECK(-NACL_ABI_EIO == RecvBytes(pair[0], buf, sizeof buf, 0, NULL));
+  NaClDescUnref(pair[0]);
+}
+
+/* A socket pair that, unlike NaClCommonDescSocketPair's, carries descs. */
+static void ImcSocketPair(struct NaClDesc *pair[2]) {
+  NaClHandle h[2];
+  struct NaClDescImcDesc *d;
+  int i;
+
+  CHECK(0 == NaClSocketPair(h));
+  for (i = 0; i < 2; ++i) {
+    d = malloc(sizeof *d);
+    CHECK(NULL != d);
+    CHECK(NaClDescImcDescCtor(d, h[i]));
+    pair[i] = (struct NaClDesc *) d;
+  }
+}
+
+/* A copy that is never received stops holding its end open. */
+static void TestDroppedTransfer(void) {
+  struct NaClDesc *pair[2];
+  struct NaClDesc *carrier[2];
+  struct NaClImcMsgIoVec iov;
+  struct NaClImcTypedMsgHdr hdr;
+  char bytes[256];
+  NaClHandle handles[NACL_ABI_IMC_DESC_MAX];
+  size_t nhandles;
+  size_t i;
+  char buf[16];
+
+  printf("TestDroppedTransfer\n");
+
+  /* Lost in flight. */
+  CHECK(0 == NaClDescShmSocketPair(pair));
+  nhandles = ExternalizeCopy(pair[1], bytes, sizeof bytes, handles);
+  NaClDescUnref(pair[1]);
+  for (i = 0; i < nhandles; ++i) {
+    CHECK(0 == NaClClose(handles[i]));
+  }
+  CHECK(-NACL_ABI_EIO == RecvBytes(pair[0], buf, sizeof buf, 0, NULL));
+  NaClDescUnref(pair[0]);
+
+  /* Received with no room for descriptors. */
+  CHECK(0 == NaClDescShmSocketPair(pair));
+  ImcSocketPair(carrier);
+  iov.base = "x";
+  iov.length = 1;
+  hdr.iov = &iov;
+  hdr.iov_length = 1;
+  hdr.ndescv = &pair[1];
+  hdr.ndesc_length = 1;
+  hdr.flags = 0;
+  CHECK(1 == NaClImcSendTypedMessage(carrier[0], &hdr, 0));
+  NaClDescUnref(pair[1]);
+  CHECK(-NACL_ABI_EAGAIN == RecvBytes(pair[0], buf, sizeof buf,
+                                      NACL_ABI_IMC_NONBLOCK, NULL));
+  CHECK(1 == RecvBytes(carrier[1], buf, sizeof buf, 0, NULL));
+  CHECK(-NACL_ABI_EIO == RecvBytes(pair[0], buf, sizeof buf, 0, NULL));
+  NaClDescUnref(pair[0]);
+
+  /* Sent to a carrier with nobody at the other end. */
+  CHECK(0 == NaClDescShmSocketPair(pair));
+  NaClDescUnref(carrier[1]);
+  hdr.ndescv = &pair[1];
+  CHECK(NaClImcSendTypedMessage(carrier[0], &hdr, 0) < 0);
+  NaClDescUnref(pair[1]);
+  CHECK(-NACL_ABI_EIO == RecvBytes(pair[0], buf, sizeof buf, 0, NULL));
+  NaClDescUnref(pair[0]);
+  NaClDescUnref(carrier[0]);
+}
+
+#if NACL_LINUX
+/*
+ * A process holding an end that is killed cannot drop its count, so the
+ * peer has to notice through the kernel, while it is blocked.
+ */
+static void TestPeerDeath(void) {
+  struct NaClDesc *pair[2];
+  struct NaClDesc *copy;
+  char bytes[256];
+  NaClHandle handles[NACL_ABI_IMC_DESC_MAX];
+  size_t nhandles;
+  size_t i;
+  pid_t pid;
+  int status;
+  char buf[16];
+
+  printf("TestPeerDeath\n");
+  CHECK(0 == NaClDescShmSocketPair(pair));
+  nhandles = ExternalizeCopy(pair[1], bytes, sizeof bytes, handles);
+  pid = fork();
+  CHECK(pid >= 0);
+  if (0 == pid) {
+    copy = InternalizeCopy(bytes, sizeof bytes, handles, nhandles);
+    CHECK(2 == SendBytes(copy, "hi", 2, 0));
+    for (;;) {
+      pause();
+    }
+  }
+  for (i = 0; i < nhandles; ++i) {
+    CHECK(0 == NaClClose(handles[i]));
+  }
+  NaClDescUnref(pair[1]);
+  CHECK(2 == RecvBytes(pair[0], buf, sizeof buf, 0, NULL));
+  CHECK(0 == memcmp(buf, "hi", 2));
+  CHECK(-NACL_ABI_EAGAIN == RecvBytes(pair[0], buf, sizeof buf,
+                                      NACL_ABI_IMC_NONBLOCK, NULL));
+  CHECK(0 == kill(pid, SIGKILL));
+  CHECK(pid == waitpid(pid, &status, 0));
+  CHECK(-NACL_ABI_EIO == RecvBytes(pair[0], buf, sizeof buf, 0, NULL));
+  CHECK(-NACL_ABI_EIO == SendBytes(pair[0], "abc", 3, 0));
+  NaClDescUnref(pair[0]);
+}
+#endif
+
+struct BenchPeer {
+  struct NaClDesc *desc;
+  int rounds;
+  size_t bytes;
+};
+
+static void WINAPI EchoThread(void *arg) {
+  struct BenchPeer *peer = (struct BenchPeer *) arg;
+  char buf[PING_PONG_BYTES];
+  int i;
+
+  for (i = 0; i < peer->rounds; ++i) {
+    CHECK(PING_PONG_BYTES == RecvBytes(peer->desc, buf, sizeof buf, 0, NULL));
+    CHECK(PING_PONG_BYTES == SendBytes(peer->desc, buf, sizeof buf, 0));
+  }
+}
+
+static void WINAPI SinkThread(void *arg) {
+  struct BenchPeer *peer = (struct BenchPeer *) arg;
+  static char buf[STREAM_BYTES];
+  int i;
+
+  for (i = 0; i < peer->rounds; ++i) {
+    CHECK((ssize_t) peer->bytes ==
+          RecvBytes(peer->desc, buf, sizeof buf, 0, NULL));
+  }
+}
+
+static void Benchmark(char const *name,
+                      int32_t (*make_pair)(struct NaClDesc *pair[2])) {
+  struct NaClDesc *pair[2];
+  struct NaClThread thread;
+  struct BenchPeer peer;
+  static char buf[STREAM_BYTES];
+  int64_t start;
+  int64_t ping_pong_us;
+  int64_t stream_us;
+  int i;
+
+  CHECK(0 == make_pair(pair));
+  peer.desc = pair[1];
+
+  peer.rounds = PING_PONG_ROUNDS;
+  peer.bytes = PING_PONG_BYTES;
+  CHECK(NaClThreadCreateJoinable(&thread, EchoThread, &peer, 64 << 10));
+  start = NaClGetTimeOfDayMicroseconds();
+  for (i = 0; i < PING_PONG_ROUNDS; ++i) {
+    CHECK(PING_PONG_BYTES == SendBytes(pair[0], buf, PING_PONG_BYTES, 0));
+    CHECK(PING_PONG_BYTES == RecvBytes(pair[0], buf, PING_PONG_BYTES, 0,
+                                       NULL));
+  }
+  ping_pong_us = NaClGetTimeOfDayMicroseconds() - start;
+  NaClThreadJoin(&thread);
+
+  peer.rounds = STREAM_MESSAGES;
+  peer.bytes = STREAM_BYTES;
+  CHECK(NaClThreadCreateJoinable(&thread, SinkThread, &peer, 64 << 10));
+  start = NaClGetTimeOfDayMicroseconds();
+  for (i = 0; i < STREAM_MESSAGES; ++i) {
+    CHECK(STREAM_BYTES == SendBytes(pair[0], buf, STREAM_BYTES, 0));
+  }
+  NaClThreadJoin(&thread);
+  stream_us = NaClGetTimeOfDayMicroseconds() - start;
+
+  printf("%-12s round trip %7.2f us, %"NACL_PRId64" MB/s\n", name,
+         (double) ping_pong_us / PING_PONG_ROUNDS,
+         stream_us > 0 ?
+         (int64_t) STREAM_MESSAGES * STREAM_BYTES / stream_us : 0);
+
+  NaClDescUnref(pair[0]);
+  NaClDescUnref(pair[1]);
+}
+
+int main(void) {
+  NaClPlatformInit();
+
+  TestMessages();
+  TestTransfer();
+  TestDroppedTransfer();
+#if NACL_LINUX
+  TestPeerDeath();
+#endif
+  Benchmark("socket pair", NaClCommonDescSocketPair);
+  Benchmark("shm socket", NaClDescShmSocketPair);
+
+  NaClPlatformFini();
+  printf("PASSED\n");
+  return 0;
+}
@@ -366,7 +366,8 @@ ssize_t NaClImcSendTypedMessage(struct NaClDesc                 *channel,
      * NaClWouldBlock uses TSD (for both the errno-based and
      * GetLastError()-based implementations), so this is threadsafe.
      */
-    if (0 != (flags & NACL_DONT_WAIT) && NaClWouldBlock()) {
+    if (-NACL_ABI_EAGAIN == retval ||
+        (0 != (flags & NACL_DONT_WAIT) && NaClWouldBlock())) {
       retval = -NACL_ABI_EAGAIN;
     } else if (-NACL_ABI_EMSGSIZE == retval) {
       /*
@@ -408,6 +409,56 @@ cleanup:
 }
 
 
+/*
+ * Receives on a channel that never carries descriptors, so that the
+ * internal header is immediately followed by the user data.  That lets
+ * us scatter the message straight into the caller's buffers instead of
+ * going through a NACL_ABI_IMC_BYTES_MAX sized bounce buffer.
+ */
+static ssize_t NaClImcRecvDataOnlyMessage(
+    struct NaClDesc               *channel,
+    struct NaClImcTypedMsgHdr     *nitmhp,
+    int                           flags) {
+  struct NaClInternalHeader intern_hdr;
+  struct NaClIOVec          recv_iov[NACL_ABI_IMC_IOVEC_MAX + 1];
+  struct NaClMessageHeader  recv_hdr;
+  ssize_t                   total_recv_bytes;
+  size_t                    i;
+
+  recv_iov[0].base = (void *) &intern_hdr;
+  recv_iov[0].length = sizeof intern_hdr;
+  for (i = 0; i < nitmhp->iov_length; ++i) {
+    recv_iov[i + 1].base = nitmhp->iov[i].base;
+    recv_iov[i + 1].length = nitmhp->iov[i].length;
+  }
+  recv_hdr.iov = recv_iov;
+  recv_hdr.iov_length = nitmhp->iov_length + 1;
+  recv_hdr.handles = (NaClHandle *) NULL;
+  recv_hdr.handle_count = 0;
+  recv_hdr.flags = 0;
+
+  total_recv_bytes = (*((struct NaClDescVtbl const *) channel->base.vtbl)->
+                      LowLevelRecvMsg)(channel,
+                                       &recv_hdr,
+                                       flags);
+  if (NaClSSizeIsNegErrno(&total_recv_bytes)) {
+    NaClLog(1, "LowLevelRecvMsg failed, returned %"NACL_PRIdS"\n",
+            total_recv_bytes);
+    return total_recv_bytes;
+  }
+  if ((size_t) total_recv_bytes < sizeof intern_hdr
+      || NACL_HANDLE_TRANSFER_PROTOCOL != intern_hdr.h.xfer_protocol_version
+      || 0 != intern_hdr.h.descriptor_data_bytes) {
+    NaClLog(4, "NaClImcRecvDataOnlyMessage: bad internal header\n");
+    return -NACL_ABI_EIO;
+  }
+  if (0 != (recv_hdr.flags & NACL_MESSAGE_TRUNCATED)) {
+    nitmhp->flags |= NACL_ABI_RECVMSG_DATA_TRUNCATED;
+  }
+  nitmhp->ndesc_length = 0;
+  return total_recv_bytes - sizeof intern_hdr;
+}
+
 ssize_t NaClImcRecvTypedMessage(
     struct NaClDesc               *channel,
     struct NaClImcTypedMsgHdr     *nitmhp,
@@ -471,6 +522,11 @@ ssize_t NaClImcRecvTypedMessage(
    *                   NACL_ABI_IMC_USER_BYTES_MAX)
    */
 
+  if (NACL_DESC_SHM_SOCKET == ((struct NaClDescVtbl const *)
+                               channel->base.vtbl)->typeTag) {
+    return NaClImcRecvDataOnlyMessage(channel, nitmhp, flags);
+  }
+
   recv_buf = NULL;
   memset(new_desc, 0, sizeof new_desc);
   /*
@@ -5,13 +5,21 @@
 	}
 #else
 #include "native_client/src/trusted/dyn_ldr/nacl_sandbox.h"
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_numa.h"
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_profile.h"
 #include "native_client/src/trusted/dyn_ldr/testing/test_dyn_lib.h"
+//Generated by gen_sandbox_stubs.py
+#include "test_dyn_lib_stubs.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <time.h>
 #include <chrono>
+#if defined(__linux__)
+	#include <pthread.h>
+	#include <sched.h>
+#endif
 using namespace std::chrono;
 
 #if defined(_WIN32)
@@ -93,6 +101,302 @@ int unsandboxedSimpleCallbackNoPrintTest(unsigned a, const char* b, CallbackType
 	return ret;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//Walks a linked list laid out in sandbox memory, with its next pointers stored as sandboxed addresses the way the
+//library would store them, to compare the cost of turning them into our addresses with the out of line
+//getUnsandboxedAddress and with getUnsandboxedAddressInline
+
+#define CHASE_NODES 4096
+#define CHASE_ROUNDS 100
+
+struct ChaseNode
+{
+	uint32_t next;
+	uint32_t value;
+};
+
+int runPointerChasingBenchmark()
+{
+	struct ChaseNode* nodes = (struct ChaseNode*) mallocInSandbox(sandbox, sizeof(struct ChaseNode) * CHASE_NODES);
+	uint32_t* order = (uint32_t*) malloc(sizeof(uint32_t) * CHASE_NODES);
+	uintptr_t* unsandboxed = (uintptr_t*) malloc(sizeof(uintptr_t) * CHASE_NODES);
+	uintptr_t memoryBase = sandbox->memoryBase;
+	unsigned long sum1 = 0, sum2 = 0, sum3 = 0;
+	uint64_t timeOutOfLine, timeInline, timeBatch;
+
+	if(nodes == NULL || order == NULL || unsandboxed == NULL)
+	{
+		printf("Dyn loader Benchmark: could not allocate the list to walk\n");
+		return 0;
+	}
+
+	//Link the nodes in a random order so that each step is a dependent load the prefetcher can't guess
+	for(uint32_t i = 0; i < CHASE_NODES; i++)
+	{
+		order[i] = i;
+	}
+	for(uint32_t i = CHASE_NODES - 1; i > 0; i--)
+	{
+		uint32_t j = rand() % (i + 1);
+		uint32_t tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	for(uint32_t i = 0; i < CHASE_NODES; i++)
+	{
+		struct ChaseNode* node = &nodes[order[i]];
+		node->value = i;
+		node->next = i + 1 == CHASE_NODES? 0 : (uint32_t) getSandboxedAddress(sandbox, (uintptr_t) &nodes[order[i + 1]]);
+	}
+
+	{
+		high_resolution_clock::time_point enterTime = high_resolution_clock::now();
+		for(int round = 0; round < CHASE_ROUNDS; round++)
+		{
+			for(struct ChaseNode* node = &nodes[order[0]]; node != NULL; node = (struct ChaseNode*) getUnsandboxedAddress(sandbox, node->next))
+			{
+				sum1 += node->value;
+			}
+		}
+		high_resolution_clock::time_point exitTime = high_resolution_clock::now();
+		timeOutOfLine = duration_cast<nanoseconds>(exitTime - enterTime).count();
+	}
+
+	{
+		high_resolution_clock::time_point enterTime = high_resolution_clock::now();
+		for(int round = 0; round < CHASE_ROUNDS; round++)
+		{
+			for(struct ChaseNode* node = &nodes[order[0]]; node != NULL; node = (struct ChaseNode*) getUnsandboxedAddressInline(memoryBase, node->next))
+			{
+				sum2 += node->value;
+			}
+		}
+		high_resolution_clock::time_point exitTime = high_resolution_clock::now();
+		timeInline = duration_cast<nanoseconds>(exitTime - enterTime).count();
+	}
+
+	//Converting all the pointers of an array at once has no dependent loads and no branches, so it vectorizes
+	{
+		high_resolution_clock::time_point enterTime = high_resolution_clock::now();
+		for(int round = 0; round < CHASE_ROUNDS; round++)
+		{
+			for(uint32_t i = 0; i < CHASE_NODES; i++)
+			{
+				unsandboxed[i] = getUnsandboxedAddressInline(memoryBase, nodes[i].next);
+			}
+			sum3 += unsandboxed[round % CHASE_NODES] != 0;
+		}
+		high_resolution_clock::time_point exitTime = high_resolution_clock::now();
+		timeBatch = duration_cast<nanoseconds>(exitTime - enterTime).count();
+	}
+
+	freeInSandbox(sandbox, nodes);
+	free(order);
+	free(unsandboxed);
+
+	if(sum1 != sum2 || sum3 == 0)
+	{
+		printf("Return values don't agree\n");
+		return 0;
+	}
+
+	printf("Pointer chase per node: out of line = %6.2f ns, inline = %6.2f ns, batch inline = %6.2f ns\n",
+		(double) timeOutOfLine / (CHASE_ROUNDS * CHASE_NODES),
+		(double) timeInline / (CHASE_ROUNDS * CHASE_NODES),
+		(double) timeBatch / (CHASE_ROUNDS * CHASE_NODES)
+	);
+	printf("------------------------------\n");
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//Times the same calls and callbacks with the sandbox call profiler off and on. The rounds alternate between the two, and
+//the fastest round of each is kept, so that the difference is the profiler's and not other load on the machine. The
+//profiler is meant to cost less than PROFILE_OVERHEAD_TARGET_PERCENT
+
+#define PROFILE_CALLS 100000
+#define PROFILE_ROUNDS 10
+#define PROFILE_OVERHEAD_TARGET_PERCENT 5.0
+
+static uint64_t timeProfiledCalls(unsigned long a, unsigned long b, uintptr_t registeredCallback, unsigned long* sum)
+{
+	high_resolution_clock::time_point enterTime = high_resolution_clock::now();
+	for(int i = 0; i < PROFILE_CALLS; i++)
+	{
+		*sum += sandbox_invoke(sandbox, simpleAddNoPrintTest, a, b).UNSAFE_noVerify();
+		*sum += invokeSimpleCallbackTest(sandbox, simpleCallbackTestPtr, 4, (char*) "Hello", registeredCallback);
+	}
+	high_resolution_clock::time_point exitTime = high_resolution_clock::now();
+	return duration_cast<nanoseconds>(exitTime - enterTime).count();
+}
+
+int runProfilerOverheadBenchmark(uintptr_t registeredCallback)
+{
+	unsigned long a = rand();
+	unsigned long b = rand();
+	unsigned long sumOff = 0, sumOn = 0;
+	uint64_t bestOff = UINT64_MAX, bestOn = UINT64_MAX;
+	double overhead;
+
+	//Profiled from creation, as NACL_DYN_LDR_PROFILE is set
+	if(sandbox->profile != NULL)
+	{
+		printf("Profiler overhead: sandbox already profiled, skipped\n");
+		printf("------------------------------\n");
+		return 1;
+	}
+
+	for(int round = 0; round < PROFILE_ROUNDS; round++)
+	{
+		uint64_t timeOff, timeOn;
+
+		timeOff = timeProfiledCalls(a, b, registeredCallback, &sumOff);
+
+		if(!startSandboxProfile(sandbox))
+		{
+			printf("Dyn loader Benchmark: startSandboxProfile failed\n");
+			return 0;
+		}
+		timeOn = timeProfiledCalls(a, b, registeredCallback, &sumOn);
+		stopSandboxProfile(sandbox);
+
+		bestOff = timeOff < bestOff? timeOff : bestOff;
+		bestOn = timeOn < bestOn? timeOn : bestOn;
+	}
+
+	if(sumOff != sumOn)
+	{
+		printf("Return values don't agree\n");
+		return 0;
+	}
+
+	overhead = 100.0 * ((double) bestOn - (double) bestOff) / (double) bestOff;
+	printf("Call and callback with profiler: off = %6.2f ns, on = %6.2f ns, overhead = %5.2f%%%s\n",
+		(double) bestOff / PROFILE_CALLS,
+		(double) bestOn / PROFILE_CALLS,
+		overhead,
+		overhead < PROFILE_OVERHEAD_TARGET_PERCENT? "" : " (over the target)"
+	);
+	printf("------------------------------\n");
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//Walks a list much larger than the caches in the memory of a sandbox placed on node 0, first from a thread on node 0
+//and then from one on node 1, to show what a call routed to the wrong node pays for each load that misses the caches
+
+#if defined(__linux__)
+
+#define NUMA_CHASE_NODES (8 * 1024 * 1024)
+#define NUMA_CHASE_STEPS (4 * 1024 * 1024)
+
+static uint64_t timeNumaChase(NaClSandbox* numaSandbox, struct ChaseNode* start, unsigned long* sum)
+{
+	uintptr_t memoryBase = numaSandbox->memoryBase;
+	struct ChaseNode* node = start;
+	high_resolution_clock::time_point enterTime = high_resolution_clock::now();
+	for(uint32_t i = 0; i < NUMA_CHASE_STEPS; i++)
+	{
+		*sum += node->value;
+		node = (struct ChaseNode*) getUnsandboxedAddressInline(memoryBase, node->next);
+	}
+	high_resolution_clock::time_point exitTime = high_resolution_clock::now();
+	return duration_cast<nanoseconds>(exitTime - enterTime).count();
+}
+
+int runNumaBenchmark(const char* libraryPath, const char* libraryToLoad)
+{
+	NaClSandbox* numaSandbox;
+	struct ChaseNode* nodes;
+	uint32_t* order;
+	cpu_set_t savedAffinity;
+	unsigned long sum = 0;
+	uint64_t timeLocal, timeRemote;
+
+	if(getNumaNodeCount() < 2)
+	{
+		printf("NUMA: one node, skipped\n");
+		printf("------------------------------\n");
+		return 1;
+	}
+
+	if(pthread_getaffinity_np(pthread_self(), sizeof(savedAffinity), &savedAffinity) != 0 || !pinThreadToNumaNode(0))
+	{
+		printf("Dyn loader Benchmark: could not pin to NUMA node 0\n");
+		return 0;
+	}
+
+	numaSandbox = createDlSandboxOnNumaNode(libraryPath, libraryToLoad, 0, 0);
+	if(numaSandbox == NULL)
+	{
+		printf("Dyn loader Benchmark: createDlSandboxOnNumaNode returned null\n");
+		return 0;
+	}
+
+	nodes = (struct ChaseNode*) mallocInSandbox(numaSandbox, sizeof(struct ChaseNode) * NUMA_CHASE_NODES);
+	order = (uint32_t*) malloc(sizeof(uint32_t) * NUMA_CHASE_NODES);
+	if(nodes == NULL || order == NULL)
+	{
+		printf("Dyn loader Benchmark: could not allocate the list to walk\n");
+		return 0;
+	}
+
+	//One random cycle through all the nodes
+	for(uint32_t i = 0; i < NUMA_CHASE_NODES; i++)
+	{
+		order[i] = i;
+	}
+	for(uint32_t i = NUMA_CHASE_NODES - 1; i > 0; i--)
+	{
+		uint32_t j = ((uint32_t) rand() * (uint32_t) RAND_MAX + (uint32_t) rand()) % (i + 1);
+		uint32_t tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	for(uint32_t i = 0; i < NUMA_CHASE_NODES; i++)
+	{
+		struct ChaseNode* node = &nodes[order[i]];
+		node->value = i;
+		node->next = (uint32_t) getSandboxedAddress(numaSandbox, (uintptr_t) &nodes[order[(i + 1) % NUMA_CHASE_NODES]]);
+	}
+
+	timeLocal = timeNumaChase(numaSandbox, &nodes[order[0]], &sum);
+	if(!pinThreadToNumaNode(1))
+	{
+		printf("Dyn loader Benchmark: could not pin to NUMA node 1\n");
+		return 0;
+	}
+	timeRemote = timeNumaChase(numaSandbox, &nodes[order[0]], &sum);
+	pthread_setaffinity_np(pthread_self(), sizeof(savedAffinity), &savedAffinity);
+
+	free(order);
+	destroyDlSandbox(numaSandbox);
+
+	if(sum == 0)
+	{
+		printf("Return values don't agree\n");
+		return 0;
+	}
+
+	printf("NUMA pointer chase per node: from node 0 = %6.2f ns, from node 1 = %6.2f ns\n",
+		(double) timeLocal / NUMA_CHASE_STEPS,
+		(double) timeRemote / NUMA_CHASE_STEPS
+	);
+	printf("------------------------------\n");
+	return 1;
+}
+
+#else
+
+int runNumaBenchmark(const char* libraryPath, const char* libraryToLoad)
+{
+	(void)libraryPath;
+	(void)libraryToLoad;
+	return 1;
+}
+
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //https://stackoverflow.com/questions/1558402/memory-usage-of-current-process-in-c
 
@@ -228,6 +532,9 @@ int main(int argc, char** argv)
 	unsigned long ret4;
 	uint64_t timeSpentInSandboxCpp;
 
+	unsigned long ret7;
+	uint64_t timeSpentInSandboxStub;
+
 	unsigned long ret5;
 	uint64_t timeSpentInCb;
 
@@ -249,6 +556,8 @@ int main(int argc, char** argv)
 	timeSpentInSandboxCppNoSymRes = 0;
 	ret4 = 0;
 	timeSpentInSandboxCpp = 0;
+	ret7 = 0;
+	timeSpentInSandboxStub = 0;
 
 	{
 		//some warm up rounds
@@ -257,14 +566,17 @@ int main(int argc, char** argv)
 		ret2 += sandboxedSimpleAddNoPrintTest(val1_1, val1_2);
 		ret3 += sandbox_invoke_with_ptr(sandbox, (decltype(simpleAddNoPrintTest)*)simpleAddNoPrintTestPtr, val1_1, val1_2).UNSAFE_noVerify();
 		ret4 += sandbox_invoke(sandbox, simpleAddNoPrintTest, val1_1, val1_2).UNSAFE_noVerify();
+		ret7 += sandbox_stub_with_ptr_simpleAddNoPrintTest(sandbox, simpleAddNoPrintTestPtr, val1_1, val1_2).UNSAFE_noVerify();
 		ret1 += unsandboxedSimpleAddNoPrintTest(val1_1, val1_2);
 		ret2 += sandboxedSimpleAddNoPrintTest(val1_1, val1_2);
 		ret3 += sandbox_invoke_with_ptr(sandbox, (decltype(simpleAddNoPrintTest)*)simpleAddNoPrintTestPtr, val1_1, val1_2).UNSAFE_noVerify();
 		ret4 += sandbox_invoke(sandbox, simpleAddNoPrintTest, val1_1, val1_2).UNSAFE_noVerify();
+		ret7 += sandbox_stub_with_ptr_simpleAddNoPrintTest(sandbox, simpleAddNoPrintTestPtr, val1_1, val1_2).UNSAFE_noVerify();
 		ret1 += unsandboxedSimpleAddNoPrintTest(val1_1, val1_2);
 		ret2 += sandboxedSimpleAddNoPrintTest(val1_1, val1_2);
 		ret3 += sandbox_invoke_with_ptr(sandbox, (decltype(simpleAddNoPrintTest)*)simpleAddNoPrintTestPtr, val1_1, val1_2).UNSAFE_noVerify();
 		ret4 += sandbox_invoke(sandbox, simpleAddNoPrintTest, val1_1, val1_2).UNSAFE_noVerify();
+		ret7 += sandbox_stub_with_ptr_simpleAddNoPrintTest(sandbox, simpleAddNoPrintTestPtr, val1_1, val1_2).UNSAFE_noVerify();
 		high_resolution_clock::time_point exitTime = high_resolution_clock::now();
 		printf("Warm up for = %10" PRId64 " ns\n", duration_cast<nanoseconds>(exitTime - enterTime).count());
 		printf("------------------------------\n");
@@ -285,6 +597,8 @@ int main(int argc, char** argv)
 		timeSpentInSandboxCppNoSymRes = 0;
 		ret4 = 0;
 		timeSpentInSandboxCpp = 0;
+		ret7 = 0;
+		timeSpentInSandboxStub = 0;
 		ret5 = 0;
 		timeSpentInCb = 0;
 		ret6 = 0;
@@ -318,6 +632,13 @@ int main(int argc, char** argv)
 			timeSpentInSandboxCpp += duration_cast<nanoseconds>(exitTime  - enterTime).count();
 		}
 
+		{
+			high_resolution_clock::time_point enterTime = high_resolution_clock::now();
+			ret7 += sandbox_stub_with_ptr_simpleAddNoPrintTest(sandbox, simpleAddNoPrintTestPtr, val1_1, val1_2).UNSAFE_noVerify();
+			high_resolution_clock::time_point exitTime = high_resolution_clock::now();
+			timeSpentInSandboxStub += duration_cast<nanoseconds>(exitTime  - enterTime).count();
+		}
+
 		{
 			high_resolution_clock::time_point enterTime = high_resolution_clock::now();
 			ret5 += unsandboxedSimpleCallbackNoPrintTest(4, "Hello", unsandboxedSimpleCallbackTest_callbackStub);
@@ -332,7 +653,7 @@ int main(int argc, char** argv)
 			timeSpentInSandboxCb += duration_cast<nanoseconds>(exitTime  - enterTime).count();
 		}
 
-		if(ret1 != ret2 || ret2 != ret3 || ret3 != ret4 || ret5 != ret6)
+		if(ret1 != ret2 || ret2 != ret3 || ret3 != ret4 || ret4 != ret7 || ret5 != ret6)
 		{
 			printf("Return values don't agree\n");
 			return 1;
@@ -340,14 +661,16 @@ int main(int argc, char** argv)
 
 		printf("Func Call = %10" PRId64
 			", Sandbox Func Call = %10" PRId64
-			// ", Sandbox Func Call(C++, no symbol res) = %10" PRId64
+			", Sandbox Func Call(C++, no symbol res) = %10" PRId64
+			", Sandbox Func Call(generated stub) = %10" PRId64
 			// ", Sandbox Func Call(C++) = %10" PRId64  " ns"
 			", Callback = %10" PRId64 " ns"
 			", Sandbox Callback = %10" PRId64  " ns\n"
 			,
 			timeSpentInFunc,
 			timeSpentInSandbox,
-			// timeSpentInSandboxCppNoSymRes,
+			timeSpentInSandboxCppNoSymRes,
+			timeSpentInSandboxStub,
 			// timeSpentInSandboxCpp,
 			timeSpentInCb,
 			timeSpentInSandboxCb
@@ -355,6 +678,21 @@ int main(int argc, char** argv)
 	}
 
 
+	if(!runProfilerOverheadBenchmark(registeredCallback))
+	{
+		return 1;
+	}
+
+	if(!runPointerChasingBenchmark())
+	{
+		return 1;
+	}
+
+	if(!runNumaBenchmark(libraryPath, libraryToLoad))
+	{
+		return 1;
+	}
+
 	/**************** Cleanup ****************/
 
 	free(execFolder);
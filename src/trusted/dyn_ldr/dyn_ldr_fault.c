@@ -0,0 +1,424 @@
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_fault.h"
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "native_client/src/include/build_config.h"
+#include "native_client/src/trusted/dyn_ldr/datastructures/ds_stack.h"
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_lib.h"
+#include "native_client/src/trusted/service_runtime/nacl_app_thread.h"
+#include "native_client/src/trusted/service_runtime/nacl_globals.h"
+#include "native_client/src/trusted/service_runtime/nacl_signal.h"
+#include "native_client/src/trusted/service_runtime/nacl_tls.h"
+#include "native_client/src/trusted/service_runtime/sel_ldr.h"
+
+static const int faultSignals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL };
+#define FAULT_SIGNAL_COUNT (sizeof(faultSignals) / sizeof(faultSignals[0]))
+
+//The handlers that were installed before ours, which get the faults that are not in sandboxed code
+static struct sigaction previousActions[FAULT_SIGNAL_COUNT];
+static int faultHandlerInstalled = 0;
+
+THREAD int sandboxFaultStackReady = 0;
+//Frees the signal stacks we allocated when their threads exit
+static pthread_key_t faultStackKey;
+static pthread_once_t faultStackKeyOnce = PTHREAD_ONCE_INIT;
+
+static void freeSandboxFaultStack(void* stack)
+{
+  NaClSignalStackUnregister();
+  NaClSignalStackFree(stack);
+}
+
+static void createFaultStackKey(void)
+{
+  if(pthread_key_create(&faultStackKey, freeSandboxFaultStack) != 0)
+  {
+    printf("NaCl Error prepareSandboxFaultStack - could not create the thread key\n");
+  }
+}
+
+void prepareSandboxFaultStackSlow(void)
+{
+  stack_t current;
+  void* stack;
+
+  sandboxFaultStackReady = 1;
+
+  //Keep the signal stack of a thread that already has one, such as a NaCl thread
+  if(sigaltstack(NULL, &current) != 0 || !(current.ss_flags & SS_DISABLE))
+  {
+    return;
+  }
+
+  pthread_once(&faultStackKeyOnce, createFaultStackKey);
+  if(!NaClSignalStackAllocate(&stack))
+  {
+    printf("NaCl Error prepareSandboxFaultStack - could not allocate a signal stack, faults in sandboxes on this thread will not be recovered\n");
+    return;
+  }
+  NaClSignalStackRegister(stack);
+  pthread_setspecific(faultStackKey, stack);
+}
+
+static int faultSignalIndex(int sig)
+{
+  unsigned i;
+  for(i = 0; i < FAULT_SIGNAL_COUNT; i++)
+  {
+    if(faultSignals[i] == sig)
+    {
+      return (int) i;
+    }
+  }
+  return -1;
+}
+
+static void passSignalOn(struct sigaction* previous, int sig, siginfo_t* info, void* uc)
+{
+  //A fault raised by an instruction is raised again when the handler returns, so it cannot be ignored
+  int raisedByInstruction = info->si_code > 0 && sig != SANDBOX_WATCHDOG_SIGNAL;
+
+  //sa_handler and sa_sigaction share storage, so SIG_DFL and SIG_IGN are checked for first, even with SA_SIGINFO
+  if(previous->sa_handler == SIG_IGN && !raisedByInstruction)
+  {
+    return;
+  }
+  if(previous->sa_handler != SIG_DFL && previous->sa_handler != SIG_IGN)
+  {
+    if(previous->sa_flags & SA_SIGINFO)
+    {
+      previous->sa_sigaction(sig, info, uc);
+    }
+    else
+    {
+      previous->sa_handler(sig);
+    }
+    return;
+  }
+
+  //Let the default action have the signal
+  signal(sig, SIG_DFL);
+  if(!raisedByInstruction)
+  {
+    raise(sig);
+  }
+}
+
+static struct NaClAppThread* getFaultingThread(struct NaClSignalContext* sigCtx)
+{
+  #if NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && NACL_BUILD_SUBARCH == 32
+    //As in the service runtime's handler, untrusted code runs with its own %cs, and %gs holds the index of its thread
+    uint32_t threadIndex = sigCtx->gs >> 3;
+    struct NaClAppThread* natp;
+
+    if(sigCtx->cs == NaClGetGlobalCs() || threadIndex >= NACL_THREAD_MAX || nacl_user[threadIndex] == NULL)
+    {
+      return NULL;
+    }
+    natp = NaClAppThreadGetFromIndex(threadIndex);
+    NaClSetGs(natp->user.trusted_gs);
+    return natp;
+  #elif NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && NACL_BUILD_SUBARCH == 64
+    (void) sigCtx;
+    return NaClTlsGetCurrentThread();
+  #else
+    #error Unsupported platform!
+  #endif
+}
+
+//The thread the signal interrupted, if it was running untrusted code entered through invokeFunctionCall
+static struct NaClAppThread* getInterruptedSandboxThread(void* uc)
+{
+  struct NaClSignalContext sigCtx;
+  struct NaClAppThread* natp;
+
+  NaClSignalContextFromHandler(&sigCtx, uc);
+  natp = getFaultingThread(&sigCtx);
+
+  if(natp == NULL
+    || (natp->suspend_state & NACL_APP_THREAD_UNTRUSTED) == 0
+    || !NaClSignalContextIsUntrusted(natp, &sigCtx)
+    || natp->jumpBufferStack->currentTop == 0)
+  {
+    return NULL;
+  }
+  return natp;
+}
+
+//Poisons the sandbox and returns from the invokeFunctionCall that entered it
+static void unwindSandboxCall(struct NaClAppThread* natp, int sig)
+{
+  sigset_t faultSet;
+  unsigned i;
+
+  natp->nap->fault_signal = sig;
+  natp->register_eax = 0;
+  natp->register_xmm0 = 0;
+  //As a syscall would, so the next invokeFunctionCall finds the thread trusted
+  NaClAppThreadSetSuspendState(natp, NACL_APP_THREAD_UNTRUSTED, NACL_APP_THREAD_TRUSTED);
+
+  //longjmp does not leave the handler the way sigreturn would, so the signals blocked while it runs stay blocked
+  //unless unblocked here
+  sigemptyset(&faultSet);
+  for(i = 0; i < FAULT_SIGNAL_COUNT; i++)
+  {
+    sigaddset(&faultSet, faultSignals[i]);
+  }
+  sigaddset(&faultSet, SANDBOX_WATCHDOG_SIGNAL);
+  pthread_sigmask(SIG_UNBLOCK, &faultSet, NULL);
+
+  longjmp(*Stack_GetTopPtrForPop(natp->jumpBufferStack), 1);
+}
+
+static void sandboxFaultHandler(int sig, siginfo_t* info, void* uc)
+{
+  struct NaClAppThread* natp = getInterruptedSandboxThread(uc);
+
+  if(natp == NULL)
+  {
+    passSignalOn(&previousActions[faultSignalIndex(sig)], sig, info, uc);
+    return;
+  }
+  unwindSandboxCall(natp, sig);
+}
+
+/********************* CPU time budgets ***********************/
+
+THREAD struct SandboxWatchdogThread sandboxWatchdog = { 0, SANDBOX_NO_DEADLINE, 0, 0, NULL };
+
+//The watchdog timers of all threads, so removeSandboxFaultHandler can delete them before it puts back the
+//previous SIGXCPU handler, which would otherwise get their ticks
+struct SandboxWatchdogTimer
+{
+  timer_t timer;
+  //Cleared when the timer is deleted, so the thread creates a new one on its next call with a budget
+  int* timerStarted;
+  struct SandboxWatchdogTimer* next;
+};
+
+static struct SandboxWatchdogTimer* watchdogTimers = NULL;
+static pthread_mutex_t watchdogTimersLock = PTHREAD_MUTEX_INITIALIZER;
+//Unregisters and deletes the watchdog timers of threads as they exit
+static pthread_key_t watchdogTimerKey;
+static pthread_once_t watchdogTimerKeyOnce = PTHREAD_ONCE_INIT;
+//Passed with the timer signals, to tell them from SIGXCPU sent for RLIMIT_CPU or by kill
+static int watchdogSignalMarker;
+static struct sigaction previousWatchdogAction;
+
+static void deleteSandboxWatchdogTimer(void* arg)
+{
+  struct SandboxWatchdogTimer* entry = (struct SandboxWatchdogTimer*) arg;
+  struct SandboxWatchdogTimer** link;
+
+  pthread_mutex_lock(&watchdogTimersLock);
+  for(link = &watchdogTimers; *link != NULL; link = &(*link)->next)
+  {
+    if(*link == entry)
+    {
+      *link = entry->next;
+      timer_delete(entry->timer);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&watchdogTimersLock);
+  free(entry);
+}
+
+//Deleting a timer also drops its tick if one is pending
+static void deleteAllSandboxWatchdogTimers(void)
+{
+  struct SandboxWatchdogTimer* entry;
+
+  pthread_mutex_lock(&watchdogTimersLock);
+  while(watchdogTimers != NULL)
+  {
+    entry = watchdogTimers;
+    watchdogTimers = entry->next;
+    timer_delete(entry->timer);
+    *entry->timerStarted = 0;
+    //The thread still owns the entry, through its key
+    entry->next = NULL;
+  }
+  pthread_mutex_unlock(&watchdogTimersLock);
+}
+
+static void createWatchdogTimerKey(void)
+{
+  if(pthread_key_create(&watchdogTimerKey, deleteSandboxWatchdogTimer) != 0)
+  {
+    printf("NaCl Error startSandboxWatchdog - could not create the thread key\n");
+  }
+}
+
+void startSandboxWatchdogSlow(void)
+{
+  struct sigevent event;
+  struct itimerspec tick;
+  struct SandboxWatchdogTimer* entry;
+
+  sandboxWatchdog.timerStarted = 1;
+  pthread_once(&watchdogTimerKeyOnce, createWatchdogTimerKey);
+
+  //A thread whose timer was deleted by removeSandboxFaultHandler reuses its entry
+  entry = (struct SandboxWatchdogTimer*) pthread_getspecific(watchdogTimerKey);
+  if(entry == NULL)
+  {
+    entry = (struct SandboxWatchdogTimer*) malloc(sizeof(struct SandboxWatchdogTimer));
+    if(entry == NULL)
+    {
+      printf("NaCl Error startSandboxWatchdog - could not allocate the timer, CPU budgets are not enforced on this thread\n");
+      return;
+    }
+    entry->timerStarted = &sandboxWatchdog.timerStarted;
+    entry->next = NULL;
+    pthread_setspecific(watchdogTimerKey, entry);
+  }
+
+  memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = SANDBOX_WATCHDOG_SIGNAL;
+  event.sigev_value.sival_ptr = &watchdogSignalMarker;
+  event._sigev_un._tid = (pid_t) syscall(__NR_gettid);
+
+  tick.it_interval.tv_sec = 0;
+  tick.it_interval.tv_nsec = SANDBOX_WATCHDOG_TICK_NS;
+  tick.it_value = tick.it_interval;
+
+  pthread_mutex_lock(&watchdogTimersLock);
+  if(timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &entry->timer) != 0)
+  {
+    printf("NaCl Error startSandboxWatchdog - could not create the timer, CPU budgets are not enforced on this thread\n");
+    pthread_mutex_unlock(&watchdogTimersLock);
+    return;
+  }
+  if(timer_settime(entry->timer, 0, &tick, NULL) != 0)
+  {
+    printf("NaCl Error startSandboxWatchdog - could not start the timer, CPU budgets are not enforced on this thread\n");
+    timer_delete(entry->timer);
+    pthread_mutex_unlock(&watchdogTimersLock);
+    return;
+  }
+  entry->next = watchdogTimers;
+  watchdogTimers = entry;
+  pthread_mutex_unlock(&watchdogTimersLock);
+}
+
+static void sandboxWatchdogHandler(int sig, siginfo_t* info, void* uc)
+{
+  struct NaClAppThread* natp;
+
+  if(info->si_code != SI_TIMER || info->si_value.sival_ptr != &watchdogSignalMarker)
+  {
+    passSignalOn(&previousWatchdogAction, sig, info, uc);
+    return;
+  }
+
+  sandboxWatchdog.ticks++;
+  if(sandboxWatchdog.ticks < sandboxWatchdog.deadline)
+  {
+    return;
+  }
+
+  //Out of time. If the thread is in trusted code, such as a callback or a syscall, or in another sandbox called
+  //from a callback, it is left to finish, and is stopped on a later tick once back in the sandbox with the budget
+  natp = getInterruptedSandboxThread(uc);
+  if(natp != NULL && (NaClSandbox*) natp->nap->custom_app_state == sandboxWatchdog.owner)
+  {
+    unwindSandboxCall(natp, sig);
+  }
+}
+
+int setSandboxCpuBudget(NaClSandbox* sandbox, uint64_t nanoseconds)
+{
+  uint64_t ticks;
+
+  if(!faultHandlerInstalled)
+  {
+    return 0;
+  }
+  if(nanoseconds == 0)
+  {
+    sandbox->cpuBudgetTicks = 0;
+    return 1;
+  }
+
+  //The first tick comes anywhere up to a tick after the call starts, so one more is needed to never stop a
+  //call short of its budget
+  ticks = (nanoseconds + SANDBOX_WATCHDOG_TICK_NS - 1) / SANDBOX_WATCHDOG_TICK_NS + 1;
+  sandbox->cpuBudgetTicks = ticks > UINT32_MAX ? UINT32_MAX : (uint32_t) ticks;
+  return 1;
+}
+
+int installSandboxFaultHandler(void)
+{
+  struct sigaction action;
+  unsigned i;
+
+  if(faultHandlerInstalled)
+  {
+    return 1;
+  }
+
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = sandboxFaultHandler;
+  action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  sigemptyset(&action.sa_mask);
+  //The watchdog must not interrupt the fault handler, as both may unwind the same call
+  sigaddset(&action.sa_mask, SANDBOX_WATCHDOG_SIGNAL);
+
+  for(i = 0; i < FAULT_SIGNAL_COUNT; i++)
+  {
+    if(sigaction(faultSignals[i], &action, &previousActions[i]) != 0)
+    {
+      printf("NaCl Error installSandboxFaultHandler - could not install the handler for signal %d\n", faultSignals[i]);
+      while(i-- > 0)
+      {
+        sigaction(faultSignals[i], &previousActions[i], NULL);
+      }
+      return 0;
+    }
+  }
+
+  action.sa_sigaction = sandboxWatchdogHandler;
+  //Ticks come while the thread is in the host too, where they must not fail its system calls with EINTR
+  action.sa_flags |= SA_RESTART;
+  if(sigaction(SANDBOX_WATCHDOG_SIGNAL, &action, &previousWatchdogAction) != 0)
+  {
+    printf("NaCl Error installSandboxFaultHandler - could not install the handler for signal %d\n", SANDBOX_WATCHDOG_SIGNAL);
+    for(i = 0; i < FAULT_SIGNAL_COUNT; i++)
+    {
+      sigaction(faultSignals[i], &previousActions[i], NULL);
+    }
+    return 0;
+  }
+
+  faultHandlerInstalled = 1;
+  return 1;
+}
+
+void removeSandboxFaultHandler(void)
+{
+  unsigned i;
+
+  if(!faultHandlerInstalled)
+  {
+    return;
+  }
+
+  for(i = 0; i < FAULT_SIGNAL_COUNT; i++)
+  {
+    sigaction(faultSignals[i], &previousActions[i], NULL);
+  }
+  //Budgets need the handler, so they stop here. Threads still in a call with a budget are no longer stopped
+  deleteAllSandboxWatchdogTimers();
+  sigaction(SANDBOX_WATCHDOG_SIGNAL, &previousWatchdogAction, NULL);
+  faultHandlerInstalled = 0;
+}
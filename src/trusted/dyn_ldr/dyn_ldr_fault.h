@@ -0,0 +1,112 @@
+#ifndef NACL_DYN_LDR_FAULT
+#define NACL_DYN_LDR_FAULT
+
+#include <signal.h>
+#include <stdint.h>
+
+#include "native_client/src/include/nacl_compiler_annotations.h"
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_lib.h"
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+//Fault recovery lets a process survive a crash in sandboxed code. A SIGSEGV, SIGBUS, SIGFPE or SIGILL raised
+//by code running in a sandbox unwinds to the invokeFunctionCall that entered the sandbox, as if the function had
+//returned 0. The invokeFunctionCall returns 0 to say so, and the sandbox is poisoned: getSandboxFaultSignal
+//returns the signal, and every later call into the sandbox returns 0 at once without running anything. A
+//poisoned sandbox can only be destroyed, which is safe, since destroyDlSandbox does not run sandboxed code.
+//If the sandbox faults in a call made from a callback, the callback still returns normally, and the calls that
+//led to it are unwound in turn as the callbacks return.
+//
+//Faults outside sandboxed code, including faults in callbacks, are passed on to the handler that was installed
+//before, or crash the process as they would have without fault recovery.
+//
+//initializeDlSandboxCreator installs the handler unless the environment variable NACL_DYN_LDR_FAULT_RECOVERY
+//is set to 0, and closeSandboxCreator puts the previous handlers back.
+
+int installSandboxFaultHandler(void);
+void removeSandboxFaultHandler(void);
+
+//The handler runs on an alternate signal stack, as the stack of the sandboxed code cannot be trusted.
+//Threads call this before entering a sandbox; it sets one up the first time a thread without one calls it.
+extern THREAD int sandboxFaultStackReady;
+void prepareSandboxFaultStackSlow(void);
+
+static INLINE void prepareSandboxFaultStack(void)
+{
+	if(!sandboxFaultStackReady)
+	{
+		prepareSandboxFaultStackSlow();
+	}
+}
+
+//A sandbox can be given a budget of CPU time for each call into it. A call that runs longer in the sandbox is
+//stopped and unwound as if it had faulted with SIGXCPU, which poisons the sandbox in the same way, as the code
+//was stopped at an arbitrary point. Time spent in callbacks counts towards the budget, but a call is only
+//stopped while it runs sandboxed code, so a slow callback finishes first. Calls made into the sandbox from a
+//callback count towards the budget of the outermost call. Only the sandbox of the outermost call is stopped; if it
+//runs out while another sandbox called from a callback runs, the call is stopped once back in its own sandbox.
+//
+//Each thread that calls a sandbox with a budget gets a timer on its CPU time clock that ticks every
+//SANDBOX_WATCHDOG_TICK_NS, on which the budget is checked. A call is stopped within a tick after its budget
+//runs out. Starting and stopping the budget of a call only touches thread locals, so it costs a few
+//instructions. The timer keeps running while the thread is in the host, where a tick costs a signal.
+//
+//Needs the fault handler; returns 0 if it is not installed. A budget of 0 removes the budget.
+//removeSandboxFaultHandler deletes the timers of all threads, which start new ones if the handler is put back.
+int setSandboxCpuBudget(NaClSandbox* sandbox, uint64_t nanoseconds);
+
+#define SANDBOX_WATCHDOG_SIGNAL SIGXCPU
+#define SANDBOX_WATCHDOG_TICK_NS 5000000
+#define SANDBOX_NO_DEADLINE UINT64_MAX
+
+struct SandboxWatchdogThread
+{
+	//Ticks of this thread's CPU time, counted by the signal handler
+	volatile uint64_t ticks;
+	volatile uint64_t deadline;
+	//Calls with a budget this thread is in, only the outermost sets the deadline
+	unsigned depth;
+	int timerStarted;
+	//The sandbox of the outermost call, the only one the deadline stops
+	NaClSandbox* volatile owner;
+};
+
+extern THREAD struct SandboxWatchdogThread sandboxWatchdog;
+void startSandboxWatchdogSlow(void);
+
+//Returns whether the call has a budget, to be passed to endSandboxCpuBudget
+static INLINE int beginSandboxCpuBudget(NaClSandbox* sandbox)
+{
+	uint32_t budgetTicks = sandbox->cpuBudgetTicks;
+
+	if(budgetTicks == 0)
+	{
+		return 0;
+	}
+	if(sandboxWatchdog.depth++ == 0)
+	{
+		if(!sandboxWatchdog.timerStarted)
+		{
+			startSandboxWatchdogSlow();
+		}
+		sandboxWatchdog.owner = sandbox;
+		sandboxWatchdog.deadline = sandboxWatchdog.ticks + budgetTicks;
+	}
+	return 1;
+}
+
+static INLINE void endSandboxCpuBudget(int hasBudget)
+{
+	if(hasBudget && --sandboxWatchdog.depth == 0)
+	{
+		sandboxWatchdog.deadline = SANDBOX_NO_DEADLINE;
+	}
+}
+
+#ifdef __cplusplus
+  }
+#endif
+
+#endif
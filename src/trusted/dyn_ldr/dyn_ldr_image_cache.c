@@ -0,0 +1,1114 @@
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_image_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/include/build_config.h"
+#include "native_client/src/include/nacl_macros.h"
+
+#if NACL_LINUX
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "native_client/src/shared/platform/nacl_host_desc.h"
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
+#include "native_client/src/trusted/dyn_ldr/datastructures/ds_map.h"
+#include "native_client/src/trusted/service_runtime/elf_symboltable_mapping.h"
+#include "native_client/src/trusted/service_runtime/include/bits/mman.h"
+#include "native_client/src/trusted/service_runtime/nacl_app.h"
+#include "native_client/src/trusted/service_runtime/nacl_app_thread.h"
+#include "native_client/src/trusted/service_runtime/nacl_text.h"
+#include "native_client/src/trusted/service_runtime/nacl_tls.h"
+#include "native_client/src/trusted/service_runtime/nacl_vvar.h"
+#include "native_client/src/trusted/service_runtime/sel_addrspace.h"
+#include "native_client/src/trusted/service_runtime/sel_ldr.h"
+#include "native_client/src/trusted/service_runtime/sel_memory.h"
+
+#define DL_SANDBOX_IMAGE_MAGIC "NACLDLIM"
+//Bump when the layout of the file or of the sandbox changes
+#define DL_SANDBOX_IMAGE_VERSION 1
+#define DL_SANDBOX_IMAGE_CALLBACKS 8
+
+NaClSandbox* constructNaClSandbox(struct NaClApp* nap);
+
+enum DlSandboxImageRegionKind
+{
+  //Private memory, mapped from the image
+  DL_SANDBOX_IMAGE_MEMORY = 0,
+  //Pages of the dynamic text region, copied into the text shm
+  DL_SANDBOX_IMAGE_TEXT = 1,
+  //The vvar page, which is made afresh
+  DL_SANDBOX_IMAGE_VVAR = 2
+};
+
+struct DlSandboxImageFileId
+{
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtimeSec;
+  int64_t mtimeNsec;
+};
+
+struct DlSandboxImageHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  uint32_t addrBits;
+  uint32_t mapPageSize;
+  uint64_t fileSize;
+  struct DlSandboxImageFileId library;
+  struct DlSandboxImageFileId app;
+
+  //The NaClApp fields the loader sets, all untrusted addresses
+  uint64_t staticTextEnd;
+  uint64_t dynamicTextStart;
+  uint64_t dynamicTextEnd;
+  uint64_t rodataStart;
+  uint64_t dataStart;
+  uint64_t dataEnd;
+  uint64_t breakAddr;
+  uint64_t initialEntryPt;
+  uint64_t userEntryPt;
+  uint64_t stackSize;
+  uint64_t vvarAddr;
+  int32_t bundleSize;
+
+  //The main thread, parked in the app's main
+  uint32_t stackPtr;
+  uint32_t tls1;
+  uint32_t tls2;
+
+  //Untrusted addresses of the functions createDlSandbox looks up
+  uint32_t threadMain;
+  uint32_t exitFunctionWrapper;
+  uint32_t callbackFunctionWrapper[DL_SANDBOX_IMAGE_CALLBACKS];
+  uint32_t mallocPtr;
+  uint32_t freePtr;
+  uint32_t fopenPtr;
+  uint32_t fclosePtr;
+
+  uint32_t regionCount;
+  uint32_t dynamicRegionCount;
+  uint32_t symbolCount;
+  uint64_t regionsOffset;
+  uint64_t dynamicRegionsOffset;
+  uint64_t symbolsOffset;
+  uint64_t stringsOffset;
+  uint64_t stringsSize;
+};
+
+struct DlSandboxImageRegion
+{
+  uint64_t pageNum;
+  uint64_t npages;
+  int32_t prot;
+  int32_t flags;
+  int32_t kind;
+  int32_t padding;
+  //Offset of the contents in the file, 0 if there are none
+  uint64_t dataOffset;
+};
+
+struct DlSandboxImageDynamicRegion
+{
+  uint64_t start;
+  uint64_t size;
+  int32_t isMmap;
+  int32_t padding;
+};
+
+struct DlSandboxImageSymbol
+{
+  uint64_t address;
+  uint64_t nameOffset;
+};
+
+//An image of a running sandbox in a memfd, which every clone maps copy-on-write
+struct _NaClSandboxSnapshot
+{
+  int fd;
+  struct DlSandboxImageHeader header;
+  //The whole memfd, for the tables and the text pages
+  char* image;
+  struct SymbolTableMapping* symbolTable;
+  size_t memoryBudget;
+  int numaNode;
+  int32_t callbackParameterStartOffset;
+  uint32_t cpuBudgetTicks;
+};
+
+struct DlSandboxImageRegionList
+{
+  struct NaClApp* nap;
+  struct DlSandboxImageRegion* regions;
+  size_t count;
+  size_t allocated;
+  //Set if the sandbox maps memory an image cannot reproduce
+  int unsupported;
+};
+
+struct DlSandboxImageDynamicRegionList
+{
+  struct NaClApp* nap;
+  struct DlSandboxImageDynamicRegion* regions;
+  size_t count;
+  size_t allocated;
+};
+
+static uint64_t roundUpToMapPage(uint64_t value)
+{
+  return (value + NACL_MAP_PAGESIZE - 1) & ~((uint64_t) NACL_MAP_PAGESIZE - 1);
+}
+
+static int getFileId(const char* path, struct DlSandboxImageFileId* id)
+{
+  struct stat st;
+  if (stat(path, &st) != 0)
+  {
+    return 0;
+  }
+  memset(id, 0, sizeof(*id));
+  id->dev = (uint64_t) st.st_dev;
+  id->ino = (uint64_t) st.st_ino;
+  id->size = (uint64_t) st.st_size;
+  id->mtimeSec = (int64_t) st.st_mtim.tv_sec;
+  id->mtimeNsec = (int64_t) st.st_mtim.tv_nsec;
+  return 1;
+}
+
+int getDlSandboxImagePath(const char* imageDir, const char* naclLibraryPath, const char* naclInitAppFullPath,
+  char* imagePath, size_t imagePathLen)
+{
+  //FNV-1a over both paths, so each library and app pair gets its own file
+  uint64_t hash = 14695981039346656037ULL;
+  const char* paths[2] = { naclLibraryPath, naclInitAppFullPath };
+  int written;
+
+  for(unsigned i = 0; i < 2; i++)
+  {
+    const char* p = paths[i];
+    do
+    {
+      hash ^= (unsigned char) *p;
+      hash *= 1099511628211ULL;
+    } while (*p++ != '\0');
+  }
+
+  written = snprintf(imagePath, imagePathLen, "%s/%016llx.nimg", imageDir, (unsigned long long) hash);
+  return written > 0 && (size_t) written < imagePathLen;
+}
+
+/********************** Saving images *****************************/
+
+static int appendRegion(struct DlSandboxImageRegionList* list, uint64_t pageNum, uint64_t npages,
+  int prot, int flags, int kind)
+{
+  struct DlSandboxImageRegion* region;
+
+  if (list->count == list->allocated)
+  {
+    size_t allocated = list->allocated == 0 ? 64 : list->allocated * 2;
+    struct DlSandboxImageRegion* regions = (struct DlSandboxImageRegion*) realloc(list->regions, allocated * sizeof(*regions));
+    if (regions == NULL)
+    {
+      return 0;
+    }
+    list->regions = regions;
+    list->allocated = allocated;
+  }
+
+  region = &list->regions[list->count++];
+  memset(region, 0, sizeof(*region));
+  region->pageNum = pageNum;
+  region->npages = npages;
+  region->prot = prot;
+  region->flags = flags;
+  region->kind = kind;
+  return 1;
+}
+
+static void collectVmmapEntry(void* state, struct NaClVmmapEntry* entry)
+{
+  struct DlSandboxImageRegionList* list = (struct DlSandboxImageRegionList*) state;
+  struct NaClApp* nap = list->nap;
+  uintptr_t start = entry->page_num << NACL_PAGESHIFT;
+  int kind = DL_SANDBOX_IMAGE_MEMORY;
+
+  //The dynamic text region is saved page by page from the text shm instead
+  if (start >= nap->dynamic_text_start && start < nap->dynamic_text_end)
+  {
+    return;
+  }
+
+  if (entry->desc != NULL && entry->desc == nap->vvar_shm)
+  {
+    kind = DL_SANDBOX_IMAGE_VVAR;
+  }
+  else if (entry->desc != NULL && (entry->flags & NACL_ABI_MAP_SHARED) != 0)
+  {
+    //A private copy would no longer see the writes of whoever else maps this
+    list->unsupported = 1;
+    return;
+  }
+
+  if (!appendRegion(list, entry->page_num, entry->npages, entry->prot,
+    (entry->flags & ~NACL_ABI_MAP_SHARED) | NACL_ABI_MAP_PRIVATE, kind))
+  {
+    list->unsupported = 1;
+  }
+}
+
+static void collectDynamicRegion(void* state, struct NaClDynamicRegion* region)
+{
+  struct DlSandboxImageDynamicRegionList* list = (struct DlSandboxImageDynamicRegionList*) state;
+
+  if (list->count == list->allocated)
+  {
+    size_t allocated = list->allocated == 0 ? 64 : list->allocated * 2;
+    struct DlSandboxImageDynamicRegion* regions = (struct DlSandboxImageDynamicRegion*) realloc(list->regions, allocated * sizeof(*regions));
+    if (regions == NULL)
+    {
+      //Leaves the list short, which saveDlSandboxImage notices
+      return;
+    }
+    list->regions = regions;
+    list->allocated = allocated;
+  }
+
+  list->regions[list->count].start = region->start - list->nap->mem_start;
+  list->regions[list->count].size = region->size;
+  list->regions[list->count].isMmap = region->is_mmap;
+  list->regions[list->count].padding = 0;
+  list->count++;
+}
+
+//Code mapped straight from a file is not in the page bitmap, but its pages hold code all the same
+static int isTextPageInUse(struct NaClApp* nap, struct DlSandboxImageDynamicRegionList* dynamicRegions, uint32_t pageIndex)
+{
+  uint64_t pageStart = nap->dynamic_text_start + (uint64_t) pageIndex * NACL_MAP_PAGESIZE;
+
+  if (NaClDynamicTextPageIsVisible(nap, pageIndex))
+  {
+    return 1;
+  }
+  for(size_t i = 0; i < dynamicRegions->count; i++)
+  {
+    struct DlSandboxImageDynamicRegion* region = &dynamicRegions->regions[i];
+    if (region->isMmap && region->start < pageStart + NACL_MAP_PAGESIZE && pageStart < region->start + region->size)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int collectTextPages(struct NaClApp* nap, struct DlSandboxImageDynamicRegionList* dynamicRegions,
+  struct DlSandboxImageRegionList* list)
+{
+  uint32_t pageCount = (uint32_t) ((nap->dynamic_text_end - nap->dynamic_text_start) / NACL_MAP_PAGESIZE);
+  uint32_t runStart = 0;
+  int inRun = 0;
+
+  if (nap->text_shm == NULL)
+  {
+    return 1;
+  }
+
+  for(uint32_t i = 0; i <= pageCount; i++)
+  {
+    int inUse = i < pageCount && isTextPageInUse(nap, dynamicRegions, i);
+    if (inUse && !inRun)
+    {
+      runStart = i;
+      inRun = 1;
+    }
+    else if (!inUse && inRun)
+    {
+      if (!appendRegion(list,
+        (nap->dynamic_text_start + (uint64_t) runStart * NACL_MAP_PAGESIZE) >> NACL_PAGESHIFT,
+        ((uint64_t) (i - runStart) * NACL_MAP_PAGESIZE) >> NACL_PAGESHIFT,
+        NACL_ABI_PROT_READ | NACL_ABI_PROT_EXEC, NACL_ABI_MAP_PRIVATE, DL_SANDBOX_IMAGE_TEXT))
+      {
+        return 0;
+      }
+      inRun = 0;
+    }
+  }
+  return 1;
+}
+
+static int writeAll(int fd, const void* data, size_t size, uint64_t offset)
+{
+  const char* p = (const char*) data;
+  while (size > 0)
+  {
+    ssize_t written = pwrite(fd, p, size, (off_t) offset);
+    if (written < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (written <= 0)
+    {
+      return 0;
+    }
+    p += written;
+    size -= (size_t) written;
+    offset += (uint64_t) written;
+  }
+  return 1;
+}
+
+static int isZero(const char* data, size_t size)
+{
+  for(size_t i = 0; i < size; i++)
+  {
+    if (data[i] != 0)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+//Untouched memory is left as holes in the file, which read back as zeros
+static int writeRegionContents(int fd, struct NaClApp* nap, struct DlSandboxImageRegion* region)
+{
+  const char* start = (const char*) NaClUserToSys(nap, region->pageNum << NACL_PAGESHIFT);
+  size_t size = (size_t) (region->npages << NACL_PAGESHIFT);
+
+  for(size_t done = 0; done < size; done += NACL_MAP_PAGESIZE)
+  {
+    size_t chunk = size - done < NACL_MAP_PAGESIZE ? size - done : NACL_MAP_PAGESIZE;
+    if (!isZero(start + done, chunk) && !writeAll(fd, start + done, chunk, region->dataOffset + done))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int sandboxHasExtraDescriptors(struct NaClApp* nap)
+{
+  int found = 0;
+  NaClFastMutexLock(&nap->desc_mu);
+  //0, 1 and 2 are set up by NaClAppInitialDescriptorHookup in every sandbox
+  for(size_t i = 3; i < nap->desc_tbl.num_entries; i++)
+  {
+    if (DynArrayGet(&nap->desc_tbl, i) != NULL)
+    {
+      found = 1;
+      break;
+    }
+  }
+  NaClFastMutexUnlock(&nap->desc_mu);
+  return found;
+}
+
+//Writes the image to fd, which must be empty. library and app are NULL for snapshots, which are not tied to files
+static int writeImage(NaClSandbox* sandbox, int fd, const struct DlSandboxImageFileId* library,
+  const struct DlSandboxImageFileId* app)
+{
+  struct NaClApp* nap = sandbox->nap;
+  struct NaClAppThread* natp;
+  struct DlSandboxImageHeader header;
+  struct DlSandboxImageRegionList regions;
+  struct DlSandboxImageDynamicRegionList dynamicRegions;
+  struct DlSandboxImageSymbol* symbols = NULL;
+  struct SymbolTableMapping* symbolTable = nap->symbolTableMapping;
+  uint64_t offset;
+  int ret = 0;
+
+  NACL_COMPILE_TIME_ASSERT(DL_SANDBOX_IMAGE_CALLBACKS == NACL_ARRAY_SIZE(sandbox->callbackFunctionWrapper));
+
+  memset(&regions, 0, sizeof(regions));
+  memset(&dynamicRegions, 0, sizeof(dynamicRegions));
+  regions.nap = nap;
+  dynamicRegions.nap = nap;
+
+  if (Map_GetSize(sandbox->threadDataMap) != 1 || nap->num_threads != 1 || sandboxHasExtraDescriptors(nap) || symbolTable == NULL)
+  {
+    goto done;
+  }
+  natp = ((NaClSandbox_Thread*) sandbox->threadDataMap->values[0])->thread;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, DL_SANDBOX_IMAGE_MAGIC, sizeof(header.magic));
+  header.version = DL_SANDBOX_IMAGE_VERSION;
+  header.headerSize = sizeof(header);
+  header.addrBits = nap->addr_bits;
+  header.mapPageSize = NACL_MAP_PAGESIZE;
+  if (library != NULL && app != NULL)
+  {
+    header.library = *library;
+    header.app = *app;
+  }
+
+  header.staticTextEnd = nap->static_text_end;
+  header.dynamicTextStart = nap->dynamic_text_start;
+  header.dynamicTextEnd = nap->dynamic_text_end;
+  header.rodataStart = nap->rodata_start;
+  header.dataStart = nap->data_start;
+  header.dataEnd = nap->data_end;
+  header.breakAddr = nap->break_addr;
+  header.initialEntryPt = nap->initial_entry_pt;
+  header.userEntryPt = nap->user_entry_pt;
+  header.stackSize = nap->stack_size;
+  header.vvarAddr = nap->vvar_addr;
+  header.bundleSize = nap->bundle_size;
+
+  //On x86-64 the low 32 bits of a system address are the untrusted address
+  header.stackPtr = (uint32_t) NaClGetThreadCtxSp(&natp->user);
+  header.tls1 = NaClTlsGetTlsValue1(natp);
+  header.tls2 = NaClTlsGetTlsValue2(natp);
+
+  header.threadMain = (uint32_t) (uintptr_t) sandbox->threadMainPtr;
+  header.exitFunctionWrapper = (uint32_t) (uintptr_t) sandbox->exitFunctionWrapperPtr;
+  for(unsigned i = 0; i < DL_SANDBOX_IMAGE_CALLBACKS; i++)
+  {
+    header.callbackFunctionWrapper[i] = (uint32_t) (uintptr_t) sandbox->callbackFunctionWrapper[i];
+  }
+  header.mallocPtr = (uint32_t) (uintptr_t) sandbox->mallocPtr;
+  header.freePtr = (uint32_t) (uintptr_t) sandbox->freePtr;
+  header.fopenPtr = (uint32_t) (uintptr_t) sandbox->fopenPtr;
+  header.fclosePtr = (uint32_t) (uintptr_t) sandbox->fclosePtr;
+
+  NaClXMutexLock(&nap->mu);
+  NaClVmmapVisit(&nap->mem_map, collectVmmapEntry, &regions);
+  NaClXMutexUnlock(&nap->mu);
+  if (regions.unsupported)
+  {
+    goto done;
+  }
+
+  NaClDyncodeVisit(nap, collectDynamicRegion, &dynamicRegions);
+  if (dynamicRegions.count != (size_t) nap->num_dynamic_regions || !collectTextPages(nap, &dynamicRegions, &regions))
+  {
+    goto done;
+  }
+
+  header.regionCount = (uint32_t) regions.count;
+  header.dynamicRegionCount = (uint32_t) dynamicRegions.count;
+  header.symbolCount = symbolTable->symbolCount;
+
+  symbols = (struct DlSandboxImageSymbol*) malloc((symbolTable->symbolCount + 1) * sizeof(*symbols));
+  if (symbols == NULL)
+  {
+    goto done;
+  }
+  header.stringsSize = 0;
+  for(uint32_t i = 0; i < symbolTable->symbolCount; i++)
+  {
+    symbols[i].address = symbolTable->symbolMap[i].address;
+    symbols[i].nameOffset = header.stringsSize;
+    header.stringsSize += strlen(symbolTable->symbolMap[i].name) + 1;
+  }
+
+  //Tables first, then the contents of each region at a page boundary
+  offset = sizeof(header);
+  header.regionsOffset = offset;
+  offset += regions.count * sizeof(struct DlSandboxImageRegion);
+  header.dynamicRegionsOffset = offset;
+  offset += dynamicRegions.count * sizeof(struct DlSandboxImageDynamicRegion);
+  header.symbolsOffset = offset;
+  offset += symbolTable->symbolCount * sizeof(struct DlSandboxImageSymbol);
+  header.stringsOffset = offset;
+  offset += header.stringsSize;
+  offset = roundUpToMapPage(offset);
+  for(size_t i = 0; i < regions.count; i++)
+  {
+    struct DlSandboxImageRegion* region = &regions.regions[i];
+    if (region->kind == DL_SANDBOX_IMAGE_VVAR || region->prot == NACL_ABI_PROT_NONE)
+    {
+      continue;
+    }
+    region->dataOffset = offset;
+    offset += roundUpToMapPage(region->npages << NACL_PAGESHIFT);
+  }
+  header.fileSize = offset;
+
+  if (ftruncate(fd, (off_t) header.fileSize) != 0 ||
+    !writeAll(fd, &header, sizeof(header), 0) ||
+    !writeAll(fd, regions.regions, regions.count * sizeof(struct DlSandboxImageRegion), header.regionsOffset) ||
+    !writeAll(fd, dynamicRegions.regions, dynamicRegions.count * sizeof(struct DlSandboxImageDynamicRegion), header.dynamicRegionsOffset) ||
+    !writeAll(fd, symbols, symbolTable->symbolCount * sizeof(struct DlSandboxImageSymbol), header.symbolsOffset))
+  {
+    goto done;
+  }
+  for(uint32_t i = 0; i < symbolTable->symbolCount; i++)
+  {
+    const char* name = symbolTable->symbolMap[i].name;
+    if (!writeAll(fd, name, strlen(name) + 1, header.stringsOffset + symbols[i].nameOffset))
+    {
+      goto done;
+    }
+  }
+  for(size_t i = 0; i < regions.count; i++)
+  {
+    if (regions.regions[i].dataOffset != 0 && !writeRegionContents(fd, nap, &regions.regions[i]))
+    {
+      goto done;
+    }
+  }
+  ret = 1;
+
+done:
+  free(symbols);
+  free(regions.regions);
+  free(dynamicRegions.regions);
+  return ret;
+}
+
+int saveDlSandboxImage(NaClSandbox* sandbox, const char* imagePath, const char* naclLibraryPath,
+  const char* naclInitAppFullPath)
+{
+  struct DlSandboxImageFileId library;
+  struct DlSandboxImageFileId app;
+  char tempPath[1100];
+  int fd;
+  int ret;
+
+  //loadDlSandboxImage would never use it
+  if (!sandbox->nap->skip_validator)
+  {
+    return 0;
+  }
+  if (!getFileId(naclLibraryPath, &library) || !getFileId(naclInitAppFullPath, &app))
+  {
+    return 0;
+  }
+
+  //Written under a temporary name so other processes never see half an image
+  if (snprintf(tempPath, sizeof(tempPath), "%s.%d.tmp", imagePath, (int) getpid()) >= (int) sizeof(tempPath))
+  {
+    return 0;
+  }
+  fd = open(tempPath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0)
+  {
+    return 0;
+  }
+
+  ret = writeImage(sandbox, fd, &library, &app);
+  if (close(fd) != 0)
+  {
+    ret = 0;
+  }
+  if (ret)
+  {
+    ret = rename(tempPath, imagePath) == 0;
+  }
+  if (!ret)
+  {
+    unlink(tempPath);
+  }
+  return ret;
+}
+
+/********************** Loading images *****************************/
+
+static int fileIdsEqual(const struct DlSandboxImageFileId* a, const struct DlSandboxImageFileId* b)
+{
+  return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+    a->mtimeSec == b->mtimeSec && a->mtimeNsec == b->mtimeNsec;
+}
+
+static int tableFits(uint64_t offset, uint64_t count, uint64_t entrySize, uint64_t fileSize)
+{
+  return offset <= fileSize && count <= (fileSize - offset) / entrySize;
+}
+
+//Whoever writes an image chooses what the sandbox memory holds, but not where code can run: only the
+//trampolines and static text, and the dynamic text, are executable, nothing is both writable and
+//executable, the guard pages stay inaccessible and the regions do not overlap. The code itself is
+//not validated again, which is why images are not used with validation on
+static int checkRegion(const struct DlSandboxImageHeader* header, const struct DlSandboxImageRegion* region)
+{
+  uint64_t start = region->pageNum << NACL_PAGESHIFT;
+  uint64_t end = start + (region->npages << NACL_PAGESHIFT);
+  int inDynamicText = start >= header->dynamicTextStart && end <= header->dynamicTextEnd;
+
+  if ((region->prot & ~(NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE | NACL_ABI_PROT_EXEC)) != 0 ||
+    ((region->prot & NACL_ABI_PROT_WRITE) != 0 && (region->prot & NACL_ABI_PROT_EXEC) != 0))
+  {
+    return 0;
+  }
+
+  switch (region->kind)
+  {
+    case DL_SANDBOX_IMAGE_TEXT:
+      return inDynamicText && region->dataOffset != 0 &&
+        region->prot == (NACL_ABI_PROT_READ | NACL_ABI_PROT_EXEC);
+    case DL_SANDBOX_IMAGE_MEMORY:
+    case DL_SANDBOX_IMAGE_VVAR:
+      if (end > header->dynamicTextStart && start < header->dynamicTextEnd)
+      {
+        return 0;
+      }
+      if (start < NACL_SYSCALL_START_ADDR && region->prot != NACL_ABI_PROT_NONE)
+      {
+        return 0;
+      }
+      if ((region->prot & NACL_ABI_PROT_EXEC) != 0 &&
+        (region->kind != DL_SANDBOX_IMAGE_MEMORY || end > NaClRoundPage(header->staticTextEnd)))
+      {
+        return 0;
+      }
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+//Checks everything that can be checked without touching nap
+static int checkImage(struct NaClApp* nap, const struct DlSandboxImageHeader* header, uint64_t fileSize,
+  const char* image)
+{
+  const struct DlSandboxImageRegion* regions;
+  uint64_t addrSpaceSize = (uint64_t) 1 << nap->addr_bits;
+
+  if (memcmp(header->magic, DL_SANDBOX_IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+    header->version != DL_SANDBOX_IMAGE_VERSION ||
+    header->headerSize != sizeof(*header) ||
+    header->addrBits != nap->addr_bits ||
+    header->mapPageSize != NACL_MAP_PAGESIZE ||
+    header->fileSize != fileSize)
+  {
+    return 0;
+  }
+
+  if (!tableFits(header->regionsOffset, header->regionCount, sizeof(struct DlSandboxImageRegion), fileSize) ||
+    !tableFits(header->dynamicRegionsOffset, header->dynamicRegionCount, sizeof(struct DlSandboxImageDynamicRegion), fileSize) ||
+    !tableFits(header->symbolsOffset, header->symbolCount, sizeof(struct DlSandboxImageSymbol), fileSize) ||
+    !tableFits(header->stringsOffset, header->stringsSize, 1, fileSize) ||
+    header->stringsSize == 0 || image[header->stringsOffset + header->stringsSize - 1] != '\0')
+  {
+    return 0;
+  }
+
+  //restoreMemory checks the dynamic text against the one NaClMakeDynamicTextShared makes
+  if (header->staticTextEnd < NACL_TRAMPOLINE_END || header->staticTextEnd > header->dynamicTextStart ||
+    header->dynamicTextStart > header->dynamicTextEnd || header->dynamicTextEnd > addrSpaceSize)
+  {
+    return 0;
+  }
+
+  regions = (const struct DlSandboxImageRegion*) (image + header->regionsOffset);
+  for(uint32_t i = 0; i < header->regionCount; i++)
+  {
+    uint64_t size = regions[i].npages << NACL_PAGESHIFT;
+    if (regions[i].pageNum > (addrSpaceSize >> NACL_PAGESHIFT) ||
+      regions[i].npages > (addrSpaceSize >> NACL_PAGESHIFT) - regions[i].pageNum ||
+      (regions[i].dataOffset != 0 && !tableFits(regions[i].dataOffset, size, 1, fileSize)) ||
+      !checkRegion(header, &regions[i]))
+    {
+      return 0;
+    }
+  }
+
+  //writeImage writes the memory regions in address order, and then the text pages in address order,
+  //so regions of the same kind can only overlap if they are out of order
+  for(uint32_t i = 1; i < header->regionCount; i++)
+  {
+    const struct DlSandboxImageRegion* previous = NULL;
+    for(uint32_t j = i; j-- > 0;)
+    {
+      if ((regions[j].kind == DL_SANDBOX_IMAGE_TEXT) == (regions[i].kind == DL_SANDBOX_IMAGE_TEXT))
+      {
+        previous = &regions[j];
+        break;
+      }
+    }
+    if (previous != NULL && previous->pageNum + previous->npages > regions[i].pageNum)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static struct SymbolTableMapping* loadSymbolTable(const struct DlSandboxImageHeader* header, const char* image)
+{
+  const struct DlSandboxImageSymbol* symbols = (const struct DlSandboxImageSymbol*) (image + header->symbolsOffset);
+  struct SymbolTableMapping* symbolTable;
+  char* strings;
+
+  //Like the table NaClElfGetSymbolTableMapping makes, this lives as long as the process
+  symbolTable = (struct SymbolTableMapping*) malloc(sizeof(*symbolTable));
+  strings = (char*) malloc((size_t) header->stringsSize);
+  if (symbolTable == NULL || strings == NULL)
+  {
+    return NULL;
+  }
+  symbolTable->symbolMap = (struct SymbolTableMapEntry*) malloc((header->symbolCount + 1) * sizeof(struct SymbolTableMapEntry));
+  if (symbolTable->symbolMap == NULL)
+  {
+    return NULL;
+  }
+
+  memcpy(strings, image + header->stringsOffset, (size_t) header->stringsSize);
+  symbolTable->symbolCount = header->symbolCount;
+  for(uint32_t i = 0; i < header->symbolCount; i++)
+  {
+    if (symbols[i].nameOffset >= header->stringsSize)
+    {
+      return NULL;
+    }
+    symbolTable->symbolMap[i].name = strings + symbols[i].nameOffset;
+    symbolTable->symbolMap[i].address = symbols[i].address;
+  }
+  return symbolTable;
+}
+
+//The steps of NaClAppLoadFileAslr and NaClMemoryProtection, with the memory coming from the image
+static int restoreMemory(struct NaClApp* nap, const struct DlSandboxImageHeader* header, const char* image, int fd)
+{
+  const struct DlSandboxImageRegion* regions = (const struct DlSandboxImageRegion*) (image + header->regionsOffset);
+  const struct DlSandboxImageDynamicRegion* dynamicRegions = (const struct DlSandboxImageDynamicRegion*) (image + header->dynamicRegionsOffset);
+  uintptr_t textStart;
+  size_t textSize;
+
+  nap->static_text_end = (uintptr_t) header->staticTextEnd;
+  nap->rodata_start = (uintptr_t) header->rodataStart;
+  nap->data_start = (uintptr_t) header->dataStart;
+  nap->data_end = (uintptr_t) header->dataEnd;
+  nap->break_addr = (uintptr_t) header->breakAddr;
+  nap->initial_entry_pt = (uintptr_t) header->initialEntryPt;
+  nap->user_entry_pt = (uintptr_t) header->userEntryPt;
+  nap->stack_size = (uintptr_t) header->stackSize;
+  nap->bundle_size = header->bundleSize;
+
+  if (NaClAllocAddrSpace(nap) != LOAD_OK)
+  {
+    return 0;
+  }
+  //The reservation is inaccessible, so whatever the image does not map stays that way
+  if (NaClMakeDynamicTextShared(nap) != LOAD_OK ||
+    nap->dynamic_text_start != header->dynamicTextStart ||
+    nap->dynamic_text_end != header->dynamicTextEnd)
+  {
+    return 0;
+  }
+
+  for(uint32_t i = 0; i < header->regionCount; i++)
+  {
+    const struct DlSandboxImageRegion* region = &regions[i];
+    if (region->kind == DL_SANDBOX_IMAGE_TEXT &&
+      NaClTextRestorePages(nap,
+        (uint32_t) ((region->pageNum << NACL_PAGESHIFT) - nap->dynamic_text_start),
+        image + region->dataOffset,
+        (uint32_t) (region->npages << NACL_PAGESHIFT)) != 0)
+    {
+      return 0;
+    }
+  }
+
+  NaClXMutexLock(&nap->mu);
+  for(uint32_t i = 0; i < header->regionCount; i++)
+  {
+    const struct DlSandboxImageRegion* region = &regions[i];
+    if (region->kind != DL_SANDBOX_IMAGE_MEMORY)
+    {
+      continue;
+    }
+    if (region->dataOffset != 0)
+    {
+      void* sysaddr = (void*) NaClUserToSys(nap, region->pageNum << NACL_PAGESHIFT);
+      void* mapped = mmap(sysaddr, (size_t) (region->npages << NACL_PAGESHIFT), NaClProtMap(region->prot),
+        MAP_PRIVATE | MAP_FIXED, fd, (off_t) region->dataOffset);
+      if (mapped != sysaddr)
+      {
+        NaClXMutexUnlock(&nap->mu);
+        return 0;
+      }
+      //The new mapping replaced the reservation NaClAllocAddrSpace bound
+      if (nap->numa_node >= 0)
+      {
+        (void) NaClBindNumaNode(sysaddr, (size_t) (region->npages << NACL_PAGESHIFT), nap->numa_node);
+      }
+    }
+    NaClVmmapAdd(&nap->mem_map, region->pageNum, region->npages, region->prot, region->flags, NULL, 0, 0);
+  }
+  textStart = NaClUserToSys(nap, nap->dynamic_text_start);
+  textSize = nap->dynamic_text_end - nap->dynamic_text_start;
+  if (textSize != 0)
+  {
+    NaClVmmapAdd(&nap->mem_map, nap->dynamic_text_start >> NACL_PAGESHIFT, textSize >> NACL_PAGESHIFT,
+      NACL_ABI_PROT_READ | NACL_ABI_PROT_EXEC, NACL_ABI_MAP_PRIVATE, nap->text_shm, 0, textSize);
+  }
+  NaClXMutexUnlock(&nap->mu);
+
+  //The trampolines hold addresses in this process, so they are written afresh
+  textStart = nap->mem_start + NACL_SYSCALL_START_ADDR;
+  textSize = NaClRoundPage(nap->static_text_end - NACL_SYSCALL_START_ADDR);
+  if (NaClMprotect((void*) textStart, textSize, PROT_READ | PROT_WRITE) != 0)
+  {
+    return 0;
+  }
+  NaClLoadTrampoline(nap, NACL_ENABLE_ASLR);
+  NaClLoadSpringboard(nap);
+  if (NaClMprotect((void*) textStart, textSize, PROT_READ | PROT_EXEC) != 0)
+  {
+    return 0;
+  }
+
+  NaClXMutexLock(&nap->dynamic_load_mutex);
+  for(uint32_t i = 0; i < header->dynamicRegionCount; i++)
+  {
+    if (!NaClDynamicRegionCreate(nap, nap->mem_start + (uintptr_t) dynamicRegions[i].start,
+      (size_t) dynamicRegions[i].size, dynamicRegions[i].isMmap))
+    {
+      NaClXMutexUnlock(&nap->dynamic_load_mutex);
+      return 0;
+    }
+  }
+  NaClXMutexUnlock(&nap->dynamic_load_mutex);
+
+  //The IRT already holds the address of the vvar page, so it has to go back in the same place
+  if (header->vvarAddr != 0 &&
+    (!NaClVvarCreateAt(nap, (uintptr_t) (header->vvarAddr >> NACL_PAGESHIFT)) || nap->vvar_addr != header->vvarAddr))
+  {
+    return 0;
+  }
+  return 1;
+}
+
+//Builds a sandbox in nap from a checked image, using symbolTable as its symbol table
+static NaClSandbox* restoreImage(struct NaClApp* nap, const struct DlSandboxImageHeader* header, const char* image,
+  int fd, struct SymbolTableMapping* symbolTable)
+{
+  NaClSandbox* sandbox;
+  uintptr_t stackPtr;
+
+  nap->symbolTableMapping = symbolTable;
+  if (nap->symbolTableMapping == NULL || !restoreMemory(nap, header, image, fd))
+  {
+    return NULL;
+  }
+
+  if (NaClAppPrepareToLaunch(nap) != LOAD_OK)
+  {
+    return NULL;
+  }
+  NaClSetInitState(nap, NACL_MODULE_LOADED);
+  NaClAppStartModule(nap);
+
+  NaClXMutexLock(&nap->mu);
+  nap->running = 1;
+  NaClXMutexUnlock(&nap->mu);
+
+  //The main thread is made again as getThreadData makes other threads, running threadMain (which
+  //returns to us straight away) just below where the app's main left the stack
+  stackPtr = ROUND_DOWN_TO_POW2((uintptr_t) header->stackPtr, STACKALIGNMENT);
+  if (NaClCreateAdditionalThreadOnCurrThread(nap, (uintptr_t) header->threadMain, NaClUserToSys(nap, stackPtr),
+    header->tls1, header->tls2) != 0)
+  {
+    return NULL;
+  }
+
+  for(unsigned i = 0; i < DL_SANDBOX_IMAGE_CALLBACKS; i++)
+  {
+    nap->callbackSlot[i] = 0;
+  }
+
+  sandbox = constructNaClSandbox(nap);
+  if (sandbox == NULL)
+  {
+    return NULL;
+  }
+
+  sandbox->threadMainPtr = (threadMain_type) (uintptr_t) header->threadMain;
+  sandbox->exitFunctionWrapperPtr = (exitFunctionWrapper_type) (uintptr_t) header->exitFunctionWrapper;
+  for(unsigned i = 0; i < DL_SANDBOX_IMAGE_CALLBACKS; i++)
+  {
+    sandbox->callbackFunctionWrapper[i] = (callbackFunctionWrapper_type) (uintptr_t) header->callbackFunctionWrapper[i];
+  }
+  sandbox->mallocPtr = (malloc_type) (uintptr_t) header->mallocPtr;
+  sandbox->freePtr = (free_type) (uintptr_t) header->freePtr;
+  sandbox->fopenPtr = (fopen_type) (uintptr_t) header->fopenPtr;
+  sandbox->fclosePtr = (fclose_type) (uintptr_t) header->fclosePtr;
+  return sandbox;
+}
+
+NaClSandbox* loadDlSandboxImage(struct NaClApp* nap, const char* imagePath, const char* naclLibraryPath,
+  const char* naclInitAppFullPath, int* imageFound)
+{
+  NaClSandbox* sandbox = NULL;
+  struct DlSandboxImageHeader header;
+  struct DlSandboxImageFileId library;
+  struct DlSandboxImageFileId app;
+  struct stat st;
+  char* image = MAP_FAILED;
+  int fd;
+
+  *imageFound = 0;
+
+  //The code in an image is not validated again, see checkRegion
+  if (!nap->skip_validator)
+  {
+    return NULL;
+  }
+
+  fd = open(imagePath, O_RDONLY);
+  if (fd < 0)
+  {
+    return NULL;
+  }
+  //As the image decides what runs in the sandbox, only images no one else could have written are used
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+    (st.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+    (uint64_t) st.st_size < sizeof(header) ||
+    pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header))
+  {
+    goto done;
+  }
+  image = (char*) mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (image == MAP_FAILED || !checkImage(nap, &header, (uint64_t) st.st_size, image) ||
+    !getFileId(naclLibraryPath, &library) || !getFileId(naclInitAppFullPath, &app) ||
+    !fileIdsEqual(&library, &header.library) || !fileIdsEqual(&app, &header.app))
+  {
+    goto done;
+  }
+
+  *imageFound = 1;
+  sandbox = restoreImage(nap, &header, image, fd, loadSymbolTable(&header, image));
+
+done:
+  if (image != MAP_FAILED)
+  {
+    munmap(image, (size_t) st.st_size);
+  }
+  close(fd);
+  return sandbox;
+}
+
+/********************** Snapshots *****************************/
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 1U
+#endif
+
+NaClSandboxSnapshot* snapshotDlSandbox(NaClSandbox* sandbox)
+{
+  NaClSandboxSnapshot* snapshot;
+  struct DlSandboxImageHeader* header;
+  int fd;
+
+  if (sandbox->nap->fault_signal != 0)
+  {
+    return NULL;
+  }
+
+  //A memfd rather than a file, so the image never reaches a disk, and no one else can open it
+  fd = (int) syscall(__NR_memfd_create, "dyn_ldr_snapshot", MFD_CLOEXEC);
+  if (fd < 0)
+  {
+    return NULL;
+  }
+  if (!writeImage(sandbox, fd, NULL, NULL))
+  {
+    close(fd);
+    return NULL;
+  }
+
+  snapshot = (NaClSandboxSnapshot*) malloc(sizeof(*snapshot));
+  if (snapshot == NULL)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  snapshot->fd = fd;
+  if (pread(fd, &snapshot->header, sizeof(snapshot->header), 0) != (ssize_t) sizeof(snapshot->header))
+  {
+    goto error;
+  }
+  header = &snapshot->header;
+  snapshot->image = (char*) mmap(NULL, (size_t) header->fileSize, PROT_READ, MAP_SHARED, fd, 0);
+  if (snapshot->image == MAP_FAILED)
+  {
+    goto error;
+  }
+
+  //The symbol table lives as long as the process, so clones share it
+  snapshot->symbolTable = sandbox->nap->symbolTableMapping;
+  snapshot->memoryBudget = sandbox->nap->mem_budget;
+  snapshot->numaNode = sandbox->nap->numa_node;
+  snapshot->callbackParameterStartOffset = sandbox->callbackParameterStartOffset;
+  snapshot->cpuBudgetTicks = sandbox->cpuBudgetTicks;
+  return snapshot;
+
+error:
+  close(fd);
+  free(snapshot);
+  return NULL;
+}
+
+NaClSandbox* loadDlSandboxSnapshot(struct NaClApp* nap, NaClSandboxSnapshot* snapshot)
+{
+  NaClSandbox* sandbox;
+
+  nap->mem_budget = snapshot->memoryBudget;
+  if (nap->numa_node < 0)
+  {
+    nap->numa_node = snapshot->numaNode;
+  }
+  sandbox = restoreImage(nap, &snapshot->header, snapshot->image, snapshot->fd, snapshot->symbolTable);
+  if (sandbox != NULL)
+  {
+    sandbox->callbackParameterStartOffset = snapshot->callbackParameterStartOffset;
+    sandbox->cpuBudgetTicks = snapshot->cpuBudgetTicks;
+  }
+  return sandbox;
+}
+
+void destroyDlSandboxSnapshot(NaClSandboxSnapshot* snapshot)
+{
+  //Clones keep their own mappings of the memfd, so it lives on until the last of them is destroyed
+  munmap(snapshot->image, (size_t) snapshot->header.fileSize);
+  close(snapshot->fd);
+  free(snapshot);
+}
+
+#else
+
+int getDlSandboxImagePath(const char* imageDir, const char* naclLibraryPath, const char* naclInitAppFullPath,
+  char* imagePath, size_t imagePathLen)
+{
+  return 0;
+}
+
+int saveDlSandboxImage(NaClSandbox* sandbox, const char* imagePath, const char* naclLibraryPath,
+  const char* naclInitAppFullPath)
+{
+  return 0;
+}
+
+NaClSandbox* loadDlSandboxImage(struct NaClApp* nap, const char* imagePath, const char* naclLibraryPath,
+  const char* naclInitAppFullPath, int* imageFound)
+{
+  *imageFound = 0;
+  return NULL;
+}
+
+NaClSandboxSnapshot* snapshotDlSandbox(NaClSandbox* sandbox)
+{
+  return NULL;
+}
+
+NaClSandbox* loadDlSandboxSnapshot(struct NaClApp* nap, NaClSandboxSnapshot* snapshot)
+{
+  return NULL;
+}
+
+void destroyDlSandboxSnapshot(NaClSandboxSnapshot* snapshot)
+{
+}
+
+#endif
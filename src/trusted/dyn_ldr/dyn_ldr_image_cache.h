@@ -0,0 +1,59 @@
+#ifndef NACL_DYN_LDR_IMAGE_CACHE
+#define NACL_DYN_LDR_IMAGE_CACHE
+
+#include <stddef.h>
+
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_lib.h"
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+struct NaClApp;
+
+//A sandbox image holds what createDlSandbox builds for one library and app: the sandbox memory
+//once the app's main has run (so with everything runnable-ld.so loaded already relocated), the
+//layout of that memory, the app's symbol table and the state of the main thread. A sandbox built
+//from an image maps the saved memory copy-on-write, so no ELF file is opened, parsed, relocated
+//or validated, and the app's main does not run again.
+//
+//An image is tied to the device, inode, size and modification time of the library and the app.
+//The shared libraries a dynamic app loads are not part of that key, and the sandbox keeps the
+//environment it had when the image was saved. Whoever can write an image controls the code in
+//the sandboxes built from it, so only images owned by the user the process runs as, and not
+//writable by anyone else, are used. Their layout is checked so that code can only be where the
+//loader would have put it, but the code is not validated again, so with validation on (see
+//NACL_DYN_LDR_VALIDATION_CACHE) images are neither saved nor used.
+//
+//Images are only supported on Linux. Elsewhere no image is ever saved or found.
+
+//Fills imagePath with the path of the image for this library and app in imageDir.
+//Returns 0 if it does not fit.
+int getDlSandboxImagePath(const char* imageDir, const char* naclLibraryPath, const char* naclInitAppFullPath,
+  char* imagePath, size_t imagePathLen);
+
+//Saves an image of a sandbox createDlSandbox has just built. Returns 0 if no image was saved,
+//which is also the case if the sandbox holds state an image cannot capture, such as open
+//descriptors or a second thread.
+int saveDlSandboxImage(NaClSandbox* sandbox, const char* imagePath, const char* naclLibraryPath,
+  const char* naclInitAppFullPath);
+
+//Builds a sandbox from the image at imagePath in nap, which must not have loaded anything yet.
+//Returns NULL with *imageFound set to 0, and nap untouched, if there is no usable image, and NULL
+//with *imageFound set to 1 if the image could not be restored. The callback parameter offset of the
+//returned sandbox is not known yet.
+NaClSandbox* loadDlSandboxImage(struct NaClApp* nap, const char* imagePath, const char* naclLibraryPath,
+  const char* naclInitAppFullPath, int* imageFound);
+
+//Used by snapshotDlSandbox and cloneDlSandbox in dyn_ldr_lib.h. A snapshot is an image of a sandbox kept in a
+//memfd instead of a file, so it is not tied to the library and app files, and can be taken of a sandbox that
+//has been called since it was made. Builds a clone of the snapshot in nap, which must not have loaded anything
+//yet, with the memory budget, callback parameter offset and CPU budget of the sandbox the snapshot was taken of,
+//and its NUMA node unless nap has one.
+NaClSandbox* loadDlSandboxSnapshot(struct NaClApp* nap, NaClSandboxSnapshot* snapshot);
+
+#ifdef __cplusplus
+  }
+#endif
+
+#endif
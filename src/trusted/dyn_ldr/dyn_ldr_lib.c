@@ -9,8 +9,13 @@
 #include "native_client/src/trusted/desc/nacl_desc_io.h"
 #include "native_client/src/trusted/dyn_ldr/datastructures/ds_stack.h"
 #include "native_client/src/trusted/dyn_ldr/datastructures/ds_map.h"
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_fault.h"
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_image_cache.h"
 #include "native_client/src/trusted/dyn_ldr/dyn_ldr_lib.h"
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_profile.h"
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_stats.h"
 #include "native_client/src/trusted/dyn_ldr/dyn_ldr_test_structs.h"
+#include "native_client/src/trusted/perf_counter/nacl_perf_stats.h"
 #include "native_client/src/trusted/service_runtime/elf_symboltable_mapping.h"
 #include "native_client/src/trusted/service_runtime/elf_util.h"
 #include "native_client/src/trusted/service_runtime/env_cleanser.h"
@@ -25,10 +30,13 @@
 #include "native_client/src/trusted/service_runtime/nacl_syscall_common.h"
 #include "native_client/src/trusted/service_runtime/nacl_tls.h"
 #include "native_client/src/trusted/service_runtime/nacl_valgrind_hooks.h"
+#include "native_client/src/trusted/service_runtime/nacl_vvar.h"
+#include "native_client/src/trusted/service_runtime/sel_addrspace.h"
 #include "native_client/src/trusted/service_runtime/sel_ldr.h"
 #include "native_client/src/trusted/service_runtime/sel_main_common.h"
 #include "native_client/src/trusted/service_runtime/sel_qualify.h"
 #include "native_client/src/trusted/service_runtime/sys_memory.h"
+#include "native_client/src/trusted/validator/persistent_validation_cache.h"
 
 #ifndef FALSE
 #define FALSE 0
@@ -40,6 +48,23 @@
 
 #define CALLBACK_SLOTS_AVAILABLE (sizeof( ((struct NaClApp*) 0)->callbackSlot ) / sizeof(uintptr_t))
 
+//Number of validated libraries remembered in the on disk validation cache
+#define VALIDATION_CACHE_MAX_ENTRIES 4096
+
+//Shared by all sandboxes, set up in initializeDlSandboxCreator if the environment variable
+//NACL_DYN_LDR_VALIDATION_CACHE names the cache file
+static struct NaClValidationCache* validationCache = NULL;
+
+//Directory of the sandbox images createDlSandbox saves and reuses, set in initializeDlSandboxCreator
+//if the environment variable NACL_DYN_LDR_IMAGE_CACHE names one
+static const char* imageCacheDir = NULL;
+
+//Prefix of the profile files destroyDlSandbox writes, set in initializeDlSandboxCreator if the
+//environment variable NACL_DYN_LDR_PROFILE names one
+static const char* profileOutputPrefix = NULL;
+//Numbers the profiled sandboxes of this process
+static unsigned profiledSandboxCount = 0;
+
 /********************* Utility functions ***********************/
 
 #if NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && NACL_BUILD_SUBARCH == 32
@@ -122,6 +147,57 @@ int initializeDlSandboxCreator(int enableLogging)
 
   NaClInsecurelyBypassAllAclChecks();
 
+  {
+    const char* validationCachePath = getenv("NACL_DYN_LDR_VALIDATION_CACHE");
+    if (validationCachePath != NULL && validationCachePath[0] != '\0')
+    {
+      validationCache = NaClPersistentValidationCacheCreate(validationCachePath, VALIDATION_CACHE_MAX_ENTRIES);
+      if (validationCache == NULL)
+      {
+        printf("NaCl Error initializeDlSandboxCreator - could not open validation cache %s, libraries will not be validated\n", validationCachePath);
+      }
+    }
+  }
+
+  {
+    //Sandboxes for a library and app that have been seen before are mapped from a saved image
+    //instead of being loaded again. See dyn_ldr_image_cache.h
+    const char* imageCachePath = getenv("NACL_DYN_LDR_IMAGE_CACHE");
+    imageCacheDir = (imageCachePath != NULL && imageCachePath[0] != '\0') ? imageCachePath : NULL;
+  }
+
+  {
+    //Profile every sandbox, see dyn_ldr_profile.h
+    const char* profilePath = getenv("NACL_DYN_LDR_PROFILE");
+    profileOutputPrefix = (profilePath != NULL && profilePath[0] != '\0') ? profilePath : NULL;
+  }
+
+  #if NACL_ADDRSPACE_PACKING
+  {
+    //Reserve room for this many sandboxes up front, packed back to back with shared guard regions
+    const char* packedSandboxes = getenv("NACL_DYN_LDR_PACKED_SANDBOXES");
+    if (packedSandboxes != NULL && atoi(packedSandboxes) > 0)
+    {
+      if (!NaClAddrSpacePackingInit((size_t) atoi(packedSandboxes), NACL_ENABLE_ASLR))
+      {
+        printf("NaCl Error initializeDlSandboxCreator - could not reserve space for %s packed sandboxes\n", packedSandboxes);
+      }
+    }
+  }
+  #endif
+
+  {
+    //Recover from faults in sandboxed code, see dyn_ldr_fault.h
+    const char* faultRecovery = getenv("NACL_DYN_LDR_FAULT_RECOVERY");
+    if (faultRecovery == NULL || strcmp(faultRecovery, "0") != 0)
+    {
+      if (!installSandboxFaultHandler())
+      {
+        printf("NaCl Error initializeDlSandboxCreator - could not install the fault handler, faults in sandboxes will not be recovered\n");
+      }
+    }
+  }
+
   if (!NaClInitSwitchToApp()) {
     return FALSE;
   }
@@ -148,6 +224,15 @@ int closeSandboxCreator(void)
   //   NaClSignalHandlerFini();
   // #endif
 
+  removeSandboxFaultHandler();
+
+  NaClPersistentValidationCacheDestroy(validationCache);
+  validationCache = NULL;
+
+  #if NACL_ADDRSPACE_PACKING
+    NaClAddrSpacePackingFini();
+  #endif
+
   NaClAllModulesFini();
 
   return TRUE;
@@ -167,7 +252,7 @@ int invokeCheckStructSizesTest
   int size_LongLongSize
 );
 
-static struct NaClApp* createAndInitNaClApp() {
+static struct NaClApp* createAndInitNaClApp(size_t memoryBudget, int numaNode) {
   struct NaClApp*         nap = NULL;
   nap = NaClAppCreate();
   if (nap == NULL) {
@@ -176,7 +261,30 @@ static struct NaClApp* createAndInitNaClApp() {
 
   nap->ignore_validator_result = TRUE;//(options->debug_mode_ignore_validator > 0);
   nap->skip_validator = TRUE;//(options->debug_mode_ignore_validator > 1);
+
+  //With a validation cache, code is validated and code that fails is refused. The cache is queried for code
+  //without a file identity, so revalidating code that has already been seen, in this process or an earlier
+  //one with the same cache file, costs a hash of the code and a lookup
+  if (validationCache != NULL)
+  {
+    nap->validation_cache = validationCache;
+    nap->skip_validator = FALSE;
+    nap->ignore_validator_result = FALSE;
+  }
   nap->enable_exception_handling = FALSE;//options->enable_exception_handling;
+  // Large libraries are validated across all online cores (only takes effect
+  // once skip_validator is turned off)
+  nap->validator_threads = nap->sc_nprocessors_onln > 1 ? nap->sc_nprocessors_onln : 1;
+  // Library threads are never suspended, so hot syscalls can skip the generic dispatch
+  nap->enable_syscall_fast_path = TRUE;
+  // Socket pairs only ever connect threads of this process
+  nap->shm_socket_pairs = TRUE;
+  // Cap on the writable memory the sandboxed library may map (0 means no cap)
+  nap->mem_budget = memoryBudget;
+  // Transparent huge pages cut TLB misses for libraries that touch a lot of memory
+  nap->huge_pages = getenv("NACL_DYN_LDR_HUGE_PAGES") != NULL;
+  // Node the sandbox memory comes from (-1 for wherever it is first touched)
+  nap->numa_node = numaNode;
 
   // #if NACL_WINDOWS
   //   nap->attach_debug_exception_handler_func = NaClDebugExceptionHandlerStandaloneAttach;
@@ -232,8 +340,46 @@ static int getRunnableLdDirPathFromNaClLibPath(const char* naclLibraryPath, char
   return 1;
 }
 
-//Adapted from ./native_client/src/trusted/service_runtime/sel_main.c NaClSelLdrMain
+//Every host thread that calls into a sandbox runs with the TLS values of its first thread (see getThreadData), which
+//the IRT's allocator has to know, as it would otherwise share its lock free thread caches between them
+static const char* sharedTlsEnvVar = "NACL_IRT_THREADS_SHARE_TLS=1";
+
+//Returns the host's environment with sharedTlsEnvVar added, to be freed by the caller, or NULL
+static const char** makeSandboxEnviron(void)
+{
+  const char** hostEnv = NaClGetEnviron();
+  size_t count = 0;
+  const char** env;
+
+  while (hostEnv != NULL && hostEnv[count] != NULL) {
+    count++;
+  }
+
+  env = (const char**) malloc((count + 2) * sizeof(*env));
+  if (env == NULL) {
+    return NULL;
+  }
+
+  if (count > 0) {
+    memcpy(env, hostEnv, count * sizeof(*env));
+  }
+  env[count] = sharedTlsEnvVar;
+  env[count + 1] = NULL;
+  return env;
+}
+
 NaClSandbox* createDlSandbox(const char* naclLibraryPath, const char* naclInitAppFullPath)
+{
+  return createDlSandboxWithBudget(naclLibraryPath, naclInitAppFullPath, 0);
+}
+
+//Adapted from ./native_client/src/trusted/service_runtime/sel_main.c NaClSelLdrMain
+NaClSandbox* createDlSandboxWithBudget(const char* naclLibraryPath, const char* naclInitAppFullPath, size_t memoryBudget)
+{
+  return createDlSandboxOnNumaNode(naclLibraryPath, naclInitAppFullPath, memoryBudget, -1);
+}
+
+NaClSandbox* createDlSandboxOnNumaNode(const char* naclLibraryPath, const char* naclInitAppFullPath, size_t memoryBudget, int numaNode)
 {
   NaClSandbox*            sandbox = NULL;
   struct NaClApp*         nap = NULL;
@@ -243,18 +389,38 @@ NaClSandbox* createDlSandbox(const char* naclLibraryPath, const char* naclInitAp
   NaClErrorCode           pq_error;
   // unsigned                testResult = 0;
   // int                     testResult2 = 0;
-  // int                     testResult3 = 0;
+  int                     testResult3 = 0;
   struct NaClDesc*        blob_file = NULL;
   char*                   nacl_load_args[5] = {0};
   int                     nacl_load_args_count = 0;
   char                    runnableLdDirPath[1024];
+  char                    imagePath[1024];
+  int                     haveImagePath = 0;
+  int                     imageFound = 0;
+  const char**            sandboxEnv = NULL;
+  int                     mainThreadCreated;
 
-  nap = createAndInitNaClApp();
+  nap = createAndInitNaClApp(memoryBudget, numaNode);
   if (nap == NULL) {
     printf("NaCl Error createDlSandbox - NaClAppCreate() failed\n");
     goto error;
   }
 
+  if (imageCacheDir != NULL) {
+    haveImagePath = getDlSandboxImagePath(imageCacheDir, naclLibraryPath, naclInitAppFullPath, imagePath, sizeof(imagePath));
+  }
+
+  if (haveImagePath) {
+    sandbox = loadDlSandboxImage(nap, imagePath, naclLibraryPath, naclInitAppFullPath, &imageFound);
+    if (sandbox != NULL) {
+      goto sandboxReady;
+    }
+    if (imageFound) {
+      printf("NaCl Error createDlSandbox - Could not restore the sandbox image %s\n", imagePath);
+      goto error;
+    }
+  }
+
   pq_error = NaClAppLoadFileFromFilename(nap, naclInitAppFullPath);
 
   if (LOAD_SEGMENT_BAD_LOC == pq_error) {
@@ -262,7 +428,7 @@ NaClSandbox* createDlSandbox(const char* naclLibraryPath, const char* naclInitAp
     // Try loading it as a dynamic file
 
     free(nap);
-    nap = createAndInitNaClApp();
+    nap = createAndInitNaClApp(memoryBudget, numaNode);
     if (nap == NULL) {
       printf("NaCl Error createDlSandbox - NaClAppCreate() failed\n");
       goto error;
@@ -326,6 +492,8 @@ NaClSandbox* createDlSandbox(const char* naclLibraryPath, const char* naclInitAp
     goto error;
   }
 
+  //No file metadata, so the validation cache is keyed on a hash of the code rather than on the file's identity,
+  //which a library rewritten in place could keep
   pq_error = NaClMainLoadIrt(nap, blob_file, NULL);
 
   if (LOAD_OK != pq_error) {
@@ -343,10 +511,20 @@ NaClSandbox* createDlSandbox(const char* naclLibraryPath, const char* naclInitAp
 
   NaClDescUnref(blob_file);
 
-  if (!NaClCreateMainThreadWithoutThreadCreate(nap,
+  sandboxEnv = makeSandboxEnviron();
+  if (sandboxEnv == NULL) {
+    printf("NaCl Error createDlSandbox - Could not allocate the environment\n");
+    goto error;
+  }
+
+  //The strings are copied to the sandbox's stack
+  mainThreadCreated = NaClCreateMainThreadWithoutThreadCreate(nap,
                             nacl_load_args_count,
                             nacl_load_args,
-                            NaClGetEnviron())) {
+                            sandboxEnv);
+  free(sandboxEnv);
+
+  if (!mainThreadCreated) {
     printf("NaCl Error createDlSandbox - Error creating main thread failed\n");
     goto error;
   }
@@ -400,6 +578,7 @@ NaClSandbox* createDlSandbox(const char* naclLibraryPath, const char* naclInitAp
     }
   }
 
+sandboxReady:
   nap->custom_app_state = (uintptr_t) sandbox;
 
   // //NaClLog(LOG_INFO, "Running a sandbox test\n");
@@ -419,19 +598,21 @@ NaClSandbox* createDlSandbox(const char* naclLibraryPath, const char* naclInitAp
   //   goto error;
   // }
 
-  // testResult3 = invokeCheckStructSizesTest(sandbox,
-  //   sizeof(struct TestStructDoubleAlign),
-  //   sizeof(struct TestStructPointerSize),
-  //   sizeof(struct TestStructIntSize),
-  //   sizeof(struct TestStructLongSize),
-  //   sizeof(struct TestStructLongLongSize)
-  // );
+  //The sandbox is ILP32 while the host may not be, so the sandbox is checked against the sizes its ABI should give
+  //rather than the host's sizeof. The C++ API's struct layout checks assume this ABI
+  testResult3 = invokeCheckStructSizesTest(sandbox,
+    SANDBOX_SIZEOF_TestStructDoubleAlign,
+    SANDBOX_SIZEOF_TestStructPointerSize,
+    SANDBOX_SIZEOF_TestStructIntSize,
+    SANDBOX_SIZEOF_TestStructLongSize,
+    SANDBOX_SIZEOF_TestStructLongLongSize
+  );
 
-  // if(!testResult3)
-  // {
-  //   //NaClLog(LOG_ERROR, "Sandbox test failed: Sizes of datastructures inside and outside the sandbox do not agree\n");
-  //   goto error;
-  // }
+  if(!testResult3)
+  {
+    printf("NaCl Error createDlSandbox - Sizes of datastructures inside the sandbox do not match the sandbox ABI\n");
+    goto error;
+  }
 
   //NaClLog(LOG_INFO, "Acquiring the callback parameter start offset\n");
   invokeIdentifyCallbackOffsetHelper(sandbox);
@@ -446,6 +627,15 @@ NaClSandbox* createDlSandbox(const char* naclLibraryPath, const char* naclInitAp
     //NaClLog(LOG_INFO, "Sandbox callback parameter start offset: %" PRId32 "\n", sandbox->callbackParameterStartOffset);
   }
 
+  //Saved once the offset is known, so the sandbox is in the state every later call finds it in
+  if (haveImagePath && !imageFound) {
+    saveDlSandboxImage(sandbox, imagePath, naclLibraryPath, naclInitAppFullPath);
+  }
+
+  if (profileOutputPrefix != NULL) {
+    startSandboxProfile(sandbox);
+  }
+
   //NaClLog(LOG_INFO, "Succeeded in creating sandbox\n");
 
   return sandbox;
@@ -459,6 +649,49 @@ error:
   return NULL;
 }
 
+NaClSandbox* cloneDlSandboxFromSnapshot(NaClSandboxSnapshot* snapshot)
+{
+  return cloneDlSandboxFromSnapshotOnNumaNode(snapshot, -1);
+}
+
+NaClSandbox* cloneDlSandboxFromSnapshotOnNumaNode(NaClSandboxSnapshot* snapshot, int numaNode)
+{
+  NaClSandbox* sandbox;
+  struct NaClApp* nap = createAndInitNaClApp(0, numaNode);
+
+  if (nap == NULL) {
+    printf("NaCl Error cloneDlSandbox - NaClAppCreate() failed\n");
+    return NULL;
+  }
+
+  sandbox = loadDlSandboxSnapshot(nap, snapshot);
+  if (sandbox == NULL) {
+    printf("NaCl Error cloneDlSandbox - Could not restore the snapshot\n");
+    free(nap);
+    return NULL;
+  }
+  nap->custom_app_state = (uintptr_t) sandbox;
+
+  if (profileOutputPrefix != NULL) {
+    startSandboxProfile(sandbox);
+  }
+  return sandbox;
+}
+
+NaClSandbox* cloneDlSandbox(NaClSandbox* parent)
+{
+  NaClSandbox* sandbox;
+  NaClSandboxSnapshot* snapshot = snapshotDlSandbox(parent);
+
+  if (snapshot == NULL) {
+    printf("NaCl Error cloneDlSandbox - Could not take a snapshot of the sandbox\n");
+    return NULL;
+  }
+  sandbox = cloneDlSandboxFromSnapshot(snapshot);
+  destroyDlSandboxSnapshot(snapshot);
+  return sandbox;
+}
+
 void NaClDescImcShmDtor(struct NaClRefCount *vself);
 
 // The old nacl app shutdown code
@@ -573,11 +806,50 @@ void NaClDescImcShmDtor(struct NaClRefCount *vself);
 //   return;
 // }
 
+static void writeSandboxProfileFiles(NaClSandbox* sandbox)
+{
+  char path[4096];
+  unsigned sandboxNumber = profiledSandboxCount++;
+  FILE* out;
+
+  snprintf(path, sizeof(path), "%s.%d.%u.txt", profileOutputPrefix, (int) getpid(), sandboxNumber);
+  out = fopen(path, "w");
+  if (out == NULL)
+  {
+    printf("NaCl Error destroyDlSandbox - could not write the profile %s\n", path);
+    return;
+  }
+  writeSandboxProfileReport(sandbox, out);
+  fclose(out);
+
+  snprintf(path, sizeof(path), "%s.%d.%u.folded", profileOutputPrefix, (int) getpid(), sandboxNumber);
+  out = fopen(path, "w");
+  if (out == NULL)
+  {
+    printf("NaCl Error destroyDlSandbox - could not write the profile %s\n", path);
+    return;
+  }
+  writeSandboxProfileCollapsedStacks(sandbox, out);
+  fclose(out);
+}
+
 void destroyDlSandbox(NaClSandbox* sandbox)
 {
   struct NaClApp* nap = sandbox->nap;
   unsigned mapSize = Map_GetSize(sandbox->threadDataMap);
 
+  //Any thread's last call may have been into this sandbox, see dyn_ldr_stats.h
+  AtomicIncrement(&sandboxStatsGeneration, 1);
+
+  if(sandbox->profile != NULL)
+  {
+    if(profileOutputPrefix != NULL)
+    {
+      writeSandboxProfileFiles(sandbox);
+    }
+    stopSandboxProfile(sandbox);
+  }
+
   for(unsigned i = 0; i < mapSize; i++)
   {
     NaClSandbox_Thread* threadData = (NaClSandbox_Thread*) sandbox->threadDataMap->values[i];
@@ -597,6 +869,8 @@ void destroyDlSandbox(NaClSandbox* sandbox)
 
   nap->text_shm = NULL;
 
+  NaClVvarDestroy(nap);
+
   NaClLog(4, "Freeing synchronization variables for the NaClApp\n");
 
   NaClCondVarDtor(&nap->cv);
@@ -643,6 +917,8 @@ NaClSandbox_Thread* constructNaClSandboxThread(NaClSandbox* sandbox)
   }
 
   threadData->callbackParamsAlreadyRead = 0;
+  threadData->profile = NULL;
+  memset(&threadData->stats, 0, sizeof(threadData->stats));
   #if NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && NACL_BUILD_SUBARCH == 64
     threadData->registerParameterNumber = 0;
     threadData->callbackParameterNumber = 0;
@@ -681,6 +957,7 @@ NaClSandbox* constructNaClSandbox(struct NaClApp* nap)
   }
 
   sandbox->nap = nap;
+  sandbox->memoryBase = nap->mem_start;
   sandbox->threadDataMap = (DS_Map *) malloc(sizeof(DS_Map));
 
   if(sandbox->threadDataMap == NULL)
@@ -708,6 +985,8 @@ NaClSandbox* constructNaClSandbox(struct NaClApp* nap)
 
   Map_Put(sandbox->threadDataMap, threadId, (uintptr_t) threadData);
   sandbox->extraState = NULL;
+  sandbox->profile = NULL;
+  sandbox->cpuBudgetTicks = 0;
   return sandbox;
 
 err_createdThreadMap:
@@ -719,9 +998,19 @@ err_createdSandbox:
   return NULL;
 }
 
+int getSandboxNumaNode(NaClSandbox* sandbox)
+{
+  return sandbox->nap->numa_node;
+}
+
 unsigned long getSandboxMemoryBase(NaClSandbox* sandbox)
 {
-  return sandbox->nap->mem_start;
+  return sandbox->memoryBase;
+}
+
+int getSandboxFaultSignal(NaClSandbox* sandbox)
+{
+  return sandbox->nap->fault_signal;
 }
 
 /********************** "Function call stub" helpers *****************************/
@@ -822,6 +1111,7 @@ NaClSandbox_Thread* preFunctionCall(NaClSandbox* sandbox, size_t paramsSize, siz
   #if NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 //32 or 64 bit
 
     NaClSandbox_Thread* threadData = getThreadData(sandbox);
+    setSandboxStatsLastCall(threadData);
     #if NACL_BUILD_SUBARCH == 64
       threadData->registerParameterNumber = 0;
       threadData->floatRegisterParameterNumber = 0;
@@ -948,6 +1238,15 @@ NaClSandbox_Thread* preFunctionCall(NaClSandbox* sandbox, size_t paramsSize, siz
 
 #endif
 
+//A sandbox that has faulted runs nothing more. Undo preFunctionCall and return 0, as a faulting call would
+static int refuseFunctionCallAfterFault(NaClSandbox_Thread* threadData)
+{
+  threadData->thread->register_eax = 0;
+  threadData->thread->register_xmm0 = 0;
+  SetStackPointerToSandboxedPointer(threadData->sandbox, threadData->thread->user, threadData->saved_stack_ptr_forFunctionCall);
+  return 0;
+}
+
 void invokeFunctionCall_helper(NaClSandbox_Thread* threadData, uintptr_t functionPtrInSandbox, jmp_buf* jmp_buf_loc)
 {
   if(!setjmp(*jmp_buf_loc))
@@ -963,31 +1262,65 @@ void invokeFunctionCall_helper(NaClSandbox_Thread* threadData, uintptr_t functio
 
 #if NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && NACL_BUILD_SUBARCH == 32
 
-void invokeFunctionCallWithSandboxPtr(NaClSandbox_Thread* threadData, uintptr_t functionPtrInSandbox)
+int invokeFunctionCallWithSandboxPtr(NaClSandbox_Thread* threadData, uintptr_t functionPtrInSandbox)
 {
   uintptr_t             saved_stack_ptr_forFunctionCall;
   jmp_buf*              jmp_buf_loc;
+  int                   hasBudget;
+  NACL_PERF_STATS_DECLARE_TIMER(start)
 
+  if(threadData->sandbox->nap->fault_signal != 0)
+  {
+    return refuseFunctionCallAfterFault(threadData);
+  }
+  prepareSandboxFaultStack();
+  //Time in the sandbox counts from here to the next syscall, see dyn_ldr_stats.h. The dyn_ldr/invoke timer starts
+  //from the same read of the time stamp counter
+  threadData->thread->untrusted_since = NaClPerfStatsTicks();
+  NACL_PERF_STATS_TIMER_START_FROM(start, threadData->thread->untrusted_since);
+  if(threadData->sandbox->profile != NULL)
+  {
+    profileSandboxInvokeBegin(threadData, functionPtrInSandbox);
+  }
   /*To resume execution with NaClStartThreadInApp, NaCl assumes that the app thread is in UNTRUSTED state*/
   NaClAppThreadSetSuspendState(threadData->thread, /* old state */ NACL_APP_THREAD_TRUSTED, /* new state */ NACL_APP_THREAD_UNTRUSTED);
   saved_stack_ptr_forFunctionCall = threadData->saved_stack_ptr_forFunctionCall;
   jmp_buf_loc = Stack_GetTopPtrForPush(threadData->thread->jumpBufferStack);
+  threadData->stats.calls++;
+  hasBudget = beginSandboxCpuBudget(threadData->sandbox);
   invokeFunctionCall_helper(threadData, functionPtrInSandbox, jmp_buf_loc);
+  endSandboxCpuBudget(hasBudget);
+  //A call from a callback may have been into another sandbox
+  setSandboxStatsLastCall(threadData);
   SetStackPointerToSandboxedPointer(threadData->sandbox, threadData->thread->user, saved_stack_ptr_forFunctionCall);
+  if(threadData->sandbox->profile != NULL)
+  {
+    profileSandboxInvokeEnd(threadData);
+  }
+  NACL_PERF_STATS_TIMER_RECORD("dyn_ldr/invoke", start);
+  return threadData->sandbox->nap->fault_signal == 0;
 }
 
-void invokeFunctionCall(NaClSandbox_Thread* threadData, void* functionPtr)
+int invokeFunctionCall(NaClSandbox_Thread* threadData, void* functionPtr)
 {
   uintptr_t functionPtrInSandbox = getSandboxedAddress(threadData->sandbox, (uintptr_t) functionPtr);
-  invokeFunctionCallWithSandboxPtr(threadData, functionPtrInSandbox);
+  return invokeFunctionCallWithSandboxPtr(threadData, functionPtrInSandbox);
 }
 
 #elif NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && NACL_BUILD_SUBARCH == 64
 
-void invokeFunctionCall(NaClSandbox_Thread* threadData, void* functionPtr)
+int invokeFunctionCall(NaClSandbox_Thread* threadData, void* functionPtr)
 {
   uintptr_t saved_stack_ptr_forFunctionCall;
   jmp_buf*              jmp_buf_loc;
+  int                   hasBudget;
+  NACL_PERF_STATS_DECLARE_TIMER(start)
+
+  if(threadData->sandbox->nap->fault_signal != 0)
+  {
+    return refuseFunctionCallAfterFault(threadData);
+  }
+  prepareSandboxFaultStack();
 
   #if NACL_LINUX
     //On 64 bit systems, we always have to set the currently used sandbox for the thread
@@ -999,21 +1332,40 @@ void invokeFunctionCall(NaClSandbox_Thread* threadData, void* functionPtr)
   #else
     #error "Unsupported Platform"
   #endif
+  //Time in the sandbox counts from here to the next syscall, see dyn_ldr_stats.h. The dyn_ldr/invoke timer starts
+  //from the same read of the time stamp counter
+  threadData->thread->untrusted_since = NaClPerfStatsTicks();
+  NACL_PERF_STATS_TIMER_START_FROM(start, threadData->thread->untrusted_since);
+  if(threadData->sandbox->profile != NULL)
+  {
+    profileSandboxInvokeBegin(threadData, getSandboxedAddress(threadData->sandbox, (uintptr_t) functionPtr));
+  }
   /*To resume execution with NaClStartThreadInApp, NaCl assumes that the app thread is in UNTRUSTED state*/
   NaClAppThreadSetSuspendState(threadData->thread, /* old state */ NACL_APP_THREAD_TRUSTED, /* new state */ NACL_APP_THREAD_UNTRUSTED);
   saved_stack_ptr_forFunctionCall = threadData->saved_stack_ptr_forFunctionCall;
   jmp_buf_loc = Stack_GetTopPtrForPush(threadData->thread->jumpBufferStack);
+  threadData->stats.calls++;
+  hasBudget = beginSandboxCpuBudget(threadData->sandbox);
   invokeFunctionCall_helper(threadData, (uintptr_t) functionPtr, jmp_buf_loc);
+  endSandboxCpuBudget(hasBudget);
+  //A call from a callback may have been into another sandbox
+  setSandboxStatsLastCall(threadData);
   SetStackPointerToSandboxedPointer(threadData->sandbox, threadData->thread->user, saved_stack_ptr_forFunctionCall);
   #if NACL_LINUX
     NaClTlsSetCurrentThreadUser(prevSandboxSavedInTls);
   #endif
+  if(threadData->sandbox->profile != NULL)
+  {
+    profileSandboxInvokeEnd(threadData);
+  }
+  NACL_PERF_STATS_TIMER_RECORD("dyn_ldr/invoke", start);
+  return threadData->sandbox->nap->fault_signal == 0;
 }
 
-void invokeFunctionCallWithSandboxPtr(NaClSandbox_Thread* threadData, uintptr_t functionPtr)
+int invokeFunctionCallWithSandboxPtr(NaClSandbox_Thread* threadData, uintptr_t functionPtr)
 {
   uintptr_t functionPtrInSandbox = getUnsandboxedAddress(threadData->sandbox, functionPtr);
-  invokeFunctionCall(threadData, (void*) functionPtrInSandbox);
+  return invokeFunctionCall(threadData, (void*) functionPtrInSandbox);
 }
 
 #else
@@ -1142,6 +1494,7 @@ int getFreeSandboxCallbackSlot(NaClSandbox* sandbox, unsigned* slot)
 NaClSandbox_Thread* callbackParamsBegin(NaClSandbox* sandbox)
 {
   NaClSandbox_Thread* threadData = getThreadData(sandbox);
+  setSandboxStatsLastCall(threadData);
   threadData->callbackParamsAlreadyRead = 0;
   #if defined(_M_X64) || defined(__x86_64__)
     threadData->callbackParameterNumber = 0;
@@ -1472,6 +1825,12 @@ void* mallocInSandbox(NaClSandbox* sandbox, size_t size)
     return NULL;
   }
 
+  if(ret != NULL)
+  {
+    threadData->stats.mallocs++;
+    threadData->stats.bytesAllocated += size;
+  }
+
   return ret;
 }
 
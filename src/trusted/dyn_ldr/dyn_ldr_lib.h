@@ -10,6 +10,16 @@
   extern "C" {
 #endif
 
+//Counters of one thread's use of a sandbox, only written by that thread. See dyn_ldr_stats.h
+struct _NaClSandboxThreadStats
+{
+	uint64_t calls;
+	uint64_t bytesCopiedIn;
+	uint64_t bytesCopiedOut;
+	uint64_t mallocs;
+	uint64_t bytesAllocated;
+};
+
 struct _NaClSandbox_Thread
 {
 	struct _NaClSandbox* sandbox;
@@ -18,6 +28,9 @@ struct _NaClSandbox_Thread
 	uintptr_t saved_stack_ptr_forFunctionCall;
 	uintptr_t stack_ptr_arrayLocation;
 	size_t callbackParamsAlreadyRead;
+	//This thread's calls while the sandbox is profiled, see dyn_ldr_profile.h
+	struct _NaClSandboxThreadProfile* profile;
+	struct _NaClSandboxThreadStats stats;
 	#if defined(_M_X64) || defined(__x86_64__)
 		//On 64 bit systems, different parameters go into different locations
 		//After param 6, we put it onto the stack, so we stop counting after this
@@ -44,6 +57,8 @@ typedef int   (*fclose_type) (FILE * stream);
 struct _NaClSandbox
 {
 	struct NaClApp* nap;
+	//nap->mem_start, kept here so that the inline address helpers below need not reach into the NaClApp
+	uintptr_t memoryBase;
 	struct _DS_Map* threadDataMap;
 	struct NaClMutex* threadCreateMutex;
 	int32_t callbackParameterStartOffset;
@@ -58,6 +73,10 @@ struct _NaClSandbox
 	fclose_type fclosePtr;
 
 	void* extraState;
+	//Non NULL while the sandbox is profiled, see dyn_ldr_profile.h
+	struct _NaClSandboxProfile* profile;
+	//CPU time each call may take, in watchdog ticks, 0 for no limit. See setSandboxCpuBudget in dyn_ldr_fault.h
+	uint32_t cpuBudgetTicks;
 };
 
 typedef struct _NaClSandbox NaClSandbox;
@@ -66,9 +85,36 @@ typedef struct _NaClSandbox_Thread NaClSandbox_Thread;
 int initializeDlSandboxCreator(int enableLogging);
 int closeSandboxCreator(void);
 NaClSandbox* createDlSandbox(const char* naclLibraryPath, const char* naclInitAppFullPath);
+//Like createDlSandbox, but mmap, mprotect and brk calls that would take the sandbox's writable memory above
+//memoryBudget bytes fail with ENOMEM. The address space itself keeps its full size. 0 means no budget.
+NaClSandbox* createDlSandboxWithBudget(const char* naclLibraryPath, const char* naclInitAppFullPath, size_t memoryBudget);
+//Like createDlSandboxWithBudget, but the sandbox memory is taken from NUMA node numaNode where it can be, see
+//dyn_ldr_numa.h. -1 leaves it to the host, so memory comes from the node of whichever thread touches it first.
+NaClSandbox* createDlSandboxOnNumaNode(const char* naclLibraryPath, const char* naclInitAppFullPath, size_t memoryBudget, int numaNode);
 void destroyDlSandbox(NaClSandbox* sandbox);
 
+//A snapshot holds the memory and state of a sandbox at the time it was taken, in a memfd. Each sandbox cloned
+//from it maps that memory copy-on-write, so clones share every page none of them has written, and making one
+//costs little more than reserving its address space. A clone gets its own NaClApp, memory map, descriptor
+//table with only stdin, stdout and stderr, and main thread, but no callbacks: register them again.
+//
+//Taking a snapshot copies the sandbox's memory once. It fails if the sandbox has faulted, has been called
+//from more than one thread, or has descriptors open beyond stdin, stdout and stderr. A snapshot can be
+//destroyed while its clones live on. Linux only; elsewhere snapshotDlSandbox returns NULL.
+typedef struct _NaClSandboxSnapshot NaClSandboxSnapshot;
+NaClSandboxSnapshot* snapshotDlSandbox(NaClSandbox* sandbox);
+NaClSandbox* cloneDlSandboxFromSnapshot(NaClSandboxSnapshot* snapshot);
+//A clone on another NUMA node than the sandbox the snapshot was taken of. -1 keeps that sandbox's node.
+NaClSandbox* cloneDlSandboxFromSnapshotOnNumaNode(NaClSandboxSnapshot* snapshot, int numaNode);
+void destroyDlSandboxSnapshot(NaClSandboxSnapshot* snapshot);
+//Takes a snapshot, clones it and destroys it. Take a snapshot once to make several clones.
+NaClSandbox* cloneDlSandbox(NaClSandbox* parent);
+
 unsigned long getSandboxMemoryBase(NaClSandbox* sandbox);
+//The NUMA node the sandbox memory is taken from, or -1 if it was not placed
+int getSandboxNumaNode(NaClSandbox* sandbox);
+//The signal that code in the sandbox faulted with, or 0 if it has not faulted
+int getSandboxFaultSignal(NaClSandbox* sandbox);
 
 void* mallocInSandbox(NaClSandbox* sandbox, size_t size);
 void  freeInSandbox  (NaClSandbox* sandbox, void* ptr);
@@ -79,8 +125,9 @@ FILE* fopenInSandbox(NaClSandbox* sandbox, const char * filename, const char * m
 int fcloseInSandbox(NaClSandbox* sandbox, FILE * stream);
 
 NaClSandbox_Thread* preFunctionCall(NaClSandbox* sandbox, size_t paramsSize, size_t arraysSize);
-void invokeFunctionCall(NaClSandbox_Thread* threadData, void* functionPtr);
-void invokeFunctionCallWithSandboxPtr(NaClSandbox_Thread* threadData, uintptr_t functionPtrInSandbox);
+//Return 0 if the sandbox faulted during the call, or had faulted before and so did not run it, see dyn_ldr_fault.h
+int invokeFunctionCall(NaClSandbox_Thread* threadData, void* functionPtr);
+int invokeFunctionCallWithSandboxPtr(NaClSandbox_Thread* threadData, uintptr_t functionPtrInSandbox);
 
 uintptr_t getUnsandboxedAddress(NaClSandbox* sandbox, uintptr_t uaddr);
 uintptr_t getSandboxedAddress(NaClSandbox* sandbox, uintptr_t uaddr);
@@ -88,6 +135,29 @@ uintptr_t getSandboxedAddress(NaClSandbox* sandbox, uintptr_t uaddr);
 int isAddressInSandboxMemoryOrNull(NaClSandbox* sandbox, uintptr_t uaddr);
 int isAddressInNonSandboxMemoryOrNull(NaClSandbox* sandbox, uintptr_t uaddr);
 
+//NACL_MAX_ADDR_BITS of the architecture (see sel_ldr_arch.h), which no sandbox is bigger than
+#if defined(_M_X64) || defined(__x86_64__)
+	#define SANDBOX_ADDR_BITS 32
+#else
+	#define SANDBOX_ADDR_BITS 30
+#endif
+
+//Inline versions of getUnsandboxedAddress and getSandboxedAddress for code that walks sandbox data structures.
+//NULL stays NULL without a branch, so loops using these can be vectorized. Unlike the versions above, they do
+//not abort on an address outside the sandbox: only the low SANDBOX_ADDR_BITS bits of a sandboxed address are
+//used, so the result is always within the address space reserved for the sandbox, though perhaps in a part of
+//it that is not mapped, and getSandboxedAddressInline of an address outside the sandbox gives an address that
+//is meaningless, but harmless, to the sandbox.
+static inline uintptr_t getUnsandboxedAddressInline(uintptr_t memoryBase, uintptr_t uaddr)
+{
+	uaddr &= ((uintptr_t) 1 << SANDBOX_ADDR_BITS) - 1;
+	return (memoryBase & -(uintptr_t)(uaddr != 0)) + uaddr;
+}
+static inline uintptr_t getSandboxedAddressInline(uintptr_t memoryBase, uintptr_t addr)
+{
+	return (addr - memoryBase) & -(uintptr_t)(addr != 0);
+}
+
 //Note that various GCCs on different architecture seem to want stack alignments - either 4, 8 or 16. So 16 should work generally
 #define STACKALIGNMENT 16
 #define ROUND_UP_TO_POW2(val, alignment) ((val + alignment - 1) & ~(alignment - 1))
@@ -172,12 +242,14 @@ do { \
 #define PUSH_SANDBOXEDPTR_TO_STACK(threadData, type, value) PUSH_VAL_TO_STACK(threadData, type, value)
 
 #define PUSH_PTR_TO_STACK(threadData, type, value) do {                               \
-  PUSH_VAL_TO_STACK(threadData, type, (getSandboxedAddress(threadData->sandbox, (uintptr_t) value))); \
+  PUSH_VAL_TO_STACK(threadData, type, (getSandboxedAddressInline(threadData->sandbox->memoryBase, (uintptr_t) value))); \
 } while (0)
 
 #define PUSH_GEN_ARRAY_TO_STACK(threadData, value, unpaddedSize) do { \
-  size_t paddedSize = ROUND_UP_TO_POW2(unpaddedSize, STACKALIGNMENT); \
-  memcpy((void *) threadData->stack_ptr_arrayLocation, (void *) value, unpaddedSize); \
+  size_t copiedSize = (unpaddedSize); \
+  size_t paddedSize = ROUND_UP_TO_POW2(copiedSize, STACKALIGNMENT); \
+  memcpy((void *) threadData->stack_ptr_arrayLocation, (void *) value, copiedSize); \
+  threadData->stats.bytesCopiedIn += copiedSize; \
   PUSH_PTR_TO_STACK(threadData, uintptr_t, (uintptr_t) threadData->stack_ptr_arrayLocation); \
   threadData->stack_ptr_arrayLocation = ADJUST_STACK_PTR(threadData->stack_ptr_arrayLocation, paddedSize); \
 } while(0)
@@ -201,10 +273,10 @@ uintptr_t getCallbackParam(NaClSandbox_Thread* threadData, size_t size, int isFl
 
 #define COMPLETELY_UNTRUSTED_CALLBACK_PTR_TO_STACK_PARAM(threadData, type) ((type *) getCallbackParam(threadData, sizeof(type), 0))
 #define COMPLETELY_UNTRUSTED_CALLBACK_STACK_PARAM(threadData, type) (* COMPLETELY_UNTRUSTED_CALLBACK_PTR_TO_STACK_PARAM(threadData, type))
-#define COMPLETELY_UNTRUSTED_CALLBACK_PTR_PARAM(threadData, type) ((type) getUnsandboxedAddress(threadData->sandbox, COMPLETELY_UNTRUSTED_CALLBACK_STACK_PARAM(threadData, uintptr_t)))
+#define COMPLETELY_UNTRUSTED_CALLBACK_PTR_PARAM(threadData, type) ((type) getUnsandboxedAddressInline(threadData->sandbox->memoryBase, COMPLETELY_UNTRUSTED_CALLBACK_STACK_PARAM(threadData, uintptr_t)))
 #define COMPLETELY_UNTRUSTED_CALLBACK_PTR_TO_STACK_FLOATPARAM(threadData, type) ((type *) getCallbackParam(threadData, sizeof(type), 1))
 #define COMPLETELY_UNTRUSTED_CALLBACK_STACK_FLOATPARAM(threadData, type) (* COMPLETELY_UNTRUSTED_CALLBACK_PTR_TO_STACK_FLOATPARAM(threadData, type))
-#define CALLBACK_RETURN_PTR(threadData, type, value) ((type) getSandboxedAddress(threadData->sandbox, value))
+#define CALLBACK_RETURN_PTR(threadData, type, value) ((type) getSandboxedAddressInline(threadData->sandbox->memoryBase, (uintptr_t) (value)))
 
 long functionCallReturnRawPrimitiveInt(NaClSandbox_Thread* threadData);
 float functionCallReturnFloat(NaClSandbox_Thread* threadData);
@@ -0,0 +1,226 @@
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_memory.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
+#include "native_client/src/trusted/service_runtime/include/bits/mman.h"
+#include "native_client/src/trusted/service_runtime/nacl_app_thread.h"
+#include "native_client/src/trusted/service_runtime/nacl_config.h"
+#include "native_client/src/trusted/service_runtime/sel_ldr.h"
+#include "native_client/src/trusted/service_runtime/sel_mem.h"
+
+//Pages passed to each mincore call
+#define MINCORE_BATCH_PAGES 256
+//Free ranges asked of the sandbox the first time; if it has more, it is asked again with room for all of them
+#define TRIM_INITIAL_RANGES 1024
+
+struct MemoryStatsState
+{
+  NaClSandbox* sandbox;
+  struct SandboxMemoryStats* stats;
+  int failed;
+};
+
+static void countEntryMemory(void* state, struct NaClVmmapEntry* entry)
+{
+  struct MemoryStatsState* statsState = (struct MemoryStatsState*) state;
+  struct SandboxMemoryStats* stats = statsState->stats;
+  unsigned char residency[MINCORE_BATCH_PAGES];
+  size_t entryBytes = entry->npages << NACL_PAGESHIFT;
+  uintptr_t start = statsState->sandbox->memoryBase + (entry->page_num << NACL_PAGESHIFT);
+
+  stats->mappedBytes += entryBytes;
+  if((entry->prot & (NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE | NACL_ABI_PROT_EXEC)) == 0)
+  {
+    return;
+  }
+  stats->committedBytes += entryBytes;
+
+  for(size_t done = 0; done < entry->npages; done += MINCORE_BATCH_PAGES)
+  {
+    size_t pages = entry->npages - done < MINCORE_BATCH_PAGES? entry->npages - done : MINCORE_BATCH_PAGES;
+
+    if(mincore((void*) (start + (done << NACL_PAGESHIFT)), pages << NACL_PAGESHIFT, residency) != 0)
+    {
+      statsState->failed = 1;
+      return;
+    }
+    for(size_t i = 0; i < pages; i++)
+    {
+      if(residency[i] & 1)
+      {
+        stats->residentBytes += NACL_PAGESIZE;
+      }
+    }
+  }
+}
+
+int getSandboxMemoryStats(NaClSandbox* sandbox, struct SandboxMemoryStats* stats)
+{
+  struct NaClApp* nap = sandbox->nap;
+  struct MemoryStatsState statsState;
+
+  memset(stats, 0, sizeof(*stats));
+  statsState.sandbox = sandbox;
+  statsState.stats = stats;
+  statsState.failed = 0;
+
+  NaClXMutexLock(&nap->mu);
+  NaClVmmapVisit(&nap->mem_map, countEntryMemory, &statsState);
+  NaClXMutexUnlock(&nap->mu);
+
+  if(statsState.failed)
+  {
+    printf("NaCl Error getSandboxMemoryStats - mincore failed\n");
+    return 0;
+  }
+  return 1;
+}
+
+//Returns the number of free ranges the sandbox's heap has, of which the first maxRanges are copied to ranges,
+//or -1 if the call failed
+static int64_t findFreeHeapPages(NaClSandbox* sandbox, void* mallocTrimPtr, uint32_t* ranges, uint32_t maxRanges)
+{
+  uint32_t* rangesInSandbox = (uint32_t*) mallocInSandbox(sandbox, 2 * sizeof(uint32_t) * maxRanges);
+  NaClSandbox_Thread* threadData;
+  uint32_t count;
+
+  if(rangesInSandbox == NULL)
+  {
+    return -1;
+  }
+
+  threadData = preFunctionCall(sandbox, sizeof(size_t) + sizeof(rangesInSandbox) + sizeof(maxRanges), 0);
+  PUSH_VAL_TO_STACK(threadData, size_t, 0);
+  PUSH_PTR_TO_STACK(threadData, uint32_t*, rangesInSandbox);
+  PUSH_VAL_TO_STACK(threadData, uint32_t, maxRanges);
+
+  if(!invokeFunctionCall(threadData, mallocTrimPtr))
+  {
+    //The sandbox faulted, and can no longer be called to free the buffer
+    return -1;
+  }
+  count = (uint32_t) functionCallReturnRawPrimitiveInt(threadData);
+
+  //Copied out, as the sandbox could change the ranges while we discard them
+  memcpy(ranges, rangesInSandbox, 2 * sizeof(uint32_t) * (count < maxRanges? count : maxRanges));
+  freeInSandbox(sandbox, rangesInSandbox);
+  return count;
+}
+
+//Discards the pages in [start, end) that are private anonymous writable memory of the sandbox. Caller must
+//hold nap->mu
+static size_t discardFreePages_mu(NaClSandbox* sandbox, uint32_t start, uint32_t end)
+{
+  struct NaClApp* nap = sandbox->nap;
+  uintptr_t pageNum = start >> NACL_PAGESHIFT;
+  uintptr_t endPageNum = end >> NACL_PAGESHIFT;
+  size_t discarded = 0;
+
+  while(pageNum < endPageNum)
+  {
+    struct NaClVmmapEntry const* entry = NaClVmmapFindPage(&nap->mem_map, pageNum);
+    uintptr_t entryEnd;
+    uintptr_t discardEnd;
+
+    if(entry == NULL)
+    {
+      pageNum++;
+      continue;
+    }
+
+    entryEnd = entry->page_num + entry->npages;
+    discardEnd = entryEnd < endPageNum? entryEnd : endPageNum;
+
+    if(entry->desc == NULL &&
+      (entry->flags & NACL_ABI_MAP_SHARED) == 0 &&
+      (entry->prot & NACL_ABI_PROT_WRITE) != 0 &&
+      (entry->prot & NACL_ABI_PROT_EXEC) == 0)
+    {
+      size_t length = (discardEnd - pageNum) << NACL_PAGESHIFT;
+
+      if(madvise((void*) (sandbox->memoryBase + (pageNum << NACL_PAGESHIFT)), length, MADV_DONTNEED) == 0)
+      {
+        discarded += length;
+      }
+    }
+    pageNum = discardEnd;
+  }
+
+  return discarded;
+}
+
+int trimSandboxMemory(NaClSandbox* sandbox, size_t* trimmedBytes)
+{
+  struct NaClApp* nap = sandbox->nap;
+  void* mallocTrimPtr = symbolTableLookupInSandbox(sandbox, "malloc_trim_wrapped");
+  uint32_t maxRanges = TRIM_INITIAL_RANGES;
+  uint32_t* ranges = NULL;
+  int64_t count;
+  size_t discarded = 0;
+
+  if(trimmedBytes)
+  {
+    *trimmedBytes = 0;
+  }
+
+  if(mallocTrimPtr == NULL)
+  {
+    printf("NaCl Error trimSandboxMemory - Sandbox has no malloc_trim_wrapped, it must be linked with dyn_ldr_sandbox_init\n");
+    return 0;
+  }
+
+  for(int attempt = 0; attempt < 2; attempt++)
+  {
+    free(ranges);
+    ranges = (uint32_t*) malloc(2 * sizeof(uint32_t) * maxRanges);
+    if(ranges == NULL)
+    {
+      printf("NaCl Error trimSandboxMemory - out of memory\n");
+      return 0;
+    }
+
+    count = findFreeHeapPages(sandbox, mallocTrimPtr, ranges, maxRanges);
+    if(count < 0)
+    {
+      printf("NaCl Error trimSandboxMemory - malloc_trim_wrapped failed\n");
+      free(ranges);
+      return 0;
+    }
+    if(count <= maxRanges)
+    {
+      break;
+    }
+    //The buffer for the second call may take up one more range
+    maxRanges = (uint32_t) count + 1;
+  }
+
+  if(count > maxRanges)
+  {
+    count = maxRanges;
+  }
+
+  NaClXMutexLock(&nap->mu);
+  for(int64_t i = 0; i < count; i++)
+  {
+    uint32_t start = ranges[2 * i];
+    uint32_t end = ranges[2 * i + 1];
+
+    if((start & (NACL_PAGESIZE - 1)) == 0 && (end & (NACL_PAGESIZE - 1)) == 0 && start < end)
+    {
+      discarded += discardFreePages_mu(sandbox, start, end);
+    }
+  }
+  NaClXMutexUnlock(&nap->mu);
+
+  free(ranges);
+  if(trimmedBytes)
+  {
+    *trimmedBytes = discarded;
+  }
+  return 1;
+}
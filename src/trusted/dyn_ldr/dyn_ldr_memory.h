@@ -0,0 +1,39 @@
+#ifndef NACL_DYN_LDR_MEMORY
+#define NACL_DYN_LDR_MEMORY
+
+#include <stddef.h>
+
+#include "dyn_ldr_lib.h"
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+struct SandboxMemoryStats
+{
+	//Bytes of the sandbox's address space that are mapped, including inaccessible guard pages
+	size_t mappedBytes;
+	//Mapped bytes the sandbox can read, write or execute
+	size_t committedBytes;
+	//Committed bytes in RAM, as reported by mincore
+	size_t residentBytes;
+};
+
+//Walks the sandbox's memory map, so it costs a system call per 1MB of committed memory. Returns 0 on failure
+int getSandboxMemoryStats(NaClSandbox* sandbox, struct SandboxMemoryStats* stats);
+
+//Gives memory the sandbox's heap does not use back to the system, without destroying the sandbox. The heap
+//frees what it can with malloc_trim, and the whole pages of the free chunks it keeps are discarded with
+//madvise(MADV_DONTNEED), so they read as zeros and take no RAM until written again. Only private anonymous
+//writable memory is discarded, whatever the sandbox reports. trimmedBytes, if not NULL, is set to the bytes
+//discarded, which may include pages that were not resident.
+//
+//Runs code in the sandbox, and must be called while no other thread is calling into it. Returns 0 on failure,
+//or if the library was built without malloc_trim_wrapped in dyn_ldr_sandbox_init.c
+int trimSandboxMemory(NaClSandbox* sandbox, size_t* trimmedBytes);
+
+#ifdef __cplusplus
+  }
+#endif
+
+#endif
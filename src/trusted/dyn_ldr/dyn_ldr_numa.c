@@ -0,0 +1,120 @@
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_numa.h"
+
+#include "native_client/src/include/build_config.h"
+
+#if NACL_LINUX
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//Reads a list of ranges such as "0-7,16-23" from a sysfs file, calling onNumber for each number in it.
+//Returns the highest number, or -1 if the file cannot be read
+static int readSysfsList(const char* path, void (*onNumber)(int number, void* state), void* state)
+{
+  FILE* file = fopen(path, "r");
+  int highest = -1;
+  int first;
+  int last;
+  int separator;
+
+  if(file == NULL)
+  {
+    return -1;
+  }
+
+  while(fscanf(file, "%d", &first) == 1)
+  {
+    last = first;
+    separator = fgetc(file);
+    if(separator == '-')
+    {
+      if(fscanf(file, "%d", &last) != 1)
+      {
+        break;
+      }
+      separator = fgetc(file);
+    }
+    for(int number = first; number <= last; number++)
+    {
+      if(onNumber != NULL)
+      {
+        onNumber(number, state);
+      }
+    }
+    if(last > highest)
+    {
+      highest = last;
+    }
+    if(separator != ',')
+    {
+      break;
+    }
+  }
+
+  fclose(file);
+  return highest;
+}
+
+int getNumaNodeCount(void)
+{
+  int highest = readSysfsList("/sys/devices/system/node/online", NULL, NULL);
+  return highest < 0? 1 : highest + 1;
+}
+
+int getCurrentNumaNode(void)
+{
+  unsigned cpu;
+  unsigned node;
+
+  if(syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+  {
+    return -1;
+  }
+  return (int) node;
+}
+
+static void addCpu(int cpu, void* state)
+{
+  if(cpu < CPU_SETSIZE)
+  {
+    CPU_SET(cpu, (cpu_set_t*) state);
+  }
+}
+
+int pinThreadToNumaNode(int node)
+{
+  char path[64];
+  cpu_set_t cpus;
+
+  CPU_ZERO(&cpus);
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  if(node < 0 || readSysfsList(path, addCpu, &cpus) < 0 || CPU_COUNT(&cpus) == 0)
+  {
+    printf("NaCl Error pinThreadToNumaNode - Could not find the CPUs of node %d\n", node);
+    return 0;
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+}
+
+#else
+
+int getNumaNodeCount(void)
+{
+  return 1;
+}
+
+int getCurrentNumaNode(void)
+{
+  return -1;
+}
+
+int pinThreadToNumaNode(int node)
+{
+  return 0;
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef NACL_DYN_LDR_NUMA
+#define NACL_DYN_LDR_NUMA
+
+#include "dyn_ldr_lib.h"
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+//A sandbox made with createDlSandboxOnNumaNode takes its memory from that node, wherever the threads that touch
+//it first run. Calls into it are fastest from threads on the same node, so pools and schedulers that spread
+//sandboxes over nodes should route each call to a thread on the sandbox's node, or pin their threads with
+//pinThreadToNumaNode. These are Linux only; elsewhere there is one node, and pinning fails.
+
+//The number of nodes the host has, counting from node 0
+int getNumaNodeCount(void);
+//The node the calling thread is running on now, or -1 if it cannot be told
+int getCurrentNumaNode(void);
+//Lets the calling thread only run on the CPUs of node. Returns 0 on failure
+int pinThreadToNumaNode(int node);
+
+#ifdef __cplusplus
+  }
+#endif
+
+#endif
@@ -0,0 +1,509 @@
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_profile.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/include/nacl_compiler_annotations.h"
+#include "native_client/src/trusted/dyn_ldr/datastructures/ds_map.h"
+#include "native_client/src/trusted/perf_counter/nacl_perf_stats.h"
+#include "native_client/src/trusted/service_runtime/elf_symboltable_mapping.h"
+#include "native_client/src/trusted/service_runtime/nacl_app_thread.h"
+#include "native_client/src/trusted/service_runtime/sel_ldr.h"
+
+//Calls nested deeper than this are counted in the frame at this depth, not as calls of their own
+#define PROFILE_MAX_DEPTH 128
+#define PROFILE_INITIAL_NODES 64
+
+enum ProfileNodeKind
+{
+  PROFILE_NODE_ROOT = 0,
+  PROFILE_NODE_INVOKE = 1,
+  PROFILE_NODE_CALLBACK = 2
+};
+
+//A node per distinct chain of calls and callbacks. Nodes refer to each other by index, as the array grows
+struct ProfileNode
+{
+  uint32_t parent;
+  uint32_t firstChild;
+  uint32_t nextSibling;
+  uint32_t kind;
+  //Untrusted address of the function for calls, slot number for callbacks
+  uintptr_t key;
+  uint64_t calls;
+  //Total ticks, including the children
+  uint64_t ticks;
+  uint64_t childTicks;
+  uint64_t bytesCopied;
+};
+
+struct _NaClSandboxThreadProfile
+{
+  struct ProfileNode* nodes;
+  uint32_t nodeCount;
+  uint32_t nodeCapacity;
+  uint32_t current;
+  unsigned depth;
+  uint64_t startTicks[PROFILE_MAX_DEPTH];
+};
+
+struct _NaClSandboxProfile
+{
+  uint64_t startTicks;
+};
+
+//Bytes copied in for the next call this thread makes
+static THREAD size_t pendingCopiedBytes = 0;
+
+static struct _NaClSandboxThreadProfile* createThreadProfile(void)
+{
+  struct _NaClSandboxThreadProfile* profile;
+
+  profile = (struct _NaClSandboxThreadProfile*) calloc(1, sizeof(*profile));
+  if (profile == NULL)
+  {
+    return NULL;
+  }
+  profile->nodes = (struct ProfileNode*) calloc(PROFILE_INITIAL_NODES, sizeof(struct ProfileNode));
+  if (profile->nodes == NULL)
+  {
+    free(profile);
+    return NULL;
+  }
+  profile->nodeCapacity = PROFILE_INITIAL_NODES;
+  //Node 0 is the root, which is where a thread is when it is not in the sandbox
+  profile->nodes[0].kind = PROFILE_NODE_ROOT;
+  profile->nodeCount = 1;
+  profile->current = 0;
+  return profile;
+}
+
+static void freeThreadProfile(struct _NaClSandboxThreadProfile* profile)
+{
+  if (profile != NULL)
+  {
+    free(profile->nodes);
+    free(profile);
+  }
+}
+
+//Returns the child of the current node for this call or callback, adding it if it is new. Returns
+//UINT32_MAX if there is no memory for it
+static uint32_t enterChild(struct _NaClSandboxThreadProfile* profile, uint32_t kind, uintptr_t key)
+{
+  struct ProfileNode* node;
+  uint32_t child;
+
+  for (child = profile->nodes[profile->current].firstChild; child != 0; child = profile->nodes[child].nextSibling)
+  {
+    if (profile->nodes[child].key == key && profile->nodes[child].kind == kind)
+    {
+      return child;
+    }
+  }
+
+  if (profile->nodeCount == profile->nodeCapacity)
+  {
+    struct ProfileNode* grown = (struct ProfileNode*) realloc(profile->nodes, 2 * profile->nodeCapacity * sizeof(struct ProfileNode));
+    if (grown == NULL)
+    {
+      return UINT32_MAX;
+    }
+    profile->nodes = grown;
+    profile->nodeCapacity *= 2;
+  }
+
+  child = profile->nodeCount++;
+  node = &profile->nodes[child];
+  memset(node, 0, sizeof(*node));
+  node->parent = profile->current;
+  node->kind = kind;
+  node->key = key;
+  node->nextSibling = profile->nodes[profile->current].firstChild;
+  profile->nodes[profile->current].firstChild = child;
+  return child;
+}
+
+static void frameBegin(struct _NaClSandboxThreadProfile* profile, uint32_t kind, uintptr_t key)
+{
+  uint32_t child;
+
+  if (profile->depth < PROFILE_MAX_DEPTH)
+  {
+    if ((child = enterChild(profile, kind, key)) != UINT32_MAX)
+    {
+      profile->nodes[child].calls++;
+      profile->current = child;
+      profile->startTicks[profile->depth] = NaClPerfStatsTicks();
+    }
+    else
+    {
+      //Not tracked, so frameEnd leaves the current node alone
+      profile->startTicks[profile->depth] = 0;
+    }
+  }
+  profile->depth++;
+}
+
+static void frameEnd(struct _NaClSandboxThreadProfile* profile)
+{
+  uint64_t start;
+  uint64_t elapsed;
+  struct ProfileNode* node;
+
+  if (profile->depth == 0)
+  {
+    return;
+  }
+  profile->depth--;
+  if (profile->depth >= PROFILE_MAX_DEPTH || (start = profile->startTicks[profile->depth]) == 0)
+  {
+    return;
+  }
+  elapsed = NaClPerfStatsTicks() - start;
+  node = &profile->nodes[profile->current];
+  node->ticks += elapsed;
+  profile->current = node->parent;
+  profile->nodes[profile->current].childTicks += elapsed;
+}
+
+static struct _NaClSandboxThreadProfile* getThreadProfile(NaClSandbox_Thread* threadData)
+{
+  if (threadData->profile == NULL)
+  {
+    threadData->profile = createThreadProfile();
+  }
+  return threadData->profile;
+}
+
+void profileSandboxCopiedBytes(size_t bytes)
+{
+  pendingCopiedBytes += bytes;
+}
+
+void profileSandboxInvokeBegin(NaClSandbox_Thread* threadData, uintptr_t functionPtrInSandbox)
+{
+  struct _NaClSandboxThreadProfile* profile = getThreadProfile(threadData);
+
+  if (profile == NULL)
+  {
+    return;
+  }
+  frameBegin(profile, PROFILE_NODE_INVOKE, functionPtrInSandbox);
+  profile->nodes[profile->current].bytesCopied += pendingCopiedBytes;
+  pendingCopiedBytes = 0;
+}
+
+void profileSandboxInvokeEnd(NaClSandbox_Thread* threadData)
+{
+  if (threadData->profile != NULL)
+  {
+    frameEnd(threadData->profile);
+  }
+}
+
+//Installed as the NaClApp's callback_hook while the sandbox is profiled
+static void profileCallbackHook(struct NaClAppThread* natp, uint32_t callbackSlotNumber, int returning)
+{
+  NaClSandbox_Thread* threadData = (NaClSandbox_Thread*) natp->custom_app_state;
+  struct _NaClSandboxThreadProfile* profile;
+
+  if (threadData == NULL || (profile = getThreadProfile(threadData)) == NULL)
+  {
+    return;
+  }
+  if (returning)
+  {
+    frameEnd(profile);
+  }
+  else
+  {
+    frameBegin(profile, PROFILE_NODE_CALLBACK, callbackSlotNumber);
+  }
+}
+
+int startSandboxProfile(NaClSandbox* sandbox)
+{
+  if (sandbox->profile != NULL)
+  {
+    return 1;
+  }
+  sandbox->profile = (struct _NaClSandboxProfile*) calloc(1, sizeof(struct _NaClSandboxProfile));
+  if (sandbox->profile == NULL)
+  {
+    printf("NaCl Error startSandboxProfile - out of memory\n");
+    return 0;
+  }
+  //Measured now rather than in the middle of a call
+  (void) NaClPerfStatsTicksPerSecond();
+  sandbox->profile->startTicks = NaClPerfStatsTicks();
+  sandbox->nap->callback_hook = profileCallbackHook;
+  return 1;
+}
+
+void stopSandboxProfile(NaClSandbox* sandbox)
+{
+  unsigned mapSize = Map_GetSize(sandbox->threadDataMap);
+
+  sandbox->nap->callback_hook = NULL;
+  for (unsigned i = 0; i < mapSize; i++)
+  {
+    NaClSandbox_Thread* threadData = (NaClSandbox_Thread*) sandbox->threadDataMap->values[i];
+    freeThreadProfile(threadData->profile);
+    threadData->profile = NULL;
+  }
+  free(sandbox->profile);
+  sandbox->profile = NULL;
+}
+
+/********************** Reports *****************************/
+
+struct ProfileSymbol
+{
+  uintptr_t address;
+  const char* name;
+};
+
+static int compareSymbols(const void* a, const void* b)
+{
+  uintptr_t addressA = ((const struct ProfileSymbol*) a)->address;
+  uintptr_t addressB = ((const struct ProfileSymbol*) b)->address;
+  return addressA < addressB ? -1 : addressA > addressB;
+}
+
+//The app's symbols sorted by address. Returns the number of entries in *symbols
+static size_t loadSymbols(NaClSandbox* sandbox, struct ProfileSymbol** symbols)
+{
+  struct SymbolTableMapping* mapping = sandbox->nap->symbolTableMapping;
+  size_t count = 0;
+
+  *symbols = NULL;
+  if (mapping == NULL || mapping->symbolCount == 0)
+  {
+    return 0;
+  }
+  *symbols = (struct ProfileSymbol*) malloc(mapping->symbolCount * sizeof(struct ProfileSymbol));
+  if (*symbols == NULL)
+  {
+    return 0;
+  }
+  for (uint32_t i = 0; i < mapping->symbolCount; i++)
+  {
+    if (mapping->symbolMap[i].address != 0 && mapping->symbolMap[i].name != NULL)
+    {
+      (*symbols)[count].address = (uintptr_t) mapping->symbolMap[i].address;
+      (*symbols)[count].name = mapping->symbolMap[i].name;
+      count++;
+    }
+  }
+  qsort(*symbols, count, sizeof(struct ProfileSymbol), compareSymbols);
+  return count;
+}
+
+//Names a call by the symbol at or just below its address
+static void nodeName(const struct ProfileNode* node, const struct ProfileSymbol* symbols, size_t symbolCount,
+  char* name, size_t nameLen)
+{
+  size_t low = 0;
+  size_t high = symbolCount;
+
+  if (node->kind == PROFILE_NODE_CALLBACK)
+  {
+    snprintf(name, nameLen, "[callback %u]", (unsigned) node->key);
+    return;
+  }
+
+  while (low < high)
+  {
+    size_t mid = low + (high - low) / 2;
+    if (symbols[mid].address <= node->key)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+
+  if (low == 0)
+  {
+    snprintf(name, nameLen, "0x%" PRIxPTR, node->key);
+  }
+  else if (symbols[low - 1].address == node->key)
+  {
+    snprintf(name, nameLen, "%s", symbols[low - 1].name);
+  }
+  else
+  {
+    snprintf(name, nameLen, "%s+0x%" PRIxPTR, symbols[low - 1].name, node->key - symbols[low - 1].address);
+  }
+}
+
+static uint64_t ticksToNs(uint64_t ticks)
+{
+  return (uint64_t) ((double) ticks * 1e9 / NaClPerfStatsTicksPerSecond());
+}
+
+struct ProfileReportEntry
+{
+  uint32_t kind;
+  uintptr_t key;
+  uint64_t calls;
+  uint64_t ownTicks;
+  uint64_t childTicks;
+  uint64_t bytesCopied;
+};
+
+static int compareReportEntries(const void* a, const void* b)
+{
+  uint64_t ticksA = ((const struct ProfileReportEntry*) a)->ownTicks;
+  uint64_t ticksB = ((const struct ProfileReportEntry*) b)->ownTicks;
+  return ticksA > ticksB ? -1 : ticksA < ticksB;
+}
+
+int writeSandboxProfileReport(NaClSandbox* sandbox, FILE* out)
+{
+  unsigned mapSize = Map_GetSize(sandbox->threadDataMap);
+  struct ProfileReportEntry* entries = NULL;
+  size_t entryCount = 0;
+  size_t entryCapacity = 0;
+  struct ProfileSymbol* symbols = NULL;
+  size_t symbolCount;
+  struct ProfileReportEntry total;
+  char name[256];
+
+  if (sandbox->profile == NULL)
+  {
+    return 0;
+  }
+
+  //Calls of the same function, or callbacks through the same slot, are added up whatever led to them
+  memset(&total, 0, sizeof(total));
+  for (unsigned i = 0; i < mapSize; i++)
+  {
+    struct _NaClSandboxThreadProfile* profile = ((NaClSandbox_Thread*) sandbox->threadDataMap->values[i])->profile;
+    if (profile == NULL)
+    {
+      continue;
+    }
+    for (uint32_t n = 1; n < profile->nodeCount; n++)
+    {
+      struct ProfileNode* node = &profile->nodes[n];
+      size_t e;
+      for (e = 0; e < entryCount; e++)
+      {
+        if (entries[e].key == node->key && entries[e].kind == node->kind)
+        {
+          break;
+        }
+      }
+      if (e == entryCount)
+      {
+        if (entryCount == entryCapacity)
+        {
+          size_t newCapacity = entryCapacity ? 2 * entryCapacity : 64;
+          struct ProfileReportEntry* grown = (struct ProfileReportEntry*) realloc(entries, newCapacity * sizeof(*entries));
+          if (grown == NULL)
+          {
+            free(entries);
+            return 0;
+          }
+          entries = grown;
+          entryCapacity = newCapacity;
+        }
+        memset(&entries[e], 0, sizeof(entries[e]));
+        entries[e].kind = node->kind;
+        entries[e].key = node->key;
+        entryCount++;
+      }
+      entries[e].calls += node->calls;
+      entries[e].ownTicks += node->ticks - node->childTicks;
+      entries[e].childTicks += node->childTicks;
+      entries[e].bytesCopied += node->bytesCopied;
+      if (node->kind == PROFILE_NODE_INVOKE)
+      {
+        total.calls += node->calls;
+        total.ownTicks += node->ticks - node->childTicks;
+        total.bytesCopied += node->bytesCopied;
+      }
+      else
+      {
+        total.childTicks += node->ticks - node->childTicks;
+      }
+    }
+  }
+  qsort(entries, entryCount, sizeof(*entries), compareReportEntries);
+  symbolCount = loadSymbols(sandbox, &symbols);
+
+  fprintf(out, "Sandbox profile over %.3f s: %" PRIu64 " calls, %.3f ms in the sandbox, %.3f ms in callbacks, %" PRIu64 " bytes copied\n",
+    ticksToNs(NaClPerfStatsTicks() - sandbox->profile->startTicks) / 1e9, total.calls,
+    ticksToNs(total.ownTicks) / 1e6, ticksToNs(total.childTicks) / 1e6, total.bytesCopied);
+  fprintf(out, "%12s %12s %12s %12s %14s  %s\n", "calls", "own ms", "nested ms", "ns/call", "bytes copied", "function");
+  for (size_t e = 0; e < entryCount; e++)
+  {
+    struct ProfileNode node;
+    node.kind = entries[e].kind;
+    node.key = entries[e].key;
+    nodeName(&node, symbols, symbolCount, name, sizeof(name));
+    //For calls, own time is spent in the sandbox and nested time in callbacks. For callbacks it is the other way round
+    fprintf(out, "%12" PRIu64 " %12.3f %12.3f %12" PRIu64 " %14" PRIu64 "  %s\n",
+      entries[e].calls, ticksToNs(entries[e].ownTicks) / 1e6, ticksToNs(entries[e].childTicks) / 1e6,
+      entries[e].calls ? ticksToNs(entries[e].ownTicks + entries[e].childTicks) / entries[e].calls : 0,
+      entries[e].bytesCopied, name);
+  }
+
+  free(symbols);
+  free(entries);
+  return 1;
+}
+
+int writeSandboxProfileCollapsedStacks(NaClSandbox* sandbox, FILE* out)
+{
+  unsigned mapSize = Map_GetSize(sandbox->threadDataMap);
+  struct ProfileSymbol* symbols = NULL;
+  size_t symbolCount;
+  uint32_t path[PROFILE_MAX_DEPTH];
+  char name[256];
+
+  if (sandbox->profile == NULL)
+  {
+    return 0;
+  }
+  symbolCount = loadSymbols(sandbox, &symbols);
+
+  //flamegraph.pl adds up lines with the same stack, so threads are written out one after another
+  for (unsigned i = 0; i < mapSize; i++)
+  {
+    struct _NaClSandboxThreadProfile* profile = ((NaClSandbox_Thread*) sandbox->threadDataMap->values[i])->profile;
+    if (profile == NULL)
+    {
+      continue;
+    }
+    for (uint32_t n = 1; n < profile->nodeCount; n++)
+    {
+      struct ProfileNode* node = &profile->nodes[n];
+      uint64_t ownNs = ticksToNs(node->ticks - node->childTicks);
+      unsigned depth = 0;
+      if (ownNs == 0)
+      {
+        continue;
+      }
+      for (uint32_t p = n; p != 0 && depth < PROFILE_MAX_DEPTH; p = profile->nodes[p].parent)
+      {
+        path[depth++] = p;
+      }
+      while (depth > 0)
+      {
+        depth--;
+        nodeName(&profile->nodes[path[depth]], symbols, symbolCount, name, sizeof(name));
+        fprintf(out, "%s%c", name, depth > 0 ? ';' : ' ');
+      }
+      fprintf(out, "%" PRIu64 "\n", ownNs);
+    }
+  }
+
+  free(symbols);
+  return 1;
+}
@@ -0,0 +1,45 @@
+#ifndef NACL_DYN_LDR_PROFILE
+#define NACL_DYN_LDR_PROFILE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "dyn_ldr_lib.h"
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+//The sandbox call profiler records, for every function invoked in a sandbox, how often it was called,
+//how long it ran inside the sandbox, how long it spent in callbacks out of the sandbox and how many bytes
+//were copied in for it with sandbox_stackarr and sandbox_heaparr. Time is attributed along the chain of
+//calls and callbacks that led to each call, so nested calls made from a callback show up under it.
+//
+//Each thread records into its own tree of calls, so recording takes no locks. Profiling must be started
+//and stopped, and reports written, while no thread is calling into the sandbox.
+//
+//If the environment variable NACL_DYN_LDR_PROFILE is set when initializeDlSandboxCreator runs, every
+//sandbox is profiled from the end of createDlSandbox, and destroyDlSandbox writes its report to
+//<NACL_DYN_LDR_PROFILE>.<pid>.<n>.txt and its collapsed stacks to <NACL_DYN_LDR_PROFILE>.<pid>.<n>.folded
+
+int startSandboxProfile(NaClSandbox* sandbox);
+void stopSandboxProfile(NaClSandbox* sandbox);
+
+//A table of the functions called in the sandbox, most time spent in the sandbox first
+int writeSandboxProfileReport(NaClSandbox* sandbox, FILE* out);
+//One line per chain of calls, "outer;inner <nanoseconds>", which flamegraph.pl reads as is
+int writeSandboxProfileCollapsedStacks(NaClSandbox* sandbox, FILE* out);
+
+//Called by the C++ API when it copies arguments into the sandbox. The bytes are charged to the next call
+//this thread makes into the sandbox
+void profileSandboxCopiedBytes(size_t bytes);
+
+void profileSandboxInvokeBegin(NaClSandbox_Thread* threadData, uintptr_t functionPtrInSandbox);
+void profileSandboxInvokeEnd(NaClSandbox_Thread* threadData);
+
+#ifdef __cplusplus
+  }
+#endif
+
+#endif
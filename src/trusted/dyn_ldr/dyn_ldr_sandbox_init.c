@@ -7,6 +7,47 @@
 #include "native_client/src/trusted/service_runtime/sel_rt.h"
 #include "native_client/src/trusted/dyn_ldr/dyn_ldr_test_structs.h"
 
+//The library frees memory the application got from malloc_wrapped and vice
+//versa, so rather than backing malloc_wrapped alone, the thread caching
+//allocator replaces malloc for everything in the sandbox. These are the
+//settings libnacl uses for dlmalloc.
+//
+//Every host thread that calls into the sandbox gets a NaClAppThread with the
+//TLS values of the first one (see getThreadData in dyn_ldr_lib.c), so they
+//would all share one thread cache, whose lists take no lock. The thread
+//caches are turned off, and every call takes dlmalloc's lock: this is the
+//same locked dlmalloc libnacl would provide, and gives no speedup. It is
+//built here so that malloc_trim_wrapped can walk the heap.
+#define TC_NO_THREAD_CACHE      1
+#define LACKS_TIME_H            1
+#define HAVE_MORECORE           0
+#define HAVE_MMAP               1
+#define HAVE_MREMAP             0
+#define NO_MALLINFO             1
+#define NO_MALLOC_STATS         1
+//For malloc_trim_wrapped
+#define MALLOC_INSPECT_ALL      1
+/* @IGNORE_LINES_FOR_CODE_HYGIENE[1] */
+#include "native_client/src/untrusted/nacl/thread_cache_malloc.c"
+
+//newlib internals call these rather than the standard entry points
+void *_malloc_r(struct _reent *ignored, size_t size) {
+	(void) ignored;
+	return malloc(size);
+}
+void *_calloc_r(struct _reent *ignored, size_t n, size_t size) {
+	(void) ignored;
+	return calloc(n, size);
+}
+void *_realloc_r(struct _reent *ignored, void *ptr, size_t size) {
+	(void) ignored;
+	return realloc(ptr, size);
+}
+void _free_r(struct _reent *ignored, void *ptr) {
+	(void) ignored;
+	free(ptr);
+}
+
 #define EXIT_FROM_MAIN 0
 #define EXIT_FROM_CALL 1
 
@@ -130,6 +171,44 @@ void* malloc_wrapped (size_t size) {
 void free_wrapped (void* ptr) {
 	free(ptr);
 }
+
+//Used by trimSandboxMemory in dyn_ldr_memory.c. Gives the free memory at the top of the heap back with
+//malloc_trim, then writes the whole pages in the remaining free chunks to ranges, as pairs of start and end,
+//so the host can discard them. Returns the number of ranges found, which may be more than maxRanges; only the
+//first maxRanges are written. The host must not let other threads into the sandbox until it is done with the
+//ranges, as the chunks may be allocated again.
+struct FreePageRanges {
+	uint32_t* ranges;
+	uint32_t maxRanges;
+	uint32_t count;
+};
+
+static void collectFreePages(void* start, void* end, size_t usedBytes, void* arg) {
+	struct FreePageRanges* found = (struct FreePageRanges*) arg;
+	uintptr_t pagesStart = ((uintptr_t) start + NACL_PAGESIZE - 1) & ~(uintptr_t) (NACL_PAGESIZE - 1);
+	uintptr_t pagesEnd = (uintptr_t) end & ~(uintptr_t) (NACL_PAGESIZE - 1);
+
+	if (usedBytes != 0 || pagesStart >= pagesEnd) {
+		return;
+	}
+	if (found->count < found->maxRanges) {
+		found->ranges[2 * found->count] = (uint32_t) pagesStart;
+		found->ranges[2 * found->count + 1] = (uint32_t) pagesEnd;
+	}
+	found->count++;
+}
+
+uint32_t malloc_trim_wrapped(size_t pad, uint32_t* ranges, uint32_t maxRanges) {
+	struct FreePageRanges found;
+	found.ranges = ranges;
+	found.maxRanges = maxRanges;
+	found.count = 0;
+
+	malloc_trim(pad);
+	dlmalloc_inspect_all(collectFreePages, &found);
+	return found.count;
+}
+
 FILE* fopen_wrapped(const char* filename, const char* mode) {
 	return fopen(filename, mode);
 }
@@ -0,0 +1,167 @@
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_stats.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
+#include "native_client/src/trusted/dyn_ldr/datastructures/ds_map.h"
+#include "native_client/src/trusted/perf_counter/nacl_perf_stats.h"
+#include "native_client/src/trusted/service_runtime/nacl_app_thread.h"
+
+THREAD struct SandboxStatsLastCall sandboxStatsLastCall;
+volatile Atomic32 sandboxStatsGeneration = 0;
+
+int getSandboxStats(NaClSandbox* sandbox, struct SandboxStats* stats)
+{
+  uint64_t untrustedTicks = 0;
+  uint64_t ticksPerSecond = NaClPerfStatsTicksPerSecond();
+
+  memset(stats, 0, sizeof(*stats));
+
+  //Threads that call into the sandbox for the first time add themselves to the map under this lock
+  NaClXMutexLock(sandbox->threadCreateMutex);
+  stats->threadContexts = Map_GetSize(sandbox->threadDataMap);
+  for(unsigned i = 0; i < stats->threadContexts; i++)
+  {
+    NaClSandbox_Thread* threadData = (NaClSandbox_Thread*) sandbox->threadDataMap->values[i];
+    struct NaClAppThread* thread = threadData->thread;
+
+    stats->calls += threadData->stats.calls;
+    stats->bytesCopiedIn += threadData->stats.bytesCopiedIn;
+    stats->bytesCopiedOut += threadData->stats.bytesCopiedOut;
+    stats->mallocs += threadData->stats.mallocs;
+    stats->bytesAllocated += threadData->stats.bytesAllocated;
+    for(unsigned sysnum = 0; sysnum < SANDBOX_STATS_SYSCALLS; sysnum++)
+    {
+      stats->syscallsByNumber[sysnum] += thread->syscall_counts[sysnum];
+    }
+    untrustedTicks += thread->untrusted_ticks;
+  }
+  NaClXMutexUnlock(sandbox->threadCreateMutex);
+
+  for(unsigned sysnum = 0; sysnum < SANDBOX_STATS_SYSCALLS; sysnum++)
+  {
+    stats->syscalls += stats->syscallsByNumber[sysnum];
+  }
+  stats->callbacks = stats->syscallsByNumber[NACL_sys_callback];
+  stats->mmaps = stats->syscallsByNumber[NACL_sys_mmap];
+
+  if(ticksPerSecond == 0)
+  {
+    printf("NaCl Error getSandboxStats - could not measure the time stamp counter\n");
+    return 0;
+  }
+  //In two steps, as the ticks times 10^9 would overflow after a few seconds
+  stats->nanosecondsInSandbox = untrustedTicks / ticksPerSecond * 1000000000ull +
+    untrustedTicks % ticksPerSecond * 1000000000ull / ticksPerSecond;
+  return 1;
+}
+
+/********************** Prometheus text format *****************************/
+
+//Label values escape backslashes, double quotes and line feeds
+static void writeLabelValue(const char* value, FILE* out)
+{
+  for(; *value != '\0'; value++)
+  {
+    if(*value == '\\' || *value == '"')
+    {
+      fprintf(out, "\\%c", *value);
+    }
+    else if(*value == '\n')
+    {
+      fputs("\\n", out);
+    }
+    else
+    {
+      fputc(*value, out);
+    }
+  }
+}
+
+struct PrometheusCounter
+{
+  const char* name;
+  const char* help;
+  size_t offset;
+};
+
+static const struct PrometheusCounter prometheusCounters[] =
+{
+  { "nacl_sandbox_calls_total", "Calls into the sandbox.", offsetof(struct SandboxStats, calls) },
+  { "nacl_sandbox_callbacks_total", "Callbacks out of the sandbox.", offsetof(struct SandboxStats, callbacks) },
+  { "nacl_sandbox_mmaps_total", "mmap syscalls made by the sandbox.", offsetof(struct SandboxStats, mmaps) },
+  { "nacl_sandbox_copied_in_bytes_total", "Bytes copied into the sandbox.", offsetof(struct SandboxStats, bytesCopiedIn) },
+  { "nacl_sandbox_copied_out_bytes_total", "Bytes copied out of the sandbox.", offsetof(struct SandboxStats, bytesCopiedOut) },
+  { "nacl_sandbox_mallocs_total", "Allocations in the sandbox heap made from outside.", offsetof(struct SandboxStats, mallocs) },
+  { "nacl_sandbox_allocated_bytes_total", "Bytes allocated in the sandbox heap from outside.", offsetof(struct SandboxStats, bytesAllocated) },
+  { "nacl_sandbox_thread_contexts_total", "Threads that have called into the sandbox.", offsetof(struct SandboxStats, threadContexts) },
+};
+
+int writeSandboxStatsPrometheus(NaClSandbox** sandboxes, const char* const* names, size_t sandboxCount, FILE* out)
+{
+  struct SandboxStats* stats = (struct SandboxStats*) malloc(sandboxCount * sizeof(struct SandboxStats));
+  int ret = 1;
+
+  if(stats == NULL && sandboxCount != 0)
+  {
+    printf("NaCl Error writeSandboxStatsPrometheus - out of memory\n");
+    return 0;
+  }
+
+  for(size_t i = 0; i < sandboxCount; i++)
+  {
+    if(!getSandboxStats(sandboxes[i], &stats[i]))
+    {
+      free(stats);
+      return 0;
+    }
+  }
+
+  //Each metric's samples follow its HELP and TYPE lines, which may only be written once
+  for(size_t counter = 0; counter < sizeof(prometheusCounters) / sizeof(prometheusCounters[0]); counter++)
+  {
+    const struct PrometheusCounter* metric = &prometheusCounters[counter];
+
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", metric->name, metric->help, metric->name);
+    for(size_t i = 0; i < sandboxCount; i++)
+    {
+      fprintf(out, "%s{sandbox=\"", metric->name);
+      writeLabelValue(names[i], out);
+      fprintf(out, "\"} %" PRIu64 "\n", *(const uint64_t*) ((const char*) &stats[i] + metric->offset));
+    }
+  }
+
+  fputs("# HELP nacl_sandbox_syscalls_total Syscalls made by the sandbox, by number.\n"
+    "# TYPE nacl_sandbox_syscalls_total counter\n", out);
+  for(size_t i = 0; i < sandboxCount; i++)
+  {
+    for(unsigned sysnum = 0; sysnum < SANDBOX_STATS_SYSCALLS; sysnum++)
+    {
+      if(stats[i].syscallsByNumber[sysnum] != 0)
+      {
+        fputs("nacl_sandbox_syscalls_total{sandbox=\"", out);
+        writeLabelValue(names[i], out);
+        fprintf(out, "\",syscall=\"%u\"} %" PRIu64 "\n", sysnum, stats[i].syscallsByNumber[sysnum]);
+      }
+    }
+  }
+
+  fputs("# HELP nacl_sandbox_seconds_total Time spent running code in the sandbox.\n"
+    "# TYPE nacl_sandbox_seconds_total counter\n", out);
+  for(size_t i = 0; i < sandboxCount; i++)
+  {
+    fputs("nacl_sandbox_seconds_total{sandbox=\"", out);
+    writeLabelValue(names[i], out);
+    fprintf(out, "\"} %.9f\n", (double) stats[i].nanosecondsInSandbox / 1e9);
+  }
+
+  if(ferror(out))
+  {
+    printf("NaCl Error writeSandboxStatsPrometheus - could not write the stats\n");
+    ret = 0;
+  }
+  free(stats);
+  return ret;
+}
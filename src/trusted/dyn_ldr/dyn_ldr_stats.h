@@ -0,0 +1,108 @@
+#ifndef NACL_DYN_LDR_STATS
+#define NACL_DYN_LDR_STATS
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "native_client/src/include/atomic_ops.h"
+#include "native_client/src/include/nacl_compiler_annotations.h"
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_lib.h"
+#include "native_client/src/trusted/service_runtime/include/bits/nacl_syscalls.h"
+
+#ifdef __cplusplus
+  extern "C" {
+#endif
+
+//Every sandbox counts how it is used, always. Each thread counts into its own NaClSandbox_Thread and
+//NaClAppThread, without locks or atomic operations, and getSandboxStats adds the threads up when asked, so
+//counting costs an increment per event and two reads of the time stamp counter per syscall. Those are the same
+//reads that time syscalls and invokeFunctionCall for the perf stats, when they are compiled in.
+//
+//Syscalls are counted by the service runtime's syscall hooks, so callbacks and mmaps, which are syscalls, are
+//counted there too. Time in the sandbox is measured from invokeFunctionCall or the end of a syscall to the next
+//syscall, so it leaves out callbacks and the service runtime. A call stopped by a fault or the CPU budget does not count the
+//time since its last syscall.
+
+#define SANDBOX_STATS_SYSCALLS NACL_MAX_SYSCALLS
+
+struct SandboxStats
+{
+	//Calls into the sandbox with invokeFunctionCall, including those made by mallocInSandbox and the like
+	uint64_t calls;
+	//Callbacks the sandbox made
+	uint64_t callbacks;
+	uint64_t syscalls;
+	uint64_t syscallsByNumber[SANDBOX_STATS_SYSCALLS];
+	uint64_t mmaps;
+	//Bytes copied into the sandbox as stack arrays and strings, and by sandbox_heaparr
+	uint64_t bytesCopiedIn;
+	//Bytes copied out of the sandbox by the C++ API's sandbox_copyAndVerify of arrays and strings
+	uint64_t bytesCopiedOut;
+	//Calls of mallocInSandbox that succeeded, and the bytes they asked for
+	uint64_t mallocs;
+	uint64_t bytesAllocated;
+	//Threads that have called into the sandbox, each of which has a thread context in it
+	uint64_t threadContexts;
+	uint64_t nanosecondsInSandbox;
+};
+
+//Counters of a thread that is still in the sandbox may miss its last few events
+int getSandboxStats(NaClSandbox* sandbox, struct SandboxStats* stats);
+
+//Writes the stats of the sandboxes in the Prometheus text format, as counters labelled sandbox="<name>", so
+//that a metrics endpoint can serve the output as is. Syscalls are labelled with their number, and only those
+//that were made are written
+int writeSandboxStatsPrometheus(NaClSandbox** sandboxes, const char* const* names, size_t sandboxCount, FILE* out);
+
+//The call into a sandbox this thread made last, which the C++ API charges the bytes it copies to, if they are in
+//that sandbox. The thread data is freed when its sandbox is destroyed, and another sandbox may then be put at the
+//same base, so it is only used while no sandbox has been destroyed since the call, see destroyDlSandbox
+struct SandboxStatsLastCall
+{
+	NaClSandbox_Thread* threadData;
+	uintptr_t memoryBase;
+	Atomic32 generation;
+};
+
+extern THREAD struct SandboxStatsLastCall sandboxStatsLastCall;
+//Bumped by destroyDlSandbox before it frees anything
+extern volatile Atomic32 sandboxStatsGeneration;
+
+static INLINE void setSandboxStatsLastCall(NaClSandbox_Thread* threadData)
+{
+	sandboxStatsLastCall.threadData = threadData;
+	sandboxStatsLastCall.memoryBase = threadData->sandbox->memoryBase;
+	sandboxStatsLastCall.generation = sandboxStatsGeneration;
+}
+
+static INLINE void countSandboxBytesCopied(const void* ptrInSandbox, size_t bytes, int copiedIn)
+{
+	NaClSandbox_Thread* threadData = sandboxStatsLastCall.threadData;
+
+	//sandboxes are 4GB aligned, so a pointer into one shares the upper half of its base
+	if(threadData == NULL || (((uintptr_t) ptrInSandbox ^ sandboxStatsLastCall.memoryBase) >> 16 >> 16) != 0)
+	{
+		return;
+	}
+	if(sandboxStatsLastCall.generation != sandboxStatsGeneration)
+	{
+		sandboxStatsLastCall.threadData = NULL;
+		return;
+	}
+
+	if(copiedIn)
+	{
+		threadData->stats.bytesCopiedIn += bytes;
+	}
+	else
+	{
+		threadData->stats.bytesCopiedOut += bytes;
+	}
+}
+
+#ifdef __cplusplus
+  }
+#endif
+
+#endif
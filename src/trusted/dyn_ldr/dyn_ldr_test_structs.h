@@ -26,3 +26,11 @@ struct TestStructLongLongSize
 {
 	long long longLongSize;
 };
+
+//The sizes of the structs above inside the sandbox, which the host checks the sandbox against. The sandbox ABI is
+//ILP32 on every architecture: pointers and long are 4 bytes, and double and long long are aligned to 8 bytes
+#define SANDBOX_SIZEOF_TestStructDoubleAlign 24
+#define SANDBOX_SIZEOF_TestStructPointerSize 4
+#define SANDBOX_SIZEOF_TestStructIntSize 4
+#define SANDBOX_SIZEOF_TestStructLongSize 4
+#define SANDBOX_SIZEOF_TestStructLongLongSize 8
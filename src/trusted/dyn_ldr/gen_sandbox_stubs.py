@@ -0,0 +1,240 @@
+#!/usr/bin/python
+# Copyright (c) 2017 The Native Client Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+# Generates call stubs for functions of a sandboxed library from its C header.
+#
+# sandbox_invoke marshals arguments with recursive templates that pick a
+# register for each argument at run time, counting the registers used so far
+# in NaClSandbox_Thread.  A generated stub knows the signature when it is
+# generated, so it stores each argument straight into its register slot of the
+# NaClThreadContext, or at its fixed offset in the stack frame, and reserves
+# exactly the frame it needs.  For each function foo the output has
+#
+#   sandbox_stub_with_ptr_foo(NaClSandbox* sandbox, void* fnPtr, args...)
+#   sandbox_stub_foo(NaClSandbox* sandbox, args...)
+#
+# which return the same unverified_data as sandbox_invoke.  The second looks
+# the function up by name like sandbox_invoke does.  Pointer arguments must
+# point into the sandbox, as with sandbox_invoke.  The output checks that the
+# signatures it was generated for match the header, so a stale stub does not
+# compile.
+#
+# Only the x86-64 C++ API is supported.  Functions taking or returning structs
+# by value, function pointers or varargs are rejected: call those with
+# sandbox_invoke.
+#
+# Usage: gen_sandbox_stubs.py <header> <include path of header> <output> <function>...
+
+from __future__ import print_function
+
+import os
+import re
+import sys
+
+INTEGER_REGISTERS = ['rdi', 'rsi', 'rdx', 'rcx', 'r8', 'r9']
+FLOAT_REGISTERS = ['xmm%d' % i for i in range(8)]
+FLOAT_TYPES = ['float', 'double']
+TYPE_KEYWORDS = ['char', 'short', 'int', 'long', 'signed', 'unsigned', 'float',
+                 'double', 'void', '_Bool']
+
+
+class StubError(Exception):
+  pass
+
+
+def StripComments(text):
+  text = re.sub(r'/\*.*?\*/', ' ', text, flags=re.DOTALL)
+  text = re.sub(r'//[^\n]*', ' ', text)
+  return re.sub(r'^\s*#[^\n]*', ' ', text, flags=re.MULTILINE)
+
+
+def NormalizeType(text):
+  text = re.sub(r'\s+', ' ', text.replace('*', ' * ')).strip()
+  return text.replace(' *', '*')
+
+
+def BaseType(c_type):
+  return ' '.join(word for word in c_type.split()
+                  if word not in ('const', 'volatile'))
+
+
+def ParseParam(param, function):
+  param = param.strip()
+  if param == '...':
+    raise StubError('%s takes varargs' % function)
+  if '(' in param:
+    raise StubError('%s takes a function pointer' % function)
+  is_array = param.endswith(']')
+  if is_array:
+    param = param[:param.index('[')]
+  # Drop the parameter name, if there is one.
+  match = re.match(r'^(.*?[\s\*])([A-Za-z_]\w*)$', param)
+  if (match and match.group(2) not in TYPE_KEYWORDS and
+      BaseType(match.group(1)).strip() not in ('', 'struct', 'union', 'enum')):
+    param = match.group(1)
+  c_type = NormalizeType(param)
+  if is_array:
+    c_type += '*'
+  return c_type
+
+
+def ParsePrototype(header_text, function):
+  match = re.search(r'(?:^|[;}])\s*([A-Za-z_][\w\s\*]*?)\b%s\s*\(([^;{)]*)\)\s*;'
+                    % re.escape(function), header_text)
+  if not match:
+    raise StubError('%s is not declared in the header' % function)
+  ret = NormalizeType(re.sub(r'\b(extern|static|inline)\b', '',
+                             match.group(1)))
+  params_text = match.group(2).strip()
+  params = []
+  if params_text not in ('', 'void'):
+    params = [ParseParam(param, function) for param in params_text.split(',')]
+  for c_type in [ret] + params:
+    if not c_type.endswith('*') and BaseType(c_type).split()[0] in ('struct',
+                                                                    'union'):
+      raise StubError('%s passes a struct by value' % function)
+  return ret, params
+
+
+def IsFloat(c_type):
+  return not c_type.endswith('*') and BaseType(c_type) in FLOAT_TYPES
+
+
+def GenerateStub(function, ret, params):
+  lines = []
+  signature = '%s(%s)' % (ret, ', '.join(params))
+  lines.append('static_assert(std::is_same<decltype(%s), %s>::value, '
+               '"%s has changed since its stub was generated");'
+               % (function, signature, function))
+
+  # Place each argument as the System V ABI does: the first six integer
+  # class arguments and the first eight floating point ones in registers,
+  # the rest on the stack in order, a slot of 8 bytes each.
+  stores = []
+  next_integer = 0
+  next_float = 0
+  stack_slots = 0
+  for index, c_type in enumerate(params):
+    arg = 'a%d' % index
+    if IsFloat(c_type):
+      value = 'sandbox_stubFloatSlot(%s)' % arg
+      if next_float < len(FLOAT_REGISTERS):
+        stores.append('user->%s = %s;' % (FLOAT_REGISTERS[next_float], value))
+        next_float += 1
+        continue
+    else:
+      value = 'sandbox_stubIntegerSlot(sandbox, %s)' % arg
+      if next_integer < len(INTEGER_REGISTERS):
+        stores.append('user->%s = %s;'
+                      % (INTEGER_REGISTERS[next_integer], value))
+        next_integer += 1
+        continue
+    stores.append('stack[%d] = %s;' % (stack_slots, value))
+    stack_slots += 1
+
+  if ret == 'void':
+    ret_type = 'void'
+    ret_expr = None
+  elif ret.endswith('*'):
+    ret_type = 'unverified_data<%s>' % ret
+    ret_expr = ('sandbox_convertToUnverified<%s>(sandbox, (%s) '
+                'functionCallReturnPtr(threadData))' % (ret, ret))
+  elif BaseType(ret) == 'float':
+    ret_type = 'unverified_data<%s>' % ret
+    ret_expr = ('sandbox_convertToUnverified<%s>(sandbox, '
+                'functionCallReturnFloat(threadData))' % ret)
+  elif BaseType(ret) == 'double':
+    ret_type = 'unverified_data<%s>' % ret
+    ret_expr = ('sandbox_convertToUnverified<%s>(sandbox, '
+                'functionCallReturnDouble(threadData))' % ret)
+  else:
+    ret_type = 'unverified_data<%s>' % ret
+    ret_expr = ('sandbox_convertToUnverified<%s>(sandbox, (%s) '
+                'functionCallReturnRawPrimitiveInt(threadData))' % (ret, ret))
+
+  params_decl = ''.join(', %s a%d' % (c_type, index)
+                        for index, c_type in enumerate(params))
+  args = ''.join(', a%d' % index for index in range(len(params)))
+
+  lines.append('')
+  lines.append('inline %s sandbox_stub_with_ptr_%s(NaClSandbox* sandbox, '
+               'void* fnPtr%s)' % (ret_type, function, params_decl))
+  lines.append('{')
+  lines.append('\tNaClSandbox_Thread* threadData = preFunctionCall(sandbox, '
+               '%d, 0);' % (8 * stack_slots))
+  if next_integer or next_float:
+    lines.append('\tstruct NaClThreadContext* user = '
+                 '&threadData->thread->user;')
+  if stack_slots:
+    lines.append('\tuint64_t* stack = (uint64_t*) '
+                 'threadData->stack_ptr_forParameters;')
+  for store in stores:
+    lines.append('\t' + store)
+  lines.append('\tinvokeFunctionCall(threadData, fnPtr);')
+  if ret_expr:
+    lines.append('\treturn %s;' % ret_expr)
+  lines.append('}')
+  lines.append('')
+  lines.append('#ifndef NACL_SANDBOX_API_NO_STL_DS')
+  lines.append('inline %s sandbox_stub_%s(NaClSandbox* sandbox%s)'
+               % (ret_type, function, params_decl))
+  lines.append('{')
+  lines.append('\t%ssandbox_stub_with_ptr_%s(sandbox, '
+               'sandbox_cacheAndRetrieveFnPtr(sandbox, "%s")%s);'
+               % ('return ' if ret_expr else '', function, function, args))
+  lines.append('}')
+  lines.append('#endif')
+  return lines
+
+
+def Main(argv):
+  if len(argv) < 4:
+    print('Usage: %s <header> <include path of header> <output> '
+          '<function>...' % os.path.basename(__file__))
+    return 1
+  header, include, output = argv[:3]
+  functions = argv[3:]
+
+  with open(header) as header_file:
+    header_text = StripComments(header_file.read())
+
+  guard = re.sub(r'\W', '_', os.path.basename(output)).upper()
+  lines = [
+      '//THIS FILE IS AUTO-GENERATED. DO NOT EDIT.',
+      '//Generated by %s from %s' % (os.path.basename(__file__),
+                                     os.path.basename(header)),
+      '#ifndef %s' % guard,
+      '#define %s' % guard,
+      '',
+      '#include <type_traits>',
+      '',
+      '#include "native_client/src/trusted/dyn_ldr/nacl_sandbox.h"',
+      '#include "native_client/src/trusted/service_runtime/nacl_app_thread.h"',
+      '#include "%s"' % include,
+      '',
+      '#if defined(_M_X64) || defined(__x86_64__)',
+  ]
+  try:
+    for function in functions:
+      ret, params = ParsePrototype(header_text, function)
+      lines.append('')
+      lines.append('//%s %s(%s)' % (ret, function, ', '.join(params)))
+      lines.extend(GenerateStub(function, ret, params))
+  except StubError as error:
+    print('%s: %s, call it with sandbox_invoke instead'
+          % (os.path.basename(__file__), error), file=sys.stderr)
+    return 1
+  lines.append('')
+  lines.append('#endif')
+  lines.append('')
+  lines.append('#endif')
+
+  with open(output, 'w') as output_file:
+    output_file.write('\n'.join(lines) + '\n')
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(Main(sys.argv[1:]))
@@ -9,6 +9,8 @@
 #include <stdio.h>
 
 #include "dyn_ldr_lib.h"
+#include "dyn_ldr_profile.h"
+#include "dyn_ldr_stats.h"
 #ifndef NACL_SANDBOX_API_NO_OPTIONAL
 	#include "helpers/optional.hpp"
 
@@ -34,16 +36,13 @@ template< class T >
 using my_remove_volatile_t = typename std::remove_volatile<T>::type;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//NULL stays NULL without a branch, the mask being all ones for any other pointer, so that loops over sandbox
+//data structures can be vectorized
 template<typename T>
 inline T getMaskedField(unsigned long sandboxMask, T arg)
 {
 	unsigned long lowBits = ((uintptr_t)arg) & ((unsigned long)0xFFFFFFFF);
-	if(lowBits == 0)
-	{
-		return 0;
-	}
-
-	return (T)(sandboxMask | lowBits);
+	return (T)((sandboxMask & -(unsigned long)(lowBits != 0)) | lowBits);
 }
 
 template<typename T>
@@ -213,6 +212,7 @@ struct sandbox_unverified_data<T, typename std::enable_if<std::is_array<T>::valu
 		if(sizeOfCopy >= sizeof(T))
 		{
 			memcpy(copy, maskedFieldPtr, sizeof(T));
+			countSandboxBytesCopied(maskedFieldPtr, sizeof(T), 0);
 			if(verify_fn(copy, sizeof(T)))
 			{
 				return true;
@@ -270,6 +270,7 @@ struct unverified_data<T, typename std::enable_if<std::is_array<T>::value>::type
 		if(sizeOfCopy >= sizeof(T))
 		{
 			memcpy(copy, maskedFieldPtr, sizeof(T));
+			countSandboxBytesCopied(maskedFieldPtr, sizeof(T), 0);
 			if(verify_fn(copy, sizeof(T)))
 			{
 				return true;
@@ -446,6 +447,7 @@ struct sandbox_unverified_data<T, typename std::enable_if<std::is_pointer<T>::va
 
 		nonPointerConstType* copy = new nonPointerConstType[elementCount];
 		memcpy(copy, maskedFieldPtr, sizeof(nonPointerConstType) * elementCount);
+		countSandboxBytesCopied(maskedFieldPtr, sizeof(nonPointerConstType) * elementCount, 0);
 		return verify_fn(copy)? copy : defaultValue;
 	}
 
@@ -467,6 +469,7 @@ struct sandbox_unverified_data<T, typename std::enable_if<std::is_pointer<T>::va
 
 		nonPointerConstType* copy = new nonPointerConstType[elementCount];
 		memcpy(copy, maskedFieldPtr, sizeof(nonPointerConstType) * elementCount);
+		countSandboxBytesCopied(maskedFieldPtr, sizeof(nonPointerConstType) * elementCount, 0);
 		//ensure we have a trailing null
 		copy[elementCount - 1] = '\0';
 		return verify_fn(copy)? copy : defaultValue;
@@ -693,6 +696,7 @@ struct unverified_data<T, typename std::enable_if<std::is_pointer<T>::value && !
 
 		nonPointerConstType* copy = new nonPointerConstType[elementCount];
 		memcpy(copy, maskedFieldPtr, sizeof(nonPointerConstType) * elementCount);
+		countSandboxBytesCopied(maskedFieldPtr, sizeof(nonPointerConstType) * elementCount, 0);
 		return verify_fn(copy)? copy : defaultValue;
 	}
 
@@ -714,6 +718,7 @@ struct unverified_data<T, typename std::enable_if<std::is_pointer<T>::value && !
 
 		nonPointerConstType* copy = new nonPointerConstType[elementCount];
 		memcpy(copy, maskedFieldPtr, sizeof(nonPointerConstType) * elementCount);
+		countSandboxBytesCopied(maskedFieldPtr, sizeof(nonPointerConstType) * elementCount, 0);
 		//ensure we have a trailing null
 		copy[elementCount - 1] = '\0';
 		return verify_fn(copy)? copy : defaultValue;
@@ -1050,6 +1055,185 @@ inline void assignValue(sandbox_unverified_data<L>& lhs, sandbox_unverified_data
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//What the C++ API knows about the layout of a struct from its sandbox_fields_reflection macro. Structs without
+//a reflection macro get the defaults here, which keep them on the slow paths
+
+//The SysV x86-64 classes of an eightbyte of a struct, which decide how it is passed and returned
+enum sandbox_sysv_class
+{
+	SANDBOX_SYSV_NONE,
+	SANDBOX_SYSV_INTEGER,
+	SANDBOX_SYSV_SSE,
+	SANDBOX_SYSV_MEMORY
+};
+
+//Merges the classes of two fields that share an eightbyte
+constexpr sandbox_sysv_class operator|(sandbox_sysv_class a, sandbox_sysv_class b)
+{
+	return a == b? a :
+		a == SANDBOX_SYSV_NONE? b :
+		b == SANDBOX_SYSV_NONE? a :
+		(a == SANDBOX_SYSV_MEMORY || b == SANDBOX_SYSV_MEMORY)? SANDBOX_SYSV_MEMORY :
+		SANDBOX_SYSV_INTEGER;
+}
+
+//Nested structs are classed as MEMORY, which is not always what the ABI does, but keeps them on the slow paths
+template<typename T>
+struct sandbox_sysv_scalar_class : std::integral_constant<sandbox_sysv_class,
+	std::is_same<T, long double>::value? SANDBOX_SYSV_MEMORY :
+	std::is_floating_point<T>::value? SANDBOX_SYSV_SSE :
+	(std::is_integral<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value)? SANDBOX_SYSV_INTEGER :
+	SANDBOX_SYSV_MEMORY>
+{};
+
+template<typename T>
+constexpr sandbox_sysv_class sandbox_sysvFieldClass(size_t offset, size_t eightbyte)
+{
+	return (offset + sizeof(T) <= eightbyte * 8 || offset >= eightbyte * 8 + 8)? SANDBOX_SYSV_NONE :
+		offset % alignof(T) != 0? SANDBOX_SYSV_MEMORY :
+		sandbox_sysv_scalar_class<typename std::remove_cv<typename std::remove_all_extents<T>::type>::type>::value;
+}
+
+//Fields that need no masking when they are copied out of the sandbox
+template<typename T>
+struct sandbox_is_plain_field : std::integral_constant<bool,
+	std::is_arithmetic<typename std::remove_all_extents<T>::type>::value ||
+	std::is_enum<typename std::remove_all_extents<T>::type>::value>
+{};
+
+//The size and alignment of a field's type inside the sandbox. The sandbox ABI is ILP32, so pointers and long are
+//4 bytes there even when the host is LP64. Other types, including nested structs, are taken to match the host
+template<typename T>
+struct sandbox_abi_type
+{
+	static constexpr size_t size = sizeof(T);
+	static constexpr size_t align = alignof(T);
+};
+
+template<typename T>
+struct sandbox_abi_type<T*>
+{
+	static constexpr size_t size = 4;
+	static constexpr size_t align = 4;
+};
+
+template<>
+struct sandbox_abi_type<long>
+{
+	static constexpr size_t size = 4;
+	static constexpr size_t align = 4;
+};
+
+template<>
+struct sandbox_abi_type<unsigned long> : sandbox_abi_type<long>
+{};
+
+template<typename T>
+struct sandbox_abi_type<const T> : sandbox_abi_type<T>
+{};
+
+template<typename T>
+struct sandbox_abi_type<volatile T> : sandbox_abi_type<T>
+{};
+
+template<typename T>
+struct sandbox_abi_type<const volatile T> : sandbox_abi_type<T>
+{};
+
+template<typename T, size_t N>
+struct sandbox_abi_type<T[N]>
+{
+	static constexpr size_t size = N * sandbox_abi_type<T>::size;
+	static constexpr size_t align = sandbox_abi_type<T>::align;
+};
+
+//Lays out the fields of a struct one at a time as the sandbox would, noting whether each lands at its host offset
+struct sandbox_abi_layout
+{
+	size_t offset;
+	size_t align;
+	bool matchesHost;
+
+	static constexpr size_t roundUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	template<typename T>
+	constexpr sandbox_abi_layout field(size_t hostOffset) const
+	{
+		return sandbox_abi_layout { roundUp(offset, sandbox_abi_type<T>::align) + sandbox_abi_type<T>::size,
+			align > sandbox_abi_type<T>::align? align : sandbox_abi_type<T>::align,
+			matchesHost && roundUp(offset, sandbox_abi_type<T>::align) == hostOffset };
+	}
+
+	constexpr size_t size() const
+	{
+		return roundUp(offset, align);
+	}
+};
+
+template<typename T>
+struct sandbox_struct_layout
+{
+	static constexpr bool isReflected = false;
+	//The sandbox lays the struct out at the same size and field offsets as the host
+	static constexpr bool matchesSandboxLayout = false;
+	//No field needs masking, so the struct can be copied in and out of the sandbox with a memcpy
+	static constexpr bool isPlainData = false;
+	//Passed and returned in registers rather than in memory
+	static constexpr bool isRegisterClass = false;
+	static constexpr sandbox_sysv_class eightbyte0 = SANDBOX_SYSV_MEMORY;
+	static constexpr sandbox_sysv_class eightbyte1 = SANDBOX_SYSV_MEMORY;
+};
+
+#define sandbox_struct_layout_andPlainField(fieldType, fieldName) && sandbox_is_plain_field<fieldType>::value
+#define sandbox_struct_layout_classifyEightbyte0(fieldType, fieldName) | sandbox_sysvFieldClass<fieldType>(offsetof(unwrappedType, fieldName), 0)
+#define sandbox_struct_layout_classifyEightbyte1(fieldType, fieldName) | sandbox_sysvFieldClass<fieldType>(offsetof(unwrappedType, fieldName), 1)
+#define sandbox_struct_layout_sandboxField(fieldType, fieldName) .field<fieldType>(offsetof(unwrappedType, fieldName))
+#define sandbox_struct_layout_checkField(fieldType, fieldName) \
+	static_assert(offsetof(sandboxType, fieldName) == offsetof(unwrappedType, fieldName) && offsetof(unverifiedType, fieldName) == offsetof(unwrappedType, fieldName), \
+		"The sandbox_fields_reflection macro does not match the struct: field " #fieldName " is at a different offset");
+
+#define sandbox_struct_layout_specialization(T, libId) \
+template<> \
+struct sandbox_struct_layout<T> \
+{ \
+	typedef T unwrappedType; \
+	static constexpr bool isReflected = true; \
+	static constexpr bool matchesSandboxLayout = \
+		(sandbox_abi_layout { 0, 1, true } sandbox_fields_reflection_##libId##_class_##T(sandbox_struct_layout_sandboxField, sandbox_unverified_data_noOp)).matchesHost && \
+		(sandbox_abi_layout { 0, 1, true } sandbox_fields_reflection_##libId##_class_##T(sandbox_struct_layout_sandboxField, sandbox_unverified_data_noOp)).size() == sizeof(T); \
+	static constexpr bool isPlainData = true sandbox_fields_reflection_##libId##_class_##T(sandbox_struct_layout_andPlainField, sandbox_unverified_data_noOp); \
+	static constexpr sandbox_sysv_class eightbyte0 = sizeof(T) > 16? SANDBOX_SYSV_MEMORY : \
+		SANDBOX_SYSV_NONE sandbox_fields_reflection_##libId##_class_##T(sandbox_struct_layout_classifyEightbyte0, sandbox_unverified_data_noOp); \
+	static constexpr sandbox_sysv_class eightbyte1 = sizeof(T) > 16? SANDBOX_SYSV_MEMORY : \
+		SANDBOX_SYSV_NONE sandbox_fields_reflection_##libId##_class_##T(sandbox_struct_layout_classifyEightbyte1, sandbox_unverified_data_noOp); \
+	static constexpr bool isRegisterClass = eightbyte0 != SANDBOX_SYSV_NONE && eightbyte0 != SANDBOX_SYSV_MEMORY && eightbyte1 != SANDBOX_SYSV_MEMORY; \
+};
+
+//The wrappers are used in place of the struct in sandbox memory, so the reflection macro must list every field,
+//in order and with the right types. Checked once both wrappers are defined.
+//Structs that are copied with a memcpy or passed in registers must also have the same layout in the sandbox's ILP32
+//ABI. A struct with a long field, for instance, would be copied at the host's offsets and classed by the host's
+//eightbytes. Structs with pointer fields never take those paths, and their fields are still read at host offsets
+#define sandbox_struct_layout_check(T, libId) \
+struct sandbox_struct_layout_check_##libId##_##T \
+{ \
+	typedef T unwrappedType; \
+	typedef sandbox_unverified_data<T> sandboxType; \
+	typedef unverified_data<T> unverifiedType; \
+	static_assert(sizeof(sandboxType) == sizeof(T) && sizeof(unverifiedType) == sizeof(T), \
+		"The sandbox_fields_reflection macro does not match the size of struct " #T); \
+	static_assert(alignof(sandboxType) == alignof(T) && alignof(unverifiedType) == alignof(T), \
+		"The sandbox_fields_reflection macro does not match the alignment of struct " #T); \
+	static_assert(sandbox_struct_layout<T>::matchesSandboxLayout || \
+		!(sandbox_struct_layout<T>::isPlainData || sandbox_struct_layout<T>::isRegisterClass), \
+		"Struct " #T " is laid out differently in the sandbox, whose pointers and long are 4 bytes, so it can not be copied or passed whole"); \
+	sandbox_fields_reflection_##libId##_class_##T(sandbox_struct_layout_checkField, sandbox_unverified_data_noOp) \
+};
+
 #define sandbox_unverified_data_createField(fieldType, fieldName) sandbox_unverified_data<fieldType> fieldName;
 #define unverified_data_createField(fieldType, fieldName) unverified_data<fieldType> fieldName;
 #define sandbox_unverified_data_noOp() 
@@ -1058,6 +1242,8 @@ inline void assignValue(sandbox_unverified_data<L>& lhs, sandbox_unverified_data
 #define sandbox_unverified_data_copyAssignMasked(fieldType, fieldName) assignValue(ret.fieldName, fieldName.getMasked());
  
 #define sandbox_unverified_data_specialization(T, libId) \
+sandbox_struct_layout_specialization(T, libId) \
+ \
 template<> \
 struct sandbox_unverified_data<T> \
 { \
@@ -1114,6 +1300,11 @@ struct sandbox_unverified_data<T> \
 	inline T getMasked() const \
 	{ \
 		T ret; \
+		if(sandbox_struct_layout<T>::isPlainData) \
+		{ \
+			memcpy((void*) &ret, (const void*) this, sizeof(T)); \
+			return ret; \
+		} \
 		sandbox_fields_reflection_##libId##_class_##T(sandbox_unverified_data_copyAssignMasked, sandbox_unverified_data_noOp) \
 		return ret; \
 	} \
@@ -1150,6 +1341,11 @@ struct unverified_data<T> \
 	unverified_data<T>&>::type operator=(const sandbox_unverified_data<TRHS>& arg) noexcept \
 	{ \
 		/*printf("Struct - Wrapped Assignment\n");*/ \
+		if(sandbox_struct_layout<T>::isPlainData && std::is_same<TRHS, T>::value) \
+		{ \
+			memcpy((void*) this, (const void*) &arg, sizeof(T)); \
+			return *this; \
+		} \
 		sandbox_fields_reflection_##libId##_class_##T(sandbox_unverified_data_fieldAssignMasked, sandbox_unverified_data_noOp) \
 		return *this; \
 	} \
@@ -1175,10 +1371,17 @@ struct unverified_data<T> \
 	inline T getMasked() const \
 	{ \
 		T ret; \
+		if(sandbox_struct_layout<T>::isPlainData) \
+		{ \
+			memcpy((void*) &ret, (const void*) this, sizeof(T)); \
+			return ret; \
+		} \
 		sandbox_fields_reflection_##libId##_class_##T(sandbox_unverified_data_copyAssignMasked, sandbox_unverified_data_noOp) \
 		return ret; \
 	} \
-};
+}; \
+ \
+sandbox_struct_layout_check(T, libId)
 
 #define sandbox_nacl_load_library_api(libId) sandbox_fields_reflection_##libId##_allClasses(sandbox_unverified_data_specialization)
 
@@ -1268,6 +1471,11 @@ inline sandbox_heaparr_helper<T>* sandbox_heaparr(NaClSandbox* sandbox, T* arg,
 {
 	T* argInSandbox = (T *) mallocInSandbox(sandbox, size);
 	memcpy((void*) argInSandbox, (void*) arg, size);
+	countSandboxBytesCopied(argInSandbox, size, 1);
+	if(sandbox->profile)
+	{
+		profileSandboxCopiedBytes(size);
+	}
 
 	auto ret = new sandbox_heaparr_helper<T>();
 	ret->sandbox = sandbox;
@@ -1330,7 +1538,7 @@ inline typename std::enable_if<std::is_pointer<T>::value && !std::is_array<T>::v
 unverified_data<T>>::type sandbox_convertToUnverified(NaClSandbox* sandbox, T retRaw)
 {
 	//printf("got a pointer return\n");
-	auto retRawMasked = getMaskedField(getSandboxMemoryBase(sandbox), retRaw);
+	auto retRawMasked = (T) getUnsandboxedAddressInline(sandbox->memoryBase, (uintptr_t) retRaw);
 	auto retRawPtr = (unverified_data<T> *) &retRawMasked;
 	return *retRawPtr;
 }
@@ -1341,7 +1549,7 @@ unverified_data<T>>::type sandbox_convertToUnverified(NaClSandbox* sandbox, T& r
 {
 	//printf("got a class return\n");
 	//structs are returned as a pointer
-	auto retRawMasked = getMaskedField(getSandboxMemoryBase(sandbox), &retRaw);
+	auto retRawMasked = getUnsandboxedAddressInline(sandbox->memoryBase, (uintptr_t) &retRaw);
 	auto retRawPtr = (sandbox_unverified_data<T> *) retRawMasked;
 	unverified_data<T> ret;
 	ret = *retRawPtr;
@@ -1354,7 +1562,7 @@ unverified_data<T>>::type sandbox_convertToUnverified(NaClSandbox* sandbox, T re
 {
 	//printf("got a array return\n");
 	//arrays are returned by pointer but are unverified_data<struct Foo> is copied by value
-	auto retRawMasked = getMaskedField(getSandboxMemoryBase(sandbox), (void*) retRaw);
+	auto retRawMasked = getUnsandboxedAddressInline(sandbox->memoryBase, (uintptr_t) retRaw);
 	auto retRawPtr = (unverified_data<T> *) retRawMasked;
 	return *retRawPtr;
 }
@@ -1649,11 +1857,59 @@ inline size_t sandbox_NaClAddStackArrParams(T arg, Targs... rem)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+template <typename T>
+inline typename std::enable_if<!sandbox_struct_layout<T>::isReflected,
+void>::type sandbox_pushValueArg(NaClSandbox_Thread* threadData, T& arg)
+{
+	PUSH_VAL_TO_STACK(threadData, T, arg);
+}
+
+template <typename T>
+inline typename std::enable_if<sandbox_struct_layout<T>::isReflected && !sandbox_struct_layout<T>::isRegisterClass,
+void>::type sandbox_pushValueArg(NaClSandbox_Thread* threadData, T& arg)
+{
+	//printf("got a struct arg passed in memory\n");
+	PUSH_VAL_TO_STACK_SKIP_REGS(threadData, T, arg);
+}
+
+//Each eightbyte of the struct goes in the next integer or float register as it is classed, unless there are not
+//enough registers left for all of it, in which case all of it goes on the stack
+template <typename T>
+inline typename std::enable_if<sandbox_struct_layout<T>::isRegisterClass,
+void>::type sandbox_pushValueArg(NaClSandbox_Thread* threadData, T& arg)
+{
+	//printf("got a struct arg passed in registers\n");
+	#if defined(_M_X64) || defined(__x86_64__)
+		const bool secondEightbyte = sizeof(T) > 8;
+		const unsigned intRegs = (sandbox_struct_layout<T>::eightbyte0 == SANDBOX_SYSV_INTEGER) + (secondEightbyte && sandbox_struct_layout<T>::eightbyte1 == SANDBOX_SYSV_INTEGER);
+		const unsigned floatRegs = 1 + secondEightbyte - intRegs;
+		uint64_t eightbytes[2] = { 0, 0 };
+
+		if(threadData->registerParameterNumber + intRegs > 6 || threadData->floatRegisterParameterNumber + floatRegs > 8)
+		{
+			PUSH_VAL_TO_STACK_SKIP_REGS(threadData, T, arg);
+			return;
+		}
+
+		memcpy(eightbytes, &arg, sizeof(T));
+		if(sandbox_struct_layout<T>::eightbyte0 == SANDBOX_SYSV_SSE) { PUSH_FLOAT_VAL_TO_REG(threadData, uint64_t, eightbytes[0]); }
+		else { PUSH_64BIT_VAL_TO_REG(threadData, eightbytes[0]); }
+
+		if(secondEightbyte)
+		{
+			if(sandbox_struct_layout<T>::eightbyte1 == SANDBOX_SYSV_SSE) { PUSH_FLOAT_VAL_TO_REG(threadData, uint64_t, eightbytes[1]); }
+			else { PUSH_64BIT_VAL_TO_REG(threadData, eightbytes[1]); }
+		}
+	#else
+		PUSH_VAL_TO_STACK(threadData, T, arg);
+	#endif
+}
+
 template <typename T>
 inline void sandbox_handleNaClArg(NaClSandbox_Thread* threadData, T arg)
 {
 	//printf("got a value arg\n");
-	PUSH_VAL_TO_STACK(threadData, T, arg);
+	sandbox_pushValueArg(threadData, arg);
 }
 
 template <>
@@ -1689,6 +1945,10 @@ inline void sandbox_handleNaClArg(NaClSandbox_Thread* threadData, sandbox_stacka
 {
 	//printf("got a stack array arg\n");
 	PUSH_GEN_ARRAY_TO_STACK(threadData, arg.arr, arg.size);
+	if(threadData->sandbox->profile)
+	{
+		profileSandboxCopiedBytes(arg.size);
+	}
 }
 
 template <typename T>
@@ -1726,8 +1986,9 @@ inline void sandbox_handleNaClArg(NaClSandbox_Thread* threadData, sandbox_unveri
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+//Structs returned in memory are written to a slot the caller passes as a hidden first argument
 template <typename T>
-inline typename std::enable_if<std::is_class<T>::value,
+inline typename std::enable_if<std::is_class<T>::value && !sandbox_struct_layout<T>::isRegisterClass,
 void>::type sandbox_dealWithNaClReturnArg(NaClSandbox_Thread* threadData)
 {
 	//printf("pushing return argument slot on stack\n");
@@ -1743,7 +2004,7 @@ void>::type sandbox_dealWithNaClReturnArg(NaClSandbox_Thread* threadData)
 }
 
 template <typename T>
-inline typename std::enable_if<!std::is_class<T>::value,
+inline typename std::enable_if<!std::is_class<T>::value || sandbox_struct_layout<T>::isRegisterClass,
 void>::type sandbox_dealWithNaClReturnArg(NaClSandbox_Thread* threadData)
 {
 	UNUSED(threadData);
@@ -1792,7 +2053,7 @@ unverified_data<return_argument<T>>>::type sandbox_invokeNaClReturn(NaClSandbox_
 }
 
 template <typename T, typename ... Targs>
-inline typename std::enable_if<std::is_class<return_argument<T>>::value && !std::is_reference<T>::value,
+inline typename std::enable_if<std::is_class<return_argument<T>>::value && !std::is_reference<T>::value && !sandbox_struct_layout<return_argument<T>>::isRegisterClass,
 unverified_data<return_argument<T>>>::type sandbox_invokeNaClReturn(NaClSandbox_Thread* threadData)
 {
 	//printf("got a class return\n");
@@ -1800,6 +2061,32 @@ unverified_data<return_argument<T>>>::type sandbox_invokeNaClReturn(NaClSandbox_
 	return sandbox_convertToUnverified<return_argument<T>>(threadData->sandbox, *((return_argument<T>*)functionCallReturnPtr(threadData)) );
 }
 
+template <typename T, typename ... Targs>
+inline typename std::enable_if<std::is_class<return_argument<T>>::value && !std::is_reference<T>::value && sandbox_struct_layout<return_argument<T>>::isRegisterClass,
+unverified_data<return_argument<T>>>::type sandbox_invokeNaClReturn(NaClSandbox_Thread* threadData)
+{
+	//printf("got a class return in a register\n");
+	typedef return_argument<T> TRet;
+	//NaClSysExitSandbox only carries rax and xmm0 out of the sandbox. A register-class struct of 9 to 16 bytes comes
+	//back in rax:rdx, xmm0:xmm1 or a mix, and its second eightbyte would be lost, so such returns do not compile.
+	//Supporting them needs the exit wrapper and the exit syscall to pass rdx and xmm1 too. A value copied out of a
+	//register is also not in sandbox memory, where pointer fields are masked against
+	static_assert(sandbox_struct_layout<TRet>::eightbyte1 == SANDBOX_SYSV_NONE && sandbox_struct_layout<TRet>::isPlainData,
+		"Only structs of up to 8 bytes without pointers can be returned by value in registers, return the struct through a pointer instead");
+	unverified_data<TRet> ret;
+	if(sandbox_struct_layout<TRet>::eightbyte0 == SANDBOX_SYSV_SSE)
+	{
+		double reg = functionCallReturnDouble(threadData);
+		memcpy((void*) &ret, &reg, sizeof(TRet));
+	}
+	else
+	{
+		long reg = functionCallReturnRawPrimitiveInt(threadData);
+		memcpy((void*) &ret, &reg, sizeof(TRet));
+	}
+	return ret;
+}
+
 template <typename T, typename ... Targs>
 inline typename std::enable_if<!std::is_pointer<return_argument<T>>::value && !std::is_void<return_argument<T>>::value && !std::is_floating_point<return_argument<T>>::value && !std::is_class<return_argument<T>>::value,
 unverified_data<return_argument<T>>>::type sandbox_invokeNaClReturn(NaClSandbox_Thread* threadData)
@@ -1855,6 +2142,36 @@ inline void sandbox_checkSignatureAndCallNaClFn(NaClSandbox_Thread* threadData,
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+//Used by the stubs gen_sandbox_stubs.py generates, which store each argument straight into the register or stack
+//slot it goes in. These only turn an argument into the 64 bits stored there
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value,
+uint64_t>::type sandbox_stubIntegerSlot(NaClSandbox* sandbox, T arg)
+{
+	UNUSED(sandbox);
+	uint64_t slot = 0;
+	memcpy(&slot, &arg, sizeof(T));
+	return slot;
+}
+
+template <typename T>
+inline uint64_t sandbox_stubIntegerSlot(NaClSandbox* sandbox, T* arg)
+{
+	return getSandboxedAddressInline(sandbox->memoryBase, (uintptr_t) arg);
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value,
+uint64_t>::type sandbox_stubFloatSlot(T arg)
+{
+	uint64_t slot = 0;
+	memcpy(&slot, &arg, sizeof(T));
+	return slot;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 template <typename T, typename ... Targs>
 __attribute__ ((noinline)) return_argument<decltype(sandbox_invokeNaClReturn<T>)> sandbox_invoker_with_ptr(NaClSandbox* sandbox, void* fnPtr, typename std::enable_if<std::is_function<T>::value>::type* dummy, Targs ... param)
 {
@@ -1928,7 +2245,7 @@ __attribute__ ((noinline)) return_argument<T> sandbox_invoker_with_ptr_ret_unsan
 template<typename T>
 inline unverified_data<T*> newInSandbox(NaClSandbox* sandbox, unsigned count = 1)
 {
-	auto ret = (T*) getMaskedField(getSandboxMemoryBase(sandbox), mallocInSandbox(sandbox, sizeof(T) * count));
+	auto ret = (T*) getUnsandboxedAddressInline(sandbox->memoryBase, (uintptr_t) mallocInSandbox(sandbox, sizeof(T) * count));
 	auto casted = (unverified_data<T*> *) &ret;
 	return *casted;
 }
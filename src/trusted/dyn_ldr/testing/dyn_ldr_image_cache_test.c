@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_image_cache.h"
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_lib.h"
+#include "native_client/src/trusted/service_runtime/sel_ldr.h"
+
+//Tests the sandbox images of dyn_ldr_image_cache.h through createDlSandbox, and compares how long making a
+//sandbox takes with and without an image.
+//
+//A sandbox made from an image leaves the image file alone, while one that could not use the image loads the
+//library and app and saves a new image under a temporary name, which is then renamed over the old one. So
+//whether an image was used shows in whether the image file is still the same inode.
+
+char SEPARATOR = '/';
+
+#define StartupRounds 10
+
+char* getExecFolder(char* executablePath);
+char* concatenateAndFixSlash(const char* string1, const char* string2);
+
+/**************** Helpers ****************/
+
+int invokeSimpleAddTest(NaClSandbox* sandbox, void* simpleAddTestPtr, int a, int b)
+{
+	NaClSandbox_Thread* threadData = preFunctionCall(sandbox, sizeof(a) + sizeof(b), 0 /* size of any arrays being pushed on the stack */);
+
+	PUSH_VAL_TO_STACK(threadData, int, a);
+	PUSH_VAL_TO_STACK(threadData, int, b);
+
+	invokeFunctionCall(threadData, simpleAddTestPtr);
+
+	return (int)functionCallReturnRawPrimitiveInt(threadData);
+}
+
+double nowSeconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Makes a sandbox, checks that it can be called and destroys it. Adds the time taken to make it to *seconds
+//if that is not NULL
+int createAndCheckSandbox(const char* libraryPath, const char* appPath, double* seconds)
+{
+	double start = nowSeconds();
+	NaClSandbox* sandbox = createDlSandbox(libraryPath, appPath);
+	void* simpleAddTestPtr;
+	int ret;
+
+	if(seconds != NULL)
+	{
+		*seconds += nowSeconds() - start;
+	}
+	if(sandbox == NULL)
+	{
+		return 0;
+	}
+
+	simpleAddTestPtr = symbolTableLookupInSandbox(sandbox, "simpleAddTest");
+	ret = simpleAddTestPtr != NULL && invokeSimpleAddTest(sandbox, simpleAddTestPtr, 2, 3) == 5;
+	destroyDlSandbox(sandbox);
+	return ret;
+}
+
+int copyFile(const char* from, const char* to)
+{
+	char buf[65536];
+	ssize_t n;
+	int ret = 1;
+	int in = open(from, O_RDONLY);
+	int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0700);
+
+	if(in < 0 || out < 0)
+	{
+		ret = 0;
+	}
+	while(ret && (n = read(in, buf, sizeof(buf))) != 0)
+	{
+		ret = n > 0 && write(out, buf, (size_t) n) == n;
+	}
+	if(in >= 0)
+	{
+		close(in);
+	}
+	if(out >= 0 && close(out) != 0)
+	{
+		ret = 0;
+	}
+	return ret;
+}
+
+int sameFile(const struct stat* a, const struct stat* b)
+{
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino;
+}
+
+/**************** Tests ****************/
+
+//The first sandbox saves an image, and the next one is made from it
+int missAndHitTestPassed(const char* libraryPath, const char* appPath, const char* imagePath)
+{
+	struct stat saved;
+	struct stat used;
+
+	unlink(imagePath);
+	if(!createAndCheckSandbox(libraryPath, appPath, NULL) || stat(imagePath, &saved) != 0 ||
+		(saved.st_mode & (S_IRWXG | S_IRWXO)) != 0)
+	{
+		return 0;
+	}
+	return createAndCheckSandbox(libraryPath, appPath, NULL) && stat(imagePath, &used) == 0 && sameFile(&saved, &used);
+}
+
+//An image saved for an earlier version of the app is not used, and is replaced
+int invalidationTestPassed(const char* libraryPath, const char* appPath, const char* imagePath)
+{
+	struct stat before;
+	struct stat after;
+	struct stat used;
+	struct timeval times[2];
+
+	if(stat(imagePath, &before) != 0)
+	{
+		return 0;
+	}
+
+	times[0].tv_sec = time(NULL);
+	times[0].tv_usec = 0;
+	times[1].tv_sec = times[0].tv_sec + 10;
+	times[1].tv_usec = 0;
+	if(utimes(appPath, times) != 0)
+	{
+		return 0;
+	}
+
+	return createAndCheckSandbox(libraryPath, appPath, NULL) && stat(imagePath, &after) == 0 && !sameFile(&before, &after) &&
+		createAndCheckSandbox(libraryPath, appPath, NULL) && stat(imagePath, &used) == 0 && sameFile(&after, &used);
+}
+
+//Images that someone else could have written are not used, and are replaced by one only this user can write
+int untrustedImageTestPassed(const char* libraryPath, const char* appPath, const char* imagePath)
+{
+	struct stat before;
+	struct stat after;
+
+	if(chmod(imagePath, 0666) != 0 || stat(imagePath, &before) != 0 ||
+		!createAndCheckSandbox(libraryPath, appPath, NULL) || stat(imagePath, &after) != 0 ||
+		sameFile(&before, &after) || (after.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+	{
+		return 0;
+	}
+
+	//Only root can give a file away
+	if(geteuid() != 0)
+	{
+		printf("Skipping the foreign owned image test, which needs root\n");
+		return 1;
+	}
+	if(chown(imagePath, 1, 1) != 0 || stat(imagePath, &before) != 0 ||
+		!createAndCheckSandbox(libraryPath, appPath, NULL) || stat(imagePath, &after) != 0 ||
+		sameFile(&before, &after) || after.st_uid != geteuid())
+	{
+		return 0;
+	}
+	return 1;
+}
+
+//Sandboxes that validate their code neither save images, as the code in an image is not validated again, nor
+//use them
+int validationSkipTestPassed(const char* libraryPath, const char* appPath, const char* imagePath,
+	const char* otherImagePath)
+{
+	NaClSandbox* sandbox = createDlSandbox(libraryPath, appPath);
+	struct NaClApp* nap;
+	int imageFound = 1;
+	int ret;
+
+	if(sandbox == NULL)
+	{
+		return 0;
+	}
+
+	unlink(otherImagePath);
+	sandbox->nap->skip_validator = 0;
+	ret = !saveDlSandboxImage(sandbox, otherImagePath, libraryPath, appPath) && access(otherImagePath, F_OK) != 0;
+	sandbox->nap->skip_validator = 1;
+	destroyDlSandbox(sandbox);
+
+	nap = NaClAppCreate();
+	if(nap == NULL)
+	{
+		return 0;
+	}
+	nap->skip_validator = 0;
+	ret = ret && loadDlSandboxImage(nap, imagePath, libraryPath, appPath, &imageFound) == NULL && !imageFound;
+	free(nap);
+	return ret;
+}
+
+//Prints how long making a sandbox takes from the image, and without it (which includes saving the image)
+int startupTimeTestPassed(const char* libraryPath, const char* appPath, const char* imagePath)
+{
+	double withoutImage = 0;
+	double withImage = 0;
+
+	for(int i = 0; i < StartupRounds; i++)
+	{
+		unlink(imagePath);
+		if(!createAndCheckSandbox(libraryPath, appPath, &withoutImage) ||
+			!createAndCheckSandbox(libraryPath, appPath, &withImage))
+		{
+			return 0;
+		}
+	}
+
+	printf("Sandbox startup: %.2f ms loading and saving an image, %.2f ms from the image (%.1fx)\n",
+		withoutImage * 1000 / StartupRounds, withImage * 1000 / StartupRounds, withoutImage / withImage);
+	return 1;
+}
+
+int main(int argc, char** argv)
+{
+	/**************** Some calculations of relative paths ****************/
+	char* execFolder;
+	char* libraryPath;
+	char* libraryToLoad;
+	char imageDir[] = "/tmp/dyn_ldr_image_cache_test_XXXXXX";
+	char appPath[PATH_MAX];
+	char imagePath[PATH_MAX];
+	char otherImagePath[PATH_MAX];
+	int ret = 1;
+
+	if(argc < 1)
+	{
+		printf("Argv not filled correctly");
+		return 1;
+	}
+
+	//exec folder is something like: "scons-out/opt-linux-x86-32/staging/"
+	execFolder = getExecFolder(argv[0]);
+
+	#if defined(_M_IX86) || defined(__i386__)
+		libraryPath = concatenateAndFixSlash(execFolder, "../../../scons-out/nacl_irt-x86-32/staging/irt_core.nexe");
+		libraryToLoad = concatenateAndFixSlash(execFolder, "../../../scons-out/nacl-x86-32/staging/test_dyn_lib.nexe");
+	#elif defined(_M_X64) || defined(__x86_64__)
+		libraryPath = concatenateAndFixSlash(execFolder, "../../../scons-out/nacl_irt-x86-64/staging/irt_core.nexe");
+		libraryToLoad = concatenateAndFixSlash(execFolder, "../../../scons-out/nacl-x86-64/staging/test_dyn_lib.nexe");
+	#else
+		#error Unknown platform!
+	#endif
+
+	printf("libraryPath: %s\n", libraryPath);
+	printf("libraryToLoad: %s\n", libraryToLoad);
+
+	//The app is copied, so that the test can change it
+	if(mkdtemp(imageDir) == NULL ||
+		snprintf(appPath, sizeof(appPath), "%s/test_dyn_lib.nexe", imageDir) >= (int) sizeof(appPath) ||
+		snprintf(otherImagePath, sizeof(otherImagePath), "%s/other.nimg", imageDir) >= (int) sizeof(otherImagePath) ||
+		!copyFile(libraryToLoad, appPath) ||
+		!getDlSandboxImagePath(imageDir, libraryPath, appPath, imagePath, sizeof(imagePath)))
+	{
+		printf("Dyn loader image cache Test: could not set up %s\n", imageDir);
+		return 1;
+	}
+
+	//Read by initializeDlSandboxCreator. Images are not used when validating
+	setenv("NACL_DYN_LDR_IMAGE_CACHE", imageDir, 1);
+	unsetenv("NACL_DYN_LDR_VALIDATION_CACHE");
+
+	printf("Starting Dyn loader image cache Test.\n");
+
+	if(!initializeDlSandboxCreator(0))
+	{
+		printf("Dyn loader image cache Test: initializeDlSandboxCreator returned null\n");
+		goto cleanup;
+	}
+
+	if(!missAndHitTestPassed(libraryPath, appPath, imagePath))
+	{
+		printf("Dyn loader image cache miss and hit test failed\n");
+		goto cleanup;
+	}
+	printf("Dyn loader image cache miss and hit test successful\n");
+
+	if(!invalidationTestPassed(libraryPath, appPath, imagePath))
+	{
+		printf("Dyn loader image cache invalidation test failed\n");
+		goto cleanup;
+	}
+	printf("Dyn loader image cache invalidation test successful\n");
+
+	if(!untrustedImageTestPassed(libraryPath, appPath, imagePath))
+	{
+		printf("Dyn loader image cache untrusted image test failed\n");
+		goto cleanup;
+	}
+	printf("Dyn loader image cache untrusted image test successful\n");
+
+	if(!validationSkipTestPassed(libraryPath, appPath, imagePath, otherImagePath))
+	{
+		printf("Dyn loader image cache validation test failed\n");
+		goto cleanup;
+	}
+	printf("Dyn loader image cache validation test successful\n");
+
+	if(!startupTimeTestPassed(libraryPath, appPath, imagePath))
+	{
+		printf("Dyn loader image cache startup time test failed\n");
+		goto cleanup;
+	}
+
+	printf("Dyn loader image cache Test Succeeded\n");
+	ret = 0;
+
+	/**************** Cleanup ****************/
+
+cleanup:
+	unlink(imagePath);
+	unlink(otherImagePath);
+	unlink(appPath);
+	rmdir(imageDir);
+
+	free(execFolder);
+	free(libraryPath);
+	free(libraryToLoad);
+
+	return ret;
+}
+
+/**************** Path Helpers ****************/
+
+int lastIndexOf(const char * s, char target)
+{
+	 int ret = -1;
+	 int curIdx = 0;
+	 while(s[curIdx] != '\0')
+	 {
+	    if (s[curIdx] == target) { ret = curIdx; }
+	    curIdx++;
+	 }
+	 return ret;
+}
+
+void replaceChar(char* str, char toReplace, char replaceWith)
+{
+	if(toReplace == replaceWith)
+	{
+		return;
+	}
+
+	while(*str != '\0')
+	{
+		if(*str == toReplace) { *str = replaceWith; }
+		str++;
+	}
+}
+
+char* getExecFolder(char* executablePath)
+{
+	int index;
+	char* execFolder;
+
+	index = lastIndexOf(executablePath, SEPARATOR);
+
+	if(index < 0)
+	{
+		execFolder = (char*)malloc(4);
+		execFolder[0] = '.';
+		execFolder[1] = SEPARATOR;
+		execFolder[2] = '\0';
+	}
+	else
+	{
+		size_t len = strlen(executablePath);
+		execFolder = (char*)malloc(len + 2);
+		strcpy(execFolder, executablePath);
+
+		if((size_t)index < len)
+		{
+			execFolder[index + 1] = '\0';
+		}
+	}
+
+	return execFolder;
+}
+
+char* concatenateAndFixSlash(const char* string1, const char* string2)
+{
+	char* ret;
+
+	ret = (char*)malloc(strlen(string1) + strlen(string2) + 2);
+	strcpy(ret, string1);
+	strcat(ret, string2);
+
+	replaceChar(ret, '/', SEPARATOR);
+	return ret;
+}
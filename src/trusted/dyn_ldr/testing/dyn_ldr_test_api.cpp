@@ -10,7 +10,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <signal.h>
 #include <memory>
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_fault.h"
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_memory.h"
+#include "native_client/src/trusted/dyn_ldr/dyn_ldr_stats.h"
 #include "native_client/src/trusted/dyn_ldr/nacl_sandbox.h"
 #include "native_client/src/trusted/dyn_ldr/testing/test_dyn_lib.h"
 
@@ -29,8 +33,15 @@
 	f(int (*)(unsigned, const char*, unsigned[1]), fieldFnPtr) \
 	g()
 
+#define sandbox_fields_reflection_exampleId_class_testFloatPair(f, g) \
+	f(float, x) \
+	g() \
+	f(float, y) \
+	g()
+
 #define sandbox_fields_reflection_exampleId_allClasses(f) \
-	f(testStruct, exampleId)
+	f(testStruct, exampleId) \
+	f(testFloatPair, exampleId)
 
 sandbox_nacl_load_library_api(exampleId)
 
@@ -343,10 +354,295 @@ void* runTests(void* runTestParamsPtr)
 		return NULL;
 	}
 
+	//a struct of two floats is passed and returned in xmm0
+	testFloatPair pair;
+	pair.x = 1.5;
+	pair.y = 2.5;
+	auto result15 = sandbox_invoke(sandbox, simpleFloatPairScaleTest, pair, 2)
+		.sandbox_copyAndVerify([](unverified_data<testFloatPair>& val){ return val.getMasked(); });
+
+	if(result15.x != 3 || result15.y != 5)
+	{
+		printf("Dyn loader Test 15: Failed\n");
+		*testResult = 0;
+		return NULL;
+	}
+
 	*testResult = 1;
 	return NULL;
 }
 
+//////////////////////////////////////////////////////////////////
+
+int fileContains(FILE* file, const char* str)
+{
+	char buffer[4096];
+	size_t len;
+	rewind(file);
+	len = fread(buffer, 1, sizeof(buffer) - 1, file);
+	buffer[len] = '\0';
+	return strstr(buffer, str) != NULL;
+}
+
+int profileTestPassed(struct runTestParams testParams)
+{
+	NaClSandbox* sandbox = testParams.sandbox;
+	FILE* report = tmpfile();
+	FILE* stacks = tmpfile();
+	int ret;
+
+	if(!report || !stacks || !startSandboxProfile(sandbox))
+	{
+		return 0;
+	}
+
+	runTests((void *) &testParams);
+
+	ret = testParams.testResult == 1 &&
+		writeSandboxProfileReport(sandbox, report) &&
+		writeSandboxProfileCollapsedStacks(sandbox, stacks) &&
+		//every call made is named, with the bytes copied in for sandbox_stackarr("Hello")
+		fileContains(report, "simpleStrLenTest\n") &&
+		fileContains(report, "simpleCallbackTest\n") &&
+		//the callback shows up under the call that made it
+		fileContains(stacks, "simpleCallbackTest;[callback");
+
+	stopSandboxProfile(sandbox);
+	fclose(report);
+	fclose(stacks);
+	return ret;
+}
+
+int statsTestPassed(struct runTestParams testParams)
+{
+	NaClSandbox* sandbox = testParams.sandbox;
+	NaClSandbox* sandboxes[] = { sandbox };
+	const char* names[] = { "test\"1" };
+	struct SandboxStats before;
+	struct SandboxStats after;
+	FILE* metrics = tmpfile();
+	int ret;
+
+	if(!metrics || !getSandboxStats(sandbox, &before))
+	{
+		return 0;
+	}
+
+	runTests((void *) &testParams);
+
+	ret = testParams.testResult == 1 &&
+		getSandboxStats(sandbox, &after) &&
+		after.calls > before.calls &&
+		after.callbacks > before.callbacks &&
+		after.syscalls >= after.callbacks &&
+		after.syscallsByNumber[NACL_sys_callback] == after.callbacks &&
+		//sandbox_stackarr("Hello") in, and the string simpleEchoTest returns out
+		after.bytesCopiedIn >= before.bytesCopiedIn + sizeof("Hello") &&
+		after.bytesCopiedOut > before.bytesCopiedOut &&
+		after.threadContexts >= 1 &&
+		after.nanosecondsInSandbox > before.nanosecondsInSandbox &&
+		writeSandboxStatsPrometheus(sandboxes, names, 1, metrics) &&
+		fileContains(metrics, "# TYPE nacl_sandbox_calls_total counter\nnacl_sandbox_calls_total{sandbox=\"test\\\"1\"} ") &&
+		fileContains(metrics, "nacl_sandbox_seconds_total{sandbox=");
+
+	fclose(metrics);
+	return ret;
+}
+
+int faultTestPassed(struct runTestParams testParams)
+{
+	NaClSandbox* sandbox = testParams.sandbox;
+
+	if(getSandboxFaultSignal(sandbox) != 0)
+	{
+		return 0;
+	}
+
+	//the null dereference faults in the sandbox, and the call returns 0 instead of crashing the process
+	unverified_data<int*> nullPtr;
+	nullPtr = nullptr;
+	auto result = sandbox_invoke(sandbox, simpleNullDerefTest, nullPtr)
+		.sandbox_copyAndVerify([](int val){ return val == 0; }, -1);
+	if(result != 0 || getSandboxFaultSignal(sandbox) != SIGSEGV)
+	{
+		return 0;
+	}
+
+	//later calls are refused
+	result = sandbox_invoke(sandbox, simpleAddTest, 2, 3)
+		.sandbox_copyAndVerify([](int val){ return val == 0; }, -1);
+	return result == 0;
+}
+
+int memoryTestPassed(NaClSandbox* sandbox)
+{
+	const unsigned allocations = 128;
+	const size_t allocationSize = 64 * 1024;
+	void* allocated[allocations];
+	struct SandboxMemoryStats before;
+	struct SandboxMemoryStats touched;
+	struct SandboxMemoryStats trimmed;
+	size_t trimmedBytes;
+
+	if(!getSandboxMemoryStats(sandbox, &before))
+	{
+		return 0;
+	}
+
+	//8MB of heap in chunks too small to be mmapped on their own
+	for(unsigned i = 0; i < allocations; i++)
+	{
+		allocated[i] = mallocInSandbox(sandbox, allocationSize);
+		if(allocated[i] == NULL)
+		{
+			return 0;
+		}
+		memset(allocated[i], 1, allocationSize);
+	}
+
+	if(!getSandboxMemoryStats(sandbox, &touched) ||
+		touched.residentBytes < before.residentBytes + allocations * allocationSize / 2 ||
+		touched.committedBytes > touched.mappedBytes ||
+		touched.residentBytes > touched.committedBytes)
+	{
+		return 0;
+	}
+
+	//all but the last, so the heap cannot give the memory back by just shrinking
+	for(unsigned i = 0; i + 1 < allocations; i++)
+	{
+		freeInSandbox(sandbox, allocated[i]);
+	}
+
+	if(!trimSandboxMemory(sandbox, &trimmedBytes) ||
+		!getSandboxMemoryStats(sandbox, &trimmed) ||
+		trimmed.residentBytes + allocations * allocationSize / 2 > touched.residentBytes)
+	{
+		return 0;
+	}
+
+	//what is still allocated is untouched, and the trimmed memory can be used again
+	unsigned char* last = (unsigned char*) allocated[allocations - 1];
+	if(last[0] != 1 || last[allocationSize - 1] != 1)
+	{
+		return 0;
+	}
+	freeInSandbox(sandbox, last);
+
+	void* reused = mallocInSandbox(sandbox, allocationSize);
+	if(reused == NULL)
+	{
+		return 0;
+	}
+	memset(reused, 2, allocationSize);
+	freeInSandbox(sandbox, reused);
+	return 1;
+}
+
+int watchdogTestPassed(const char* libraryPath, const char* libraryToLoad)
+{
+	NaClSandbox* sandbox = createDlSandbox(libraryPath, libraryToLoad);
+	int ret;
+
+	if(sandbox == NULL)
+	{
+		return 0;
+	}
+	initCPPApi(sandbox);
+
+	//the call spins forever, and is stopped once it has used its 20ms
+	ret = setSandboxCpuBudget(sandbox, 20 * 1000 * 1000) &&
+		sandbox_invoke(sandbox, simpleAddTest, 2, 3).sandbox_copyAndVerify([](int val){ return true; }, -1) == 5 &&
+		sandbox_invoke(sandbox, simpleSpinTest).sandbox_copyAndVerify([](int val){ return true; }, -1) == 0 &&
+		getSandboxFaultSignal(sandbox) == SIGXCPU;
+
+	destroyDlSandbox(sandbox);
+	return ret;
+}
+
+int cloneTestPassed(const char* libraryPath, const char* libraryToLoad)
+{
+	NaClSandbox* parent = createDlSandbox(libraryPath, libraryToLoad);
+	NaClSandbox* clone;
+	int* parentState;
+	int* cloneState;
+	int ret;
+
+	if(parent == NULL)
+	{
+		return 0;
+	}
+	initCPPApi(parent);
+
+	//state the parent built up, which the clone starts with
+	parentState = (int*) mallocInSandbox(parent, sizeof(int));
+	if(parentState == NULL)
+	{
+		destroyDlSandbox(parent);
+		return 0;
+	}
+	*parentState = 42;
+
+	clone = cloneDlSandbox(parent);
+	if(clone == NULL)
+	{
+		destroyDlSandbox(parent);
+		return 0;
+	}
+	initCPPApi(clone);
+
+	cloneState = (int*) getUnsandboxedAddress(clone, getSandboxedAddress(parent, (uintptr_t) parentState));
+	ret = *cloneState == 42;
+
+	//writes in either are not seen by the other
+	*cloneState = 7;
+	ret = ret && *parentState == 42;
+
+	ret = ret &&
+		sandbox_invoke(clone, simpleAddTest, 2, 3).sandbox_copyAndVerify([](int val){ return true; }, -1) == 5 &&
+		sandbox_invoke(parent, simpleAddTest, 2, 3).sandbox_copyAndVerify([](int val){ return true; }, -1) == 5;
+
+	freeInSandbox(clone, cloneState);
+	freeInSandbox(parent, parentState);
+	destroyDlSandbox(clone);
+	destroyDlSandbox(parent);
+	return ret;
+}
+
+//bytes copied out of a sandbox after the last sandbox called has been destroyed must not be charged to
+//the destroyed sandbox's thread data
+int statsAfterDestroyTestPassed(NaClSandbox* sandbox, const char* libraryPath, const char* libraryToLoad)
+{
+	NaClSandbox* other = createDlSandbox(libraryPath, libraryToLoad);
+	struct SandboxStats before;
+	struct SandboxStats after;
+	char* retStr;
+	int ret;
+
+	if(other == NULL)
+	{
+		return 0;
+	}
+	initCPPApi(other);
+
+	unverified_data<char*> temp = newInSandbox<char>(sandbox, sizeof("Hello"));
+	strcpy(temp.sandbox_onlyVerifyAddress(), "Hello");
+	auto retStrRaw = sandbox_invoke(sandbox, simpleEchoTest, temp.sandbox_onlyVerifyAddress());
+
+	ret = sandbox_invoke(other, simpleAddTest, 2, 3).sandbox_copyAndVerify([](int val){ return true; }, -1) == 5;
+	destroyDlSandbox(other);
+
+	ret = ret && getSandboxStats(sandbox, &before);
+	retStr = retStrRaw.sandbox_copyAndVerifyString([](char* val) { return strlen(val) < 100; }, nullptr);
+	ret = ret && retStr != nullptr && strcmp(retStr, "Hello") == 0 &&
+		getSandboxStats(sandbox, &after) &&
+		after.bytesCopiedOut == before.bytesCopiedOut;
+
+	delete[] retStr;
+	freeInSandbox(sandbox, temp.sandbox_onlyVerifyAddress());
+	return ret;
+}
+
 #define ThreadsToTest 4
 
 void runSingleThreadedTest(struct runTestParams testParams)
@@ -361,6 +657,79 @@ void runSingleThreadedTest(struct runTestParams testParams)
 	printf("Main thread tests successful\n");
 }
 
+#define MallocStressRounds 4000
+#define MallocStressLive 64
+
+//Allocates and frees small blocks, which the sandbox's allocator serves from its fastest path, checking that
+//no block is handed to two threads at once
+void* runMallocStress(void* runTestParamsPtr)
+{
+	struct runTestParams* testParams = (struct runTestParams*) runTestParamsPtr;
+	NaClSandbox* sandbox = testParams->sandbox;
+	unsigned char* live[MallocStressLive] = { 0 };
+	size_t sizes[MallocStressLive] = { 0 };
+	unsigned char pattern = (unsigned char) ((uintptr_t) testParams / sizeof(*testParams));
+	unsigned seed = pattern;
+
+	testParams->testResult = 0;
+
+	for(unsigned round = 0; round < MallocStressRounds + MallocStressLive; round++)
+	{
+		unsigned slot = round % MallocStressLive;
+
+		if(live[slot] != NULL)
+		{
+			for(size_t i = 0; i < sizes[slot]; i++)
+			{
+				if(live[slot][i] != (unsigned char) (pattern ^ slot))
+				{
+					return NULL;
+				}
+			}
+			freeInSandbox(sandbox, live[slot]);
+			live[slot] = NULL;
+		}
+
+		if(round < MallocStressRounds)
+		{
+			sizes[slot] = 1 + rand_r(&seed) % 1024;
+			live[slot] = (unsigned char*) mallocInSandbox(sandbox, sizes[slot]);
+			if(live[slot] == NULL)
+			{
+				return NULL;
+			}
+			memset(live[slot], pattern ^ slot, sizes[slot]);
+		}
+	}
+
+	testParams->testResult = 1;
+	return NULL;
+}
+
+int mallocStressTestPassed(struct runTestParams testParams)
+{
+	struct runTestParams threadParams[ThreadsToTest];
+
+	for(unsigned i = 0; i < ThreadsToTest; i++)
+	{
+		threadParams[i] = testParams;
+		if(pthread_create(&threadParams[i].newThread, NULL, runMallocStress, (void *) &threadParams[i]))
+		{
+			return 0;
+		}
+	}
+
+	int ret = 1;
+	for(unsigned i = 0; i < ThreadsToTest; i++)
+	{
+		if(pthread_join(threadParams[i].newThread, NULL) || threadParams[i].testResult != 1)
+		{
+			ret = 0;
+		}
+	}
+	return ret;
+}
+
 void runMultiThreadedTest(struct runTestParams * testParams, unsigned threadCount)
 {
 	for(unsigned i = 0; i < threadCount; i++)
@@ -467,6 +836,20 @@ int main(int argc, char** argv)
 		runSingleThreadedTest(sandboxParams[i]);
 	}
 
+	if(!profileTestPassed(sandboxParams[0]))
+	{
+		printf("Dyn loader profile test failed\n");
+		return 1;
+	}
+	printf("Dyn loader profile test successful\n");
+
+	if(!statsTestPassed(sandboxParams[0]))
+	{
+		printf("Dyn loader stats test failed\n");
+		return 1;
+	}
+	printf("Dyn loader stats test successful\n");
+
 	for(int i = 0; i < 2; i++)
 	{
 		struct runTestParams threadParams[ThreadsToTest];
@@ -497,6 +880,53 @@ int main(int argc, char** argv)
 		checkMultiThreadedTest(threadParams2, ThreadsToTest);
 	}
 
+	//threads allocating in one sandbox at once must not corrupt its heap
+	if(!mallocStressTestPassed(sandboxParams[0]))
+	{
+		printf("Dyn loader malloc stress test failed\n");
+		return 1;
+	}
+	runSingleThreadedTest(sandboxParams[0]);
+	printf("Dyn loader malloc stress test successful\n");
+
+	if(!memoryTestPassed(sandboxParams[0].sandbox))
+	{
+		printf("Dyn loader memory test failed\n");
+		return 1;
+	}
+	runSingleThreadedTest(sandboxParams[0]);
+	printf("Dyn loader memory test successful\n");
+
+	//poisons the second sandbox, the first must be unaffected
+	if(!faultTestPassed(sandboxParams[1]))
+	{
+		printf("Dyn loader fault test failed\n");
+		return 1;
+	}
+	runSingleThreadedTest(sandboxParams[0]);
+	printf("Dyn loader fault test successful\n");
+
+	if(!watchdogTestPassed(libraryPath, libraryToLoad))
+	{
+		printf("Dyn loader watchdog test failed\n");
+		return 1;
+	}
+	printf("Dyn loader watchdog test successful\n");
+
+	if(!cloneTestPassed(libraryPath, libraryToLoad))
+	{
+		printf("Dyn loader clone test failed\n");
+		return 1;
+	}
+	printf("Dyn loader clone test successful\n");
+
+	if(!statsAfterDestroyTestPassed(sandboxParams[0].sandbox, libraryPath, libraryToLoad))
+	{
+		printf("Dyn loader stats after destroy test failed\n");
+		return 1;
+	}
+	printf("Dyn loader stats after destroy test successful\n");
+
 	printf("Dyn loader Test Succeeded\n");
 
 	/**************** Cleanup ****************/
@@ -97,3 +97,23 @@ int* echoPointer(int* pointer)
 {
 	return pointer;
 }
+
+struct testFloatPair simpleFloatPairScaleTest(struct testFloatPair pair, int factor)
+{
+	struct testFloatPair ret;
+	ret.x = pair.x * factor;
+	ret.y = pair.y * factor;
+	return ret;
+}
+
+int simpleNullDerefTest(int* pointer)
+{
+	return *pointer + 1;
+}
+
+int simpleSpinTest()
+{
+	volatile int spin = 1;
+	while(spin) {}
+	return 1;
+}
@@ -1,3 +1,6 @@
+#ifndef NACL_DYN_LDR_TEST_DYN_LIB
+#define NACL_DYN_LDR_TEST_DYN_LIB
+
 typedef int (*CallbackType)(unsigned, const char*, unsigned[1]);
 
 struct testStruct
@@ -9,6 +12,12 @@ struct testStruct
 	int (*fieldFnPtr)(unsigned, const char*, unsigned[1]);
 };
 
+struct testFloatPair
+{
+	float x;
+	float y;
+};
+
 unsigned long simpleAddNoPrintTest(unsigned long a, unsigned long b);
 int simpleAddTest(int a, int b);
 size_t simpleStrLenTest(const char* str);
@@ -21,3 +30,8 @@ unsigned long simpleLongAddTest(unsigned long a, unsigned long b);
 struct testStruct simpleTestStructVal();
 struct testStruct* simpleTestStructPtr();
 int* echoPointer(int* pointer);
+struct testFloatPair simpleFloatPairScaleTest(struct testFloatPair pair, int factor);
+int simpleNullDerefTest(int* pointer);
+int simpleSpinTest();
+
+#endif
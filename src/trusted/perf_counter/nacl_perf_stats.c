@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Per-thread counters and histograms; see nacl_perf_stats.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "native_client/src/include/atomic_ops.h"
+#include "native_client/src/include/nacl_macros.h"
+#include "native_client/src/include/portability.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/platform/nacl_threads.h"
+#include "native_client/src/shared/platform/nacl_time.h"
+#include "native_client/src/trusted/perf_counter/nacl_perf_stats.h"
+
+/* How long NaClPerfStatsTicksPerSecond() watches the tick count. */
+#define NACL_PERF_STATS_CALIBRATION_NS  (20 * 1000 * 1000)
+
+THREAD struct NaClPerfStatsThread *g_nacl_perf_stats_thread = NULL;
+
+/*
+ * Registering names and linking in thread storage is rare, and may
+ * happen before any module init has run, so a spin lock protects them
+ * rather than a NaClMutex that would need a constructor.
+ */
+static volatile Atomic32 g_lock = 0;
+
+static int g_num_counters = 0;
+static int g_num_histograms = 0;
+static char g_counter_names[NACL_PERF_STATS_MAX_COUNTERS]
+                           [NACL_PERF_STATS_MAX_NAME];
+static char g_histogram_names[NACL_PERF_STATS_MAX_HISTOGRAMS]
+                             [NACL_PERF_STATS_MAX_NAME];
+static struct NaClPerfStatsThread *g_threads = NULL;
+
+/* Totals at the last NaClPerfStatsReset(), subtracted from snapshots. */
+static uint64_t g_baseline_counters[NACL_PERF_STATS_MAX_COUNTERS];
+static struct NaClPerfStatsHistogram
+    g_baseline_histograms[NACL_PERF_STATS_MAX_HISTOGRAMS];
+
+static uint64_t g_ticks_per_second = 0;
+
+static void Lock(void) {
+  while (0 != CompareAndSwap(&g_lock, 0, 1)) {
+    NaClThreadYield();
+  }
+}
+
+static void Unlock(void) {
+  (void) AtomicExchange(&g_lock, 0);
+}
+
+static int RegisterName(char const *name,
+                        char (*names)[NACL_PERF_STATS_MAX_NAME],
+                        int *num_names,
+                        int max_names) {
+  int id;
+
+  if (NULL == name || strlen(name) >= NACL_PERF_STATS_MAX_NAME) {
+    return -1;
+  }
+  Lock();
+  for (id = 0; id < *num_names; ++id) {
+    if (0 == strcmp(names[id], name)) {
+      break;
+    }
+  }
+  if (id == *num_names) {
+    if (id < max_names) {
+      strcpy(names[id], name);
+      *num_names = id + 1;
+    } else {
+      NaClLog(LOG_WARNING, "NaClPerfStats: no room for \"%s\"\n", name);
+      id = -1;
+    }
+  }
+  Unlock();
+  return id;
+}
+
+int NaClPerfStatsCounterId(char const *name) {
+  return RegisterName(name, g_counter_names, &g_num_counters,
+                      NACL_PERF_STATS_MAX_COUNTERS);
+}
+
+int NaClPerfStatsHistogramId(char const *name) {
+  return RegisterName(name, g_histogram_names, &g_num_histograms,
+                      NACL_PERF_STATS_MAX_HISTOGRAMS);
+}
+
+/*
+ * The storage of a thread that exits stays on the list, so that its
+ * counts are not lost; nothing is freed.
+ */
+struct NaClPerfStatsThread *NaClPerfStatsThreadAlloc(void) {
+  struct NaClPerfStatsThread *stats;
+  int i;
+
+  stats = (struct NaClPerfStatsThread *) calloc(1, sizeof *stats);
+  if (NULL == stats) {
+    return NULL;
+  }
+  for (i = 0; i < NACL_PERF_STATS_MAX_HISTOGRAMS; ++i) {
+    stats->histograms[i].min = ~(uint64_t) 0;
+  }
+  Lock();
+  stats->next = g_threads;
+  g_threads = stats;
+  Unlock();
+  g_nacl_perf_stats_thread = stats;
+  return stats;
+}
+
+uint64_t NaClPerfStatsClockTicks(void) {
+#if NACL_LINUX
+  struct timespec ts;
+
+  if (0 == clock_gettime(CLOCK_MONOTONIC_RAW, &ts)) {
+    return (uint64_t) ts.tv_sec * NACL_NANOS_PER_UNIT + ts.tv_nsec;
+  }
+#endif
+  return (uint64_t) NaClGetTimeOfDayMicroseconds() * NACL_NANOS_PER_MICRO;
+}
+
+uint64_t NaClPerfStatsTicksPerSecond(void) {
+#if NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && !NACL_WINDOWS
+  uint64_t start_ns;
+  uint64_t start_ticks;
+  uint64_t ns;
+  uint64_t ticks;
+
+  if (0 != g_ticks_per_second) {
+    return g_ticks_per_second;
+  }
+  start_ns = NaClPerfStatsClockTicks();
+  start_ticks = NaClPerfStatsTicks();
+  do {
+    ns = NaClPerfStatsClockTicks() - start_ns;
+  } while (ns < NACL_PERF_STATS_CALIBRATION_NS);
+  ticks = NaClPerfStatsTicks() - start_ticks;
+  g_ticks_per_second = (uint64_t) ((double) ticks * NACL_NANOS_PER_UNIT / ns);
+  return g_ticks_per_second;
+#else
+  return NACL_NANOS_PER_UNIT;
+#endif
+}
+
+uint64_t NaClPerfStatsBucketLowerBound(int bucket) {
+  int msb;
+
+  if (bucket < NACL_PERF_STATS_SUB_BUCKETS) {
+    return (uint64_t) bucket;
+  }
+  msb = (bucket >> NACL_PERF_STATS_SUB_BUCKET_BITS) +
+        NACL_PERF_STATS_SUB_BUCKET_BITS - 1;
+  return ((uint64_t) NACL_PERF_STATS_SUB_BUCKETS +
+          (bucket & (NACL_PERF_STATS_SUB_BUCKETS - 1)))
+         << (msb - NACL_PERF_STATS_SUB_BUCKET_BITS);
+}
+
+static void ClearHistogram(struct NaClPerfStatsHistogram *h) {
+  memset(h, 0, sizeof *h);
+  h->min = ~(uint64_t) 0;
+}
+
+static void AddHistogram(struct NaClPerfStatsHistogram *sum,
+                         struct NaClPerfStatsHistogram const *h) {
+  int i;
+
+  sum->count += h->count;
+  sum->sum += h->sum;
+  if (h->min < sum->min) {
+    sum->min = h->min;
+  }
+  if (h->max > sum->max) {
+    sum->max = h->max;
+  }
+  for (i = 0; i < NACL_PERF_STATS_BUCKETS; ++i) {
+    sum->buckets[i] += h->buckets[i];
+  }
+}
+
+/* Leaves min and max alone; see NaClPerfStatsReset(). */
+static void SubtractHistogram(struct NaClPerfStatsHistogram *sum,
+                              struct NaClPerfStatsHistogram const *h) {
+  int i;
+
+  sum->count -= h->count;
+  sum->sum -= h->sum;
+  for (i = 0; i < NACL_PERF_STATS_BUCKETS; ++i) {
+    sum->buckets[i] -= h->buckets[i];
+  }
+}
+
+/* Adds up all threads' storage; the caller holds the lock. */
+static void SumThreads(uint64_t *counters,
+                       struct NaClPerfStatsHistogram *histograms) {
+  struct NaClPerfStatsThread *stats;
+  int i;
+
+  memset(counters, 0, NACL_PERF_STATS_MAX_COUNTERS * sizeof *counters);
+  for (i = 0; i < NACL_PERF_STATS_MAX_HISTOGRAMS; ++i) {
+    ClearHistogram(&histograms[i]);
+  }
+  for (stats = g_threads; NULL != stats; stats = stats->next) {
+    for (i = 0; i < NACL_PERF_STATS_MAX_COUNTERS; ++i) {
+      counters[i] += ((volatile uint64_t *) stats->counters)[i];
+    }
+    for (i = 0; i < NACL_PERF_STATS_MAX_HISTOGRAMS; ++i) {
+      AddHistogram(&histograms[i], &stats->histograms[i]);
+    }
+  }
+}
+
+void NaClPerfStatsTakeSnapshot(struct NaClPerfStatsSnapshot *snapshot) {
+  int i;
+
+  memset(snapshot, 0, sizeof *snapshot);
+  snapshot->ticks_per_second = NaClPerfStatsTicksPerSecond();
+  Lock();
+  snapshot->num_counters = g_num_counters;
+  snapshot->num_histograms = g_num_histograms;
+  memcpy(snapshot->counter_names, g_counter_names,
+         sizeof snapshot->counter_names);
+  memcpy(snapshot->histogram_names, g_histogram_names,
+         sizeof snapshot->histogram_names);
+  SumThreads(snapshot->counters, snapshot->histograms);
+  for (i = 0; i < NACL_PERF_STATS_MAX_COUNTERS; ++i) {
+    snapshot->counters[i] -= g_baseline_counters[i];
+  }
+  for (i = 0; i < NACL_PERF_STATS_MAX_HISTOGRAMS; ++i) {
+    SubtractHistogram(&snapshot->histograms[i], &g_baseline_histograms[i]);
+  }
+  Unlock();
+}
+
+void NaClPerfStatsReset(void) {
+  Lock();
+  SumThreads(g_baseline_counters, g_baseline_histograms);
+  Unlock();
+}
+
+static int PathMatches(char const *name, char const *path) {
+  size_t len = strlen(path);
+
+  return (0 == strncmp(name, path, len) &&
+          ('\0' == name[len] || '/' == name[len] || 0 == len));
+}
+
+int NaClPerfStatsSnapshotCounter(struct NaClPerfStatsSnapshot const *snapshot,
+                                 char const *path,
+                                 uint64_t *value) {
+  int matched = 0;
+  int i;
+
+  *value = 0;
+  for (i = 0; i < snapshot->num_counters; ++i) {
+    if (PathMatches(snapshot->counter_names[i], path)) {
+      *value += snapshot->counters[i];
+      ++matched;
+    }
+  }
+  return matched;
+}
+
+int NaClPerfStatsSnapshotHistogram(
+    struct NaClPerfStatsSnapshot const *snapshot,
+    char const *path,
+    struct NaClPerfStatsHistogram *histogram) {
+  int matched = 0;
+  int i;
+
+  ClearHistogram(histogram);
+  for (i = 0; i < snapshot->num_histograms; ++i) {
+    if (PathMatches(snapshot->histogram_names[i], path)) {
+      AddHistogram(histogram, &snapshot->histograms[i]);
+      ++matched;
+    }
+  }
+  return matched;
+}
+
+uint64_t NaClPerfStatsPercentile(
+    struct NaClPerfStatsHistogram const *histogram,
+    double percentile) {
+  uint64_t wanted;
+  uint64_t seen = 0;
+  int i;
+
+  if (0 == histogram->count) {
+    return 0;
+  }
+  wanted = (uint64_t) (histogram->count * percentile / 100.0 + 0.5);
+  if (wanted < 1) {
+    wanted = 1;
+  }
+  for (i = 0; i < NACL_PERF_STATS_BUCKETS - 1; ++i) {
+    seen += histogram->buckets[i];
+    if (seen >= wanted) {
+      /* The last value that falls into bucket i. */
+      return NaClPerfStatsBucketLowerBound(i + 1) - 1;
+    }
+  }
+  return histogram->max;
+}
+
+static uint64_t TicksToNs(uint64_t ticks, uint64_t ticks_per_second) {
+  return (uint64_t) ((double) ticks * NACL_NANOS_PER_UNIT / ticks_per_second);
+}
+
+void NaClPerfStatsLog(int detail_level) {
+  struct NaClPerfStatsSnapshot *snapshot;
+  struct NaClPerfStatsHistogram const *h;
+  uint64_t tps;
+  int i;
+
+  snapshot = (struct NaClPerfStatsSnapshot *) malloc(sizeof *snapshot);
+  if (NULL == snapshot) {
+    return;
+  }
+  NaClPerfStatsTakeSnapshot(snapshot);
+  tps = snapshot->ticks_per_second;
+  for (i = 0; i < snapshot->num_counters; ++i) {
+    NaClLog(detail_level, "NaClPerfStats %s: %"NACL_PRIu64"\n",
+            snapshot->counter_names[i], snapshot->counters[i]);
+  }
+  for (i = 0; i < snapshot->num_histograms; ++i) {
+    h = &snapshot->histograms[i];
+    if (0 == h->count) {
+      continue;
+    }
+    NaClLog(detail_level,
+            ("NaClPerfStats %s: count %"NACL_PRIu64", mean %"NACL_PRIu64
+             " ns, p50 %"NACL_PRIu64" ns, p99 %"NACL_PRIu64
+             " ns, max %"NACL_PRIu64" ns\n"),
+            snapshot->histogram_names[i], h->count,
+            TicksToNs(h->sum / h->count, tps),
+            TicksToNs(NaClPerfStatsPercentile(h, 50), tps),
+            TicksToNs(NaClPerfStatsPercentile(h, 99), tps),
+            TicksToNs(h->max, tps));
+  }
+  free(snapshot);
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+#ifndef NATIVE_CLIENT_SRC_TRUSTED_PERF_COUNTER_NACL_PERF_STATS_H
+#define NATIVE_CLIENT_SRC_TRUSTED_PERF_COUNTER_NACL_PERF_STATS_H 1
+
+/*
+ * Named counters and latency histograms for hot paths.
+ *
+ * Unlike NaClPerfCounter, which records a handful of wall clock
+ * samples for one run, these are cheap enough to be updated on every
+ * syscall or sandbox transition.  Each thread records into its own
+ * storage without taking locks or using atomic operations; a snapshot
+ * adds up the storage of all threads.
+ *
+ * Names are '/' separated paths such as "service_runtime/syscall".
+ * NaClPerfStatsSnapshotCounter() and NaClPerfStatsSnapshotHistogram()
+ * sum all the stats below a path, so "service_runtime" covers every
+ * stat of the service runtime.
+ *
+ * Histograms record durations in ticks of NaClPerfStatsTicks() into
+ * buckets that are logarithmic in the value, with
+ * 2^NACL_PERF_STATS_SUB_BUCKET_BITS linear sub-buckets per power of two
+ * (as in HdrHistogram), so that a bucket is never wider than a quarter
+ * of its lower bound.
+ *
+ * The NACL_PERF_STATS_* macros below are how the runtime is
+ * instrumented.  They expand to nothing unless the tree is built with
+ * NACL_PERF_STATS defined to 1 (scons perf_stats=1); the functions are
+ * always available.
+ */
+
+#include "native_client/src/include/nacl_base.h"
+#include "native_client/src/include/nacl_compiler_annotations.h"
+#include "native_client/src/include/portability.h"
+
+EXTERN_C_BEGIN
+
+#define NACL_PERF_STATS_MAX_COUNTERS        (64)
+#define NACL_PERF_STATS_MAX_HISTOGRAMS      (16)
+#define NACL_PERF_STATS_MAX_NAME            (64)
+#define NACL_PERF_STATS_SUB_BUCKET_BITS     (2)
+#define NACL_PERF_STATS_SUB_BUCKETS \
+  (1 << NACL_PERF_STATS_SUB_BUCKET_BITS)
+#define NACL_PERF_STATS_BUCKETS \
+  ((64 - NACL_PERF_STATS_SUB_BUCKET_BITS + 1) << \
+   NACL_PERF_STATS_SUB_BUCKET_BITS)
+
+struct NaClPerfStatsHistogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;   /* ~0 while count is 0 */
+  uint64_t max;
+  uint64_t buckets[NACL_PERF_STATS_BUCKETS];
+};
+
+struct NaClPerfStatsSnapshot {
+  uint64_t ticks_per_second;
+  int num_counters;
+  int num_histograms;
+  char counter_names[NACL_PERF_STATS_MAX_COUNTERS][NACL_PERF_STATS_MAX_NAME];
+  uint64_t counters[NACL_PERF_STATS_MAX_COUNTERS];
+  char histogram_names[NACL_PERF_STATS_MAX_HISTOGRAMS]
+                      [NACL_PERF_STATS_MAX_NAME];
+  struct NaClPerfStatsHistogram histograms[NACL_PERF_STATS_MAX_HISTOGRAMS];
+};
+
+/*
+ * Returns the id of the counter or histogram called name, registering
+ * it if this is the first use of the name.  Returns -1 if there is no
+ * room for another one or the name is too long.  Registering the same
+ * name again is cheap but takes a lock, so callers cache the id.
+ */
+extern int NaClPerfStatsCounterId(char const *name);
+extern int NaClPerfStatsHistogramId(char const *name);
+
+/* Per-thread storage, allocated on the first use by a thread. */
+struct NaClPerfStatsThread {
+  uint64_t counters[NACL_PERF_STATS_MAX_COUNTERS];
+  struct NaClPerfStatsHistogram histograms[NACL_PERF_STATS_MAX_HISTOGRAMS];
+  struct NaClPerfStatsThread *next;
+};
+
+extern THREAD struct NaClPerfStatsThread *g_nacl_perf_stats_thread;
+
+/*
+ * Allocates the calling thread's storage.  Returns NULL if it could
+ * not be allocated.
+ */
+extern struct NaClPerfStatsThread *NaClPerfStatsThreadAlloc(void);
+
+static INLINE struct NaClPerfStatsThread *NaClPerfStatsThreadGet(void) {
+  struct NaClPerfStatsThread *stats = g_nacl_perf_stats_thread;
+
+  if (NACL_UNLIKELY(NULL == stats)) {
+    stats = NaClPerfStatsThreadAlloc();
+  }
+  return stats;
+}
+
+/* CLOCK_MONOTONIC_RAW (or the closest clock there is) in nanoseconds. */
+extern uint64_t NaClPerfStatsClockTicks(void);
+
+/*
+ * A monotonic tick count: the time stamp counter on x86, and
+ * CLOCK_MONOTONIC_RAW nanoseconds elsewhere.
+ */
+static INLINE uint64_t NaClPerfStatsTicks(void) {
+#if NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && !NACL_WINDOWS
+  uint32_t lo;
+  uint32_t hi;
+  __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((uint64_t) hi << 32) | lo;
+#else
+  return NaClPerfStatsClockTicks();
+#endif
+}
+
+/* The number of NaClPerfStatsTicks() per second, measured once. */
+extern uint64_t NaClPerfStatsTicksPerSecond(void);
+
+/*
+ * Values below NACL_PERF_STATS_SUB_BUCKETS get a bucket each.  Above
+ * that, the position of the most significant bit picks a group of
+ * buckets and the bits just below it pick the bucket in the group.
+ */
+static INLINE int NaClPerfStatsBucket(uint64_t value) {
+  int msb;
+
+  if (value < NACL_PERF_STATS_SUB_BUCKETS) {
+    return (int) value;
+  }
+#if defined(__GNUC__)
+  msb = 63 - __builtin_clzll(value);
+#else
+  for (msb = 63; 0 == (value >> msb); --msb) {
+  }
+#endif
+  return ((msb - NACL_PERF_STATS_SUB_BUCKET_BITS + 1)
+          << NACL_PERF_STATS_SUB_BUCKET_BITS) +
+         (int) ((value >> (msb - NACL_PERF_STATS_SUB_BUCKET_BITS)) &
+                (NACL_PERF_STATS_SUB_BUCKETS - 1));
+}
+
+/* Returns the least value that falls into bucket. */
+extern uint64_t NaClPerfStatsBucketLowerBound(int bucket);
+
+static INLINE void NaClPerfStatsAdd(int id, uint64_t n) {
+  struct NaClPerfStatsThread *stats;
+
+  if (id < 0 || NULL == (stats = NaClPerfStatsThreadGet())) {
+    return;
+  }
+  stats->counters[id] += n;
+}
+
+static INLINE void NaClPerfStatsRecord(int id, uint64_t value) {
+  struct NaClPerfStatsThread *stats;
+  struct NaClPerfStatsHistogram *h;
+
+  if (id < 0 || NULL == (stats = NaClPerfStatsThreadGet())) {
+    return;
+  }
+  h = &stats->histograms[id];
+  h->buckets[NaClPerfStatsBucket(value)]++;
+  h->count++;
+  h->sum += value;
+  if (value < h->min) {
+    h->min = value;
+  }
+  if (value > h->max) {
+    h->max = value;
+  }
+}
+
+/*
+ * Adds up the stats of all threads.  A thread recording while the
+ * snapshot is taken may have its latest update left out, or counted in
+ * a histogram's buckets but not yet in its count.
+ */
+extern void NaClPerfStatsTakeSnapshot(struct NaClPerfStatsSnapshot *snapshot);
+
+/*
+ * Sums the counters (or merges the histograms) called path or whose
+ * names start with path followed by '/'.  Returns the number of stats
+ * that matched.
+ */
+extern int NaClPerfStatsSnapshotCounter(
+    struct NaClPerfStatsSnapshot const *snapshot,
+    char const *path,
+    uint64_t *value);
+extern int NaClPerfStatsSnapshotHistogram(
+    struct NaClPerfStatsSnapshot const *snapshot,
+    char const *path,
+    struct NaClPerfStatsHistogram *histogram);
+
+/*
+ * Returns the least value v such that at least percentile percent of
+ * the values recorded in histogram are at most v, as a bucket bound.
+ */
+extern uint64_t NaClPerfStatsPercentile(
+    struct NaClPerfStatsHistogram const *histogram,
+    double percentile);
+
+/*
+ * Makes later snapshots count from now.  Threads never write to each
+ * other's storage, so this records the current totals as a baseline
+ * rather than clearing them.  The min and max of a histogram are not
+ * reset.
+ */
+extern void NaClPerfStatsReset(void);
+
+/* Logs a snapshot at the given NaClLog level, in nanoseconds. */
+extern void NaClPerfStatsLog(int detail_level);
+
+#if defined(NACL_PERF_STATS) && NACL_PERF_STATS
+
+# define NACL_PERF_STATS_COUNT(name, n)                       \
+  do {                                                        \
+    static int nacl_perf_stats_id_ = -2;                      \
+    if (-2 == nacl_perf_stats_id_) {                          \
+      nacl_perf_stats_id_ = NaClPerfStatsCounterId(name);     \
+    }                                                         \
+    NaClPerfStatsAdd(nacl_perf_stats_id_, (n));               \
+  } while (0)
+
+/* Declares a start time; no trailing semicolon, as it may be empty. */
+# define NACL_PERF_STATS_DECLARE_TIMER(var) uint64_t var;
+
+# define NACL_PERF_STATS_TIMER_START(var)                     \
+  do {                                                        \
+    (var) = NaClPerfStatsTicks();                             \
+  } while (0)
+
+# define NACL_PERF_STATS_TIMER_RECORD(name, var)              \
+  NACL_PERF_STATS_TIMER_RECORD_TO(name, var, NaClPerfStatsTicks())
+
+/*
+ * As above, with a time the caller has already read for its own use,
+ * so that one read of the time stamp counter serves both.  ticks is
+ * evaluated even when the stats are compiled out, so pass a variable.
+ */
+# define NACL_PERF_STATS_TIMER_START_FROM(var, ticks)         \
+  do {                                                        \
+    (var) = (ticks);                                          \
+  } while (0)
+
+# define NACL_PERF_STATS_TIMER_RECORD_TO(name, var, ticks)    \
+  do {                                                        \
+    static int nacl_perf_stats_id_ = -2;                      \
+    if (-2 == nacl_perf_stats_id_) {                          \
+      nacl_perf_stats_id_ = NaClPerfStatsHistogramId(name);   \
+    }                                                         \
+    NaClPerfStatsRecord(nacl_perf_stats_id_, (ticks) - (var)); \
+  } while (0)
+
+#else
+
+# define NACL_PERF_STATS_COUNT(name, n) do { } while (0)
+# define NACL_PERF_STATS_DECLARE_TIMER(var)
+# define NACL_PERF_STATS_TIMER_START(var) do { } while (0)
+# define NACL_PERF_STATS_TIMER_RECORD(name, var) do { } while (0)
+# define NACL_PERF_STATS_TIMER_START_FROM(var, ticks) \
+  do { (void) (ticks); } while (0)
+# define NACL_PERF_STATS_TIMER_RECORD_TO(name, var, ticks) \
+  do { (void) (ticks); } while (0)
+
+#endif
+
+EXTERN_C_END
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "native_client/src/include/nacl_assert.h"
+#include "native_client/src/include/portability.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/platform/nacl_threads.h"
+#include "native_client/src/shared/platform/nacl_time.h"
+
+#include "native_client/src/trusted/perf_counter/nacl_perf_stats.h"
+
+#define NUM_THREADS       4
+#define THREAD_ITERATIONS 10000
+
+static int g_thread_counter;
+
+static void WINAPI CountThread(void *arg) {
+  int i;
+  UNREFERENCED_PARAMETER(arg);
+
+  for (i = 0; i < THREAD_ITERATIONS; ++i) {
+    NaClPerfStatsAdd(g_thread_counter, 1);
+  }
+}
+
+static void TestBuckets(void) {
+  uint64_t v;
+  int bucket;
+  int last = 0;
+
+  /* Buckets are contiguous and in order, and each value is in its own. */
+  for (v = 0; v < 100000; ++v) {
+    bucket = NaClPerfStatsBucket(v);
+    ASSERT(bucket == last || bucket == last + 1);
+    ASSERT_LE(NaClPerfStatsBucketLowerBound(bucket), v);
+    ASSERT_GT(NaClPerfStatsBucketLowerBound(bucket + 1), v);
+    last = bucket;
+  }
+  ASSERT_EQ(NACL_PERF_STATS_BUCKETS - 1, NaClPerfStatsBucket(~(uint64_t) 0));
+  ASSERT_EQ((uint64_t) 1 << 63,
+            NaClPerfStatsBucketLowerBound(
+                NaClPerfStatsBucket((uint64_t) 1 << 63)));
+}
+
+static void TestCountersAndHistograms(void) {
+  struct NaClPerfStatsSnapshot *snapshot;
+  struct NaClPerfStatsHistogram h;
+  struct NaClThread threads[NUM_THREADS];
+  uint64_t value;
+  int read_id;
+  int write_id;
+  int latency_id;
+  int i;
+
+  snapshot = (struct NaClPerfStatsSnapshot *) malloc(sizeof *snapshot);
+  ASSERT_NE(NULL, snapshot);
+
+  read_id = NaClPerfStatsCounterId("test/io/read");
+  write_id = NaClPerfStatsCounterId("test/io/write");
+  g_thread_counter = NaClPerfStatsCounterId("test/threads");
+  latency_id = NaClPerfStatsHistogramId("test/latency");
+  ASSERT_NE(-1, read_id);
+  ASSERT_NE(read_id, write_id);
+  ASSERT_EQ(read_id, NaClPerfStatsCounterId("test/io/read"));
+  ASSERT_EQ(-1, NaClPerfStatsCounterId(
+      "a name that is far too long to fit into the name buffer of a stat"));
+
+  NaClPerfStatsAdd(read_id, 3);
+  NaClPerfStatsAdd(write_id, 4);
+  for (i = 1; i <= 100; ++i) {
+    NaClPerfStatsRecord(latency_id, i);
+  }
+  for (i = 0; i < NUM_THREADS; ++i) {
+    ASSERT(NaClThreadCreateJoinable(&threads[i], CountThread, NULL, 64 << 10));
+  }
+  for (i = 0; i < NUM_THREADS; ++i) {
+    NaClThreadJoin(&threads[i]);
+  }
+
+  NaClPerfStatsTakeSnapshot(snapshot);
+  ASSERT_NE(0, snapshot->ticks_per_second);
+  ASSERT_EQ(1, NaClPerfStatsSnapshotCounter(snapshot, "test/io/read", &value));
+  ASSERT_EQ(3, value);
+  /* A path covers the stats below it, not those that share a prefix. */
+  ASSERT_EQ(2, NaClPerfStatsSnapshotCounter(snapshot, "test/io", &value));
+  ASSERT_EQ(7, value);
+  ASSERT_EQ(0, NaClPerfStatsSnapshotCounter(snapshot, "test/i", &value));
+  ASSERT_EQ(3, NaClPerfStatsSnapshotCounter(snapshot, "test", &value));
+  ASSERT_EQ(7 + NUM_THREADS * THREAD_ITERATIONS, value);
+
+  ASSERT_EQ(1, NaClPerfStatsSnapshotHistogram(snapshot, "test", &h));
+  ASSERT_EQ(100, h.count);
+  ASSERT_EQ(5050, h.sum);
+  ASSERT_EQ(1, h.min);
+  ASSERT_EQ(100, h.max);
+  /* Percentiles are exact to within the width of a bucket. */
+  value = NaClPerfStatsPercentile(&h, 50);
+  ASSERT(value >= 50 && value < 50 + 50 / NACL_PERF_STATS_SUB_BUCKETS * 2);
+  value = NaClPerfStatsPercentile(&h, 100);
+  ASSERT(value >= 100 && value < 128);
+
+  NaClPerfStatsReset();
+  NaClPerfStatsAdd(read_id, 1);
+  NaClPerfStatsRecord(latency_id, 7);
+  NaClPerfStatsTakeSnapshot(snapshot);
+  ASSERT_EQ(3, NaClPerfStatsSnapshotCounter(snapshot, "test", &value));
+  ASSERT_EQ(1, value);
+  ASSERT_EQ(1, NaClPerfStatsSnapshotHistogram(snapshot, "test/latency", &h));
+  ASSERT_EQ(1, h.count);
+  ASSERT_EQ(7, h.sum);
+  ASSERT_EQ(7, NaClPerfStatsPercentile(&h, 50));
+
+  NaClPerfStatsLog(1);
+  free(snapshot);
+}
+
+static void TestTicks(void) {
+  uint64_t start = NaClPerfStatsTicks();
+  uint64_t tps = NaClPerfStatsTicksPerSecond();
+  struct nacl_abi_timespec req = { 0, 10 * 1000 * 1000 };
+  uint64_t elapsed;
+
+  ASSERT_EQ(0, NaClNanosleep(&req, NULL));
+  elapsed = NaClPerfStatsTicks() - start;
+  /* At least the 10ms slept; allow a lot of slack on loaded machines. */
+  ASSERT_GE(elapsed, tps / 100 - tps / 1000);
+  printf("%"NACL_PRIu64" ticks per second\n", tps);
+}
+
+int main(void) {
+  NaClLogModuleInit();
+  NaClTimeInit();
+
+  TestBuckets();
+  TestCountersAndHistograms();
+  TestTicks();
+
+  NaClTimeFini();
+  NaClLogModuleFini();
+  printf("PASSED\n");
+  return 0;
+}
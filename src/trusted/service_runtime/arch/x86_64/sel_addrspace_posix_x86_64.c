@@ -5,6 +5,7 @@
  */
 
 #include <errno.h>
+#include <stdlib.h>
 #include <sys/mman.h>
 
 #include "native_client/src/include/build_config.h"
@@ -19,6 +20,7 @@
 #include "native_client/src/include/nacl_platform.h"
 #include "native_client/src/shared/platform/nacl_check.h"
 #include "native_client/src/shared/platform/nacl_find_addrsp.h"
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
 #include "native_client/src/trusted/service_runtime/arch/sel_ldr_arch.h"
 #include "native_client/src/trusted/service_runtime/sel_addrspace.h"
 #include "native_client/src/trusted/service_runtime/sel_ldr.h"
@@ -64,10 +66,11 @@ static void *NaClAllocatePow2AlignedMemory(size_t mem_sz,
     found_memory = NaClFindAddressSpace(&unrounded_addr, request_size);
   }
   if (!found_memory) {
-    NaClLog(LOG_FATAL,
+    NaClLog(LOG_ERROR,
             "NaClAllocatePow2AlignedMemory: Failed to reserve %"NACL_PRIxS
             " bytes of address space\n",
             request_size);
+    return NULL;
   }
 
   NaClLog(4,
@@ -120,6 +123,160 @@ static void *NaClAllocatePow2AlignedMemory(size_t mem_sz,
   return (void *) rounded_addr;
 }
 
+/*
+ * Dense packing of sandboxes.  All the slots live in one reservation,
+ * back to back, so the gap between two neighbouring sandboxes is both
+ * the upper guard of one and the lower guard of the other.  This makes
+ * each sandbox cost FOURGIG plus one guard of address space rather
+ * than FOURGIG plus two guards, and replaces a search for free address
+ * space with a pop from a free list.
+ */
+#define PACKED_GUARD_SIZE \
+  (NACL_ADDRSPACE_LOWER_GUARD_SIZE > NACL_ADDRSPACE_UPPER_GUARD_SIZE ? \
+   NACL_ADDRSPACE_LOWER_GUARD_SIZE : NACL_ADDRSPACE_UPPER_GUARD_SIZE)
+#define PACKED_SLOT_STRIDE  (FOURGIG + PACKED_GUARD_SIZE)
+
+static struct NaClMutex g_packed_mu;
+/* Start of the reservation, and of the lower guard of slot 0. */
+static uintptr_t g_packed_start = 0;
+static size_t g_packed_size = 0;
+static uint32_t g_packed_num_slots = 0;
+static uint32_t g_packed_num_used = 0;
+/*
+ * Singly-linked free list of slot indexes.  g_packed_num_slots marks
+ * the end of the list.
+ */
+static uint32_t *g_packed_next_free = NULL;
+static uint32_t g_packed_free_head = 0;
+
+static uintptr_t PackedSlotAddr(uint32_t slot) {
+  return (g_packed_start + NACL_ADDRSPACE_LOWER_GUARD_SIZE +
+          slot * PACKED_SLOT_STRIDE);
+}
+
+int NaClAddrSpacePackingInit(size_t num_slots, enum NaClAslrMode aslr_mode) {
+  void *mem_ptr;
+  uint32_t slot;
+
+  CHECK(0 == g_packed_num_slots);
+  if (NACL_X86_64_ZERO_BASED_SANDBOX) {
+    NaClLog(LOG_WARNING, "NaClAddrSpacePackingInit: not supported with the"
+            " zero-based sandbox\n");
+    return 0;
+  }
+  if (0 == num_slots ||
+      num_slots > (SIZE_MAX - NACL_ADDRSPACE_LOWER_GUARD_SIZE) /
+                  PACKED_SLOT_STRIDE) {
+    return 0;
+  }
+
+  g_packed_size = NACL_ADDRSPACE_LOWER_GUARD_SIZE +
+      num_slots * PACKED_SLOT_STRIDE;
+  NaClAddrSpaceBeforeAlloc(g_packed_size);
+  /*
+   * The lower guard is a multiple of 4GB, so aligning the start of the
+   * reservation aligns every slot.
+   */
+  mem_ptr = NaClAllocatePow2AlignedMemory(g_packed_size, ALIGN_BITS,
+                                          aslr_mode);
+  if (NULL == mem_ptr) {
+    NaClLog(LOG_ERROR, "NaClAddrSpacePackingInit: could not reserve %"
+            NACL_PRIuS" sandbox slots\n", num_slots);
+    return 0;
+  }
+  g_packed_next_free = malloc(num_slots * sizeof *g_packed_next_free);
+  if (NULL == g_packed_next_free) {
+    if (munmap(mem_ptr, g_packed_size) != 0) {
+      NaClLog(LOG_FATAL, "NaClAddrSpacePackingInit: munmap() failed\n");
+    }
+    return 0;
+  }
+  for (slot = 0; slot < num_slots; slot++) {
+    g_packed_next_free[slot] = slot + 1;
+  }
+  NaClXMutexCtor(&g_packed_mu);
+  g_packed_start = (uintptr_t) mem_ptr;
+  g_packed_free_head = 0;
+  g_packed_num_used = 0;
+  g_packed_num_slots = (uint32_t) num_slots;
+  NaClLog(4, "NaClAddrSpacePackingInit: %"NACL_PRIuS" slots at 0x%016"
+          NACL_PRIxPTR"\n", num_slots, g_packed_start);
+  return 1;
+}
+
+void NaClAddrSpacePackingFini(void) {
+  if (0 == g_packed_num_slots) {
+    return;
+  }
+  if (0 != g_packed_num_used) {
+    NaClLog(LOG_WARNING, "NaClAddrSpacePackingFini: %u sandboxes still in"
+            " use, keeping the reservation\n", g_packed_num_used);
+    return;
+  }
+  if (munmap((void *) g_packed_start, g_packed_size) != 0) {
+    NaClLog(LOG_FATAL, "NaClAddrSpacePackingFini: munmap() failed, errno %d\n",
+            errno);
+  }
+  free(g_packed_next_free);
+  g_packed_next_free = NULL;
+  g_packed_num_slots = 0;
+  g_packed_start = 0;
+  g_packed_size = 0;
+  NaClMutexDtor(&g_packed_mu);
+}
+
+/* Returns the address of a free slot, or NULL if there is none. */
+static void *PackedSlotAlloc(void) {
+  uint32_t slot;
+
+  if (0 == g_packed_num_slots) {
+    return NULL;
+  }
+  NaClXMutexLock(&g_packed_mu);
+  slot = g_packed_free_head;
+  if (slot != g_packed_num_slots) {
+    g_packed_free_head = g_packed_next_free[slot];
+    g_packed_num_used++;
+  }
+  NaClXMutexUnlock(&g_packed_mu);
+  if (slot == g_packed_num_slots) {
+    return NULL;
+  }
+  return (void *) PackedSlotAddr(slot);
+}
+
+int NaClAddrSpacePackedRelease(void *mem_start) {
+  uintptr_t addr = (uintptr_t) mem_start;
+  uint32_t slot;
+
+  if (0 == g_packed_num_slots ||
+      addr < g_packed_start ||
+      addr >= g_packed_start + g_packed_size) {
+    return 0;
+  }
+  slot = (uint32_t) ((addr - g_packed_start -
+                      NACL_ADDRSPACE_LOWER_GUARD_SIZE) / PACKED_SLOT_STRIDE);
+  CHECK(PackedSlotAddr(slot) == addr);
+
+  /*
+   * Replace whatever the sandbox mapped with a fresh inaccessible
+   * reservation, which also drops the pages it used.
+   */
+  if (mmap(mem_start, FOURGIG, PROT_NONE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+           -1, 0) != mem_start) {
+    NaClLog(LOG_FATAL, "NaClAddrSpacePackedRelease: mmap() failed, errno %d\n",
+            errno);
+  }
+
+  NaClXMutexLock(&g_packed_mu);
+  g_packed_next_free[slot] = g_packed_free_head;
+  g_packed_free_head = slot;
+  g_packed_num_used--;
+  NaClXMutexUnlock(&g_packed_mu);
+  return 1;
+}
+
 NaClErrorCode NaClAllocateSpaceAslr(void **mem, size_t addrsp_size,
                                     enum NaClAslrMode aslr_mode) {
   /* 40G guard on each side */
@@ -183,6 +340,14 @@ NaClErrorCode NaClAllocateSpaceAslr(void **mem, size_t addrsp_size,
     return LOAD_NO_MEMORY_FOR_ADDRESS_SPACE;
   }
 
+  *mem = PackedSlotAlloc();
+  if (NULL != *mem) {
+    NaClLog(4,
+            "NaClAllocateSpace: packed addr space at 0x%016"NACL_PRIxPTR"\n",
+            (uintptr_t) *mem);
+    return LOAD_OK;
+  }
+
   NaClAddrSpaceBeforeAlloc(mem_sz);
 
   errno = 0;
@@ -105,6 +105,7 @@
 #define NACL_sys_dyncode_create         104
 #define NACL_sys_dyncode_modify         105
 #define NACL_sys_dyncode_delete         106
+#define NACL_sys_dyncode_create_batch   107
 
 #define NACL_sys_test_infoleak          109
 #define NACL_sys_test_crash             110
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * NaCl dynamic code batch installation
+ */
+
+#ifndef _NATIVE_CLIENT_SRC_SERVICE_RUNTIME_INCLUDE_SYS_NACL_DYNCODE_H_
+#define _NATIVE_CLIENT_SRC_SERVICE_RUNTIME_INCLUDE_SYS_NACL_DYNCODE_H_ 1
+
+#if defined(NACL_IN_TOOLCHAIN_HEADERS)
+# include <stdint.h>
+#else
+# include "native_client/src/include/portability.h"
+#endif
+
+/* Maximum number of regions a single dyncode_create_batch call accepts. */
+#define NACL_ABI_DYNCODE_BATCH_MAX 4096
+
+/*
+ * One element of the array passed to dyncode_create_batch.  |dest| and
+ * |src| are untrusted addresses; the requirements on each region are the
+ * same as for dyncode_create.
+ */
+struct NaClDyncodeRegion {
+  uint32_t dest;
+  uint32_t src;
+  uint32_t size;
+};
+
+#endif /* _NATIVE_CLIENT_SRC_SERVICE_RUNTIME_INCLUDE_SYS_NACL_DYNCODE_H_ */
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * NaCl read-only time data page ("vvar")
+ */
+
+#ifndef _NATIVE_CLIENT_SRC_SERVICE_RUNTIME_INCLUDE_SYS_NACL_VVAR_H_
+#define _NATIVE_CLIENT_SRC_SERVICE_RUNTIME_INCLUDE_SYS_NACL_VVAR_H_ 1
+
+#if defined(NACL_IN_TOOLCHAIN_HEADERS)
+# include <stdint.h>
+#else
+# include "native_client/src/include/portability.h"
+#endif
+
+/* Set in |flags| when the TSC fields below may be used. */
+#define NACL_ABI_VVAR_TSC_VALID 1
+
+/* |tsc_mult| is nanoseconds per TSC tick in 32.32 fixed point. */
+#define NACL_ABI_VVAR_TSC_SHIFT 32
+
+/*
+ * The service runtime maps one read-only page holding this struct into
+ * each sandbox and passes its address in the AT_NACL_VVAR auxv entry.
+ *
+ * The fields are protected by a seqlock: |seq| is odd while trusted
+ * code updates them, and a reader must retry if |seq| was odd or has
+ * changed by the time it has read them.  At TSC value |tsc_base| the
+ * clocks read |realtime_ns| and |monotonic_ns|; other times are
+ * extrapolated as
+ *
+ *   base_ns + (((tsc - tsc_base) * tsc_mult) >> NACL_ABI_VVAR_TSC_SHIFT)
+ *
+ * which is only valid while tsc - tsc_base <= tsc_max_delta.  Past that,
+ * or without NACL_ABI_VVAR_TSC_VALID, the reader must make the
+ * clock_gettime syscall, which also refreshes the page.
+ */
+struct nacl_abi_vvar {
+  uint32_t seq;
+  uint32_t flags;
+  uint64_t tsc_base;
+  uint64_t tsc_max_delta;
+  uint64_t tsc_mult;
+  int64_t realtime_ns;
+  int64_t monotonic_ns;
+};
+
+#endif /* _NATIVE_CLIENT_SRC_SERVICE_RUNTIME_INCLUDE_SYS_NACL_VVAR_H_ */
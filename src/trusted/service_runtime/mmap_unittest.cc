@@ -132,6 +132,35 @@ TEST_F(MmapTest, TestFreeingAddressSpace) {
   }
 }
 
+#if NACL_ADDRSPACE_PACKING
+// Check that packed sandboxes share their guard regions, that freeing
+// one makes its slot available again, and that running out of slots
+// falls back to ordinary allocation.
+TEST_F(MmapTest, TestPackedAddressSpace) {
+  const uintptr_t kStride = ((uintptr_t) 1 << 32) +
+                            NACL_ADDRSPACE_UPPER_GUARD_SIZE;
+  struct NaClApp app[3];
+
+  ASSERT_NE(NaClAddrSpacePackingInit(2, NACL_ENABLE_ASLR), 0);
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(NaClAppCtor(&app[i]), 1);
+    ASSERT_EQ(NaClAllocAddrSpace(&app[i]), LOAD_OK);
+  }
+  ASSERT_EQ(app[0].mem_start + kStride, app[1].mem_start);
+  ASSERT_EQ(NaClAddrSpacePackedRelease((void *) app[2].mem_start), 0);
+
+  uintptr_t freed_start = app[0].mem_start;
+  NaClAddrSpaceFree(&app[0]);
+  ASSERT_EQ(NaClAppCtor(&app[0]), 1);
+  ASSERT_EQ(NaClAllocAddrSpace(&app[0]), LOAD_OK);
+  ASSERT_EQ(app[0].mem_start, freed_start);
+
+  for (int i = 0; i < 3; i++)
+    NaClAddrSpaceFree(&app[i]);
+  NaClAddrSpacePackingFini();
+}
+#endif
+
 void MapShmFd(struct NaClApp *nap, uintptr_t addr, size_t shm_size) {
   struct NaClDescImcShm *shm_desc =
       (struct NaClDescImcShm *) malloc(sizeof(*shm_desc));
@@ -232,6 +232,10 @@ struct NaClAppThread *NaClAppThreadMake(struct NaClApp *nap,
 
   natp->dynamic_delete_generation = 0;
 
+  memset(natp->syscall_counts, 0, sizeof(natp->syscall_counts));
+  natp->untrusted_ticks = 0;
+  natp->untrusted_since = 0;
+
   if (!NaClCondVarCtor(&natp->futex_condvar)) {
     goto cleanup_suspend_mu;
   }
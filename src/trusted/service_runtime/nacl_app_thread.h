@@ -18,6 +18,7 @@
 #include "native_client/src/include/build_config.h"
 #include "native_client/src/shared/platform/nacl_sync.h"
 #include "native_client/src/shared/platform/nacl_threads.h"
+#include "native_client/src/trusted/service_runtime/include/bits/nacl_syscalls.h"
 #include "native_client/src/trusted/service_runtime/nacl_signal.h"
 #include "native_client/src/trusted/service_runtime/sel_rt.h"
 #include "native_client/src/trusted/service_runtime/sys_futex.h"
@@ -181,6 +182,18 @@ struct NaClAppThread {
    * NaCl app switches to trusted code via the NaClExitSandbox syscall
   */
   uint64_t                register_xmm0;
+
+  /*
+   * Kept by the syscall hooks for dyn_ldr's per-sandbox statistics,
+   * and only written by this thread.  syscall_counts counts this
+   * thread's syscalls by number, and untrusted_ticks the ticks of
+   * NaClPerfStatsTicks() it spent running untrusted code.
+   * untrusted_since is when it last entered untrusted code, or 0
+   * while it runs trusted code.
+   */
+  uint64_t                  syscall_counts[NACL_MAX_SYSCALLS];
+  uint64_t                  untrusted_ticks;
+  uint64_t                  untrusted_since;
 };
 
 void WINAPI NaClAppThreadLauncher(void *state);
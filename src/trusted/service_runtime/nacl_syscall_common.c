@@ -38,6 +38,8 @@
 #include "native_client/src/trusted/desc/nacl_desc_mutex.h"
 #include "native_client/src/trusted/desc/nacl_desc_semaphore.h"
 
+#include "native_client/src/trusted/perf_counter/nacl_perf_stats.h"
+
 #include "native_client/src/trusted/service_runtime/include/bits/nacl_syscalls.h"
 #include "native_client/src/trusted/service_runtime/include/sys/errno.h"
 #include "native_client/src/trusted/service_runtime/include/sys/stat.h"
@@ -51,6 +53,7 @@
 #include "native_client/src/trusted/service_runtime/nacl_syscall_handlers.h"
 #include "native_client/src/trusted/service_runtime/nacl_thread_nice.h"
 #include "native_client/src/trusted/service_runtime/nacl_tls.h"
+#include "native_client/src/trusted/service_runtime/nacl_vvar.h"
 #include "native_client/src/trusted/service_runtime/sel_ldr.h"
 
 #include "native_client/src/trusted/dyn_ldr/datastructures/ds_stack.h"
@@ -69,6 +72,16 @@ void NaClAddSyscall(struct NaClApp *nap, uint32_t num,
   nap->syscall_table[num].handler = fn;
 }
 
+void NaClAddFastSyscall(struct NaClApp *nap, uint32_t num,
+                        int32_t (*fn)(struct NaClAppThread *,
+                                      uint32_t, uint32_t)) {
+  CHECK(num < NACL_MAX_SYSCALLS);
+  if (nap->syscall_table[num].handler == &NaClSysNotImplementedDecoder) {
+    NaClLog(LOG_FATAL, "Fast handler for unregistered syscall %d\n", num);
+  }
+  nap->syscall_table[num].fast_handler = fn;
+}
+
 int32_t NaClSysNull(struct NaClAppThread *natp) {
   UNREFERENCED_PARAMETER(natp);
   return 0;
@@ -308,8 +321,21 @@ int32_t NaClSysExitSandbox(struct NaClAppThread *natp, uint32_t exitLocation,
   return 0;
 }
 
+/*
+ * The sandbox faulted while the callback ran (in a call it made back
+ * into the sandbox), so the untrusted code that made the callback must
+ * not be resumed.  Unwind to the call that entered the sandbox, as
+ * NaClSysExitSandbox would, with a zero return value.
+ */
+static void NaClCallbackUnwindFault(struct NaClAppThread *natp) {
+  natp->register_eax = 0;
+  natp->register_xmm0 = 0;
+  longjmp(*Stack_GetTopPtrForPop(natp->jumpBufferStack), 1);
+}
+
 //NACL_sys_callback
 nacl_reg_t NaClSysCallback(struct NaClAppThread *natp, uint32_t callbackSlotNumber, uint32_t parameterRegisters, uint32_t retAddr) {
+  NACL_PERF_STATS_DECLARE_TIMER(start)
 
   // NaClLog(LOG_INFO, "Entered NaClSysCallback: %"PRIu32"\n", callbackSlotNumber);
 
@@ -342,7 +368,18 @@ nacl_reg_t NaClSysCallback(struct NaClAppThread *natp, uint32_t callbackSlotNumb
 
       // NaClLog(LOG_INFO, "Making NaClSysCallback: %"PRIu32"\n", callbackSlotNumber);
       func = (RegPtrPtrFunc) (natp->nap->callbackSlot[callbackSlotNumber]);
+      if (natp->nap->callback_hook != NULL) {
+        natp->nap->callback_hook(natp, callbackSlotNumber, 0);
+      }
+      NACL_PERF_STATS_TIMER_START(start);
       func(natp->nap->custom_app_state, natp->nap->callbackSlotState[callbackSlotNumber], returnBufferAddr);
+      NACL_PERF_STATS_TIMER_RECORD("service_runtime/callback", start);
+      if (natp->nap->callback_hook != NULL) {
+        natp->nap->callback_hook(natp, callbackSlotNumber, 1);
+      }
+      if (natp->nap->fault_signal != 0) {
+        NaClCallbackUnwindFault(natp);
+      }
 
       natp->user.ebx          = saved_ebx;
       natp->user.esi          = saved_esi;
@@ -377,7 +414,18 @@ nacl_reg_t NaClSysCallback(struct NaClAppThread *natp, uint32_t callbackSlotNumb
 
       // NaClLog(LOG_INFO, "Making NaClSysCallback: %"PRIu32"\n", callbackSlotNumber);
       func = (RegPtrPtrFunc) (natp->nap->callbackSlot[callbackSlotNumber]);
+      if (natp->nap->callback_hook != NULL) {
+        natp->nap->callback_hook(natp, callbackSlotNumber, 0);
+      }
+      NACL_PERF_STATS_TIMER_START(start);
       func(natp->nap->custom_app_state, natp->nap->callbackSlotState[callbackSlotNumber], returnBufferAddr);
+      NACL_PERF_STATS_TIMER_RECORD("service_runtime/callback", start);
+      if (natp->nap->callback_hook != NULL) {
+        natp->nap->callback_hook(natp, callbackSlotNumber, 1);
+      }
+      if (natp->nap->fault_signal != 0) {
+        NaClCallbackUnwindFault(natp);
+      }
 
       natp->user.rbx          = saved_rbx;
       natp->user.r12          = saved_r12;
@@ -1150,6 +1198,10 @@ static int32_t NaClSysClockGetCommon(struct NaClAppThread  *natp,
   /* memset() call is required to clear padding in struct nacl_abi_timespec. */
   memset(&out_buf, 0, sizeof(out_buf));
   retval = (*timefunc)((nacl_clockid_t) clk_id, &out_buf);
+  if (0 == retval && NaClClockGetTime == timefunc &&
+      NACL_ABI_CLOCK_MONOTONIC == clk_id) {
+    NaClVvarClampMonotonic(nap, &out_buf);
+  }
   if (0 == retval) {
     if (ts_addr == 0 ? !null_ok :
         !NaClCopyOutToUser(nap, (uintptr_t) ts_addr,
@@ -1171,6 +1223,14 @@ int32_t NaClSysClockGetRes(struct NaClAppThread *natp,
 int32_t NaClSysClockGetTime(struct NaClAppThread  *natp,
                             int                   clk_id,
                             uint32_t              tsp) {
+  /*
+   * Untrusted code falls back to this syscall when the vvar page's
+   * snapshot is stale, so this is where it gets refreshed.
+   */
+  if (NACL_ABI_CLOCK_REALTIME == clk_id ||
+      NACL_ABI_CLOCK_MONOTONIC == clk_id) {
+    NaClVvarUpdate(natp->nap);
+  }
   return NaClSysClockGetCommon(natp, clk_id, (uintptr_t) tsp,
                                NaClClockGetTime, 0);
 }
@@ -31,6 +31,10 @@ int32_t NaClSysNotImplementedDecoder(struct NaClAppThread *natp);
 void NaClAddSyscall(struct NaClApp *nap, uint32_t num,
                     int32_t (*fn)(struct NaClAppThread *));
 
+void NaClAddFastSyscall(struct NaClApp *nap, uint32_t num,
+                        int32_t (*fn)(struct NaClAppThread *,
+                                      uint32_t, uint32_t));
+
 int32_t NaClSysNull(struct NaClAppThread *natp);
 
 int NaClHighResolutionTimerEnabled(void);
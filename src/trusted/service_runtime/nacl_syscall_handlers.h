@@ -14,6 +14,14 @@ struct NaClAppThread;
 
 struct NaClSyscallTableEntry {
   int32_t (*handler)(struct NaClAppThread *natp);
+  /*
+   * Optional handler taking the first two syscall arguments in
+   * registers, used by NaClSyscallFastHook().  It is called without
+   * the suspend state switched to NACL_APP_THREAD_TRUSTED, so it must
+   * be short and must not block.
+   */
+  int32_t (*fast_handler)(struct NaClAppThread *natp,
+                          uint32_t arg1, uint32_t arg2);
 };
 
 #endif
@@ -18,6 +18,7 @@
 #include "native_client/src/include/nacl_compiler_annotations.h"
 #include "native_client/src/shared/platform/nacl_exit.h"
 #include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/trusted/perf_counter/nacl_perf_stats.h"
 #include "native_client/src/trusted/service_runtime/nacl_globals.h"
 #include "native_client/src/trusted/service_runtime/nacl_config.h"
 #include "native_client/src/trusted/service_runtime/nacl_copy.h"
@@ -88,6 +89,32 @@ static void HandleStackContext(struct NaClAppThread *natp,
   *sp_user_out = sp_user;
 }
 
+/*
+ * Per-thread syscall counts and time in untrusted code, for dyn_ldr's
+ * per-sandbox statistics.  These only touch the thread's own fields,
+ * so they are cheap enough to always run.  Each returns the time it
+ * read, which the service_runtime/syscall timer reuses rather than
+ * reading the time stamp counter again.
+ */
+static INLINE uint64_t NaClSyscallStatsEnter(struct NaClAppThread *natp,
+                                             size_t sysnum) {
+  uint64_t now = NaClPerfStatsTicks();
+
+  if (NACL_LIKELY(sysnum < NACL_MAX_SYSCALLS)) {
+    natp->syscall_counts[sysnum]++;
+  }
+  if (0 != natp->untrusted_since) {
+    natp->untrusted_ticks += now - natp->untrusted_since;
+    natp->untrusted_since = 0;
+  }
+  return now;
+}
+
+static INLINE uint64_t NaClSyscallStatsLeave(struct NaClAppThread *natp) {
+  natp->untrusted_since = NaClPerfStatsTicks();
+  return natp->untrusted_since;
+}
+
 struct NaClThreadContext *NaClSyscallCSegHook(struct NaClThreadContext *ntcp) {
   struct NaClAppThread      *natp = NaClAppThreadFromThreadContext(ntcp);
   struct NaClApp            *nap;
@@ -95,6 +122,8 @@ struct NaClThreadContext *NaClSyscallCSegHook(struct NaClThreadContext *ntcp) {
   size_t                    sysnum;
   uintptr_t                 sp_user;
   uint32_t                  sysret;
+  uint64_t                  ticks;
+  NACL_PERF_STATS_DECLARE_TIMER(start)
 
   /*
    * Mark the thread as running on a trusted stack as soon as possible
@@ -121,6 +150,8 @@ struct NaClThreadContext *NaClSyscallCSegHook(struct NaClThreadContext *ntcp) {
    */
 
   sysnum = (tramp_ret - NACL_SYSCALL_START_ADDR) >> NACL_SYSCALL_BLOCK_SHIFT;
+  ticks = NaClSyscallStatsEnter(natp, sysnum);
+  NACL_PERF_STATS_TIMER_START_FROM(start, ticks);
 
   NaClLog(4, "Entering syscall %"NACL_PRIuS
           ": return address 0x%08"NACL_PRIxNACL_REG"\n",
@@ -155,6 +186,13 @@ struct NaClThreadContext *NaClSyscallCSegHook(struct NaClThreadContext *ntcp) {
           sysnum, sysret, sysret);
   natp->user.sysret = sysret;
 
+  /*
+   * The first record on a thread allocates, so this has to come
+   * before the thread can be suspended again.
+   */
+  ticks = NaClSyscallStatsLeave(natp);
+  NACL_PERF_STATS_TIMER_RECORD_TO("service_runtime/syscall", start, ticks);
+
   /*
    * After this NaClAppThreadSetSuspendState() call, we should not
    * claim any mutexes, otherwise we risk deadlock.
@@ -168,3 +206,46 @@ struct NaClThreadContext *NaClSyscallCSegHook(struct NaClThreadContext *ntcp) {
    */
   return ntcp;
 }
+
+#if NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && NACL_BUILD_SUBARCH == 64 && \
+    NACL_LINUX
+/*
+ * Entry point for the register-argument fast path in nacl_syscall_64.S.
+ * The trampoline has already decoded |sysnum| and checked that it is
+ * below NACL_MAX_SYSCALLS, and passes the first two syscall arguments
+ * in registers.
+ *
+ * Syscalls with a fast_handler are run without the suspend state
+ * transitions, the copy lock and the argument decoder.  This is only
+ * safe while nothing can suspend the thread and look at its registers,
+ * so the embedder has to opt in with nap->enable_syscall_fast_path.
+ * Otherwise, and for all other syscalls, we take the generic path.
+ */
+struct NaClThreadContext *NaClSyscallFastHook(struct NaClThreadContext *ntcp,
+                                              uint32_t arg1,
+                                              uint32_t arg2,
+                                              uint32_t sysnum) {
+  struct NaClAppThread      *natp = NaClAppThreadFromThreadContext(ntcp);
+  struct NaClApp            *nap = natp->nap;
+  int32_t                   (*handler)(struct NaClAppThread *natp,
+                                       uint32_t arg1, uint32_t arg2);
+  uintptr_t                 sp_sys;
+  nacl_reg_t                user_ret;
+
+  handler = nap->syscall_table[sysnum].fast_handler;
+  if (NULL == handler || !nap->enable_syscall_fast_path) {
+    return NaClSyscallCSegHook(ntcp);
+  }
+
+  /* As in HandleStackContext(). */
+  sp_sys = NaClUserToSysStackAddr(nap, NaClGetThreadCtxSp(&natp->user));
+  user_ret = *(volatile uintptr_t *) (sp_sys + NACL_USERRET_FIX);
+  natp->user.new_prog_ctr =
+      (nacl_reg_t) NaClSandboxCodeAddr(nap, (uintptr_t) user_ret);
+
+  (void) NaClSyscallStatsEnter(natp, sysnum);
+  natp->user.sysret = (*handler)(natp, arg1, arg2);
+  (void) NaClSyscallStatsLeave(natp);
+  return ntcp;
+}
+#endif
@@ -24,7 +24,7 @@
  * syscall arguments and call the syscall implementation functions listed
  * here.
  */
-NACL_DEFINE_SYSCALL_0(NaClSysNull)
+NACL_DEFINE_FAST_SYSCALL_0(NaClSysNull)
 NACL_DEFINE_SYSCALL_1(NaClSysDup)
 NACL_DEFINE_SYSCALL_2(NaClSysDup2)
 NACL_DEFINE_SYSCALL_3(NaClSysOpen)
@@ -47,8 +47,8 @@ NACL_DEFINE_SYSCALL_1(NaClSysThreadExit)
 NACL_DEFINE_SYSCALL_1(NaClSysGetTimeOfDay)
 NACL_DEFINE_SYSCALL_0(NaClSysClock)
 NACL_DEFINE_SYSCALL_2(NaClSysNanosleep)
-NACL_DEFINE_SYSCALL_2(NaClSysClockGetRes)
-NACL_DEFINE_SYSCALL_2(NaClSysClockGetTime)
+NACL_DEFINE_FAST_SYSCALL_2(NaClSysClockGetRes)
+NACL_DEFINE_FAST_SYSCALL_2(NaClSysClockGetTime)
 NACL_DEFINE_SYSCALL_2(NaClSysMkdir)
 NACL_DEFINE_SYSCALL_1(NaClSysRmdir)
 NACL_DEFINE_SYSCALL_1(NaClSysChdir)
@@ -78,7 +78,7 @@ NACL_DEFINE_SYSCALL_3(NaClSysImcRecvmsg)
 NACL_DEFINE_SYSCALL_1(NaClSysImcMemObjCreate)
 NACL_DEFINE_SYSCALL_1(NaClSysTlsInit)
 NACL_DEFINE_SYSCALL_4(NaClSysThreadCreate)
-NACL_DEFINE_SYSCALL_0(NaClSysTlsGet)
+NACL_DEFINE_FAST_SYSCALL_0(NaClSysTlsGet)
 NACL_DEFINE_SYSCALL_1(NaClSysThreadNice)
 NACL_DEFINE_SYSCALL_0(NaClSysMutexCreate)
 NACL_DEFINE_SYSCALL_1(NaClSysMutexLock)
@@ -99,21 +99,22 @@ NACL_DEFINE_SYSCALL_2(NaClSysSysconf)
 NACL_DEFINE_SYSCALL_3(NaClSysDyncodeCreate)
 NACL_DEFINE_SYSCALL_3(NaClSysDyncodeModify)
 NACL_DEFINE_SYSCALL_2(NaClSysDyncodeDelete)
+NACL_DEFINE_SYSCALL_2(NaClSysDyncodeCreateBatch)
 NACL_DEFINE_SYSCALL_1(NaClSysSecondTlsSet)
 NACL_DEFINE_SYSCALL_5(NaClSysExitSandbox)
 NACL_DEFINE_SYSCALL_3(NaClSysCallback)
-NACL_DEFINE_SYSCALL_0(NaClSysSecondTlsGet)
+NACL_DEFINE_FAST_SYSCALL_0(NaClSysSecondTlsGet)
 NACL_DEFINE_SYSCALL_2(NaClSysExceptionHandler)
 NACL_DEFINE_SYSCALL_2(NaClSysExceptionStack)
 NACL_DEFINE_SYSCALL_0(NaClSysExceptionClearFlag)
 NACL_DEFINE_SYSCALL_0(NaClSysTestInfoLeak)
 NACL_DEFINE_SYSCALL_1(NaClSysTestCrash)
 NACL_DEFINE_SYSCALL_3(NaClSysFutexWaitAbs)
-NACL_DEFINE_SYSCALL_2(NaClSysFutexWake)
+NACL_DEFINE_FAST_SYSCALL_2(NaClSysFutexWake)
 NACL_DEFINE_SYSCALL_2(NaClSysGetRandomBytes)
 
 void NaClAppRegisterDefaultSyscalls(struct NaClApp *nap) {
-  NACL_REGISTER_SYSCALL(nap, NaClSysNull, NACL_sys_null);
+  NACL_REGISTER_FAST_SYSCALL(nap, NaClSysNull, NACL_sys_null);
   NACL_REGISTER_SYSCALL(nap, NaClSysDup, NACL_sys_dup);
   NACL_REGISTER_SYSCALL(nap, NaClSysDup2, NACL_sys_dup2);
   NACL_REGISTER_SYSCALL(nap, NaClSysOpen, NACL_sys_open);
@@ -136,8 +137,8 @@ void NaClAppRegisterDefaultSyscalls(struct NaClApp *nap) {
   NACL_REGISTER_SYSCALL(nap, NaClSysGetTimeOfDay, NACL_sys_gettimeofday);
   NACL_REGISTER_SYSCALL(nap, NaClSysClock, NACL_sys_clock);
   NACL_REGISTER_SYSCALL(nap, NaClSysNanosleep, NACL_sys_nanosleep);
-  NACL_REGISTER_SYSCALL(nap, NaClSysClockGetRes, NACL_sys_clock_getres);
-  NACL_REGISTER_SYSCALL(nap, NaClSysClockGetTime, NACL_sys_clock_gettime);
+  NACL_REGISTER_FAST_SYSCALL(nap, NaClSysClockGetRes, NACL_sys_clock_getres);
+  NACL_REGISTER_FAST_SYSCALL(nap, NaClSysClockGetTime, NACL_sys_clock_gettime);
   NACL_REGISTER_SYSCALL(nap, NaClSysMkdir, NACL_sys_mkdir);
   NACL_REGISTER_SYSCALL(nap, NaClSysRmdir, NACL_sys_rmdir);
   NACL_REGISTER_SYSCALL(nap, NaClSysChdir, NACL_sys_chdir);
@@ -169,7 +170,7 @@ void NaClAppRegisterDefaultSyscalls(struct NaClApp *nap) {
                         NACL_sys_imc_mem_obj_create);
   NACL_REGISTER_SYSCALL(nap, NaClSysTlsInit, NACL_sys_tls_init);
   NACL_REGISTER_SYSCALL(nap, NaClSysThreadCreate, NACL_sys_thread_create);
-  NACL_REGISTER_SYSCALL(nap, NaClSysTlsGet, NACL_sys_tls_get);
+  NACL_REGISTER_FAST_SYSCALL(nap, NaClSysTlsGet, NACL_sys_tls_get);
   NACL_REGISTER_SYSCALL(nap, NaClSysThreadNice, NACL_sys_thread_nice);
   NACL_REGISTER_SYSCALL(nap, NaClSysMutexCreate, NACL_sys_mutex_create);
   NACL_REGISTER_SYSCALL(nap, NaClSysMutexLock, NACL_sys_mutex_lock);
@@ -191,10 +192,12 @@ void NaClAppRegisterDefaultSyscalls(struct NaClApp *nap) {
   NACL_REGISTER_SYSCALL(nap, NaClSysDyncodeCreate, NACL_sys_dyncode_create);
   NACL_REGISTER_SYSCALL(nap, NaClSysDyncodeModify, NACL_sys_dyncode_modify);
   NACL_REGISTER_SYSCALL(nap, NaClSysDyncodeDelete, NACL_sys_dyncode_delete);
+  NACL_REGISTER_SYSCALL(nap, NaClSysDyncodeCreateBatch,
+                        NACL_sys_dyncode_create_batch);
   NACL_REGISTER_SYSCALL(nap, NaClSysSecondTlsSet, NACL_sys_second_tls_set);
   NACL_REGISTER_SYSCALL(nap, NaClSysExitSandbox, NACL_sys_exit_sandbox);
   NACL_REGISTER_SYSCALL(nap, NaClSysCallback, NACL_sys_callback);
-  NACL_REGISTER_SYSCALL(nap, NaClSysSecondTlsGet, NACL_sys_second_tls_get);
+  NACL_REGISTER_FAST_SYSCALL(nap, NaClSysSecondTlsGet, NACL_sys_second_tls_get);
   NACL_REGISTER_SYSCALL(nap, NaClSysExceptionHandler,
                         NACL_sys_exception_handler);
   NACL_REGISTER_SYSCALL(nap, NaClSysExceptionStack, NACL_sys_exception_stack);
@@ -203,6 +206,6 @@ void NaClAppRegisterDefaultSyscalls(struct NaClApp *nap) {
   NACL_REGISTER_SYSCALL(nap, NaClSysTestInfoLeak, NACL_sys_test_infoleak);
   NACL_REGISTER_SYSCALL(nap, NaClSysTestCrash, NACL_sys_test_crash);
   NACL_REGISTER_SYSCALL(nap, NaClSysFutexWaitAbs, NACL_sys_futex_wait_abs);
-  NACL_REGISTER_SYSCALL(nap, NaClSysFutexWake, NACL_sys_futex_wake);
+  NACL_REGISTER_FAST_SYSCALL(nap, NaClSysFutexWake, NACL_sys_futex_wake);
   NACL_REGISTER_SYSCALL(nap, NaClSysGetRandomBytes, NACL_sys_get_random_bytes);
 }
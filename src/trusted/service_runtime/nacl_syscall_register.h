@@ -23,6 +23,11 @@
  *  * NACL_REGISTER_SYSCALL(Func, SysNum) registers the syscall implemented
  *    by Func() at run time, with syscall number |SysNum|.
  *
+ *  * NACL_DEFINE_FAST_SYSCALL_<N>(Func) and NACL_REGISTER_FAST_SYSCALL()
+ *    are the same, for N <= 2, but also give the syscall a handler that
+ *    NaClSyscallFastHook() calls with the arguments in registers.  Only
+ *    use these for syscalls that are short and never block.
+ *
  * Example usage:
  *
  *   NACL_DEFINE_SYSCALL_3(NaClSysRead)
@@ -84,4 +89,35 @@
 #define NACL_REGISTER_SYSCALL(NAP, FUNC, NUM) \
     NaClAddSyscall((NAP), (NUM), FUNC##Decoder)
 
+
+#define NACL_DEFINE_FAST_SYSCALL_0(FUNC) \
+    NACL_DEFINE_SYSCALL_0(FUNC) \
+    static int32_t FUNC##FastDecoder(struct NaClAppThread *natp, \
+                                     uint32_t arg1, uint32_t arg2) { \
+      UNREFERENCED_PARAMETER(arg1); \
+      UNREFERENCED_PARAMETER(arg2); \
+      return FUNC(natp); \
+    }
+
+#define NACL_DEFINE_FAST_SYSCALL_1(FUNC) \
+    NACL_DEFINE_SYSCALL_1(FUNC) \
+    static int32_t FUNC##FastDecoder(struct NaClAppThread *natp, \
+                                     uint32_t arg1, uint32_t arg2) { \
+      UNREFERENCED_PARAMETER(arg2); \
+      return FUNC(natp, arg1); \
+    }
+
+#define NACL_DEFINE_FAST_SYSCALL_2(FUNC) \
+    NACL_DEFINE_SYSCALL_2(FUNC) \
+    static int32_t FUNC##FastDecoder(struct NaClAppThread *natp, \
+                                     uint32_t arg1, uint32_t arg2) { \
+      return FUNC(natp, arg1, arg2); \
+    }
+
+#define NACL_REGISTER_FAST_SYSCALL(NAP, FUNC, NUM) \
+    do { \
+      NaClAddSyscall((NAP), (NUM), FUNC##Decoder); \
+      NaClAddFastSyscall((NAP), (NUM), FUNC##FastDecoder); \
+    } while (0)
+
 #endif
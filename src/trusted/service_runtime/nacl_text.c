@@ -4,6 +4,7 @@
  * found in the LICENSE file.
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "native_client/src/include/build_config.h"
@@ -23,7 +24,9 @@
 #include "native_client/src/trusted/service_runtime/arch/sel_ldr_arch.h"
 #include "native_client/src/trusted/service_runtime/include/bits/mman.h"
 #include "native_client/src/trusted/service_runtime/include/sys/errno.h"
+#include "native_client/src/trusted/service_runtime/include/sys/nacl_dyncode.h"
 #include "native_client/src/trusted/service_runtime/nacl_app_thread.h"
+#include "native_client/src/trusted/service_runtime/nacl_copy.h"
 #include "native_client/src/trusted/service_runtime/nacl_error_code.h"
 #include "native_client/src/trusted/service_runtime/nacl_text.h"
 #include "native_client/src/trusted/service_runtime/sel_ldr.h"
@@ -213,6 +216,15 @@ NaClErrorCode NaClMakeDynamicTextShared(struct NaClApp *nap) {
   if (text_sysaddr != mmap_ret) {
     NaClLog(LOG_FATAL, "Could not map in shm for dynamic text region\n");
   }
+  if (nap->huge_pages) {
+    /* Takes effect if the host allows huge pages for shmem. */
+    NaClAdviseHugePages((void *) text_sysaddr, dynamic_text_size);
+  }
+  if (nap->numa_node >= 0) {
+    /* Sets the policy of the shm itself, so it covers every mapping of it. */
+    (void) NaClBindNumaNode((void *) text_sysaddr, dynamic_text_size,
+                            nap->numa_node);
+  }
 
   nap->dynamic_page_bitmap =
     BitmapAllocate((uint32_t) (dynamic_text_size / NACL_MAP_PAGESIZE));
@@ -658,29 +670,22 @@ static INLINE void NaClTextMapClearCacheIfNeeded(struct NaClApp *nap,
   }
 }
 
-int32_t NaClTextDyncodeCreate(struct NaClApp *nap,
-                              uint32_t       dest,
-                              void           *code_copy,
-                              uint32_t       size,
-                              const struct NaClValidationMetadata *metadata) {
-  uintptr_t                   dest_addr;
-  uint8_t                     *mapped_addr;
-  int32_t                     retval = -NACL_ABI_EINVAL;
-  int                         validator_result;
-  struct NaClPerfCounter      time_dyncode_create;
-  NaClPerfCounterCtor(&time_dyncode_create, "NaClTextDyncodeCreate");
-
-  if (NULL == nap->text_shm) {
-    NaClLog(1, "NaClTextDyncodeCreate: Dynamic loading not enabled\n");
-    return -NACL_ABI_EINVAL;
-  }
+/*
+ * Checks that [dest, dest+size) is a bundle-aligned range inside the
+ * dynamic code area, and stores its system address in *dest_addr.
+ * Returns 0 on success, or a negated NaCl ABI errno.
+ */
+static int32_t CheckDyncodeDest(struct NaClApp *nap,
+                                uint32_t       dest,
+                                uint32_t       size,
+                                uintptr_t      *dest_addr) {
   if (0 != (dest & (nap->bundle_size - 1)) ||
       0 != (size & (nap->bundle_size - 1))) {
     NaClLog(1, "NaClTextDyncodeCreate: Non-bundle-aligned address or size\n");
     return -NACL_ABI_EINVAL;
   }
-  dest_addr = NaClUserToSysAddrRange(nap, dest, size);
-  if (kNaClBadAddress == dest_addr) {
+  *dest_addr = NaClUserToSysAddrRange(nap, dest, size);
+  if (kNaClBadAddress == *dest_addr) {
     NaClLog(1, "NaClTextDyncodeCreate: Dest address out of range\n");
     return -NACL_ABI_EFAULT;
   }
@@ -696,6 +701,58 @@ int32_t NaClTextDyncodeCreate(struct NaClApp *nap,
     NaClLog(1, "NaClTextDyncodeCreate: Above dynamic code area\n");
     return -NACL_ABI_EFAULT;
   }
+  return 0;
+}
+
+/*
+ * Validates code_copy for installation at dest, honouring the
+ * skip_validator and ignore_validator_result debug options.
+ * Caller must hold nap->dynamic_load_mutex.
+ * Returns boolean, true if the code may be installed.
+ */
+static int ValidateDyncode(struct NaClApp *nap,
+                           uint32_t       dest,
+                           uint8_t        *code_copy,
+                           uint32_t       size,
+                           const struct NaClValidationMetadata *metadata) {
+  int validator_result;
+
+  if (!nap->skip_validator) {
+    validator_result = NaClValidateCode(nap, dest, code_copy, size, metadata);
+  } else {
+    NaClLog(LOG_ERROR, "VALIDATION SKIPPED.\n");
+    validator_result = LOAD_OK;
+  }
+
+  if (validator_result != LOAD_OK
+      && nap->ignore_validator_result) {
+    NaClLog(LOG_ERROR, "VALIDATION FAILED for dynamically-loaded code: "
+            "continuing anyway...\n");
+    validator_result = LOAD_OK;
+  }
+  return validator_result == LOAD_OK;
+}
+
+int32_t NaClTextDyncodeCreate(struct NaClApp *nap,
+                              uint32_t       dest,
+                              void           *code_copy,
+                              uint32_t       size,
+                              const struct NaClValidationMetadata *metadata) {
+  uintptr_t                   dest_addr;
+  uint8_t                     *mapped_addr;
+  int32_t                     retval = -NACL_ABI_EINVAL;
+  int                         validated;
+  struct NaClPerfCounter      time_dyncode_create;
+  NaClPerfCounterCtor(&time_dyncode_create, "NaClTextDyncodeCreate");
+
+  if (NULL == nap->text_shm) {
+    NaClLog(1, "NaClTextDyncodeCreate: Dynamic loading not enabled\n");
+    return -NACL_ABI_EINVAL;
+  }
+  retval = CheckDyncodeDest(nap, dest, size, &dest_addr);
+  if (0 != retval) {
+    return retval;
+  }
   if (0 == size) {
     /* Nothing to load.  Succeed trivially. */
     return 0;
@@ -708,25 +765,13 @@ int32_t NaClTextDyncodeCreate(struct NaClApp *nap,
    * to delete the region if validation fails.
    * See: http://code.google.com/p/nativeclient/issues/detail?id=2566
    */
-  if (!nap->skip_validator) {
-    validator_result = NaClValidateCode(nap, dest, code_copy, size, metadata);
-  } else {
-    NaClLog(LOG_ERROR, "VALIDATION SKIPPED.\n");
-    validator_result = LOAD_OK;
-  }
+  validated = ValidateDyncode(nap, dest, code_copy, size, metadata);
 
   NaClPerfCounterMark(&time_dyncode_create,
                       NACL_PERF_IMPORTANT_PREFIX "DynRegionValidate");
   NaClPerfCounterIntervalLast(&time_dyncode_create);
 
-  if (validator_result != LOAD_OK
-      && nap->ignore_validator_result) {
-    NaClLog(LOG_ERROR, "VALIDATION FAILED for dynamically-loaded code: "
-            "continuing anyway...\n");
-    validator_result = LOAD_OK;
-  }
-
-  if (validator_result != LOAD_OK) {
+  if (!validated) {
     NaClLog(1, "NaClTextDyncodeCreate: "
             "Validation of dynamic code failed\n");
     retval = -NACL_ABI_EINVAL;
@@ -802,6 +847,215 @@ int32_t NaClSysDyncodeCreate(struct NaClAppThread *natp,
   return retval;
 }
 
+static int CompareDyncodeRegions(const void *a, const void *b) {
+  const struct NaClDyncodeRegion *ra = (const struct NaClDyncodeRegion *) a;
+  const struct NaClDyncodeRegion *rb = (const struct NaClDyncodeRegion *) b;
+
+  if (ra->dest != rb->dest) {
+    return ra->dest < rb->dest ? -1 : 1;
+  }
+  return 0;
+}
+
+int32_t NaClSysDyncodeCreateBatch(struct NaClAppThread *natp,
+                                  uint32_t             regions,
+                                  uint32_t             count) {
+  struct NaClApp              *nap = natp->nap;
+  struct NaClDyncodeRegion    *region_list = NULL;
+  uint8_t                     *code_copy = NULL;
+  uint8_t                     *code;
+  uint8_t                     *mapped_addr;
+  uintptr_t                   dest_addr;
+  uintptr_t                   src_addr;
+  uint32_t                    span_start;
+  uint32_t                    span_size;
+  uint32_t                    total_size;
+  uint32_t                    i;
+  int32_t                     retval = -NACL_ABI_EINVAL;
+
+  if (!nap->enable_dyncode_syscalls) {
+    NaClLog(LOG_WARNING,
+            "NaClSysDyncodeCreateBatch: Dynamic code syscalls are disabled\n");
+    return -NACL_ABI_ENOSYS;
+  }
+  if (NULL == nap->text_shm) {
+    NaClLog(1, "NaClSysDyncodeCreateBatch: Dynamic loading not enabled\n");
+    return -NACL_ABI_EINVAL;
+  }
+  if (0 == count) {
+    return 0;
+  }
+  if (count > NACL_ABI_DYNCODE_BATCH_MAX) {
+    NaClLog(1, "NaClSysDyncodeCreateBatch: Too many regions\n");
+    return -NACL_ABI_EINVAL;
+  }
+
+  region_list = malloc(count * sizeof *region_list);
+  if (NULL == region_list) {
+    return -NACL_ABI_ENOMEM;
+  }
+  if (!NaClCopyInFromUser(nap, region_list, regions,
+                          count * sizeof *region_list)) {
+    retval = -NACL_ABI_EFAULT;
+    goto cleanup;
+  }
+
+  /*
+   * Check every region on its own, then sort them by address so that
+   * overlaps within the batch are found in one pass.  The regions do
+   * not overlap and all lie in the dynamic code area, so their total
+   * size cannot overflow.
+   */
+  for (i = 0; i < count; i++) {
+    retval = CheckDyncodeDest(nap, region_list[i].dest, region_list[i].size,
+                              &dest_addr);
+    if (0 != retval) {
+      goto cleanup;
+    }
+    if (kNaClBadAddress == NaClUserToSysAddrRange(nap, region_list[i].src,
+                                                  region_list[i].size)) {
+      NaClLog(1, "NaClSysDyncodeCreateBatch: Source address out of range\n");
+      retval = -NACL_ABI_EFAULT;
+      goto cleanup;
+    }
+  }
+  qsort(region_list, count, sizeof *region_list, CompareDyncodeRegions);
+  total_size = region_list[0].size;
+  for (i = 1; i < count; i++) {
+    if (region_list[i - 1].dest + region_list[i - 1].size >
+        region_list[i].dest) {
+      NaClLog(1, "NaClSysDyncodeCreateBatch: Regions overlap\n");
+      retval = -NACL_ABI_EINVAL;
+      goto cleanup;
+    }
+    total_size += region_list[i].size;
+  }
+  if (0 == total_size) {
+    /* Nothing to load.  Succeed trivially. */
+    retval = 0;
+    goto cleanup;
+  }
+
+  /*
+   * Make a private copy of all the code, so that we can validate it
+   * without a TOCTTOU race condition.
+   */
+  code_copy = malloc(total_size);
+  if (NULL == code_copy) {
+    retval = -NACL_ABI_ENOMEM;
+    goto cleanup;
+  }
+  code = code_copy;
+  for (i = 0; i < count; i++) {
+    src_addr = NaClUserToSys(nap, region_list[i].src);
+    memcpy(code, (uint8_t *) src_addr, region_list[i].size);
+    code += region_list[i].size;
+  }
+
+  NaClXMutexLock(&nap->dynamic_load_mutex);
+
+  /*
+   * Nothing is installed until every region has validated and is known
+   * to be free, so that a failure leaves the address space unchanged.
+   */
+  code = code_copy;
+  for (i = 0; i < count; i++) {
+    if (!ValidateDyncode(nap, region_list[i].dest, code, region_list[i].size,
+                         NULL)) {
+      NaClLog(1, "NaClSysDyncodeCreateBatch: "
+              "Validation of dynamic code failed\n");
+      retval = -NACL_ABI_EINVAL;
+      goto cleanup_unlock;
+    }
+    code += region_list[i].size;
+  }
+  for (i = 0; i < count; i++) {
+    if (0 != region_list[i].size &&
+        NULL != NaClDynamicRegionFind(nap,
+                                      NaClUserToSys(nap, region_list[i].dest),
+                                      region_list[i].size)) {
+      NaClLog(1, "NaClSysDyncodeCreateBatch: Code range already allocated\n");
+      retval = -NACL_ABI_EINVAL;
+      goto cleanup_unlock;
+    }
+  }
+
+  /*
+   * One writable mapping covers the whole batch.  As with the tail of a
+   * page in NaClTextDyncodeCreate, any pages between the regions become
+   * visible filled with halts.
+   */
+  span_start = region_list[0].dest;
+  span_size = region_list[count - 1].dest + region_list[count - 1].size -
+      span_start;
+  if (!NaClTextMapWrapper(nap, span_start, span_size, &mapped_addr)) {
+    retval = -NACL_ABI_ENOMEM;
+    goto cleanup_unlock;
+  }
+
+  code = code_copy;
+  for (i = 0; i < count; i++) {
+    if (0 == region_list[i].size) {
+      continue;
+    }
+    dest_addr = NaClUserToSys(nap, region_list[i].dest);
+    if (NaClDynamicRegionCreate(nap, dest_addr, region_list[i].size, 0) != 1) {
+      NaClLog(LOG_FATAL, "NaClSysDyncodeCreateBatch: "
+              "Checked code range already allocated\n");
+    }
+    CopyCodeSafelyInitial(mapped_addr + (region_list[i].dest - span_start),
+                          code, region_list[i].size, nap->bundle_size);
+    code += region_list[i].size;
+  }
+  /* A single instruction cache flush for the whole batch. */
+  NaClFlushCacheForDoublyMappedCode(mapped_addr,
+                                    (uint8_t *) NaClUserToSys(nap, span_start),
+                                    span_size);
+
+  retval = 0;
+
+  NaClTextMapClearCacheIfNeeded(nap, span_start, span_size);
+
+ cleanup_unlock:
+  NaClXMutexUnlock(&nap->dynamic_load_mutex);
+ cleanup:
+  free(code_copy);
+  free(region_list);
+  return retval;
+}
+
+/*
+ * Finds the first run of consecutive bundles at or after offset
+ * |*run_begin| in which |data_new| differs from |data_old|, and stores its
+ * bounds in |*run_begin| and |*run_end|.  Returns 0 if all the remaining
+ * bundles are unchanged.
+ */
+static int NextChangedBundleRun(const uint8_t *data_old,
+                                const uint8_t *data_new,
+                                uint32_t size,
+                                uint32_t bundle_size,
+                                uint32_t *run_begin,
+                                uint32_t *run_end) {
+  uint32_t begin = *run_begin;
+  uint32_t end;
+
+  while (begin < size &&
+         0 == memcmp(data_old + begin, data_new + begin, bundle_size)) {
+    begin += bundle_size;
+  }
+  if (begin >= size) {
+    return 0;
+  }
+  end = begin + bundle_size;
+  while (end < size &&
+         0 != memcmp(data_old + end, data_new + end, bundle_size)) {
+    end += bundle_size;
+  }
+  *run_begin = begin;
+  *run_end = end;
+  return 1;
+}
+
 int32_t NaClSysDyncodeModify(struct NaClAppThread *natp,
                              uint32_t             dest,
                              uint32_t             src,
@@ -812,6 +1066,8 @@ int32_t NaClSysDyncodeModify(struct NaClAppThread *natp,
   uintptr_t                   beginbundle;
   uintptr_t                   endbundle;
   uintptr_t                   offset;
+  uint32_t                    run_begin;
+  uint32_t                    run_end;
   uint8_t                     *mapped_addr;
   uint8_t                     *code_copy = NULL;
   uint8_t                     code_copy_buf[NACL_INSTR_BLOCK_SIZE];
@@ -896,12 +1152,37 @@ int32_t NaClSysDyncodeModify(struct NaClAppThread *natp,
   CHECK(endbundle-beginbundle < UINT32_MAX);
   size = (uint32_t)(endbundle - beginbundle);
 
-  /* validate this code as a replacement */
-  validator_result = NaClValidateCodeReplacement(nap,
-                                                 dest,
-                                                 (uint8_t*) dest_addr,
-                                                 code_copy,
-                                                 size);
+  /*
+   * Only the bundles that actually change are validated and copied, so
+   * patching one instruction costs the same whatever range the caller
+   * passes in.  The replacement rules keep instruction boundaries intact,
+   * so unchanged jumps between changed and unchanged bundles stay valid.
+   * A changed direct call or jump out of its run is refused when the run is
+   * validated on its own, although it may target an unchanged bundle of
+   * the request; if any run fails, the whole request is validated instead,
+   * which accepts exactly what validating the request always did.
+   */
+  run_begin = 0;
+  if (!NextChangedBundleRun((uint8_t *) dest_addr, code_copy, size,
+                            nap->bundle_size, &run_begin, &run_end)) {
+    retval = 0;
+    goto cleanup_unlock;
+  }
+
+  /* validate the changed bundles as a replacement */
+  do {
+    validator_result = NaClValidateCodeReplacement(
+        nap, dest + run_begin, (uint8_t *) dest_addr + run_begin,
+        code_copy + run_begin, run_end - run_begin);
+    run_begin = run_end;
+  } while (LOAD_OK == validator_result &&
+           NextChangedBundleRun((uint8_t *) dest_addr, code_copy, size,
+                                nap->bundle_size, &run_begin, &run_end));
+
+  if (validator_result != LOAD_OK) {
+    validator_result = NaClValidateCodeReplacement(
+        nap, dest, (uint8_t *) dest_addr, code_copy, size);
+  }
 
   if (validator_result != LOAD_OK
       && nap->ignore_validator_result) {
@@ -921,10 +1202,19 @@ int32_t NaClSysDyncodeModify(struct NaClAppThread *natp,
     goto cleanup_unlock;
   }
 
-  if (LOAD_OK != NaClCopyCode(nap, dest, mapped_addr, code_copy, size)) {
-    NaClLog(1, "NaClSysDyncodeModify: Copying of replacement code failed\n");
-    retval = -NACL_ABI_EINVAL;
-    goto cleanup_unlock;
+  run_begin = 0;
+  while (NextChangedBundleRun((uint8_t *) dest_addr, code_copy, size,
+                              nap->bundle_size, &run_begin, &run_end)) {
+    if (LOAD_OK != NaClCopyCode(nap, dest + run_begin,
+                                mapped_addr + run_begin,
+                                code_copy + run_begin,
+                                run_end - run_begin)) {
+      NaClLog(1,
+              "NaClSysDyncodeModify: Copying of replacement code failed\n");
+      retval = -NACL_ABI_EINVAL;
+      goto cleanup_unlock;
+    }
+    run_begin = run_end;
   }
   retval = 0;
 
@@ -1064,3 +1354,44 @@ void NaClDyncodeVisit(
   }
   NaClXMutexUnlock(&nap->dynamic_load_mutex);
 }
+
+int NaClDynamicTextPageIsVisible(struct NaClApp *nap, uint32_t page_index) {
+  int visible;
+
+  NaClXMutexLock(&nap->dynamic_load_mutex);
+  visible = BitmapIsBitSet(nap->dynamic_page_bitmap, page_index);
+  NaClXMutexUnlock(&nap->dynamic_load_mutex);
+  return visible;
+}
+
+int32_t NaClTextRestorePages(struct NaClApp *nap,
+                             uint32_t       offset,
+                             const void     *code,
+                             uint32_t       size) {
+  uintptr_t mapping;
+  int32_t   retval = 0;
+
+  if (NULL == nap->text_shm ||
+      0 != offset % NACL_MAP_PAGESIZE ||
+      0 != size % NACL_MAP_PAGESIZE ||
+      offset + size < offset ||
+      offset + size > nap->dynamic_text_end - nap->dynamic_text_start) {
+    return -NACL_ABI_EINVAL;
+  }
+
+  NaClXMutexLock(&nap->dynamic_load_mutex);
+  /* This makes the pages visible, just as if dyncode_create had. */
+  mapping = CachedMapWritableText(nap, offset, size);
+  if (0 == mapping) {
+    retval = -NACL_ABI_ENOMEM;
+  } else {
+    memcpy((void *) mapping, code, size);
+    NaClFlushCacheForDoublyMappedCode(
+        (uint8_t *) mapping,
+        (uint8_t *) NaClUserToSys(nap, nap->dynamic_text_start + offset),
+        size);
+    CachedMapWritableText(nap, 0, 0);
+  }
+  NaClXMutexUnlock(&nap->dynamic_load_mutex);
+  return retval;
+}
@@ -98,11 +98,42 @@ int32_t NaClSysDyncodeDelete(struct NaClAppThread *natp,
                              uint32_t             dest,
                              uint32_t             size) NACL_WUR;
 
+/*
+ * Validates and installs |count| regions described by the
+ * NaClDyncodeRegion array at untrusted address |regions|, as if by one
+ * dyncode_create call per region, but with a single mapping of the
+ * dynamic text and a single instruction cache flush.  Either all the
+ * regions are installed or none is.
+ */
+int32_t NaClSysDyncodeCreateBatch(struct NaClAppThread *natp,
+                                  uint32_t             regions,
+                                  uint32_t             count) NACL_WUR;
+
 void NaClDyncodeVisit(
     struct NaClApp *nap,
     void           (*fn)(void *state, struct NaClDynamicRegion *region),
     void           *state);
 
+/*
+ * Whether the NACL_MAP_PAGESIZE page |page_index| pages into the
+ * dynamic text region has been made visible to untrusted code, i.e.
+ * whether it holds code rather than being inaccessible.
+ */
+int NaClDynamicTextPageIsVisible(struct NaClApp *nap, uint32_t page_index);
+
+/*
+ * Copies |size| bytes of code to |offset| bytes into the dynamic text
+ * region and makes those pages visible.  Unlike dyncode_create this
+ * neither validates the code nor records a dynamic region: it is for
+ * putting back pages saved from a sandbox that already did both, before
+ * any untrusted thread runs.  |offset| and |size| must be multiples of
+ * NACL_MAP_PAGESIZE.  Returns 0 or a negated NaCl errno.
+ */
+int32_t NaClTextRestorePages(struct NaClApp *nap,
+                             uint32_t       offset,
+                             const void     *code,
+                             uint32_t       size) NACL_WUR;
+
 EXTERN_C_END
 
 #endif
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "native_client/src/trusted/service_runtime/nacl_vvar.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/include/build_config.h"
+#include "native_client/src/include/concurrency_ops.h"
+#include "native_client/src/include/nacl_platform.h"
+#include "native_client/src/shared/platform/nacl_clock.h"
+#include "native_client/src/shared/platform/nacl_host_desc.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/platform/nacl_sync.h"
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
+#include "native_client/src/trusted/desc/nacl_desc_base.h"
+#include "native_client/src/trusted/desc/nacl_desc_effector_trusted_mem.h"
+#include "native_client/src/trusted/desc/nacl_desc_imc_shm.h"
+#include "native_client/src/trusted/service_runtime/include/bits/mman.h"
+#include "native_client/src/trusted/service_runtime/include/sys/nacl_vvar.h"
+#include "native_client/src/trusted/service_runtime/sel_ldr.h"
+#include "native_client/src/trusted/service_runtime/sel_memory.h"
+
+#if NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && defined(__GNUC__)
+# define NACL_VVAR_HAVE_TSC 1
+# include <cpuid.h>
+#else
+# define NACL_VVAR_HAVE_TSC 0
+#endif
+
+/* Minimum time over which the TSC is measured before it is used. */
+#define NACL_VVAR_CALIBRATION_NS  (100 * 1000 * 1000)
+/*
+ * Untrusted code makes the syscall once the snapshot is this old.  This
+ * also bounds how long it takes for a step of the host's realtime clock
+ * to become visible.
+ */
+#define NACL_VVAR_MAX_AGE_NS      (1000 * 1000 * 1000)
+
+#define NACL_VVAR_SIZE            NACL_MAP_PAGESIZE
+
+#if NACL_VVAR_HAVE_TSC
+/*
+ * An invariant TSC runs at a constant rate in all P-, C- and T-states,
+ * which is what makes extrapolating the clocks from it meaningful.
+ */
+static int TscIsInvariant(void) {
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+    return 0;
+  }
+  return (edx & (1U << 8)) != 0;
+}
+
+static uint64_t ReadTsc(void) {
+  return __builtin_ia32_rdtsc();
+}
+
+/*
+ * The largest CLOCK_MONOTONIC value untrusted code can have read from
+ * |published| by the time the TSC reads |tsc|.  Readers stop
+ * extrapolating at tsc_max_delta, and one who read the TSC before
+ * tsc_base fails that check.
+ */
+static int64_t PublishedMonotonicNs(const struct nacl_abi_vvar *published,
+                                    uint64_t tsc) {
+  uint64_t delta = 0;
+
+  if (tsc > published->tsc_base) {
+    delta = tsc - published->tsc_base;
+    if (delta > published->tsc_max_delta) {
+      delta = published->tsc_max_delta;
+    }
+  }
+  return published->monotonic_ns +
+      (int64_t) ((delta * published->tsc_mult) >> NACL_ABI_VVAR_TSC_SHIFT);
+}
+#endif
+
+static int64_t TimespecToNs(const struct nacl_abi_timespec *ts) {
+  return (int64_t) ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+int NaClVvarCreate(struct NaClApp *nap) {
+  return NaClVvarCreateAt(nap, 0);
+}
+
+int NaClVvarCreateAt(struct NaClApp *nap, uintptr_t page_num) {
+  struct NaClDescImcShm *shm;
+  uintptr_t             writable;
+  uintptr_t             sysaddr;
+  uintptr_t             map_ret;
+
+  if (!NaClFastMutexCtor(&nap->vvar_mu)) {
+    return 0;
+  }
+  shm = (struct NaClDescImcShm *) malloc(sizeof *shm);
+  if (NULL == shm) {
+    goto cleanup_mu;
+  }
+  if (!NaClDescImcShmAllocCtor(shm, NACL_VVAR_SIZE, /* executable= */ 0)) {
+    free(shm);
+    goto cleanup_mu;
+  }
+
+  writable = (*NACL_VTBL(NaClDesc, &shm->base)->
+              Map)(&shm->base,
+                   NaClDescEffectorTrustedMem(),
+                   NULL,
+                   NACL_VVAR_SIZE,
+                   NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE,
+                   NACL_ABI_MAP_SHARED,
+                   0);
+  if (NaClPtrIsNegErrno(&writable)) {
+    NaClLog(LOG_WARNING, "NaClVvarCreate: could not map the vvar page\n");
+    goto cleanup_shm;
+  }
+
+  NaClXMutexLock(&nap->mu);
+  if (0 == page_num) {
+    page_num = NaClVmmapFindMapSpace(&nap->mem_map,
+                                     NACL_VVAR_SIZE >> NACL_PAGESHIFT);
+  }
+  if (0 == page_num) {
+    NaClXMutexUnlock(&nap->mu);
+    NaClLog(LOG_WARNING, "NaClVvarCreate: no space for the vvar page\n");
+    goto cleanup_writable;
+  }
+  sysaddr = NaClUserToSys(nap, page_num << NACL_PAGESHIFT);
+  /* As in NaClMakeDynamicTextShared(). */
+  if (NACL_WINDOWS) {
+    NaClPageFree((void *) sysaddr, NACL_VVAR_SIZE);
+  }
+  map_ret = (*NACL_VTBL(NaClDesc, &shm->base)->
+             Map)(&shm->base,
+                  NaClDescEffectorTrustedMem(),
+                  (void *) sysaddr,
+                  NACL_VVAR_SIZE,
+                  NACL_ABI_PROT_READ,
+                  NACL_ABI_MAP_SHARED | NACL_ABI_MAP_FIXED,
+                  0);
+  if (sysaddr != map_ret) {
+    NaClLog(LOG_FATAL, "NaClVvarCreate: could not map in the vvar page\n");
+  }
+  NaClVmmapAdd(&nap->mem_map,
+               page_num,
+               NACL_VVAR_SIZE >> NACL_PAGESHIFT,
+               NACL_ABI_PROT_READ,
+               NACL_ABI_MAP_SHARED,
+               &shm->base,
+               0,
+               NACL_VVAR_SIZE);
+  NaClXMutexUnlock(&nap->mu);
+
+  memset(&nap->vvar_published, 0, sizeof nap->vvar_published);
+  nap->vvar_calib_tsc = 0;
+  nap->vvar_calib_ns = 0;
+#if NACL_VVAR_HAVE_TSC
+  nap->vvar_tsc_invariant = TscIsInvariant();
+#else
+  nap->vvar_tsc_invariant = 0;
+#endif
+  nap->vvar_shm = &shm->base;
+  nap->vvar = (struct nacl_abi_vvar *) writable;
+  nap->vvar_addr = page_num << NACL_PAGESHIFT;
+
+  /* Start measuring the TSC. */
+  NaClVvarUpdate(nap);
+  return 1;
+
+ cleanup_writable:
+  NaClHostDescUnmapUnsafe((void *) writable, NACL_VVAR_SIZE);
+ cleanup_shm:
+  NaClDescUnref(&shm->base);
+ cleanup_mu:
+  NaClFastMutexDtor(&nap->vvar_mu);
+  return 0;
+}
+
+void NaClVvarUpdate(struct NaClApp *nap) {
+  struct nacl_abi_vvar      *published = &nap->vvar_published;
+  volatile struct nacl_abi_vvar *page = nap->vvar;
+  struct nacl_abi_timespec  realtime;
+  struct nacl_abi_timespec  monotonic;
+  struct nacl_abi_vvar      next;
+  uint64_t                  tsc = 0;
+  int64_t                   monotonic_ns;
+
+  if (NULL == page || 0 != NaClFastMutexTryLock(&nap->vvar_mu)) {
+    return;
+  }
+
+#if NACL_VVAR_HAVE_TSC
+  if (nap->vvar_tsc_invariant) {
+    tsc = ReadTsc();
+  }
+#endif
+  if (0 != NaClClockGetTime(NACL_CLOCK_MONOTONIC, &monotonic) ||
+      0 != NaClClockGetTime(NACL_CLOCK_REALTIME, &realtime) ||
+      0 == tsc) {
+    goto done;
+  }
+  monotonic_ns = TimespecToNs(&monotonic);
+
+  if (0 == nap->vvar_calib_tsc) {
+    nap->vvar_calib_tsc = tsc;
+    nap->vvar_calib_ns = monotonic_ns;
+    goto done;
+  }
+  if (monotonic_ns - nap->vvar_calib_ns < NACL_VVAR_CALIBRATION_NS ||
+      tsc <= nap->vvar_calib_tsc) {
+    goto done;
+  }
+
+  /*
+   * Recalibrate over the whole time since the page was created, so the
+   * rate keeps getting more precise.
+   */
+  next = *published;
+  next.tsc_mult = (uint64_t) ((double) (monotonic_ns - nap->vvar_calib_ns) *
+                              (double) (1ULL << NACL_ABI_VVAR_TSC_SHIFT) /
+                              (double) (tsc - nap->vvar_calib_tsc));
+  if (0 == next.tsc_mult) {
+    goto done;
+  }
+  next.tsc_max_delta = ((uint64_t) NACL_VVAR_MAX_AGE_NS <<
+                        NACL_ABI_VVAR_TSC_SHIFT) / next.tsc_mult;
+  next.tsc_base = tsc;
+  next.realtime_ns = TimespecToNs(&realtime);
+  next.monotonic_ns = monotonic_ns;
+  /*
+   * Do not let CLOCK_MONOTONIC go backwards for a reader that saw an
+   * extrapolation from the previous snapshot which ran slightly fast.
+   */
+  if (0 != (published->flags & NACL_ABI_VVAR_TSC_VALID)) {
+    int64_t seen = PublishedMonotonicNs(published, tsc);
+    if (seen > next.monotonic_ns) {
+      next.monotonic_ns = seen;
+    }
+  }
+  next.flags = NACL_ABI_VVAR_TSC_VALID;
+  next.seq = published->seq + 2;
+
+  page->seq = published->seq + 1;
+  NaClWriteMemoryBarrier();
+  page->flags = next.flags;
+  page->tsc_base = next.tsc_base;
+  page->tsc_max_delta = next.tsc_max_delta;
+  page->tsc_mult = next.tsc_mult;
+  page->realtime_ns = next.realtime_ns;
+  page->monotonic_ns = next.monotonic_ns;
+  NaClWriteMemoryBarrier();
+  page->seq = next.seq;
+  *published = next;
+
+ done:
+  NaClFastMutexUnlock(&nap->vvar_mu);
+}
+
+void NaClVvarClampMonotonic(struct NaClApp *nap,
+                            struct nacl_abi_timespec *ts) {
+#if NACL_VVAR_HAVE_TSC
+  int64_t seen;
+
+  if (NULL == nap->vvar) {
+    return;
+  }
+  NaClFastMutexLock(&nap->vvar_mu);
+  if (0 != (nap->vvar_published.flags & NACL_ABI_VVAR_TSC_VALID)) {
+    seen = PublishedMonotonicNs(&nap->vvar_published, ReadTsc());
+    if (seen > TimespecToNs(ts)) {
+      ts->tv_sec = seen / 1000000000;
+      ts->tv_nsec = seen % 1000000000;
+    }
+  }
+  NaClFastMutexUnlock(&nap->vvar_mu);
+#else
+  UNREFERENCED_PARAMETER(nap);
+  UNREFERENCED_PARAMETER(ts);
+#endif
+}
+
+void NaClVvarDestroy(struct NaClApp *nap) {
+  if (NULL == nap->vvar) {
+    return;
+  }
+  NaClHostDescUnmapUnsafe((void *) nap->vvar, NACL_VVAR_SIZE);
+  NaClDescUnref(nap->vvar_shm);
+  NaClFastMutexDtor(&nap->vvar_mu);
+  nap->vvar = NULL;
+  nap->vvar_shm = NULL;
+  nap->vvar_addr = 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef NATIVE_CLIENT_SRC_TRUSTED_SERVICE_RUNTIME_NACL_VVAR_H_
+#define NATIVE_CLIENT_SRC_TRUSTED_SERVICE_RUNTIME_NACL_VVAR_H_
+
+#include "native_client/src/include/portability.h"
+
+EXTERN_C_BEGIN
+
+struct NaClApp;
+struct nacl_abi_timespec;
+
+/*
+ * The vvar page lets untrusted code read the clocks without a syscall.
+ * It holds a struct nacl_abi_vvar (see include/sys/nacl_vvar.h) which
+ * is mapped read-only into the sandbox and written by trusted code
+ * through a second, writable mapping of the same shm object.
+ *
+ * The TSC-based snapshot is only published on x86 hosts with an
+ * invariant TSC, and only once the TSC has been measured against the
+ * host's monotonic clock for a while.  Until then, and on other hosts,
+ * the page just tells untrusted code to make the syscall.
+ */
+
+/*
+ * Creates the vvar page and maps it into the sandbox, and sets
+ * nap->vvar_addr.  Returns 0 if there is no vvar page, which is not an
+ * error: untrusted code then always makes the syscall.  Must be called
+ * before any untrusted thread runs.
+ */
+int NaClVvarCreate(struct NaClApp *nap);
+
+/*
+ * As NaClVvarCreate, but maps the page at page_num, which must not be
+ * in use, rather than wherever there is room.  Used to put the page
+ * back where a restored image of the sandbox expects it.
+ */
+int NaClVvarCreateAt(struct NaClApp *nap, uintptr_t page_num);
+
+/*
+ * Takes a fresh clock and TSC reading and publishes it in the vvar page.
+ * Called from the clock syscalls, which is what untrusted code falls
+ * back to once the snapshot is too old.  Does nothing if another thread
+ * is updating the page at the same time.
+ */
+void NaClVvarUpdate(struct NaClApp *nap);
+
+/*
+ * Raises |ts|, a CLOCK_MONOTONIC reading from the host, to at least the
+ * latest value untrusted code can have read from the vvar page.  The
+ * snapshot's rate is only an estimate, so extrapolating from it can run
+ * slightly ahead of the host clock, and the syscall fallback must not go
+ * back behind it.
+ */
+void NaClVvarClampMonotonic(struct NaClApp *nap,
+                            struct nacl_abi_timespec *ts);
+
+/* Unmaps the trusted view of the vvar page and releases the shm. */
+void NaClVvarDestroy(struct NaClApp *nap);
+
+EXTERN_C_END
+
+#endif
@@ -18,6 +18,12 @@ void NaClAddrSpaceFree(struct NaClApp *nap) {
   uintptr_t addrsp_size = (uintptr_t) 1U << nap->addr_bits;
   size_t full_size = (NACL_ADDRSPACE_LOWER_GUARD_SIZE + addrsp_size +
                       NACL_ADDRSPACE_UPPER_GUARD_SIZE);
+#if NACL_ADDRSPACE_PACKING
+  /* The guards of a packed slot are shared, so only the slot goes. */
+  if (NaClAddrSpacePackedRelease((void *) nap->mem_start)) {
+    return;
+  }
+#endif
   if (munmap(base, full_size) != 0) {
     NaClLog(LOG_FATAL, "NaClAddrSpaceFree: munmap() failed, errno %d\n",
             errno);
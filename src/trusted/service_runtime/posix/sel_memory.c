@@ -20,6 +20,9 @@
 #include <unistd.h>
 
 #include "native_client/src/include/build_config.h"
+#if NACL_LINUX
+# include <sys/syscall.h>
+#endif
 #include "native_client/src/include/nacl_platform.h"
 #include "native_client/src/include/portability.h"
 #include "native_client/src/shared/platform/nacl_exit.h"
@@ -171,3 +174,46 @@ int NaClMadvise(void *start, size_t length, int advice) {
    */
   return ret == -1 ? -errno : ret;
 }
+
+void NaClAdviseHugePages(void *start, size_t length) {
+#if NACL_LINUX && defined(MADV_HUGEPAGE)
+  if (0 != madvise(start, length, MADV_HUGEPAGE)) {
+    NaClLog(4, "NaClAdviseHugePages: madvise failed, errno %d\n", errno);
+  }
+#else
+  UNREFERENCED_PARAMETER(start);
+  UNREFERENCED_PARAMETER(length);
+#endif
+}
+
+/* From <numaif.h>, which needs libnuma's headers. */
+#define NACL_MPOL_PREFERRED 1
+#define NACL_NUMA_MAX_NODES 1024
+
+int NaClBindNumaNode(void *start, size_t length, int node) {
+#if NACL_LINUX && defined(__NR_mbind)
+  unsigned long nodemask[NACL_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+
+  if (node < 0 || node >= NACL_NUMA_MAX_NODES) {
+    return -EINVAL;
+  }
+  memset(nodemask, 0, sizeof nodemask);
+  nodemask[node / (8 * sizeof(unsigned long))] |=
+      1UL << (node % (8 * sizeof(unsigned long)));
+  /*
+   * maxnode counts one past the highest bit the kernel reads, as libnuma
+   * passes it.
+   */
+  if (0 != syscall(__NR_mbind, start, length, NACL_MPOL_PREFERRED,
+                   nodemask, (unsigned long) NACL_NUMA_MAX_NODES + 1, 0)) {
+    NaClLog(4, "NaClBindNumaNode: mbind failed, errno %d\n", errno);
+    return -errno;
+  }
+  return 0;
+#else
+  UNREFERENCED_PARAMETER(start);
+  UNREFERENCED_PARAMETER(length);
+  UNREFERENCED_PARAMETER(node);
+  return -ENOSYS;
+#endif
+}
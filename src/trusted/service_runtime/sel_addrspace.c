@@ -42,6 +42,18 @@ NaClErrorCode NaClAllocAddrSpaceAslr(struct NaClApp *nap,
   }
 
   nap->mem_start = (uintptr_t) mem;
+  if (nap->huge_pages) {
+    /*
+     * This covers the image, the brk heap and the stack, which are all
+     * carved out of this reservation with mprotect().  mmap() replaces
+     * parts of it with new mappings, which sys_memory.c advises again.
+     */
+    NaClAdviseHugePages(mem, (size_t) 1 << nap->addr_bits);
+  }
+  if (nap->numa_node >= 0) {
+    /* As with huge pages, mmap() in sys_memory.c binds new mappings again. */
+    (void) NaClBindNumaNode(mem, (size_t) 1 << nap->addr_bits, nap->numa_node);
+  }
   /*
    * The following should not be NaClLog(2, ...) because logging with
    * any detail level higher than LOG_INFO is disabled in the release
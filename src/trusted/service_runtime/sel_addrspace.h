@@ -88,6 +88,39 @@ NaClErrorCode NaClAllocateSpaceAslr(void **mem, size_t addrsp_size,
  */
 NaClErrorCode NaClAllocateSpace(void **mem, size_t addrsp_size) NACL_WUR;
 
+#if NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && NACL_BUILD_SUBARCH == 64 && \
+    !NACL_WINDOWS
+# define NACL_ADDRSPACE_PACKING 1
+#else
+# define NACL_ADDRSPACE_PACKING 0
+#endif
+
+#if NACL_ADDRSPACE_PACKING
+/*
+ * Reserves address space for |num_slots| sandboxes placed back to back,
+ * with each guard region shared between two neighbouring sandboxes.
+ * NaClAllocateSpaceAslr then hands out these slots first, and only
+ * reserves new address space once they are all in use.  Roughly halves
+ * the address space used per sandbox on x86-64.
+ *
+ * Must be called before any sandbox is created, and at most once until
+ * NaClAddrSpacePackingFini.  Returns non-zero on success.
+ */
+int NaClAddrSpacePackingInit(size_t num_slots, enum NaClAslrMode aslr_mode);
+
+/*
+ * Releases the reservation, unless some of its slots are still in use.
+ */
+void NaClAddrSpacePackingFini(void);
+
+/*
+ * Returns the slot starting at |mem_start| to the free list, discarding
+ * its contents.  Returns zero, doing nothing, if |mem_start| is not a
+ * packed slot.
+ */
+int NaClAddrSpacePackedRelease(void *mem_start);
+#endif
+
 /*
  * NaClAddrSpaceFree() unmaps all of untrusted address space.  This is
  * only safe if no untrusted threads are running.
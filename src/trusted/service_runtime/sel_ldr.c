@@ -92,6 +92,7 @@ int NaClAppWithEmptySyscallTableCtor(struct NaClApp *nap) {
 
   nap->stack_size = NACL_DEFAULT_STACK_MAX;
   nap->initial_nexe_max_code_bytes = 0;
+  nap->mem_budget = 0;
 
   nap->mem_start = 0;
 
@@ -157,6 +158,10 @@ int NaClAppWithEmptySyscallTableCtor(struct NaClApp *nap) {
   }
   nap->dynamic_page_bitmap = NULL;
 
+  nap->vvar_shm = NULL;
+  nap->vvar = NULL;
+  nap->vvar_addr = 0;
+
   nap->dynamic_regions = NULL;
   nap->num_dynamic_regions = 0;
   nap->dynamic_regions_allocated = 0;
@@ -186,6 +191,7 @@ int NaClAppWithEmptySyscallTableCtor(struct NaClApp *nap) {
 
   for (i = 0; i < NACL_MAX_SYSCALLS; ++i) {
     nap->syscall_table[i].handler = &NaClSysNotImplementedDecoder;
+    nap->syscall_table[i].fast_handler = NULL;
   }
 
   nap->module_initialization_state = NACL_MODULE_UNINITIALIZED;
@@ -194,6 +200,7 @@ int NaClAppWithEmptySyscallTableCtor(struct NaClApp *nap) {
   nap->ignore_validator_result = 0;
   nap->skip_validator = 0;
   nap->validator_stub_out_mode = 0;
+  nap->validator_threads = 1;
 
   if (IsEnvironmentVariableSet("NACL_DANGEROUS_ENABLE_FILE_ACCESS")) {
     NaClInsecurelyBypassAllAclChecks();
@@ -242,6 +249,10 @@ int NaClAppWithEmptySyscallTableCtor(struct NaClApp *nap) {
     goto cleanup_desc_mu;
   }
   nap->enable_exception_handling = 0;
+  nap->enable_syscall_fast_path = 0;
+  nap->shm_socket_pairs = 0;
+  nap->huge_pages = 0;
+  nap->numa_node = -1;
 #if NACL_WINDOWS
   nap->debug_exception_handler_state = NACL_DEBUG_EXCEPTION_HANDLER_NOT_STARTED;
   nap->attach_debug_exception_handler_func = NULL;
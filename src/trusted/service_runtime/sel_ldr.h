@@ -46,6 +46,7 @@
 
 #include "native_client/src/trusted/service_runtime/dyn_array.h"
 #include "native_client/src/trusted/service_runtime/include/bits/nacl_syscalls.h"
+#include "native_client/src/trusted/service_runtime/include/sys/nacl_vvar.h"
 #include "native_client/src/trusted/service_runtime/nacl_error_code.h"
 #include "native_client/src/trusted/service_runtime/nacl_resource.h"
 #include "native_client/src/trusted/service_runtime/nacl_syscall_handlers.h"
@@ -108,6 +109,15 @@ struct NaClApp {
    * populated (no MAP_POPULATE), so actual accesses will likely
    * incur page faults.
    */
+  size_t                    mem_budget;
+  /*
+   * mem_budget, if non-zero, caps the number of bytes of writable
+   * memory the module can have mapped at once, counting the data
+   * segment, the stack and anything mapped with mmap.  mmap and
+   * mprotect requests that would exceed it fail with ENOMEM.  The
+   * address space itself keeps its full size, so the sandboxing
+   * guarantees do not change; the rest of it just stays inaccessible.
+   */
 
   /*
    * Determined at load time; OS-determined.
@@ -302,6 +312,22 @@ struct NaClApp {
    */
   int                       dynamic_delete_generation;
 
+  /*
+   * The read-only time data page, see nacl_vvar.h.  vvar is the
+   * trusted, writable view of it and vvar_addr the untrusted address
+   * of the read-only view; both are zero if the app has no vvar page.
+   * The remaining fields are protected by vvar_mu.  vvar_published is
+   * what was last written to the page; we never read the page back.
+   */
+  struct NaClDesc           *vvar_shm;
+  struct nacl_abi_vvar      *vvar;
+  uintptr_t                 vvar_addr;
+  struct NaClFastMutex      vvar_mu;
+  struct nacl_abi_vvar      vvar_published;
+  int                       vvar_tsc_invariant;
+  uint64_t                  vvar_calib_tsc;
+  int64_t                   vvar_calib_ns;
+
 
   int                       running;
   int                       exit_status;
@@ -311,6 +337,12 @@ struct NaClApp {
   int                       ignore_validator_result;
   int                       skip_validator;
   int                       validator_stub_out_mode;
+  /*
+   * Maximum number of threads used to validate a large code segment, if
+   * the validator supports it.  1 (the default) validates on the calling
+   * thread.
+   */
+  int                       validator_threads;
 
   int                       enable_list_mappings;
   /* Whether or not the app is a PNaCl app.  Boolean. */
@@ -338,6 +370,35 @@ struct NaClApp {
 
   const struct NaClDebugCallbacks *debug_stub_callbacks;
 
+  /*
+   * If set, syscalls with a fast_handler skip the suspend state
+   * transitions and the generic argument decoder (x86-64 Linux only).
+   * Must not be set if the app's threads may be suspended with
+   * NaClUntrustedThreadSuspend(), e.g. by the debug stub.
+   */
+  int                       enable_syscall_fast_path;
+
+  /*
+   * If set, imc_socketpair makes NaClDescShmSocket pairs, which pass
+   * messages through shared memory instead of the kernel (Linux only).
+   */
+  int                       shm_socket_pairs;
+
+  /*
+   * If set, the sandbox's anonymous memory and dynamic text are advised
+   * for transparent huge pages, and large mmaps without an address are
+   * placed on huge page boundaries (Linux only).  Must be set before
+   * the address space is allocated.
+   */
+  int                       huge_pages;
+
+  /*
+   * NUMA node the sandbox's memory should come from, or -1 to leave it
+   * to the host's default policy (Linux only).  Like huge_pages, must be
+   * set before the address space is allocated.
+   */
+  int                       numa_node;
+
   struct NaClDesc                 *main_nexe_desc;
   struct NaClDesc                 *irt_nexe_desc;
 
@@ -409,6 +470,18 @@ struct NaClApp {
   uintptr_t callbackSlot[8];
   void* callbackSlotState[8];
 
+  /* If set, called before and after each callback made through
+   * callbackSlot, so the user of this lib can profile them. */
+  void (*callback_hook)(struct NaClAppThread *natp,
+                        uint32_t callbackSlotNumber,
+                        int returning);
+
+  /* Set by the user of this lib to the number of the signal when
+   * untrusted code faulted and was unwound to the call that entered the
+   * sandbox.  Once set, callbacks unwind to the enclosing call as soon
+   * as they return instead of resuming the untrusted code. */
+  volatile int fault_signal;
+
   /* Structure that holds the symbol table mapping of (symbol->address)
    */
   struct SymbolTableMapping * symbolTableMapping;
@@ -647,6 +720,13 @@ void NaClAppStartModule(struct NaClApp *self);
 
 NaClErrorCode NaClGetLoadStatus(struct NaClApp *nap) NACL_WUR;
 
+/*
+ * Advances nap->module_initialization_state, which only ever increases.
+ * For embedders that set up the module without NaClAppLoadModule.
+ */
+void NaClSetInitState(struct NaClApp *nap,
+                      enum NaClModuleInitializationState state);
+
 void NaClFillMemoryRegionWithHalt(void *start, size_t size);
 
 void NaClFillTrampolineRegion(struct NaClApp *nap);
@@ -37,6 +37,7 @@
 #include "native_client/src/trusted/service_runtime/nacl_switch_to_app.h"
 #include "native_client/src/trusted/service_runtime/nacl_syscall_common.h"
 #include "native_client/src/trusted/service_runtime/nacl_text.h"
+#include "native_client/src/trusted/service_runtime/nacl_vvar.h"
 #include "native_client/src/trusted/service_runtime/sel_memory.h"
 #include "native_client/src/trusted/service_runtime/sel_ldr.h"
 #include "native_client/src/trusted/service_runtime/sel_util.h"
@@ -611,6 +612,9 @@ int NaClCreateMainThread_helper(struct NaClApp     *nap,
   if (0 != nap->dynamic_text_start) {
     auxv_entries++;
   }
+  if (NaClVvarCreate(nap)) {
+    auxv_entries++;
+  }
   ptr_tbl_size = 3 + argc + 1 + envc + 1 + auxv_entries * 2;
 #if NACL_STACK_GETS_ARG
   ptr_tbl_size++;
@@ -694,6 +698,10 @@ int NaClCreateMainThread_helper(struct NaClApp     *nap,
     *p++ = AT_BASE;
     *p++ = (uint32_t) nap->dynamic_text_start;
   }
+  if (0 != nap->vvar_addr) {
+    *p++ = AT_NACL_VVAR;
+    *p++ = (uint32_t) nap->vvar_addr;
+  }
   *p++ = AT_NULL;
   *p++ = 0;
 
@@ -190,6 +190,9 @@ struct SelLdrOptions {
   int enable_env_passthrough;
   int enable_exception_handling;
   int enable_debug_stub;
+  int enable_syscall_fast_path;
+  int huge_pages;
+  int numa_node;
   int debug_mode_bypass_acl_checks;
   int debug_mode_ignore_validator;
   int debug_mode_startup_signal;
@@ -215,6 +218,9 @@ static void SelLdrOptionsCtor(struct SelLdrOptions *options) {
   options->enable_env_passthrough = 0;
   options->enable_exception_handling = 0;
   options->enable_debug_stub = 0;
+  options->enable_syscall_fast_path = 1;
+  options->huge_pages = 0;
+  options->numa_node = -1;
   options->debug_mode_bypass_acl_checks = 0;
   options->debug_mode_ignore_validator = 0;
   options->debug_mode_startup_signal = 0;
@@ -443,6 +449,19 @@ static void NaClSelLdrParseArgs(int argc, char **argv,
   if (getenv("NACL_UNTRUSTED_EXCEPTION_HANDLING") != NULL) {
     options->enable_exception_handling = 1;
   }
+
+  /* Used for measuring the syscall fast path against the generic path. */
+  if (getenv("NACL_DISABLE_SYSCALL_FAST_PATH") != NULL) {
+    options->enable_syscall_fast_path = 0;
+  }
+
+  if (getenv("NACL_HUGE_PAGES") != NULL) {
+    options->huge_pages = 1;
+  }
+
+  if (getenv("NACL_NUMA_NODE") != NULL) {
+    options->numa_node = atoi(getenv("NACL_NUMA_NODE"));
+  }
 }
 
 static void RedirectIO(struct NaClApp *nap, struct redir *redir_queue){
@@ -570,6 +589,11 @@ int NaClSelLdrMain(int argc, char **argv) {
   nap->ignore_validator_result = (options->debug_mode_ignore_validator > 0);
   nap->skip_validator = (options->debug_mode_ignore_validator > 1);
   nap->enable_exception_handling = options->enable_exception_handling;
+  /* The debug stub suspends threads, which the fast path does not allow. */
+  nap->enable_syscall_fast_path = (options->enable_syscall_fast_path &&
+                                   !options->enable_debug_stub);
+  nap->huge_pages = options->huge_pages;
+  nap->numa_node = options->numa_node;
 
   /*
    * TODO(mseaborn): Always enable the Mach exception handler on Mac
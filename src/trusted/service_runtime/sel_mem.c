@@ -456,6 +456,35 @@ static int NaClVmmapCheckExistingMapping(struct NaClVmmap  *self,
   return 0;
 }
 
+size_t NaClVmmapCountPages(struct NaClVmmap  *self,
+                           uintptr_t         page_num,
+                           size_t            npages,
+                           int               prot) {
+  uintptr_t             end_page = page_num + npages;
+  size_t                count = 0;
+  size_t                i;
+  struct NaClVmmapEntry *entry;
+
+  for (i = 0; i < self->nvalid; ++i) {
+    uintptr_t overlap_start;
+    uintptr_t overlap_end;
+
+    entry = self->vmentry[i];
+    if (entry->removed || (entry->prot & prot) != prot) {
+      continue;
+    }
+    overlap_start = entry->page_num > page_num ? entry->page_num : page_num;
+    overlap_end = entry->page_num + entry->npages;
+    if (overlap_end > end_page) {
+      overlap_end = end_page;
+    }
+    if (overlap_start < overlap_end) {
+      count += overlap_end - overlap_start;
+    }
+  }
+  return count;
+}
+
 int NaClVmmapChangeProt(struct NaClVmmap   *self,
                         uintptr_t          page_num,
                         size_t             npages,
@@ -771,6 +800,44 @@ uintptr_t NaClVmmapFindMapSpace(struct NaClVmmap *self,
 }
 
 
+/*
+ * As NaClVmmapFindMapSpace, but the hole is used from its highest
+ * aligned start that leaves room for num_pages.
+ */
+uintptr_t NaClVmmapFindAlignedMapSpace(struct NaClVmmap *self,
+                                       size_t           num_pages,
+                                       size_t           align_pages) {
+  size_t                i;
+  struct NaClVmmapEntry *vmep;
+  uintptr_t             end_page;
+  uintptr_t             start_page;
+  uintptr_t             aligned_page;
+
+  if (0 == self->nvalid)
+    return 0;
+  NaClVmmapMakeSorted(self);
+  num_pages = NaClRoundPageNumUpToMapMultiple(num_pages);
+
+  for (i = self->nvalid; --i > 0; ) {
+    vmep = self->vmentry[i-1];
+    end_page = vmep->page_num + vmep->npages;  /* end page from previous */
+    end_page = NaClRoundPageNumUpToMapMultiple(end_page);
+
+    start_page = self->vmentry[i]->page_num;  /* start page from current */
+    start_page = NaClTruncPageNumDownToMapMultiple(start_page);
+
+    if (start_page <= end_page || start_page - end_page < num_pages) {
+      continue;
+    }
+    aligned_page = (start_page - num_pages) & ~(uintptr_t) (align_pages - 1);
+    if (aligned_page >= end_page) {
+      return aligned_page;
+    }
+  }
+  return 0;
+}
+
+
 /*
  * Linear search, from uaddr up.
  */
@@ -118,6 +118,15 @@ int NaClVmmapChangeProt(struct NaClVmmap  *self,
                         size_t            npages,
                         int               prot);
 
+/*
+ * NaClVmmapCountPages returns the number of pages in the specified
+ * region that are mapped with all of the protection bits in |prot|.
+ */
+size_t NaClVmmapCountPages(struct NaClVmmap  *self,
+                           uintptr_t         page_num,
+                           size_t            npages,
+                           int               prot);
+
 /*
  * NaClVmmapFindPage and NaClVmmapFindPageIter only works if pnum is
  * in the NaClVmmap.  If not, NULL and an AtEnd iterator is returned.
@@ -156,6 +165,15 @@ uintptr_t NaClVmmapFindMapSpaceAboveHint(struct NaClVmmap *self,
                                          uintptr_t        uaddr,
                                          size_t           num_pages);
 
+/*
+ * Just like NaClVmmapFindMapSpace, except that the region found starts
+ * on a multiple of align_pages, which must be a power of two.  Used to
+ * place large mappings so that they can be backed by huge pages.
+ */
+uintptr_t NaClVmmapFindAlignedMapSpace(struct NaClVmmap *self,
+                                       size_t           num_pages,
+                                       size_t           align_pages);
+
 void NaClVmmapMakeSorted(struct NaClVmmap  *self);
 
 int NaClVmmapEntryMaxProt(struct NaClVmmapEntry *entry);
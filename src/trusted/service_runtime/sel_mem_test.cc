@@ -5,6 +5,7 @@
  */
 
 #include "native_client/src/include/nacl_platform.h"
+#include "native_client/src/trusted/service_runtime/nacl_config.h"
 #include "native_client/src/trusted/service_runtime/sel_mem.h"
 #include "native_client/src/shared/platform/nacl_log.h"
 #include "gtest/gtest.h"
@@ -234,3 +235,84 @@ TEST_F(SelMemTest, FindSpaceTest) {
 
   NaClVmmapDtor(&mem_map);
 }
+
+TEST_F(SelMemTest, FindAlignedMapSpaceTest) {
+  struct NaClVmmap mem_map;
+  uintptr_t ret_code;
+  const size_t kMapPages = NACL_MAP_PAGESIZE >> NACL_PAGESHIFT;
+  const size_t kAlign = 32 * kMapPages;
+
+  EXPECT_EQ(1, NaClVmmapCtor(&mem_map));
+
+  // vmmap is [0, 1), [70, 71), [100, 101) in units of map pages.
+  NaClVmmapAdd(&mem_map, 0, kMapPages,
+               NACL_ABI_PROT_NONE, NACL_ABI_MAP_PRIVATE, NULL, 0, 0);
+  NaClVmmapAdd(&mem_map, 70 * kMapPages, kMapPages,
+               NACL_ABI_PROT_READ, NACL_ABI_MAP_PRIVATE, NULL, 0, 0);
+  NaClVmmapAdd(&mem_map, 100 * kMapPages, kMapPages,
+               NACL_ABI_PROT_READ, NACL_ABI_MAP_PRIVATE, NULL, 0, 0);
+
+  // The highest aligned start that fits in the highest hole, [71, 100).
+  ret_code = NaClVmmapFindAlignedMapSpace(&mem_map, 4 * kMapPages, kAlign);
+  EXPECT_EQ(96 * kMapPages, ret_code);
+
+  // [71, 100) is big enough but has no aligned start that fits, so the
+  // search goes on down to [1, 70).
+  ret_code = NaClVmmapFindAlignedMapSpace(&mem_map, 10 * kMapPages, kAlign);
+  EXPECT_EQ(32 * kMapPages, ret_code);
+  ret_code = NaClVmmapFindAlignedMapSpace(&mem_map, 4 * kMapPages,
+                                          2 * kAlign);
+  EXPECT_EQ(64 * kMapPages, ret_code);
+
+  // No hole has an aligned start that fits.
+  ret_code = NaClVmmapFindAlignedMapSpace(&mem_map, 40 * kMapPages, kAlign);
+  EXPECT_EQ(0U, ret_code);
+
+  NaClVmmapDtor(&mem_map);
+}
+
+TEST_F(SelMemTest, CountPagesTest) {
+  struct NaClVmmap mem_map;
+
+  EXPECT_EQ(1, NaClVmmapCtor(&mem_map));
+
+  NaClVmmapAdd(&mem_map,
+               32,
+               10,
+               NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE,
+               NACL_ABI_MAP_PRIVATE,
+               NULL,
+               0,
+               0);
+  NaClVmmapAdd(&mem_map,
+               64,
+               10,
+               NACL_ABI_PROT_READ | NACL_ABI_PROT_EXEC,
+               NACL_ABI_MAP_PRIVATE,
+               NULL,
+               0,
+               0);
+  NaClVmmapAdd(&mem_map,
+               96,
+               10,
+               NACL_ABI_PROT_READ | NACL_ABI_PROT_WRITE,
+               NACL_ABI_MAP_PRIVATE,
+               NULL,
+               0,
+               0);
+
+  // vmmap is [32, 42) rw, [64, 74) rx, [96, 106) rw
+  EXPECT_EQ(20U, NaClVmmapCountPages(&mem_map, 0, 1024,
+                                     NACL_ABI_PROT_WRITE));
+  EXPECT_EQ(30U, NaClVmmapCountPages(&mem_map, 0, 1024,
+                                     NACL_ABI_PROT_READ));
+  EXPECT_EQ(10U, NaClVmmapCountPages(&mem_map, 0, 1024,
+                                     NACL_ABI_PROT_READ | NACL_ABI_PROT_EXEC));
+  // Partial overlaps at both ends.
+  EXPECT_EQ(7U, NaClVmmapCountPages(&mem_map, 40, 61,
+                                    NACL_ABI_PROT_WRITE));
+  EXPECT_EQ(0U, NaClVmmapCountPages(&mem_map, 42, 54,
+                                    NACL_ABI_PROT_WRITE));
+
+  NaClVmmapDtor(&mem_map);
+}
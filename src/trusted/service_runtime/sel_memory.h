@@ -29,6 +29,26 @@ int NaClMprotect(void *addr, size_t len, int prot) NACL_WUR;
 
 int NaClMadvise(void *start, size_t length, int advice) NACL_WUR;
 
+#define NACL_HUGE_PAGESHIFT 21
+#define NACL_HUGE_PAGESIZE  (1U << NACL_HUGE_PAGESHIFT)
+
+/*
+ * Asks the host to back [start, start + length) with transparent huge
+ * pages.  This is only a hint: it has no effect outside Linux or where
+ * THP is disabled, and the memory behaves the same either way,
+ * including when parts of it are later unmapped or reprotected.
+ */
+void NaClAdviseHugePages(void *start, size_t length);
+
+/*
+ * Asks the host to take the pages of [start, start + length) that are
+ * touched from now on from NUMA node |node|.  The node is preferred,
+ * not required, so allocation falls back to other nodes rather than
+ * failing when it is full.  Returns 0 if the policy was set; it is
+ * never set outside Linux.
+ */
+int NaClBindNumaNode(void *start, size_t length, int node);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
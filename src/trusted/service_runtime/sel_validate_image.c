@@ -11,6 +11,11 @@
 #include "native_client/src/trusted/validator/ncvalidate.h"
 
 const size_t kMinimumCachedCodeSize = 40000;
+/*
+ * Below this size the cost of starting validator threads outweighs the
+ * time saved by validating in parallel.
+ */
+const size_t kMinimumParallelCodeSize = 256 * 1024;
 
 /* Translate validation status to values wanted by sel_ldr. */
 static int NaClValidateStatus(NaClValidationStatus status) {
@@ -73,13 +78,26 @@ int NaClValidateCode(struct NaClApp *nap, uintptr_t guest_addr,
                                  cache);
   }
   if (status == NaClValidationSucceeded) {
-    status = validator->Validate(guest_addr, data, size,
-                                 FALSE, /* do not stub out */
-                                 flags,
-                                 FALSE /* readonly_text */,
-                                 nap->cpu_features,
-                                 metadata,
-                                 cache);
+    if (validator->ValidateParallel != NULL &&
+        nap->validator_threads > 1 &&
+        size >= kMinimumParallelCodeSize) {
+      status = validator->ValidateParallel(guest_addr, data, size,
+                                           FALSE, /* do not stub out */
+                                           flags,
+                                           FALSE /* readonly_text */,
+                                           nap->cpu_features,
+                                           metadata,
+                                           cache,
+                                           nap->validator_threads);
+    } else {
+      status = validator->Validate(guest_addr, data, size,
+                                   FALSE, /* do not stub out */
+                                   flags,
+                                   FALSE /* readonly_text */,
+                                   nap->cpu_features,
+                                   metadata,
+                                   cache);
+    }
   }
   return NaClValidateStatus(status);
 }
@@ -11,6 +11,7 @@
 #include "native_client/src/trusted/desc/nacl_desc_imc.h"
 #include "native_client/src/trusted/desc/nacl_desc_imc_shm.h"
 #include "native_client/src/trusted/desc/nacl_desc_invalid.h"
+#include "native_client/src/trusted/desc/nacl_desc_shm_socket.h"
 #include "native_client/src/trusted/desc/nrd_xfer.h"
 #include "native_client/src/trusted/service_runtime/include/sys/errno.h"
 #include "native_client/src/trusted/service_runtime/nacl_app_thread.h"
@@ -571,7 +572,11 @@ int32_t NaClSysImcSocketPair(struct NaClAppThread *natp,
     return -NACL_ABI_EACCES;
   }
 
-  retval = NaClCommonDescSocketPair(pair);
+  if (nap->shm_socket_pairs) {
+    retval = NaClDescShmSocketPair(pair);
+  } else {
+    retval = NaClCommonDescSocketPair(pair);
+  }
   if (0 != retval) {
     goto cleanup;
   }
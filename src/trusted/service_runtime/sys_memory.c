@@ -41,6 +41,28 @@ static int32_t MunmapInternal(struct NaClApp *nap,
 static const size_t kMaxUsableFileSize = (SIZE_T_MAX >> 1);
 
 
+/*
+ * Returns whether giving the pages [page_num, page_num + npages)
+ * protection |prot| keeps the module's writable memory within
+ * nap->mem_budget.  Caller must hold nap->mu.
+ */
+static int NaClMemBudgetAllows_mu(struct NaClApp *nap,
+                                  uintptr_t      page_num,
+                                  size_t         npages,
+                                  int            prot) {
+  size_t all_pages = ((uintptr_t) 1U << nap->addr_bits) >> NACL_PAGESHIFT;
+  size_t writable;
+
+  if (0 == nap->mem_budget || 0 == (prot & NACL_ABI_PROT_WRITE)) {
+    return 1;
+  }
+  writable = NaClVmmapCountPages(&nap->mem_map, 0, all_pages,
+                                 NACL_ABI_PROT_WRITE);
+  writable -= NaClVmmapCountPages(&nap->mem_map, page_num, npages,
+                                  NACL_ABI_PROT_WRITE);
+  return writable + npages <= (nap->mem_budget >> NACL_PAGESHIFT);
+}
+
 static INLINE size_t  size_min(size_t a, size_t b) {
   return (a < b) ? a : b;
 }
@@ -154,6 +176,13 @@ int32_t NaClSysBrk(struct NaClAppThread *natp,
                 next_ent->page_num, next_ent->npages);
         goto cleanup;
       }
+      if (!NaClMemBudgetAllows_mu(nap, ent->page_num + ent->npages,
+                                  (last_internal_page + 1 -
+                                   (ent->page_num + ent->npages)),
+                                  NACL_ABI_PROT_WRITE)) {
+        NaClLog(4, "new break request exceeds the memory budget\n");
+        goto cleanup;
+      }
       NaClLog(4,
               "extending segment: page_num 0x%08"NACL_PRIxPTR", "
               "npages 0x%"NACL_PRIxS"\n",
@@ -509,8 +538,18 @@ int32_t NaClSysMmapIntern(struct NaClApp        *nap,
        * Pick a hole in addr space of appropriate size, anywhere.
        * We pick one that's best for the system.
        */
-      usrpage = NaClVmmapFindMapSpace(&nap->mem_map,
-                                      alloc_rounded_length >> NACL_PAGESHIFT);
+      usrpage = 0;
+      if (nap->huge_pages && NULL == ndp &&
+          alloc_rounded_length >= NACL_HUGE_PAGESIZE) {
+        usrpage = NaClVmmapFindAlignedMapSpace(
+            &nap->mem_map,
+            alloc_rounded_length >> NACL_PAGESHIFT,
+            NACL_HUGE_PAGESIZE >> NACL_PAGESHIFT);
+      }
+      if (0 == usrpage) {
+        usrpage = NaClVmmapFindMapSpace(&nap->mem_map,
+                                        alloc_rounded_length >> NACL_PAGESHIFT);
+      }
       NaClLog(4, "NaClSysMmap: FindMapSpace: page 0x%05"NACL_PRIxPTR"\n",
               usrpage);
       if (0 == usrpage) {
@@ -606,6 +645,13 @@ int32_t NaClSysMmapIntern(struct NaClApp        *nap,
     goto cleanup;
   }
 
+  if (!NaClMemBudgetAllows_mu(nap, usraddr >> NACL_PAGESHIFT,
+                              alloc_rounded_length >> NACL_PAGESHIFT, prot)) {
+    NaClLog(2, "NaClSysMmap: mapping exceeds the memory budget\n");
+    map_result = (uintptr_t) -NACL_ABI_ENOMEM;
+    goto cleanup;
+  }
+
   NaClVmIoPendingCheck_mu(nap,
                           (uint32_t) usraddr,
                           (uint32_t) (usraddr + length - 1));
@@ -867,6 +913,12 @@ int32_t NaClSysMmapIntern(struct NaClApp        *nap,
     if (map_result != sysaddr) {
       NaClLog(LOG_FATAL, "system mmap did not honor NACL_ABI_MAP_FIXED\n");
     }
+    if (NULL == ndp && nap->huge_pages) {
+      NaClAdviseHugePages((void *) sysaddr, length);
+    }
+    if (NULL == ndp && nap->numa_node >= 0) {
+      (void) NaClBindNumaNode((void *) sysaddr, length, nap->numa_node);
+    }
   }
   /*
    * If we are mapping beyond the end of the file, we fill this space
@@ -1334,6 +1386,13 @@ int32_t NaClSysMprotectInternal(struct NaClApp  *nap,
     goto cleanup;
   }
 
+  if (!NaClMemBudgetAllows_mu(nap, (uintptr_t) start >> NACL_PAGESHIFT,
+                              length >> NACL_PAGESHIFT, prot)) {
+    NaClLog(4, "mprotect: region exceeds the memory budget\n");
+    retval = -NACL_ABI_ENOMEM;
+    goto cleanup;
+  }
+
   if (!NaClVmmapChangeProt(&nap->mem_map,
                            NaClSysToUser(nap, sysaddr) >> NACL_PAGESHIFT,
                            length >> NACL_PAGESHIFT,
@@ -402,3 +402,17 @@ int NaClMadvise(void *start, size_t length, int advice) {
   NaClLog(5, "NaClMadvise: done\n");
   return 0;
 }
+
+void NaClAdviseHugePages(void *start, size_t length) {
+  /* Large pages on Windows need a privilege and cannot be reprotected. */
+  UNREFERENCED_PARAMETER(start);
+  UNREFERENCED_PARAMETER(length);
+}
+
+int NaClBindNumaNode(void *start, size_t length, int node) {
+  /* VirtualAllocExNuma only applies when memory is committed. */
+  UNREFERENCED_PARAMETER(start);
+  UNREFERENCED_PARAMETER(length);
+  UNREFERENCED_PARAMETER(node);
+  return -ENOSYS;
+}
@@ -155,6 +155,28 @@ typedef NaClValidationStatus (*NaClIsOnInstBoundaryFunc)(
     size_t size,
     const NaClCPUFeatures *cpu_features);
 
+/* Function type for applying a validator to a code segment using several
+ * threads. The code segment is split into bundle-aligned chunks which are
+ * validated concurrently; jumps that cross chunk boundaries are resolved
+ * after all chunks have been processed. The result must be identical to
+ * NaClValidateFunc for the same arguments.
+ *
+ * Parameters are the same as for NaClValidateFunc, plus:
+ *    num_threads - The maximum number of threads to validate with. Values
+ *           less than 2 mean the code is validated on the calling thread.
+ */
+typedef NaClValidationStatus (*NaClValidateParallelFunc)(
+    uintptr_t guest_addr,
+    uint8_t *data,
+    size_t size,
+    int stubout_mode,
+    uint32_t flags,
+    int readonly_text,
+    const NaClCPUFeatures *cpu_features,
+    const struct NaClValidationMetadata *metadata,
+    struct NaClValidationCache *cache,
+    int num_threads);
+
 /* The full set of validator APIs. */
 struct NaClValidatorInterface {
   /* Meta-information for early diagnosis. We assume that at least basic
@@ -177,6 +199,8 @@ struct NaClValidatorInterface {
   /* Get the features for the CPU this code is running on. */
   NaClCPUFeaturesAllFunc GetCurrentCPUFeatures;
   NaClIsOnInstBoundaryFunc IsOnInstBoundary;
+  /* Optional multi-threaded validation. NULL if not implemented. */
+  NaClValidateParallelFunc ValidateParallel;
 };
 
 /* Make a choice of validating functions. */
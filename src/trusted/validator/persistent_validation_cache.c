@@ -0,0 +1,701 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "native_client/src/trusted/validator/persistent_validation_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/include/build_config.h"
+#include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/platform/nacl_sync.h"
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
+#include "native_client/src/trusted/validator/validation_metadata.h"
+
+#if NACL_WINDOWS
+
+struct NaClValidationCache *NaClPersistentValidationCacheCreate(
+    const char *path,
+    uint32_t max_entries) {
+  UNREFERENCED_PARAMETER(path);
+  UNREFERENCED_PARAMETER(max_entries);
+  return NULL;
+}
+
+void NaClPersistentValidationCacheDestroy(struct NaClValidationCache *cache) {
+  CHECK(cache == NULL);
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * SHA-256 (FIPS 180-4), used to derive cache keys.  A cache hit costs a
+ * hash of the whole code, and the portable implementation below hashes
+ * about as fast as the DFA validates, so x86 CPUs with the SHA extensions
+ * use those instead.
+ */
+
+/* The target attribute lets us build the SHA path without -msha.  */
+#if NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && defined(__GNUC__) && \
+    (defined(__clang__) || \
+     __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# define NACL_SHA256_X86_SHA 1
+# include <cpuid.h>
+# include <immintrin.h>
+#else
+# define NACL_SHA256_X86_SHA 0
+#endif
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_DIGEST_SIZE 32
+
+struct Sha256Context {
+  uint32_t state[8];
+  uint64_t length;
+  uint8_t block[SHA256_BLOCK_SIZE];
+  size_t block_used;
+};
+
+static const uint32_t kSha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void Sha256Init(struct Sha256Context *ctx) {
+  ctx->state[0] = 0x6a09e667;
+  ctx->state[1] = 0xbb67ae85;
+  ctx->state[2] = 0x3c6ef372;
+  ctx->state[3] = 0xa54ff53a;
+  ctx->state[4] = 0x510e527f;
+  ctx->state[5] = 0x9b05688c;
+  ctx->state[6] = 0x1f83d9ab;
+  ctx->state[7] = 0x5be0cd19;
+  ctx->length = 0;
+  ctx->block_used = 0;
+}
+
+static void Sha256Block(struct Sha256Context *ctx, const uint8_t *block) {
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h;
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    w[i] = ((uint32_t) block[i * 4] << 24) |
+           ((uint32_t) block[i * 4 + 1] << 16) |
+           ((uint32_t) block[i * 4 + 2] << 8) |
+           (uint32_t) block[i * 4 + 3];
+  }
+  for (i = 16; i < 64; i++) {
+    uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^
+                  (w[i - 15] >> 3);
+    uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^
+                  (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  a = ctx->state[0];
+  b = ctx->state[1];
+  c = ctx->state[2];
+  d = ctx->state[3];
+  e = ctx->state[4];
+  f = ctx->state[5];
+  g = ctx->state[6];
+  h = ctx->state[7];
+  for (i = 0; i < 64; i++) {
+    uint32_t s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + ch + kSha256K[i] + w[i];
+    uint32_t s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  ctx->state[0] += a;
+  ctx->state[1] += b;
+  ctx->state[2] += c;
+  ctx->state[3] += d;
+  ctx->state[4] += e;
+  ctx->state[5] += f;
+  ctx->state[6] += g;
+  ctx->state[7] += h;
+}
+
+#if NACL_SHA256_X86_SHA
+/*
+ * Four rounds per iteration.  msg[i % 4] holds the message words of rounds
+ * 4 * i .. 4 * i + 3; from the fifth iteration on they are computed from
+ * the four previous groups.
+ */
+__attribute__((target("sha,sse4.1")))
+static void Sha256BlocksSHA(struct Sha256Context *ctx, const uint8_t *data,
+                            size_t blocks) {
+  const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                           0x0405060700010203ULL);
+  __m128i state0, state1, tmp;
+  __m128i msg[4];
+  int i;
+
+  /* The rounds instruction wants the state as ABEF and CDGH.  */
+  tmp = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *) &ctx->state[0]), 0xb1);
+  state1 = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *) &ctx->state[4]),
+                             0x1b);
+  state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+  for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE) {
+    __m128i abef = state0;
+    __m128i cdgh = state1;
+
+    for (i = 0; i < 16; i++) {
+      __m128i words;
+
+      if (i < 4) {
+        msg[i] = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i *) (data + i * 16)), byte_swap);
+      } else {
+        tmp = _mm_sha256msg1_epu32(msg[i % 4], msg[(i + 1) % 4]);
+        tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(msg[(i + 3) % 4],
+                                                 msg[(i + 2) % 4], 4));
+        msg[i % 4] = _mm_sha256msg2_epu32(tmp, msg[(i + 3) % 4]);
+      }
+      words = _mm_add_epi32(
+          msg[i % 4], _mm_loadu_si128((const __m128i *) &kSha256K[i * 4]));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, words);
+      state0 = _mm_sha256rnds2_epu32(state0, state1,
+                                     _mm_shuffle_epi32(words, 0x0e));
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1b);
+  state1 = _mm_shuffle_epi32(state1, 0xb1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+  _mm_storeu_si128((__m128i *) &ctx->state[0], state0);
+  _mm_storeu_si128((__m128i *) &ctx->state[4], state1);
+}
+
+static int CpuHasSHA(void) {
+  static int has_sha = -1;
+
+  if (has_sha < 0) {
+    unsigned int eax, ebx, ecx, edx;
+
+    has_sha = 0;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+        (ecx & bit_SSE4_1) != 0 && __get_cpuid_max(0, NULL) >= 7) {
+      __cpuid_count(7, 0, eax, ebx, ecx, edx);
+      has_sha = (ebx & (1U << 29)) != 0;
+    }
+  }
+  return has_sha;
+}
+#endif
+
+static void Sha256Blocks(struct Sha256Context *ctx, const uint8_t *data,
+                         size_t blocks) {
+#if NACL_SHA256_X86_SHA
+  if (CpuHasSHA()) {
+    Sha256BlocksSHA(ctx, data, blocks);
+    return;
+  }
+#endif
+  for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE)
+    Sha256Block(ctx, data);
+}
+
+static void Sha256Update(struct Sha256Context *ctx, const uint8_t *data,
+                         size_t length) {
+  ctx->length += length;
+  if (ctx->block_used != 0) {
+    size_t n = SHA256_BLOCK_SIZE - ctx->block_used;
+    if (n > length)
+      n = length;
+    memcpy(ctx->block + ctx->block_used, data, n);
+    ctx->block_used += n;
+    data += n;
+    length -= n;
+    if (ctx->block_used < SHA256_BLOCK_SIZE)
+      return;
+    Sha256Blocks(ctx, ctx->block, 1);
+    ctx->block_used = 0;
+  }
+  Sha256Blocks(ctx, data, length / SHA256_BLOCK_SIZE);
+  data += length & ~(size_t) (SHA256_BLOCK_SIZE - 1);
+  length &= SHA256_BLOCK_SIZE - 1;
+  memcpy(ctx->block, data, length);
+  ctx->block_used = length;
+}
+
+static void Sha256Final(struct Sha256Context *ctx,
+                        uint8_t digest[SHA256_DIGEST_SIZE]) {
+  uint64_t bit_length = ctx->length * 8;
+  int i;
+
+  ctx->block[ctx->block_used++] = 0x80;
+  if (ctx->block_used > SHA256_BLOCK_SIZE - 8) {
+    memset(ctx->block + ctx->block_used, 0,
+           SHA256_BLOCK_SIZE - ctx->block_used);
+    Sha256Blocks(ctx, ctx->block, 1);
+    ctx->block_used = 0;
+  }
+  memset(ctx->block + ctx->block_used, 0,
+         SHA256_BLOCK_SIZE - 8 - ctx->block_used);
+  for (i = 0; i < 8; i++)
+    ctx->block[SHA256_BLOCK_SIZE - 1 - i] = (uint8_t) (bit_length >> (i * 8));
+  Sha256Blocks(ctx, ctx->block, 1);
+
+  for (i = 0; i < 8; i++) {
+    digest[i * 4] = (uint8_t) (ctx->state[i] >> 24);
+    digest[i * 4 + 1] = (uint8_t) (ctx->state[i] >> 16);
+    digest[i * 4 + 2] = (uint8_t) (ctx->state[i] >> 8);
+    digest[i * 4 + 3] = (uint8_t) ctx->state[i];
+  }
+}
+
+/*
+ * File layout:
+ *
+ *   struct CacheFileHeader
+ *   uint32_t index[header.index_slots]
+ *   struct CacheRecord log[header.log_capacity]
+ *
+ * Records are appended to the log; the index maps a digest to its record by
+ * linear probing.  Evicting a record leaves a tombstone in the index and a
+ * dead record in the log.  When the log is full, live records are moved to
+ * the front and the index is rebuilt.  The log is twice as long as the
+ * entry bound and the index twice as long as the log, so probing always
+ * terminates and compaction is amortized over many insertions.
+ */
+
+#define CACHE_FILE_MAGIC 0x4356434e  /* "NCVC" */
+#define CACHE_FILE_VERSION 1
+
+#define INDEX_SLOT_EMPTY 0
+#define INDEX_SLOT_TOMBSTONE 0xffffffff
+
+struct CacheFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t max_entries;
+  uint32_t index_slots;
+  uint32_t log_capacity;
+  uint32_t log_count;
+  uint32_t live_count;
+  uint32_t reserved;
+  /* Incremented on every hit and insertion; stamps records for LRU.  */
+  uint64_t clock;
+};
+
+struct CacheRecord {
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  /* 0 for records that have been evicted.  */
+  uint64_t last_use;
+};
+
+struct PersistentCache {
+  struct NaClValidationCache interface;
+  struct NaClMutex mu;
+  int fd;
+  void *mapping;
+  size_t mapping_size;
+  struct CacheFileHeader *header;
+  uint32_t *index;
+  struct CacheRecord *log;
+};
+
+struct PersistentCacheQuery {
+  struct PersistentCache *cache;
+  struct Sha256Context sha;
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  int finalized;
+};
+
+static size_t CacheFileSize(uint32_t index_slots, uint32_t log_capacity) {
+  return sizeof(struct CacheFileHeader) +
+         (size_t) index_slots * sizeof(uint32_t) +
+         (size_t) log_capacity * sizeof(struct CacheRecord);
+}
+
+static int LockCacheFile(int fd, short type) {
+  struct flock lock;
+  int rc;
+
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = 0;  /* The whole file.  */
+  do {
+    rc = fcntl(fd, F_SETLKW, &lock);
+  } while (rc == -1 && errno == EINTR);
+  return rc == 0;
+}
+
+static void Lock(struct PersistentCache *cache) {
+  NaClXMutexLock(&cache->mu);
+  CHECK(LockCacheFile(cache->fd, F_WRLCK));
+}
+
+static void Unlock(struct PersistentCache *cache) {
+  CHECK(LockCacheFile(cache->fd, F_UNLCK));
+  NaClXMutexUnlock(&cache->mu);
+}
+
+static uint32_t IndexStart(struct PersistentCache *cache,
+                           const uint8_t *digest) {
+  uint32_t hash;
+  /* The digest is uniformly distributed, any four bytes will do.  */
+  memcpy(&hash, digest, sizeof(hash));
+  return hash & (cache->header->index_slots - 1);
+}
+
+/*
+ * Returns the index slot holding |digest|, or -1.  If |free_slot| is not
+ * NULL, it receives the first empty or tombstone slot on the probe path.
+ */
+static int64_t FindSlot(struct PersistentCache *cache, const uint8_t *digest,
+                        int64_t *free_slot) {
+  uint32_t mask = cache->header->index_slots - 1;
+  uint32_t slot = IndexStart(cache, digest);
+  uint32_t probes;
+
+  if (free_slot != NULL)
+    *free_slot = -1;
+  for (probes = 0; probes <= mask; probes++, slot = (slot + 1) & mask) {
+    uint32_t entry = cache->index[slot];
+    if (entry == INDEX_SLOT_EMPTY) {
+      if (free_slot != NULL && *free_slot == -1)
+        *free_slot = slot;
+      return -1;
+    }
+    if (entry == INDEX_SLOT_TOMBSTONE) {
+      if (free_slot != NULL && *free_slot == -1)
+        *free_slot = slot;
+      continue;
+    }
+    if (entry - 1 < cache->header->log_count &&
+        memcmp(cache->log[entry - 1].digest, digest,
+               SHA256_DIGEST_SIZE) == 0) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+static void RebuildIndex(struct PersistentCache *cache) {
+  struct CacheFileHeader *header = cache->header;
+  uint32_t i;
+
+  memset(cache->index, 0, header->index_slots * sizeof(uint32_t));
+  for (i = 0; i < header->log_count; i++) {
+    int64_t free_slot;
+    if (cache->log[i].last_use == 0)
+      continue;
+    FindSlot(cache, cache->log[i].digest, &free_slot);
+    CHECK(free_slot >= 0);
+    cache->index[free_slot] = i + 1;
+  }
+}
+
+/* Moves live records to the front of the log and drops all tombstones.  */
+static void CompactLog(struct PersistentCache *cache) {
+  struct CacheFileHeader *header = cache->header;
+  uint32_t i;
+  uint32_t live = 0;
+
+  for (i = 0; i < header->log_count; i++) {
+    if (cache->log[i].last_use == 0)
+      continue;
+    if (i != live)
+      cache->log[live] = cache->log[i];
+    live++;
+  }
+  header->log_count = live;
+  header->live_count = live;
+  RebuildIndex(cache);
+}
+
+static void EvictLeastRecentlyUsed(struct PersistentCache *cache) {
+  struct CacheFileHeader *header = cache->header;
+  int64_t victim = -1;
+  int64_t slot;
+  uint32_t i;
+
+  for (i = 0; i < header->log_count; i++) {
+    if (cache->log[i].last_use == 0)
+      continue;
+    if (victim == -1 || cache->log[i].last_use < cache->log[victim].last_use)
+      victim = i;
+  }
+  if (victim == -1)
+    return;
+  slot = FindSlot(cache, cache->log[victim].digest, NULL);
+  if (slot >= 0)
+    cache->index[slot] = INDEX_SLOT_TOMBSTONE;
+  cache->log[victim].last_use = 0;
+  header->live_count--;
+}
+
+static void Insert(struct PersistentCache *cache, const uint8_t *digest) {
+  struct CacheFileHeader *header = cache->header;
+  struct CacheRecord *record;
+  int64_t free_slot;
+  int64_t slot;
+
+  slot = FindSlot(cache, digest, NULL);
+  if (slot >= 0) {
+    cache->log[cache->index[slot] - 1].last_use = ++header->clock;
+    return;
+  }
+  if (header->live_count >= header->max_entries)
+    EvictLeastRecentlyUsed(cache);
+  if (header->log_count >= header->log_capacity)
+    CompactLog(cache);
+
+  /* Write the record before publishing it in the index.  */
+  record = &cache->log[header->log_count];
+  memcpy(record->digest, digest, SHA256_DIGEST_SIZE);
+  record->last_use = ++header->clock;
+  header->log_count++;
+  header->live_count++;
+
+  FindSlot(cache, digest, &free_slot);
+  CHECK(free_slot >= 0);
+  cache->index[free_slot] = header->log_count;
+}
+
+static void *CreateQuery(void *handle) {
+  struct PersistentCacheQuery *query = malloc(sizeof(*query));
+  if (query == NULL)
+    return NULL;
+  query->cache = handle;
+  Sha256Init(&query->sha);
+  query->finalized = 0;
+  return query;
+}
+
+static void AddData(void *handle, const uint8_t *data, size_t length) {
+  struct PersistentCacheQuery *query = handle;
+  CHECK(!query->finalized);
+  Sha256Update(&query->sha, data, length);
+}
+
+static int QueryKnownToValidate(void *handle) {
+  struct PersistentCacheQuery *query = handle;
+  struct PersistentCache *cache = query->cache;
+  int64_t slot;
+
+  CHECK(!query->finalized);
+  Sha256Final(&query->sha, query->digest);
+  query->finalized = 1;
+
+  Lock(cache);
+  slot = FindSlot(cache, query->digest, NULL);
+  if (slot >= 0)
+    cache->log[cache->index[slot] - 1].last_use = ++cache->header->clock;
+  Unlock(cache);
+  return slot >= 0;
+}
+
+static void SetKnownToValidate(void *handle) {
+  struct PersistentCacheQuery *query = handle;
+  struct PersistentCache *cache = query->cache;
+
+  CHECK(query->finalized);
+  Lock(cache);
+  Insert(cache, query->digest);
+  Unlock(cache);
+}
+
+static void DestroyQuery(void *query) {
+  free(query);
+}
+
+static int HeaderIsValid(const struct CacheFileHeader *header,
+                         off_t file_size) {
+  return header->magic == CACHE_FILE_MAGIC &&
+         header->version == CACHE_FILE_VERSION &&
+         header->max_entries > 0 &&
+         header->log_capacity >= header->max_entries &&
+         header->index_slots >= 2 * header->log_capacity &&
+         (header->index_slots & (header->index_slots - 1)) == 0 &&
+         header->log_count <= header->log_capacity &&
+         header->live_count <= header->log_count &&
+         (off_t) CacheFileSize(header->index_slots,
+                               header->log_capacity) == file_size;
+}
+
+/*
+ * Maps the cache file, (re)initializing it if it is empty or does not
+ * look like a cache file.  Must be called with the file lock held.
+ */
+static int MapCacheFile(struct PersistentCache *cache, uint32_t max_entries) {
+  struct CacheFileHeader header;
+  struct stat st;
+  ssize_t read_size;
+
+  if (fstat(cache->fd, &st) != 0)
+    return 0;
+  read_size = pread(cache->fd, &header, sizeof(header), 0);
+  if (read_size != (ssize_t) sizeof(header) ||
+      !HeaderIsValid(&header, st.st_size)) {
+    uint32_t index_slots = 1;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = CACHE_FILE_MAGIC;
+    header.version = CACHE_FILE_VERSION;
+    header.max_entries = max_entries;
+    header.log_capacity = 2 * max_entries;
+    while (index_slots < 2 * header.log_capacity)
+      index_slots <<= 1;
+    header.index_slots = index_slots;
+
+    if (ftruncate(cache->fd, 0) != 0 ||
+        ftruncate(cache->fd, CacheFileSize(header.index_slots,
+                                           header.log_capacity)) != 0 ||
+        pwrite(cache->fd, &header, sizeof(header), 0) !=
+            (ssize_t) sizeof(header)) {
+      NaClLog(LOG_ERROR,
+              "NaClPersistentValidationCacheCreate: cannot initialize cache "
+              "file, errno %d\n", errno);
+      return 0;
+    }
+  }
+
+  cache->mapping_size = CacheFileSize(header.index_slots, header.log_capacity);
+  cache->mapping = mmap(NULL, cache->mapping_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, cache->fd, 0);
+  if (cache->mapping == MAP_FAILED) {
+    cache->mapping = NULL;
+    return 0;
+  }
+  cache->header = cache->mapping;
+  cache->index = (uint32_t *) (cache->header + 1);
+  cache->log = (struct CacheRecord *) (cache->index + header.index_slots);
+  return 1;
+}
+
+/*
+ * A query keyed on the code costs a SHA-256 of it, which is no slower than
+ * running the DFA over it and several times faster with the SHA extensions,
+ * so such queries are always worth making.  A file identity only says where the code came from, which is not
+ * enough for a result that outlives the process: the file can be replaced
+ * by one with the same name, inode, size and times.
+ */
+static int CachingIsInexpensive(const struct NaClValidationMetadata *metadata) {
+  return metadata == NULL || metadata->identity_type == NaClCodeIdentityData;
+}
+
+/*
+ * Anyone who can write the cache file can mark arbitrary code as
+ * validated, so it must belong to us and be writable by no one else.
+ */
+static int CacheFileIsPrivate(int fd, const char *path) {
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+    NaClLog(LOG_ERROR,
+            "NaClPersistentValidationCacheCreate: %s is not a regular file "
+            "owned by this user and writable only by it\n", path);
+    return 0;
+  }
+  return 1;
+}
+
+struct NaClValidationCache *NaClPersistentValidationCacheCreate(
+    const char *path,
+    uint32_t max_entries) {
+  struct PersistentCache *cache;
+  int mapped;
+
+  /* Keep the index size computation well within 32 bits.  */
+  if (max_entries == 0 || max_entries > (1U << 22))
+    return NULL;
+
+  cache = malloc(sizeof(*cache));
+  if (cache == NULL)
+    return NULL;
+  memset(cache, 0, sizeof(*cache));
+  if (!NaClMutexCtor(&cache->mu)) {
+    free(cache);
+    return NULL;
+  }
+
+  cache->fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW, 0600);
+  if (cache->fd < 0) {
+    NaClLog(LOG_ERROR,
+            "NaClPersistentValidationCacheCreate: cannot open %s, errno %d\n",
+            path, errno);
+    goto error;
+  }
+  if (!CacheFileIsPrivate(cache->fd, path))
+    goto error;
+  if (!LockCacheFile(cache->fd, F_WRLCK))
+    goto error;
+  mapped = MapCacheFile(cache, max_entries);
+  LockCacheFile(cache->fd, F_UNLCK);
+  if (!mapped)
+    goto error;
+
+  cache->interface.handle = cache;
+  cache->interface.CreateQuery = CreateQuery;
+  cache->interface.AddData = AddData;
+  cache->interface.QueryKnownToValidate = QueryKnownToValidate;
+  cache->interface.SetKnownToValidate = SetKnownToValidate;
+  cache->interface.DestroyQuery = DestroyQuery;
+  cache->interface.CachingIsInexpensive = CachingIsInexpensive;
+  return &cache->interface;
+
+ error:
+  if (cache->fd >= 0)
+    close(cache->fd);
+  NaClMutexDtor(&cache->mu);
+  free(cache);
+  return NULL;
+}
+
+void NaClPersistentValidationCacheDestroy(struct NaClValidationCache *cache) {
+  struct PersistentCache *self;
+
+  if (cache == NULL)
+    return;
+  self = cache->handle;
+  CHECK(&self->interface == cache);
+  munmap(self->mapping, self->mapping_size);
+  close(self->fd);
+  NaClMutexDtor(&self->mu);
+  free(self);
+}
+
+#endif  /* NACL_WINDOWS */
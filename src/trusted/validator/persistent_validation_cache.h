@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_PERSISTENT_VALIDATION_CACHE_H_
+#define NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_PERSISTENT_VALIDATION_CACHE_H_
+
+#include "native_client/src/include/nacl_base.h"
+#include "native_client/src/include/portability.h"
+#include "native_client/src/public/validation_cache.h"
+
+EXTERN_C_BEGIN
+
+/*
+ * A NaClValidationCache backed by a file, so validation results survive
+ * across processes.
+ *
+ * Queries are keyed by the SHA-256 of the data passed to AddData (for the
+ * validators, that is the validator id, the CPU features and
+ * NaClAddCodeIdentity()).  Only code without a file identity is looked up,
+ * so the key covers the code bytes themselves.  The file holds an
+ * append-only log of digests and an open-addressing index over it, and is
+ * mapped into memory, so a lookup costs a hash computation and a few
+ * probes.  Access from several
+ * processes is serialized with an fcntl() lock on the file.  Once
+ * |max_entries| digests are stored, adding a new one evicts the least
+ * recently used.
+ *
+ * Anyone who can write the cache file can make arbitrary code "known to
+ * validate", so it must live in a directory only the embedder can write
+ * to.  The file is created with mode 0600, and an existing file is refused
+ * unless it is a regular file (not a symlink) owned by the effective user
+ * and not writable by group or others.
+ *
+ * Returns NULL if the file cannot be opened or mapped.  Not implemented on
+ * Windows, where it always returns NULL.
+ */
+struct NaClValidationCache *NaClPersistentValidationCacheCreate(
+    const char *path,
+    uint32_t max_entries);
+
+void NaClPersistentValidationCacheDestroy(struct NaClValidationCache *cache);
+
+EXTERN_C_END
+
+#endif /* NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_PERSISTENT_VALIDATION_CACHE_H_ */
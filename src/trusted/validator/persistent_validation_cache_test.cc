@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "gtest/gtest.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/utils/types.h"
+#include "native_client/src/trusted/validator/ncvalidate.h"
+#include "native_client/src/trusted/validator/persistent_validation_cache.h"
+#include "native_client/src/trusted/validator/validation_metadata.h"
+
+#define CODE_SIZE 64
+#define NOP 0x90
+
+class PersistentValidationCacheTests : public ::testing::Test {
+ protected:
+  char path[64];
+
+  void SetUp() {
+    strcpy(path, "/tmp/nacl_validation_cache_test_XXXXXX");
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+  }
+
+  void TearDown() {
+    unlink(path);
+  }
+
+  // Looks up |key|, optionally recording it.  Returns the lookup result.
+  static int Query(NaClValidationCache *cache, int key, bool set) {
+    void *query = cache->CreateQuery(cache->handle);
+    EXPECT_NE((void *) NULL, query);
+    cache->AddData(query, (const unsigned char *) &key, sizeof(key));
+    int result = cache->QueryKnownToValidate(query);
+    if (set && !result)
+      cache->SetKnownToValidate(query);
+    cache->DestroyQuery(query);
+    return result;
+  }
+};
+
+TEST_F(PersistentValidationCacheTests, MissThenHit) {
+  NaClValidationCache *cache = NaClPersistentValidationCacheCreate(path, 16);
+  ASSERT_NE((NaClValidationCache *) NULL, cache);
+
+  EXPECT_EQ(0, Query(cache, 1, true));
+  EXPECT_EQ(1, Query(cache, 1, false));
+  EXPECT_EQ(0, Query(cache, 2, false));
+
+  NaClPersistentValidationCacheDestroy(cache);
+}
+
+TEST_F(PersistentValidationCacheTests, SurvivesReopen) {
+  NaClValidationCache *cache = NaClPersistentValidationCacheCreate(path, 16);
+  ASSERT_NE((NaClValidationCache *) NULL, cache);
+  EXPECT_EQ(0, Query(cache, 7, true));
+  NaClPersistentValidationCacheDestroy(cache);
+
+  // A different bound does not discard a valid file.
+  cache = NaClPersistentValidationCacheCreate(path, 32);
+  ASSERT_NE((NaClValidationCache *) NULL, cache);
+  EXPECT_EQ(1, Query(cache, 7, false));
+  NaClPersistentValidationCacheDestroy(cache);
+}
+
+TEST_F(PersistentValidationCacheTests, EvictsLeastRecentlyUsed) {
+  NaClValidationCache *cache = NaClPersistentValidationCacheCreate(path, 4);
+  ASSERT_NE((NaClValidationCache *) NULL, cache);
+
+  for (int key = 0; key < 4; key++)
+    EXPECT_EQ(0, Query(cache, key, true));
+  // Touch 0 so that 1 becomes the least recently used entry.
+  EXPECT_EQ(1, Query(cache, 0, false));
+  EXPECT_EQ(0, Query(cache, 100, true));
+
+  EXPECT_EQ(1, Query(cache, 0, false));
+  EXPECT_EQ(0, Query(cache, 1, false));
+  EXPECT_EQ(1, Query(cache, 2, false));
+  EXPECT_EQ(1, Query(cache, 100, false));
+
+  // Enough insertions to compact the log several times.
+  for (int key = 1000; key < 1100; key++)
+    EXPECT_EQ(0, Query(cache, key, true));
+  for (int key = 1096; key < 1100; key++)
+    EXPECT_EQ(1, Query(cache, key, false));
+  EXPECT_EQ(0, Query(cache, 0, false));
+
+  NaClPersistentValidationCacheDestroy(cache);
+}
+
+TEST_F(PersistentValidationCacheTests, CorruptFileIsReset) {
+  FILE *file = fopen(path, "wb");
+  ASSERT_NE((FILE *) NULL, file);
+  fputs("not a validation cache", file);
+  fclose(file);
+
+  NaClValidationCache *cache = NaClPersistentValidationCacheCreate(path, 16);
+  ASSERT_NE((NaClValidationCache *) NULL, cache);
+  EXPECT_EQ(0, Query(cache, 3, true));
+  EXPECT_EQ(1, Query(cache, 3, false));
+  NaClPersistentValidationCacheDestroy(cache);
+}
+
+TEST_F(PersistentValidationCacheTests, RefusesWritableFile) {
+  ASSERT_EQ(0, chmod(path, 0620));
+  EXPECT_EQ((NaClValidationCache *) NULL,
+            NaClPersistentValidationCacheCreate(path, 16));
+  ASSERT_EQ(0, chmod(path, 0602));
+  EXPECT_EQ((NaClValidationCache *) NULL,
+            NaClPersistentValidationCacheCreate(path, 16));
+  ASSERT_EQ(0, chmod(path, 0600));
+  NaClValidationCache *cache = NaClPersistentValidationCacheCreate(path, 16);
+  EXPECT_NE((NaClValidationCache *) NULL, cache);
+  NaClPersistentValidationCacheDestroy(cache);
+}
+
+TEST_F(PersistentValidationCacheTests, RefusesSymlink) {
+  char link_path[sizeof(path) + 5];
+  snprintf(link_path, sizeof(link_path), "%s.link", path);
+  ASSERT_EQ(0, symlink(path, link_path));
+  EXPECT_EQ((NaClValidationCache *) NULL,
+            NaClPersistentValidationCacheCreate(link_path, 16));
+  unlink(link_path);
+}
+
+// Forwards to a persistent cache and counts the lookups that hit.
+struct CountingCache {
+  NaClValidationCache interface;
+  NaClValidationCache *cache;
+  int queries;
+  int hits;
+};
+
+struct CountingQuery {
+  CountingCache *counter;
+  void *query;
+};
+
+void *CountingCreateQuery(void *handle) {
+  CountingCache *counter = (CountingCache *) handle;
+  CountingQuery *query = new CountingQuery;
+  query->counter = counter;
+  query->query = counter->cache->CreateQuery(counter->cache->handle);
+  return query;
+}
+
+void CountingAddData(void *handle, const uint8_t *data, size_t length) {
+  CountingQuery *query = (CountingQuery *) handle;
+  query->counter->cache->AddData(query->query, data, length);
+}
+
+int CountingQueryKnownToValidate(void *handle) {
+  CountingQuery *query = (CountingQuery *) handle;
+  int result = query->counter->cache->QueryKnownToValidate(query->query);
+  query->counter->queries++;
+  query->counter->hits += result;
+  return result;
+}
+
+void CountingSetKnownToValidate(void *handle) {
+  CountingQuery *query = (CountingQuery *) handle;
+  query->counter->cache->SetKnownToValidate(query->query);
+}
+
+void CountingDestroyQuery(void *handle) {
+  CountingQuery *query = (CountingQuery *) handle;
+  query->counter->cache->DestroyQuery(query->query);
+  delete query;
+}
+
+class PersistentValidationCacheValidatorTests
+    : public PersistentValidationCacheTests {
+ protected:
+  const struct NaClValidatorInterface *validator;
+  NaClCPUFeatures *cpu_features;
+  CountingCache counter;
+  unsigned char code_buffer[CODE_SIZE];
+
+  void SetUp() {
+    PersistentValidationCacheTests::SetUp();
+    validator = NaClCreateValidator();
+    cpu_features = (NaClCPUFeatures *) malloc(validator->CPUFeatureSize);
+    ASSERT_NE((NaClCPUFeatures *) NULL, cpu_features);
+    validator->SetAllCPUFeatures(cpu_features);
+    memset(code_buffer, NOP, sizeof(code_buffer));
+    memset(&counter, 0, sizeof(counter));
+  }
+
+  void TearDown() {
+    free(cpu_features);
+    PersistentValidationCacheTests::TearDown();
+  }
+
+  // Opens the cache file as a new process would, and validates the code
+  // with |metadata| through it.
+  NaClValidationStatus Load(const NaClValidationMetadata *metadata) {
+    counter.cache = NaClPersistentValidationCacheCreate(path, 16);
+    EXPECT_NE((NaClValidationCache *) NULL, counter.cache);
+    counter.interface.handle = &counter;
+    counter.interface.CreateQuery = CountingCreateQuery;
+    counter.interface.AddData = CountingAddData;
+    counter.interface.QueryKnownToValidate = CountingQueryKnownToValidate;
+    counter.interface.SetKnownToValidate = CountingSetKnownToValidate;
+    counter.interface.DestroyQuery = CountingDestroyQuery;
+    counter.interface.CachingIsInexpensive =
+        counter.cache->CachingIsInexpensive;
+    NaClValidationStatus status =
+        validator->Validate(0, code_buffer, CODE_SIZE,
+                            FALSE,  /* stubout_mode */
+                            0,      /* flags */
+                            TRUE,   /* readonly_text */
+                            cpu_features,
+                            metadata,
+                            &counter.interface);
+    NaClPersistentValidationCacheDestroy(counter.cache);
+    return status;
+  }
+};
+
+// Code without a file identity (the IRT, and code mapped or created by the
+// untrusted loader) is looked up by its hash, so loading it again in another
+// process is a cache hit.
+TEST_F(PersistentValidationCacheValidatorTests, SecondLoadHits) {
+  EXPECT_EQ(NaClValidationSucceeded, Load(NULL));
+  EXPECT_EQ(1, counter.queries);
+  EXPECT_EQ(0, counter.hits);
+
+  EXPECT_EQ(NaClValidationSucceeded, Load(NULL));
+  EXPECT_EQ(2, counter.queries);
+  EXPECT_EQ(1, counter.hits);
+
+  // Different code misses, and is validated.  0xff 0xff is not a valid x86
+  // instruction.
+  memset(code_buffer, 0xff, sizeof(code_buffer));
+  EXPECT_NE(NaClValidationSucceeded, Load(NULL));
+  EXPECT_EQ(3, counter.queries);
+  EXPECT_EQ(1, counter.hits);
+}
+
+// A file identity is not looked up: the file could be replaced by one with
+// the same identity, so code that changed is validated again.
+TEST_F(PersistentValidationCacheValidatorTests, FileIdentityIsNotCached) {
+  NaClValidationMetadata metadata;
+  memset(&metadata, 0, sizeof(metadata));
+  metadata.identity_type = NaClCodeIdentityFile;
+  metadata.file_name = (char *) "foobar";
+  metadata.file_name_length = 6;
+  metadata.file_size = CODE_SIZE;
+
+  EXPECT_EQ(NaClValidationSucceeded, Load(&metadata));
+  memset(code_buffer, 0xff, sizeof(code_buffer));
+  EXPECT_NE(NaClValidationSucceeded, Load(&metadata));
+  EXPECT_EQ(0, counter.queries);
+}
+
+// Test driver function.
+int main(int argc, char *argv[]) {
+  NaClLogModuleInit();
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
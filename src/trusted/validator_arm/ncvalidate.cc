@@ -266,6 +266,7 @@ static struct NaClValidatorInterface validator = {
   NaClSetAllCPUFeaturesArm,
   NaClGetCurrentCPUFeaturesArm,
   IsOnInstBoundaryArm,
+  NULL,  /* Multi-threaded validation is not implemented. */
 };
 
 const struct NaClValidatorInterface *NaClValidatorCreateArm() {
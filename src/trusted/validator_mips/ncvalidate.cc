@@ -228,6 +228,7 @@ static struct NaClValidatorInterface validator = {
   NaClSetAllCPUFeaturesMips,
   NaClGetCurrentCPUFeaturesMips,
   IsOnInstBoundaryMips,
+  NULL,  /* Multi-threaded validation is not implemented. */
 };
 
 const struct NaClValidatorInterface *NaClValidatorCreateMips() {
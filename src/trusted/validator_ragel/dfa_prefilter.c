@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "native_client/src/trusted/validator_ragel/dfa_prefilter.h"
+
+#include "native_client/src/include/build_config.h"
+#include "native_client/src/trusted/validator_ragel/validator.h"
+
+#if NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && \
+    (defined(__SSE2__) || defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+# define NACL_DFA_PREFILTER_SSE2 1
+# include <emmintrin.h>
+#else
+# define NACL_DFA_PREFILTER_SSE2 0
+#endif
+
+/* The target attribute lets us build the AVX2 path without -mavx2.  */
+#if NACL_ARCH(NACL_BUILD_ARCH) == NACL_x86 && defined(__GNUC__) && \
+    (defined(__clang__) || \
+     __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# define NACL_DFA_PREFILTER_AVX2 1
+# include <immintrin.h>
+#else
+# define NACL_DFA_PREFILTER_AVX2 0
+#endif
+
+#define NOP_OPCODE 0x90
+#define HLT_OPCODE 0xf4
+
+Bool NaClDfaIsTrivialBundle(const uint8_t *bundle) {
+  size_t i;
+
+  for (i = 0; i < kBundleSize; i++) {
+    if (bundle[i] != NOP_OPCODE && bundle[i] != HLT_OPCODE)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+#if !NACL_DFA_PREFILTER_SSE2
+static void ClassifyBundlesC(const uint8_t *code, size_t bundles,
+                             uint8_t *trivial) {
+  size_t i;
+
+  for (i = 0; i < bundles; i++)
+    trivial[i] = (uint8_t) NaClDfaIsTrivialBundle(code + i * kBundleSize);
+}
+#else
+static void ClassifyBundlesSSE2(const uint8_t *code, size_t bundles,
+                                uint8_t *trivial) {
+  const __m128i nop = _mm_set1_epi8((char) NOP_OPCODE);
+  const __m128i hlt = _mm_set1_epi8((char) HLT_OPCODE);
+  size_t i;
+
+  for (i = 0; i < bundles; i++) {
+    const __m128i *p = (const __m128i *) (code + i * kBundleSize);
+    __m128i lo = _mm_loadu_si128(p);
+    __m128i hi = _mm_loadu_si128(p + 1);
+    __m128i ok_lo = _mm_or_si128(_mm_cmpeq_epi8(lo, nop),
+                                 _mm_cmpeq_epi8(lo, hlt));
+    __m128i ok_hi = _mm_or_si128(_mm_cmpeq_epi8(hi, nop),
+                                 _mm_cmpeq_epi8(hi, hlt));
+    trivial[i] = _mm_movemask_epi8(_mm_and_si128(ok_lo, ok_hi)) == 0xffff;
+  }
+}
+#endif
+
+#if NACL_DFA_PREFILTER_AVX2
+/* One bundle is exactly one 256-bit register.  */
+__attribute__((target("avx2")))
+static void ClassifyBundlesAVX2(const uint8_t *code, size_t bundles,
+                                uint8_t *trivial) {
+  const __m256i nop = _mm256_set1_epi8((char) NOP_OPCODE);
+  const __m256i hlt = _mm256_set1_epi8((char) HLT_OPCODE);
+  size_t i;
+
+  for (i = 0; i < bundles; i++) {
+    __m256i bundle =
+        _mm256_loadu_si256((const __m256i *) (code + i * kBundleSize));
+    __m256i ok = _mm256_or_si256(_mm256_cmpeq_epi8(bundle, nop),
+                                 _mm256_cmpeq_epi8(bundle, hlt));
+    trivial[i] = (uint32_t) _mm256_movemask_epi8(ok) == 0xffffffff;
+  }
+}
+
+static Bool CpuHasAVX2(void) {
+  static int has_avx2 = -1;
+
+  if (has_avx2 < 0) {
+    __builtin_cpu_init();
+    has_avx2 = __builtin_cpu_supports("avx2") != 0;
+  }
+  return has_avx2;
+}
+#endif
+
+void NaClDfaClassifyBundles(const uint8_t *code, size_t size,
+                            uint8_t *trivial) {
+  size_t bundles = size / kBundleSize;
+
+#if NACL_DFA_PREFILTER_AVX2
+  if (CpuHasAVX2()) {
+    ClassifyBundlesAVX2(code, bundles, trivial);
+    return;
+  }
+#endif
+#if NACL_DFA_PREFILTER_SSE2
+  ClassifyBundlesSSE2(code, bundles, trivial);
+#else
+  ClassifyBundlesC(code, bundles, trivial);
+#endif
+}
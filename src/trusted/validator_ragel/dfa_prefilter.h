@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Vectorized pre-scan for the DFA validators.
+ */
+
+#ifndef NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_RAGEL_DFA_PREFILTER_H_
+#define NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_RAGEL_DFA_PREFILTER_H_
+
+#include <stddef.h>
+
+#include "native_client/src/include/nacl_base.h"
+#include "native_client/src/shared/utils/types.h"
+
+EXTERN_C_BEGIN
+
+/*
+ * A bundle is "trivial" if every byte in it is a one-byte NOP (0x90) or HLT
+ * (0xf4).  These are the padding the toolchain emits between functions and
+ * before call-aligned instructions.  Such a bundle is valid on its own,
+ * needs no CPU features, and every byte in it is a valid jump target, so
+ * the DFA does not have to decode it.
+ *
+ * Sets trivial[i] to 1 if the i-th bundle of |code| is trivial and to 0
+ * otherwise.  |size| must be a multiple of the bundle size.  Uses AVX2 when
+ * the CPU supports it, and SSE2 or plain C otherwise.
+ */
+void NaClDfaClassifyBundles(const uint8_t *code, size_t size,
+                            uint8_t *trivial);
+
+/* Scalar version, for classifying a single bundle.  */
+Bool NaClDfaIsTrivialBundle(const uint8_t *bundle);
+
+EXTERN_C_END
+
+#endif /* NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_RAGEL_DFA_PREFILTER_H_ */
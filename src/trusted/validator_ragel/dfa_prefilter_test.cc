@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+// Differential test for the prefiltered and multi-threaded x86-64 DFA
+// drivers.  Every @hex snippet from the given .test files is embedded in
+// code blocks surrounded by NOP/HLT padding, together with direct jumps to
+// every byte of the block, and the verdict and the set of reported errors
+// must match those of a plain ValidateChunkAMD64() call.  Sequences that
+// depend on the DFA state are also put right at a boundary between chunks.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "native_client/src/shared/utils/types.h"
+#include "native_client/src/trusted/validator_ragel/dfa_prefilter.h"
+#include "native_client/src/trusted/validator_ragel/dfa_validate_parallel.h"
+#include "native_client/src/trusted/validator_ragel/validator.h"
+
+namespace {
+
+const uint8_t kNop = 0x90;
+const uint8_t kHlt = 0xf4;
+const uint8_t kJmpRel32 = 0xe9;
+const int kJmpRel32Size = 5;
+
+// Large enough for NaClDfaParallelChunkCount() to return 4.
+const size_t kParallelBlockSize = 4 * NACL_DFA_MIN_PARALLEL_CHUNK_SIZE;
+const int kThreads = 4;
+
+struct Report {
+  size_t begin;
+  size_t end;
+  uint32_t info;
+
+  bool operator<(const Report &other) const {
+    if (begin != other.begin)
+      return begin < other.begin;
+    if (end != other.end)
+      return end < other.end;
+    return info < other.info;
+  }
+
+  bool operator==(const Report &other) const {
+    return begin == other.begin && end == other.end && info == other.info;
+  }
+};
+
+typedef std::set<Report> Reports;
+
+struct Collector {
+  const uint8_t *codeblock;
+  Reports reports;
+};
+
+Bool CollectReport(const uint8_t *begin, const uint8_t *end,
+                   uint32_t info, void *callback_data) {
+  Collector *collector = static_cast<Collector *>(callback_data);
+  Report report;
+  report.begin = begin - collector->codeblock;
+  report.end = end - collector->codeblock;
+  report.info = info;
+  collector->reports.insert(report);
+  if (info & (VALIDATION_ERRORS_MASK | BAD_JUMP_TARGET))
+    return FALSE;
+  return TRUE;
+}
+
+// Returns the byte sequences of all @hex sections in |path|.
+std::vector<std::vector<uint8_t> > ReadHexSections(const char *path) {
+  std::vector<std::vector<uint8_t> > sections;
+  std::ifstream file(path);
+  std::string line;
+  bool in_hex = false;
+
+  while (std::getline(file, line)) {
+    if (!line.empty() && line[0] == '@') {
+      in_hex = line.compare(0, 4, "@hex") == 0;
+      if (in_hex)
+        sections.push_back(std::vector<uint8_t>());
+      continue;
+    }
+    if (!in_hex)
+      continue;
+    size_t comment = line.find('#');
+    if (comment != std::string::npos)
+      line.erase(comment);
+    std::istringstream bytes(line);
+    std::string byte;
+    while (bytes >> byte)
+      sections.back().push_back(
+          static_cast<uint8_t>(strtoul(byte.c_str(), NULL, 16)));
+  }
+  return sections;
+}
+
+// Size of the bundles AppendJumps() adds for |targets| targets.
+size_t JumpBytes(size_t targets) {
+  const size_t jumps_per_bundle = kBundleSize / kJmpRel32Size;
+  return (targets + 1 + jumps_per_bundle - 1) / jumps_per_bundle *
+      kBundleSize;
+}
+
+void AppendPadding(std::vector<uint8_t> *code, uint8_t byte, size_t size) {
+  code->insert(code->end(), size, byte);
+}
+
+void PadToBundle(std::vector<uint8_t> *code, uint8_t byte) {
+  AppendPadding(code, byte, (kBundleSize - code->size() % kBundleSize) %
+                kBundleSize);
+}
+
+// Appends bundles of direct jumps to every offset in [0, targets) and to
+// one byte past the end of the final block of |block_size| bytes.
+void AppendJumps(std::vector<uint8_t> *code, size_t targets,
+                 size_t block_size) {
+  const int jumps_per_bundle = kBundleSize / kJmpRel32Size;
+
+  for (size_t target = 0; target <= targets; target++) {
+    if ((code->size() % kBundleSize) / kJmpRel32Size == jumps_per_bundle)
+      PadToBundle(code, kNop);
+    size_t next = code->size() + kJmpRel32Size;
+    int32_t rel32 = static_cast<int32_t>(
+        (target == targets ? block_size + 1 : target) - next);
+    code->push_back(kJmpRel32);
+    const uint8_t *rel32_bytes = reinterpret_cast<const uint8_t *>(&rel32);
+    code->insert(code->end(), rel32_bytes, rel32_bytes + sizeof(rel32));
+  }
+  PadToBundle(code, kNop);
+}
+
+bool Compare(const char *name, size_t index, const char *layout,
+             const std::vector<uint8_t> &code, uint32_t options = 0) {
+  Collector expected;
+  expected.codeblock = &code[0];
+  Bool expected_result = ValidateChunkAMD64(&code[0], code.size(), options,
+                                            &kFullCPUIDFeatures,
+                                            CollectReport, &expected);
+
+  Collector prefiltered;
+  prefiltered.codeblock = &code[0];
+  Bool prefiltered_result = ValidateChunkAMD64Prefiltered(
+      &code[0], code.size(), options, &kFullCPUIDFeatures,
+      CollectReport, &prefiltered);
+
+  Collector chunks[NACL_DFA_MAX_VALIDATION_THREADS];
+  void *callback_data[NACL_DFA_MAX_VALIDATION_THREADS];
+  for (int i = 0; i < NACL_DFA_MAX_VALIDATION_THREADS; i++) {
+    chunks[i].codeblock = &code[0];
+    callback_data[i] = &chunks[i];
+  }
+  Bool parallel_result = ValidateChunkAMD64Parallel(
+      &code[0], code.size(), options, &kFullCPUIDFeatures,
+      CollectReport, callback_data, kThreads);
+  Reports parallel;
+  for (int i = 0; i < NACL_DFA_MAX_VALIDATION_THREADS; i++)
+    parallel.insert(chunks[i].reports.begin(), chunks[i].reports.end());
+
+  bool ok = true;
+  if (prefiltered_result != expected_result ||
+      prefiltered.reports != expected.reports) {
+    printf("%s: snippet %d, %s layout: prefiltered validation differs\n",
+           name, static_cast<int>(index), layout);
+    ok = false;
+  }
+  if (parallel_result != expected_result || parallel != expected.reports) {
+    printf("%s: snippet %d, %s layout: parallel validation differs\n",
+           name, static_cast<int>(index), layout);
+    ok = false;
+  }
+  return ok;
+}
+
+bool TestSnippet(const char *name, size_t index,
+                 const std::vector<uint8_t> &snippet) {
+  bool ok = true;
+
+  // A padding bundle on each side of the snippet, then jumps to every byte.
+  std::vector<uint8_t> code;
+  AppendPadding(&code, kNop, kBundleSize);
+  code.insert(code.end(), snippet.begin(), snippet.end());
+  PadToBundle(&code, kHlt);
+  AppendPadding(&code, kHlt, kBundleSize);
+  size_t targets = code.size();
+  AppendJumps(&code, targets, targets + JumpBytes(targets));
+  ok &= Compare(name, index, "compact", code);
+
+  // The same, spread over several chunks of the parallel validator: the
+  // snippet starts the block and the jumps end it.
+  code.clear();
+  code.insert(code.end(), snippet.begin(), snippet.end());
+  PadToBundle(&code, kHlt);
+  targets = code.size();
+  if (targets + JumpBytes(targets) <= kParallelBlockSize) {
+    AppendPadding(&code, kNop,
+                  kParallelBlockSize - JumpBytes(targets) - targets);
+    AppendJumps(&code, targets, kParallelBlockSize);
+    ok &= Compare(name, index, "chunked", code);
+  }
+
+  return ok;
+}
+
+void PutBytes(std::vector<uint8_t> *code, size_t offset,
+              const uint8_t *bytes, size_t size) {
+  memcpy(&(*code)[offset], bytes, size);
+}
+
+void PutJump(std::vector<uint8_t> *code, size_t offset, size_t target) {
+  int32_t rel32 = static_cast<int32_t>(target - (offset + kJmpRel32Size));
+  (*code)[offset] = kJmpRel32;
+  memcpy(&(*code)[offset + 1], &rel32, sizeof(rel32));
+}
+
+// Puts instruction sequences whose validity depends on the state the DFA
+// carries from one instruction to the next right at the first boundary
+// between the chunks of the parallel validator, and compares the result with
+// serial validation, with and without an initial restricted register.
+bool TestChunkBoundary() {
+  // and $~31, %eax; add %r15, %rax; jmp *%rax
+  static const uint8_t kNaClJmp[] = {
+    0x83, 0xe0, 0xe0, 0x4c, 0x01, 0xf8, 0xff, 0xe0
+  };
+  const size_t kNaClJmpAddOffset = 3;
+  // mov %eax, %eax
+  static const uint8_t kRestrictRax[] = { 0x89, 0xc0 };
+  // mov (%r15, %rax), %ecx
+  static const uint8_t kUseRax[] = { 0x41, 0x8b, 0x0c, 0x07 };
+  static const uint32_t kOptions[] = {
+    0,
+    PACK_RESTRICTED_REGISTER_INITIAL_VALUE(NC_REG_RAX),
+    PACK_RESTRICTED_REGISTER_INITIAL_VALUE(NC_REG_RBP),
+  };
+  // Same computation as ValidateChunks() in dfa_validate_parallel.c.
+  const size_t boundary = ((kParallelBlockSize / kThreads) + kBundleMask) &
+      ~static_cast<size_t>(kBundleMask);
+  bool ok = true;
+
+  for (size_t i = 0; i < sizeof(kOptions) / sizeof(kOptions[0]); i++) {
+    std::vector<uint8_t> code(kParallelBlockSize, kNop);
+
+    // A nacljmp split by the boundary.
+    PutBytes(&code, boundary - kNaClJmpAddOffset,
+             kNaClJmp, sizeof(kNaClJmp));
+    ok &= Compare("chunk boundary", i, "split nacljmp", code, kOptions[i]);
+
+    // A whole nacljmp starting the second chunk, with jumps from the first
+    // chunk to its start and into the middle of it.
+    code.assign(kParallelBlockSize, kNop);
+    PutBytes(&code, boundary, kNaClJmp, sizeof(kNaClJmp));
+    PutJump(&code, 0, boundary);
+    PutJump(&code, kJmpRel32Size, boundary + kNaClJmpAddOffset);
+    ok &= Compare("chunk boundary", i, "nacljmp target", code, kOptions[i]);
+
+    // A register restricted at the end of the first chunk and used at the
+    // start of the second.
+    code.assign(kParallelBlockSize, kNop);
+    PutBytes(&code, boundary - sizeof(kRestrictRax),
+             kRestrictRax, sizeof(kRestrictRax));
+    PutBytes(&code, boundary, kUseRax, sizeof(kUseRax));
+    ok &= Compare("chunk boundary", i, "restricted register", code,
+                  kOptions[i]);
+  }
+  return ok;
+}
+
+// Checks NaClDfaClassifyBundles() against NaClDfaIsTrivialBundle().
+bool TestClassifyBundles() {
+  const size_t kBundles = 64;
+  std::vector<uint8_t> code(kBundles * kBundleSize);
+  uint8_t trivial[kBundles];
+
+  for (size_t i = 0; i < code.size(); i++)
+    code[i] = (i / kBundleSize) % 2 ? kHlt : kNop;
+  // Put one odd byte into every position of bundles 8..39.
+  for (size_t i = 0; i < kBundleSize; i++)
+    code[(8 + i) * kBundleSize + i] = static_cast<uint8_t>(i);
+  code[50 * kBundleSize + 3] = kHlt;
+
+  NaClDfaClassifyBundles(&code[0], code.size(), trivial);
+  for (size_t i = 0; i < kBundles; i++) {
+    Bool expected = NaClDfaIsTrivialBundle(&code[i * kBundleSize]);
+    if (trivial[i] != expected || expected != (i < 8 || i >= 40)) {
+      printf("bundle %d misclassified\n", static_cast<int>(i));
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  bool ok = TestClassifyBundles() && TestChunkBoundary();
+  int snippets = 0;
+
+  for (int i = 1; i < argc; i++) {
+    std::vector<std::vector<uint8_t> > sections = ReadHexSections(argv[i]);
+    for (size_t j = 0; j < sections.size(); j++, snippets++)
+      ok &= TestSnippet(argv[i], j, sections[j]);
+  }
+  printf("%d snippets from %d files: %s\n", snippets, argc - 1,
+         ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -370,6 +370,7 @@ static const struct NaClValidatorInterface validator = {
   NaClSetAllCPUFeaturesX86,
   NaClGetCurrentCPUFeaturesX86,
   IsOnInstBoundary_x86_32,
+  NULL,  /* Multi-threaded validation is not implemented. */
 };
 
 const struct NaClValidatorInterface *NaClDfaValidatorCreate_x86_32(void) {
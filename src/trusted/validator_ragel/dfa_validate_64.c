@@ -12,6 +12,7 @@
 #include "native_client/src/shared/platform/nacl_check.h"
 #include "native_client/src/trusted/validator/validation_cache.h"
 #include "native_client/src/trusted/validator_ragel/dfa_validate_common.h"
+#include "native_client/src/trusted/validator_ragel/dfa_validate_parallel.h"
 #include "native_client/src/trusted/validator_ragel/validator.h"
 
 /*
@@ -25,7 +26,7 @@
 #endif
 
 
-static NaClValidationStatus ApplyDfaValidator_x86_64(
+static NaClValidationStatus ApplyDfaValidatorParallel_x86_64(
     uintptr_t guest_addr,
     uint8_t *data,
     size_t size,
@@ -34,18 +35,33 @@ static NaClValidationStatus ApplyDfaValidator_x86_64(
     int readonly_text,
     const NaClCPUFeatures *f,
     const struct NaClValidationMetadata *metadata,
-    struct NaClValidationCache *cache) {
+    struct NaClValidationCache *cache,
+    int num_threads) {
   /* TODO(jfb) Use a safe cast here. */
   NaClCPUFeaturesX86 *cpu_features = (NaClCPUFeaturesX86 *) f;
   enum NaClValidationStatus status = NaClValidationFailed;
   void *query = NULL;
-  struct StubOutCallbackData callback_data;
-  callback_data.flags = flags;
-  callback_data.chunk_begin = data;
-  callback_data.chunk_end = data + size;
-  callback_data.cpu_features = cpu_features;
-  callback_data.validate_chunk_func = ValidateChunkAMD64;
-  callback_data.did_rewrite = 0;
+  /*
+   * Each chunk validated in parallel gets its own callback data, since
+   * NaClDfaStubOutUnsupportedInstruction() writes to it.  All of them share
+   * the whole code block as chunk_begin/chunk_end so that bundles are located
+   * relative to the start of the code.
+   */
+  struct StubOutCallbackData callback_data[NACL_DFA_MAX_VALIDATION_THREADS];
+  void *callback_data_ptrs[NACL_DFA_MAX_VALIDATION_THREADS];
+  int num_chunks = NaClDfaParallelChunkCount(size, num_threads);
+  int did_rewrite = 0;
+  int i;
+
+  for (i = 0; i < num_chunks; i++) {
+    callback_data[i].flags = flags;
+    callback_data[i].chunk_begin = data;
+    callback_data[i].chunk_end = data + size;
+    callback_data[i].cpu_features = cpu_features;
+    callback_data[i].validate_chunk_func = ValidateChunkAMD64;
+    callback_data[i].did_rewrite = 0;
+    callback_data_ptrs[i] = readonly_text ? NULL : &callback_data[i];
+  }
 
   UNREFERENCED_PARAMETER(guest_addr);
 
@@ -73,24 +89,22 @@ static NaClValidationStatus ApplyDfaValidator_x86_64(
     }
   }
 
-  if (readonly_text) {
-    if (ValidateChunkAMD64(data, size, 0 /*options*/, cpu_features,
-                           NaClDfaProcessValidationError,
-                           NULL))
-      status = NaClValidationSucceeded;
-  } else {
-    if (ValidateChunkAMD64(data, size, 0 /*options*/, cpu_features,
-                           NaClDfaStubOutUnsupportedInstruction,
-                           &callback_data))
-      status = NaClValidationSucceeded;
-  }
+  if (ValidateChunkAMD64Parallel(data, size, 0 /*options*/, cpu_features,
+                                 readonly_text ?
+                                     NaClDfaProcessValidationError :
+                                     NaClDfaStubOutUnsupportedInstruction,
+                                 callback_data_ptrs, num_chunks))
+    status = NaClValidationSucceeded;
 
   if (status != NaClValidationSucceeded && errno == ENOMEM)
     status = NaClValidationFailedOutOfMemory;
 
+  for (i = 0; i < num_chunks; i++)
+    did_rewrite |= callback_data[i].did_rewrite;
+
   /* Cache the result if validation succeeded and the code was not modified. */
   if (query != NULL) {
-    if (status == NaClValidationSucceeded && callback_data.did_rewrite == 0)
+    if (status == NaClValidationSucceeded && did_rewrite == 0)
       cache->SetKnownToValidate(query);
     cache->DestroyQuery(query);
   }
@@ -99,6 +113,23 @@ static NaClValidationStatus ApplyDfaValidator_x86_64(
 }
 
 
+static NaClValidationStatus ApplyDfaValidator_x86_64(
+    uintptr_t guest_addr,
+    uint8_t *data,
+    size_t size,
+    int stubout_mode,
+    uint32_t flags,
+    int readonly_text,
+    const NaClCPUFeatures *f,
+    const struct NaClValidationMetadata *metadata,
+    struct NaClValidationCache *cache) {
+  return ApplyDfaValidatorParallel_x86_64(guest_addr, data, size,
+                                          stubout_mode, flags, readonly_text,
+                                          f, metadata, cache,
+                                          1 /* num_threads */);
+}
+
+
 static NaClValidationStatus ValidatorCodeCopy_x86_64(
     uintptr_t guest_addr,
     uint8_t *data_existing,
@@ -310,6 +341,7 @@ static const struct NaClValidatorInterface validator = {
   NaClSetAllCPUFeaturesX86,
   NaClGetCurrentCPUFeaturesX86,
   IsOnInstBoundary_x86_64,
+  ApplyDfaValidatorParallel_x86_64,
 };
 
 const struct NaClValidatorInterface *NaClDfaValidatorCreate_x86_64(void) {
@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Multi-threaded driver for the x86-64 DFA validator.
+ *
+ * The DFA itself is strictly sequential, but no instruction may cross a
+ * bundle boundary and the restricted register state is reset to its
+ * initial value at every bundle, so bundle-aligned pieces of a code block
+ * can be validated independently.  The only state that crosses chunk
+ * boundaries is the set of direct jump targets: a jump to an unaligned
+ * address in another chunk is reported by the worker as
+ * DIRECT_JUMP_OUT_OF_RANGE.  Workers record such jumps instead of reporting
+ * them, and once all workers are done the target bundles are validated again
+ * to check that the DFA accepts each target (which also rejects jumps into
+ * the middle of a superinstruction).
+ *
+ * The same mechanism lets workers skip bundles the SIMD prefilter (see
+ * dfa_prefilter.h) has classified as padding: each worker only runs the DFA
+ * over the runs of non-trivial bundles in its chunk, and treats the gaps
+ * between runs the same way as chunk boundaries.
+ */
+
+#include "native_client/src/trusted/validator_ragel/dfa_validate_parallel.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/shared/platform/nacl_threads.h"
+#include "native_client/src/trusted/validator_ragel/dfa_prefilter.h"
+
+/*
+ * The DFA keeps its bitmaps on the heap, so worker threads need little
+ * stack of their own.
+ */
+static const size_t kWorkerStackSize = 128 * 1024;
+
+#define NOP_OPCODE 0x90
+#define JMP_REL32_OPCODE 0xe9
+
+/* A direct jump that left the run of bundles it was found in.  */
+struct CrossChunkJump {
+  /* Jump target, as an offset from the start of the whole code block.  */
+  size_t target;
+};
+
+struct ChunkWorker {
+  /* Input parameters: */
+  const uint8_t *codeblock;
+  size_t size;
+  /* Prefilter result for the whole code block, one entry per bundle.  */
+  const uint8_t *trivial;
+  size_t chunk_offset;
+  size_t chunk_size;
+  uint32_t options;
+  const NaClCPUFeaturesX86 *cpu_features;
+  ValidationCallbackFunc user_callback;
+  void *callback_data;
+  /* Output parameters: */
+  struct CrossChunkJump *jumps;
+  size_t jumps_count;
+  size_t jumps_capacity;
+  Bool result;
+  int out_of_memory;
+};
+
+int NaClDfaParallelChunkCount(size_t size, int num_threads) {
+  size_t max_chunks = size / NACL_DFA_MIN_PARALLEL_CHUNK_SIZE;
+
+  if (num_threads > NACL_DFA_MAX_VALIDATION_THREADS)
+    num_threads = NACL_DFA_MAX_VALIDATION_THREADS;
+  if (num_threads < 1)
+    num_threads = 1;
+  if ((size_t) num_threads > max_chunks)
+    num_threads = max_chunks > 0 ? (int) max_chunks : 1;
+  return num_threads;
+}
+
+static Bool RecordCrossChunkJump(struct ChunkWorker *worker,
+                                 size_t target) {
+  struct CrossChunkJump *jump;
+
+  if (worker->jumps_count == worker->jumps_capacity) {
+    size_t new_capacity = worker->jumps_capacity == 0 ?
+        64 : worker->jumps_capacity * 2;
+    struct CrossChunkJump *new_jumps =
+        realloc(worker->jumps, new_capacity * sizeof(*new_jumps));
+    if (new_jumps == NULL) {
+      worker->out_of_memory = 1;
+      return FALSE;
+    }
+    worker->jumps = new_jumps;
+    worker->jumps_capacity = new_capacity;
+  }
+  jump = &worker->jumps[worker->jumps_count++];
+  jump->target = target;
+  return TRUE;
+}
+
+/*
+ * Callback used by workers: postpones DIRECT_JUMP_OUT_OF_RANGE errors for
+ * targets inside the code block and passes everything else to the user
+ * callback.
+ */
+static Bool ChunkWorkerCallback(const uint8_t *begin,
+                                const uint8_t *end,
+                                uint32_t info,
+                                void *callback_data) {
+  struct ChunkWorker *worker = callback_data;
+
+  if (info & DIRECT_JUMP_OUT_OF_RANGE) {
+    /* Relative fields always come at the end of the instruction.  */
+    ptrdiff_t offset;
+    size_t target;
+    if ((info & ANYFIELD_INFO_MASK) == RELATIVE_8BIT) {
+      offset = (int8_t) end[-1];
+    } else {
+      int32_t rel32;
+      CHECK((info & ANYFIELD_INFO_MASK) == RELATIVE_32BIT);
+      memcpy(&rel32, end - sizeof(rel32), sizeof(rel32));
+      offset = rel32;
+    }
+    target = (size_t) ((end - worker->codeblock) + offset);
+    /* Jumps out of the whole code block are errors in any case.  */
+    if (target >= worker->size)
+      return worker->user_callback(begin, end, info, worker->callback_data);
+    /* Every byte of a trivial bundle is an instruction boundary.  */
+    if (!worker->trivial[target / kBundleSize] &&
+        !RecordCrossChunkJump(worker, target))
+      return FALSE;
+    info &= ~DIRECT_JUMP_OUT_OF_RANGE;
+    if ((info & (VALIDATION_ERRORS_MASK | BAD_JUMP_TARGET)) == 0)
+      return TRUE;
+  }
+  return worker->user_callback(begin, end, info, worker->callback_data);
+}
+
+static void WINAPI ChunkWorkerMain(void *state) {
+  struct ChunkWorker *worker = state;
+  size_t bundle = worker->chunk_offset / kBundleSize;
+  size_t end_bundle = (worker->chunk_offset + worker->chunk_size) /
+      kBundleSize;
+
+  errno = 0;
+  worker->result = TRUE;
+  while (bundle < end_bundle) {
+    size_t run_begin;
+
+    while (bundle < end_bundle && worker->trivial[bundle])
+      bundle++;
+    run_begin = bundle;
+    while (bundle < end_bundle && !worker->trivial[bundle])
+      bundle++;
+    if (run_begin == bundle)
+      break;
+
+    if (!ValidateChunkAMD64(worker->codeblock + run_begin * kBundleSize,
+                            (bundle - run_begin) * kBundleSize,
+                            worker->options, worker->cpu_features,
+                            ChunkWorkerCallback, worker)) {
+      worker->result = FALSE;
+      if (errno == ENOMEM) {
+        worker->out_of_memory = 1;
+        return;
+      }
+    }
+  }
+}
+
+struct JumpTargetCallbackData {
+  const uint8_t *target;
+  Bool valid;
+};
+
+static Bool JumpTargetCallback(const uint8_t *begin,
+                               const uint8_t *end,
+                               uint32_t info,
+                               void *callback_data) {
+  struct JumpTargetCallbackData *data = callback_data;
+  UNREFERENCED_PARAMETER(end);
+
+  if ((info & BAD_JUMP_TARGET) != 0 && begin == data->target)
+    data->valid = FALSE;
+  return TRUE;
+}
+
+/*
+ * Checks whether the DFA accepts |target| as a jump target.  Rather than
+ * reimplementing its rules (superinstructions, restricted registers), we
+ * validate a copy of the target bundle followed by a bundle holding a jump
+ * to the target, and look for a BAD_JUMP_TARGET report.
+ */
+static Bool IsValidJumpTarget(const uint8_t *codeblock,
+                              size_t target,
+                              uint32_t options,
+                              const NaClCPUFeaturesX86 *cpu_features) {
+  uint8_t code[2 * kBundleSize];
+  struct JumpTargetCallbackData data;
+  int32_t rel32;
+
+  memcpy(code, codeblock + (target & ~(size_t) kBundleMask), kBundleSize);
+  memset(code + kBundleSize, NOP_OPCODE, kBundleSize);
+  code[kBundleSize] = JMP_REL32_OPCODE;
+  rel32 = (int32_t) (target & kBundleMask) - (kBundleSize + 5);
+  memcpy(code + kBundleSize + 1, &rel32, sizeof(rel32));
+
+  data.target = code + (target & kBundleMask);
+  data.valid = TRUE;
+  ValidateChunkAMD64(code, sizeof(code), options, cpu_features,
+                     JumpTargetCallback, &data);
+  return data.valid;
+}
+
+static int CompareCrossChunkJumps(const void *a, const void *b) {
+  const struct CrossChunkJump *ja = a;
+  const struct CrossChunkJump *jb = b;
+
+  if (ja->target != jb->target)
+    return ja->target < jb->target ? -1 : 1;
+  return 0;
+}
+
+/*
+ * Checks the jumps postponed by the workers.  Every distinct target that
+ * is not an instruction boundary is reported once as BAD_JUMP_TARGET, as
+ * ValidateChunkAMD64() would report it.
+ */
+static Bool ResolveCrossChunkJumps(const uint8_t codeblock[],
+                                   uint32_t options,
+                                   const NaClCPUFeaturesX86 *cpu_features,
+                                   struct CrossChunkJump *jumps,
+                                   size_t jumps_count,
+                                   ValidationCallbackFunc user_callback,
+                                   void *callback_data) {
+  Bool result = TRUE;
+  size_t i;
+
+  qsort(jumps, jumps_count, sizeof(*jumps), CompareCrossChunkJumps);
+  for (i = 0; i < jumps_count; i++) {
+    struct CrossChunkJump *jump = &jumps[i];
+    if (i > 0 && jumps[i - 1].target == jump->target)
+      continue;
+    if (!IsValidJumpTarget(codeblock, jump->target, options, cpu_features)) {
+      result &= user_callback(codeblock + jump->target,
+                              codeblock + jump->target,
+                              BAD_JUMP_TARGET,
+                              callback_data);
+    }
+  }
+  return result;
+}
+
+/*
+ * The initial restricted register applies at the start of every bundle, not
+ * just the first one.  With %rbp or %rsp restricted, even padding bundles
+ * are reported, so none of them may be skipped.
+ */
+static Bool RestrictsStackRegisters(uint32_t options) {
+  enum OperandName initial = EXTRACT_RESTRICTED_REGISTER_INITIAL_VALUE(options);
+  return initial == NC_REG_RBP || initial == NC_REG_RSP;
+}
+
+/*
+ * Splits |codeblock| into |num_chunks| bundle-aligned chunks, validates them
+ * (all but the first on new threads) and resolves the postponed jumps.
+ */
+static Bool ValidateChunks(const uint8_t codeblock[],
+                           size_t size,
+                           uint32_t options,
+                           const NaClCPUFeaturesX86 *cpu_features,
+                           ValidationCallbackFunc user_callback,
+                           void *const callback_data[],
+                           int num_chunks) {
+  struct ChunkWorker workers[NACL_DFA_MAX_VALIDATION_THREADS];
+  struct NaClThread threads[NACL_DFA_MAX_VALIDATION_THREADS];
+  int thread_started[NACL_DFA_MAX_VALIDATION_THREADS];
+  struct CrossChunkJump *jumps = NULL;
+  uint8_t *trivial;
+  size_t jumps_count = 0;
+  size_t chunk_size;
+  size_t offset;
+  int out_of_memory = 0;
+  Bool result = TRUE;
+  int i;
+
+  CHECK(num_chunks >= 1 && num_chunks <= NACL_DFA_MAX_VALIDATION_THREADS);
+
+  /*
+   * Classify the bundles before any worker starts: in stub-out mode the
+   * callbacks rewrite the code while other workers are still running.
+   */
+  trivial = malloc(size / kBundleSize);
+  if (trivial == NULL) {
+    errno = ENOMEM;
+    return FALSE;
+  }
+  if (RestrictsStackRegisters(options)) {
+    memset(trivial, 0, size / kBundleSize);
+  } else {
+    NaClDfaClassifyBundles(codeblock, size, trivial);
+  }
+
+  chunk_size = ((size / num_chunks) + kBundleMask) & ~(size_t) kBundleMask;
+  memset(workers, 0, sizeof(workers));
+  offset = 0;
+  for (i = 0; i < num_chunks; i++) {
+    struct ChunkWorker *worker = &workers[i];
+    worker->codeblock = codeblock;
+    worker->size = size;
+    worker->trivial = trivial;
+    worker->chunk_offset = offset;
+    worker->chunk_size = i == num_chunks - 1 ? size - offset : chunk_size;
+    worker->options = options;
+    worker->cpu_features = cpu_features;
+    worker->user_callback = user_callback;
+    worker->callback_data = callback_data[i];
+    offset += worker->chunk_size;
+  }
+  CHECK(offset == size);
+
+  /* The calling thread takes the first chunk itself.  */
+  for (i = 1; i < num_chunks; i++) {
+    thread_started[i] = NaClThreadCreateJoinable(&threads[i], ChunkWorkerMain,
+                                                 &workers[i],
+                                                 kWorkerStackSize);
+  }
+  ChunkWorkerMain(&workers[0]);
+  for (i = 1; i < num_chunks; i++) {
+    if (thread_started[i])
+      NaClThreadJoin(&threads[i]);
+    else
+      ChunkWorkerMain(&workers[i]);
+  }
+
+  for (i = 0; i < num_chunks; i++) {
+    result &= workers[i].result;
+    out_of_memory |= workers[i].out_of_memory;
+    jumps_count += workers[i].jumps_count;
+  }
+
+  if (!out_of_memory && jumps_count != 0) {
+    jumps = malloc(jumps_count * sizeof(*jumps));
+    if (jumps == NULL) {
+      out_of_memory = 1;
+    } else {
+      jumps_count = 0;
+      for (i = 0; i < num_chunks; i++) {
+        memcpy(&jumps[jumps_count], workers[i].jumps,
+               workers[i].jumps_count * sizeof(*jumps));
+        jumps_count += workers[i].jumps_count;
+      }
+      result &= ResolveCrossChunkJumps(codeblock, options, cpu_features,
+                                       jumps, jumps_count,
+                                       user_callback, callback_data[0]);
+      free(jumps);
+    }
+  }
+
+  for (i = 0; i < num_chunks; i++)
+    free(workers[i].jumps);
+  free(trivial);
+
+  if (out_of_memory) {
+    errno = ENOMEM;
+    return FALSE;
+  }
+  if (!result)
+    errno = EINVAL;
+  return result;
+}
+
+/* Options which need a sequential walk over every byte of the code block.  */
+static Bool NeedsSequentialWalk(uint32_t options) {
+  return (options & (CALL_USER_CALLBACK_ON_EACH_INSTRUCTION |
+                     PROCESS_CHUNK_AS_A_CONTIGUOUS_STREAM)) != 0;
+}
+
+Bool ValidateChunkAMD64Prefiltered(const uint8_t codeblock[],
+                                   size_t size,
+                                   uint32_t options,
+                                   const NaClCPUFeaturesX86 *cpu_features,
+                                   ValidationCallbackFunc user_callback,
+                                   void *callback_data) {
+  CHECK(size % kBundleSize == 0);
+
+  /* A single bundle is cheaper to decode than to classify.  */
+  if (size <= kBundleSize || NeedsSequentialWalk(options)) {
+    return ValidateChunkAMD64(codeblock, size, options, cpu_features,
+                              user_callback, callback_data);
+  }
+  return ValidateChunks(codeblock, size, options, cpu_features,
+                        user_callback, &callback_data, 1);
+}
+
+Bool ValidateChunkAMD64Parallel(const uint8_t codeblock[],
+                                size_t size,
+                                uint32_t options,
+                                const NaClCPUFeaturesX86 *cpu_features,
+                                ValidationCallbackFunc user_callback,
+                                void *const callback_data[],
+                                int num_threads) {
+  int num_chunks = NaClDfaParallelChunkCount(size, num_threads);
+
+  CHECK(size % kBundleSize == 0);
+
+  if (num_chunks < 2 || NeedsSequentialWalk(options)) {
+    return ValidateChunkAMD64Prefiltered(codeblock, size, options,
+                                         cpu_features, user_callback,
+                                         callback_data[0]);
+  }
+  return ValidateChunks(codeblock, size, options, cpu_features,
+                        user_callback, callback_data, num_chunks);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Multi-threaded driver for the x86-64 DFA validator.
+ */
+
+#ifndef NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_RAGEL_DFA_VALIDATE_PARALLEL_H_
+#define NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_RAGEL_DFA_VALIDATE_PARALLEL_H_
+
+#include <stddef.h>
+
+#include "native_client/src/include/nacl_base.h"
+#include "native_client/src/shared/utils/types.h"
+#include "native_client/src/trusted/validator_ragel/validator.h"
+
+EXTERN_C_BEGIN
+
+/* Upper bound on the number of threads used for a single code block.  */
+#define NACL_DFA_MAX_VALIDATION_THREADS 64
+
+/*
+ * Code blocks are split into chunks of at least this many bytes; blocks
+ * smaller than two chunks are validated on the calling thread.
+ */
+#define NACL_DFA_MIN_PARALLEL_CHUNK_SIZE (16 * 1024)
+
+/*
+ * Returns the number of chunks ValidateChunkAMD64Parallel() will split a
+ * code block of |size| bytes into when asked to use |num_threads| threads.
+ */
+int NaClDfaParallelChunkCount(size_t size, int num_threads);
+
+/*
+ * Validates |codeblock| like ValidateChunkAMD64(), but runs the DFA only
+ * over the bundles NaClDfaClassifyBundles() does not classify as padding.
+ * Direct jumps between the remaining runs of bundles are checked the same
+ * way ValidateChunkAMD64Parallel() checks jumps between chunks, so the
+ * result and the set of reported errors are the same as for
+ * ValidateChunkAMD64().
+ *
+ * Options which need a sequential walk over the whole code block
+ * (CALL_USER_CALLBACK_ON_EACH_INSTRUCTION and
+ * PROCESS_CHUNK_AS_A_CONTIGUOUS_STREAM) disable the prefilter.
+ */
+Bool ValidateChunkAMD64Prefiltered(const uint8_t codeblock[],
+                                   size_t size,
+                                   uint32_t options,
+                                   const NaClCPUFeaturesX86 *cpu_features,
+                                   ValidationCallbackFunc user_callback,
+                                   void *callback_data);
+
+/*
+ * Validates |codeblock| like ValidateChunkAMD64Prefiltered(), but splits it
+ * at bundle boundaries into NaClDfaParallelChunkCount(size, num_threads) chunks which
+ * are validated concurrently.  Direct jumps that leave a chunk are recorded
+ * by the worker and checked against the target bundle once all workers have
+ * finished, so the result and the set of reported errors are the same as for
+ * a single ValidateChunkAMD64() call (the order of the reports is not).
+ *
+ * |user_callback| may be called concurrently from several threads.  Chunk i
+ * passes |callback_data[i]| to it; errors found while resolving cross-chunk
+ * jumps are reported with |callback_data[0]| after all workers have joined.
+ * |callback_data| must have NaClDfaParallelChunkCount(size, num_threads)
+ * entries.
+ *
+ * Options which need a sequential walk over the whole code block are
+ * validated on the calling thread.
+ */
+Bool ValidateChunkAMD64Parallel(const uint8_t codeblock[],
+                                size_t size,
+                                uint32_t options,
+                                const NaClCPUFeaturesX86 *cpu_features,
+                                ValidationCallbackFunc user_callback,
+                                void *const callback_data[],
+                                int num_threads);
+
+EXTERN_C_END
+
+#endif /* NATIVE_CLIENT_SRC_TRUSTED_VALIDATOR_RAGEL_DFA_VALIDATE_PARALLEL_H_ */
@@ -8,12 +8,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#if !NACL_WINDOWS
+# include <unistd.h>
+#endif
 
 #include "native_client/src/include/elf.h"
 #include "native_client/src/include/elf_constants.h"
 #include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/shared/platform/nacl_time.h"
 #include "native_client/src/shared/utils/types.h"
+#include "native_client/src/public/validation_cache.h"
+#include "native_client/src/trusted/validator/persistent_validation_cache.h"
 #include "native_client/src/trusted/validator/driver/elf_load.h"
+#include "native_client/src/trusted/validator_ragel/dfa_prefilter.h"
+#include "native_client/src/trusted/validator_ragel/dfa_validate_parallel.h"
 #include "native_client/src/trusted/validator_ragel/validator.h"
 
 
@@ -30,15 +38,140 @@ Bool ProcessError(
 }
 
 
+// Compares ValidateChunkAMD64 with ValidateChunkAMD64Prefiltered, which
+// skips the NOP/HLT padding bundles.
+static void BenchmarkPrefilter(const elf_load::Segment &segment,
+                               int repetitions,
+                               float plain_seconds) {
+  uint8_t *trivial = new uint8_t[segment.size / kBundleSize];
+  NaClDfaClassifyBundles(segment.data, segment.size, trivial);
+  size_t trivial_bundles = 0;
+  for (size_t i = 0; i < segment.size / kBundleSize; i++)
+    trivial_bundles += trivial[i];
+  delete[] trivial;
+  printf("Padding bundles: %" NACL_PRIuS " of %" NACL_PRIuS "\n",
+         trivial_bundles, (size_t) (segment.size / kBundleSize));
+
+  Bool result = FALSE;
+  clock_t start = clock();
+  for (int i = 0; i < repetitions; i++) {
+    result = ValidateChunkAMD64Prefiltered(
+        segment.data, segment.size,
+        0, &kFullCPUIDFeatures,
+        ProcessError, NULL);
+  }
+  float seconds = (float)(clock() - start) / CLOCKS_PER_SEC;
+  printf("Prefiltered: %s %.3fs", result ? "valid" : "invalid", seconds);
+  if (seconds > 1e-6)
+    printf(" (%.3f MB/s, x%.2f)",
+           segment.size / seconds * repetitions / (1<<20),
+           plain_seconds / seconds);
+  printf("\n");
+}
+
+
+// Measures wall-clock throughput of ValidateChunkAMD64Parallel for 1, 2,
+// 4, ... max_threads threads.  clock() can't be used here since it adds up
+// the CPU time of all threads.
+static void BenchmarkParallel(const elf_load::Segment &segment,
+                              int repetitions,
+                              int max_threads) {
+  void *callback_data[NACL_DFA_MAX_VALIDATION_THREADS] = { NULL };
+  double base_seconds = 0;
+
+  NaClTimeInit();
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    Bool result = FALSE;
+    int64_t start = NaClGetTimeOfDayMicroseconds();
+    for (int i = 0; i < repetitions; i++) {
+      result = ValidateChunkAMD64Parallel(
+          segment.data, segment.size,
+          0, &kFullCPUIDFeatures,
+          ProcessError, callback_data, threads);
+    }
+    double seconds =
+        (NaClGetTimeOfDayMicroseconds() - start) / 1e6;
+    if (threads == 1)
+      base_seconds = seconds;
+
+    printf("%2d thread(s), %2d chunk(s): %s %.3fs",
+           threads, NaClDfaParallelChunkCount(segment.size, threads),
+           result ? "valid" : "invalid", seconds);
+    if (seconds > 1e-6)
+      printf(" (%.3f MB/s, x%.2f)",
+             segment.size / seconds * repetitions / (1<<20),
+             base_seconds / seconds);
+    printf("\n");
+  }
+  NaClTimeFini();
+}
+
+
+#if !NACL_WINDOWS
+// Compares a full validation with a hit in the persistent validation cache,
+// which is what a second process loading the same code pays: a SHA-256 of
+// the code and a lookup.  The code is passed the way NaClAddCodeIdentity()
+// passes code that has no file identity.
+static bool QueryPersistentCache(struct NaClValidationCache *cache,
+                                 const elf_load::Segment &segment) {
+  void *query = cache->CreateQuery(cache->handle);
+  uint64_t size = segment.size;
+  cache->AddData(query, (const uint8_t *) &size, sizeof(size));
+  cache->AddData(query, segment.data, segment.size);
+  bool hit = cache->QueryKnownToValidate(query) != 0;
+  if (!hit)
+    cache->SetKnownToValidate(query);
+  cache->DestroyQuery(query);
+  return hit;
+}
+
+static void BenchmarkPersistentCache(const elf_load::Segment &segment,
+                                     int repetitions,
+                                     float plain_seconds) {
+  char path[] = "/tmp/validator_benchmark_cache_XXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  close(fd);
+
+  struct NaClValidationCache *cache =
+      NaClPersistentValidationCacheCreate(path, 1024);
+  CHECK(cache != NULL);
+  CHECK(!QueryPersistentCache(cache, segment));
+  NaClPersistentValidationCacheDestroy(cache);
+
+  bool hit = true;
+  clock_t start = clock();
+  for (int i = 0; i < repetitions; i++) {
+    cache = NaClPersistentValidationCacheCreate(path, 1024);
+    CHECK(cache != NULL);
+    hit = QueryPersistentCache(cache, segment) && hit;
+    NaClPersistentValidationCacheDestroy(cache);
+  }
+  float seconds = (float)(clock() - start) / CLOCKS_PER_SEC;
+  unlink(path);
+
+  printf("Persistent cache: %s %.3fs", hit ? "hit" : "miss", seconds);
+  if (seconds > 1e-6)
+    printf(" (%.3f MB/s, x%.2f)",
+           segment.size / seconds * repetitions / (1<<20),
+           plain_seconds / seconds);
+  printf("\n");
+}
+#endif
+
+
 int main(int argc, char *argv[]) {
-  if (argc != 3) {
+  if (argc != 3 && argc != 4) {
     printf("Usage:\n");
-    printf("    validator_benchmark <nexe> <number of repetitions>\n");
+    printf("    validator_benchmark <nexe> <number of repetitions> "
+           "[<max threads>]\n");
     exit(1);
   }
   const char *input_file = argv[1];
   int repetitions = atoi(argv[2]);
   CHECK(repetitions > 0);
+  int max_threads = argc == 4 ? atoi(argv[3]) : 0;
+  CHECK(max_threads >= 0 && max_threads <= NACL_DFA_MAX_VALIDATION_THREADS);
 
   printf("Validating %s %d times ...\n", input_file, repetitions);
 
@@ -90,5 +223,19 @@ int main(int argc, char *argv[]) {
 
   printf("\n");
 
+  if (architecture == elf_load::X86_64)
+    BenchmarkPrefilter(segment, repetitions, seconds);
+
+#if !NACL_WINDOWS
+  BenchmarkPersistentCache(segment, repetitions, seconds);
+#endif
+
+  if (max_threads > 0) {
+    if (architecture == elf_load::X86_64)
+      BenchmarkParallel(segment, repetitions, max_threads);
+    else
+      printf("Parallel validation is only implemented for x86-64.\n");
+  }
+
   return result ? 0 : 1;
 }
@@ -214,6 +214,28 @@ struct nacl_irt_dyncode {
   int (*dyncode_delete)(void *dest, size_t size);
 };
 
+struct nacl_irt_dyncode_region {
+  void *dest;
+  const void *src;
+  size_t size;
+};
+
+#define NACL_IRT_DYNCODE_v0_2   "nacl-irt-dyncode-0.2"
+struct nacl_irt_dyncode_v0_2 {
+  int (*dyncode_create)(void *dest, const void *src, size_t size);
+  int (*dyncode_modify)(void *dest, const void *src, size_t size);
+  int (*dyncode_delete)(void *dest, size_t size);
+  /*
+   * dyncode_create_batch() is equivalent to calling dyncode_create() for
+   * each of the |count| regions, except that either all of them are
+   * installed or, on error, none is.  The regions must not overlap.
+   * Loading many regions this way is cheaper, because the code is
+   * validated and copied into place in a single call.
+   */
+  int (*dyncode_create_batch)(const struct nacl_irt_dyncode_region *regions,
+                              size_t count);
+};
+
 #define NACL_IRT_THREAD_v0_1   "nacl-irt-thread-0.1"
 struct nacl_irt_thread {
   /*
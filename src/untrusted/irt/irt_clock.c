@@ -4,11 +4,70 @@
  * found in the LICENSE file.
  */
 
+#include <time.h>
+
 #include "native_client/src/include/nacl_macros.h"
+#include "native_client/src/trusted/service_runtime/include/sys/nacl_vvar.h"
 #include "native_client/src/untrusted/irt/irt.h"
 #include "native_client/src/untrusted/irt/irt_interfaces.h"
+#include "native_client/src/untrusted/irt/irt_private.h"
 #include "native_client/src/untrusted/nacl/syscall_bindings_trampoline.h"
 
+#if defined(__i386__) || defined(__x86_64__)
+static uint64_t read_tsc(void) {
+  uint32_t lo;
+  uint32_t hi;
+  __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+/*
+ * Reads CLOCK_REALTIME or CLOCK_MONOTONIC from the vvar page, following
+ * the protocol described in nacl_vvar.h.  Returns 0 if the caller has to
+ * make the syscall instead.
+ */
+static int vvar_clock_gettime(nacl_irt_clockid_t clk_id,
+                              struct timespec *tp) {
+  const volatile struct nacl_abi_vvar *vvar = g_nacl_vvar;
+  uint32_t seq;
+  uint64_t delta;
+  uint64_t max_delta;
+  uint64_t mult;
+  int64_t ns;
+
+  if (vvar == NULL ||
+      (clk_id != CLOCK_REALTIME && clk_id != CLOCK_MONOTONIC))
+    return 0;
+  do {
+    seq = vvar->seq;
+    __asm__ __volatile__("" : : : "memory");
+    if ((seq & 1) != 0 || (vvar->flags & NACL_ABI_VVAR_TSC_VALID) == 0)
+      return 0;
+    max_delta = vvar->tsc_max_delta;
+    mult = vvar->tsc_mult;
+    ns = clk_id == CLOCK_REALTIME ? vvar->realtime_ns : vvar->monotonic_ns;
+    /*
+     * If the TSC is read before tsc_base, the difference wraps around and
+     * fails the max_delta check below.
+     */
+    delta = read_tsc() - vvar->tsc_base;
+    __asm__ __volatile__("" : : : "memory");
+  } while (vvar->seq != seq);
+
+  if (delta > max_delta)
+    return 0;
+  ns += (int64_t) ((delta * mult) >> NACL_ABI_VVAR_TSC_SHIFT);
+  tp->tv_sec = ns / 1000000000;
+  tp->tv_nsec = ns % 1000000000;
+  return 1;
+}
+#else
+static int vvar_clock_gettime(nacl_irt_clockid_t clk_id,
+                              struct timespec *tp) {
+  return 0;
+}
+#endif
+
 static int nacl_irt_clock_getres(nacl_irt_clockid_t clk_id,
                                  struct timespec *res) {
   return -NACL_SYSCALL(clock_getres)(clk_id, res);
@@ -16,6 +75,8 @@ static int nacl_irt_clock_getres(nacl_irt_clockid_t clk_id,
 
 static int nacl_irt_clock_gettime(nacl_irt_clockid_t clk_id,
                                   struct timespec *tp) {
+  if (vvar_clock_gettime(clk_id, tp))
+    return 0;
   return -NACL_SYSCALL(clock_gettime)(clk_id, tp);
 }
 
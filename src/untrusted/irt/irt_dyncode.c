@@ -4,6 +4,8 @@
  * found in the LICENSE file.
  */
 
+#include "native_client/src/include/nacl_macros.h"
+#include "native_client/src/trusted/service_runtime/include/sys/nacl_dyncode.h"
 #include "native_client/src/untrusted/irt/irt.h"
 #include "native_client/src/untrusted/nacl/syscall_bindings_trampoline.h"
 
@@ -19,8 +21,26 @@ static int nacl_irt_dyncode_delete(void *dest, size_t size) {
   return -NACL_SYSCALL(dyncode_delete)(dest, size);
 }
 
+static int nacl_irt_dyncode_create_batch(
+    const struct nacl_irt_dyncode_region *regions, size_t count) {
+  /*
+   * Untrusted pointers and size_t are 32 bits wide, so the region list
+   * already has the layout the syscall expects.
+   */
+  NACL_ASSERT_SAME_SIZE(struct nacl_irt_dyncode_region,
+                        struct NaClDyncodeRegion);
+  return -NACL_SYSCALL(dyncode_create_batch)(regions, count);
+}
+
 const struct nacl_irt_dyncode nacl_irt_dyncode = {
   nacl_irt_dyncode_create,
   nacl_irt_dyncode_modify,
   nacl_irt_dyncode_delete,
 };
+
+const struct nacl_irt_dyncode_v0_2 nacl_irt_dyncode_v0_2 = {
+  nacl_irt_dyncode_create,
+  nacl_irt_dyncode_modify,
+  nacl_irt_dyncode_delete,
+  nacl_irt_dyncode_create_batch,
+};
@@ -12,12 +12,14 @@
 #include "native_client/src/include/elf32.h"
 #include "native_client/src/include/elf_auxv.h"
 #include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/untrusted/irt/irt_private.h"
 #include "native_client/src/untrusted/irt/irt_interfaces.h"
 #include "native_client/src/untrusted/nacl/nacl_irt.h"
 #include "native_client/src/untrusted/nacl/nacl_startup.h"
 #include "native_client/src/untrusted/nacl/tls.h"
 
 uintptr_t g_dynamic_text_start;
+const struct nacl_abi_vvar *g_nacl_vvar;
 
 void __libc_init_array(void);
 
@@ -28,6 +30,16 @@ void nacl_irt_init(uint32_t *info) {
 
   environ = envp;
 
+  /* The clock functions read the time from this page when they can. */
+  for (Elf32_auxv_t *av = nacl_startup_auxv(info);
+       av->a_type != AT_NULL;
+       ++av) {
+    if (av->a_type == AT_NACL_VVAR) {
+      g_nacl_vvar = (const struct nacl_abi_vvar *) av->a_un.a_val;
+      break;
+    }
+  }
+
   /*
    * We are the true entry point, never called by a dynamic linker.
    * So the finalizer function pointer is always NULL.
@@ -84,6 +84,8 @@ static const struct nacl_irt_interface irt_interfaces[] = {
    */
   { NACL_IRT_DYNCODE_v0_1, &nacl_irt_dyncode, sizeof(nacl_irt_dyncode),
     non_pnacl_filter },
+  { NACL_IRT_DYNCODE_v0_2, &nacl_irt_dyncode_v0_2,
+    sizeof(nacl_irt_dyncode_v0_2), non_pnacl_filter },
   { NACL_IRT_THREAD_v0_1, &nacl_irt_thread, sizeof(nacl_irt_thread), NULL },
   { NACL_IRT_FUTEX_v0_1, &nacl_irt_futex, sizeof(nacl_irt_futex), NULL },
   /*
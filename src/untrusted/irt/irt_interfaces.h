@@ -19,6 +19,7 @@ extern const struct nacl_irt_memory_v0_1 nacl_irt_memory_v0_1;
 extern const struct nacl_irt_memory_v0_2 nacl_irt_memory_v0_2;
 extern const struct nacl_irt_memory nacl_irt_memory;
 extern const struct nacl_irt_dyncode nacl_irt_dyncode;
+extern const struct nacl_irt_dyncode_v0_2 nacl_irt_dyncode_v0_2;
 extern const struct nacl_irt_thread nacl_irt_thread;
 extern const struct nacl_irt_futex nacl_irt_futex;
 extern const struct nacl_irt_mutex nacl_irt_mutex;
@@ -10,6 +10,11 @@
  * allocator cannot use sbrk (the NaCl brk syscall), which is reserved
  * for the user application.
  *
+ * Small requests are served from per-thread caches, so IRT calls made
+ * from many threads at once do not all contend on dlmalloc's lock.  See
+ * thread_cache_malloc.c.  Under dyn_ldr they are not: see
+ * irt_threads_share_tls() below.
+ *
  * NOTE: However, this allocator is exposed to PPAPI applications via the
  * PPB_Core MemAlloc and MemFree function pointers.  That should go away.
  * See http://code.google.com/p/chromium/issues/detail?id=80610
@@ -17,6 +22,7 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include "native_client/src/untrusted/irt/irt_private.h"
@@ -54,8 +60,21 @@ static void irt_malloc_failure(void) {
   errno = ENOMEM;
 }
 
+/*
+ * dyn_ldr runs every host thread that calls into a sandbox with the TLS
+ * values of the sandbox's first thread (see getThreadData in
+ * dyn_ldr_lib.c), and sets NACL_IRT_THREADS_SHARE_TLS in the environment
+ * to say so.  The IRT's thread caches would then be shared by threads
+ * running at once, and their lists take no lock, so every request goes
+ * to the locked dlmalloc heap instead, as it did before the thread caches.
+ */
+static int irt_threads_share_tls(void) {
+  return getenv("NACL_IRT_THREADS_SHARE_TLS") != NULL;
+}
+#define TC_NO_THREAD_CACHE      irt_threads_share_tls()
+
 /* @IGNORE_LINES_FOR_CODE_HYGIENE[1] */
-#include "native_client/src/third_party/dlmalloc/malloc.c"
+#include "native_client/src/untrusted/nacl/thread_cache_malloc.c"
 
 /*
  * Crufty newlib internals use these entry points rather than the standard ones.
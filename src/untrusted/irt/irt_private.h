@@ -12,6 +12,11 @@ extern __thread int g_is_irt_internal_thread;
 
 extern uintptr_t g_dynamic_text_start;
 
+struct nacl_abi_vvar;
+
+/* The read-only time page from AT_NACL_VVAR, or NULL if there is none. */
+extern const struct nacl_abi_vvar *g_nacl_vvar;
+
 void irt_reserve_code_allocation(uintptr_t code_begin, size_t code_size);
 
 #endif  /* NATIVE_CLIENT_SRC_UNTRUSTED_IRT_IRT_PRIVATE_H_ */
@@ -6,6 +6,8 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "native_client/src/untrusted/nacl/nacl_random.h"
 #include "native_client/src/untrusted/irt/irt.h"
@@ -16,10 +18,59 @@ int nacl_secure_random_init(void) {
   return 0;
 }
 
+/*
+ * Small requests are served from a pool which is refilled with one
+ * syscall, so that e.g. a hash table seeding itself on every construction
+ * does not leave the sandbox each time.  Bytes are wiped from the pool as
+ * they are handed out, and the pool is taken under a lock so that no
+ * bytes are ever handed out twice.  The pool is not thread-local: in
+ * dyn_ldr sandboxes every host thread runs with the same thread pointer,
+ * so thread-local variables would be shared without a lock.  The lock is
+ * a spin lock for the same reason, as it does not need to know which
+ * thread holds it.
+ */
+#define RANDOM_POOL_SIZE 256
+#define RANDOM_POOL_MAX_REQUEST (RANDOM_POOL_SIZE / 4)
+
+static uint8_t g_random_pool[RANDOM_POOL_SIZE];
+static size_t g_random_pool_left;
+static int g_random_pool_lock;
+
+static void random_pool_lock(void) {
+  while (__sync_lock_test_and_set(&g_random_pool_lock, 1))
+    NACL_SYSCALL(sched_yield)();
+}
+
+static void random_pool_unlock(void) {
+  __sync_lock_release(&g_random_pool_lock);
+}
+
+static int get_random_bytes(void *buf, size_t count) {
+  return NACL_GC_WRAP_SYSCALL(NACL_SYSCALL(get_random_bytes)(buf, count));
+}
+
 int nacl_secure_random(void *buf, size_t count, size_t *nread) {
-  int rv = NACL_GC_WRAP_SYSCALL(NACL_SYSCALL(get_random_bytes)(buf, count));
-  if (rv != 0)
-    return -rv;
+  if (count > RANDOM_POOL_MAX_REQUEST) {
+    int rv = get_random_bytes(buf, count);
+    if (rv != 0)
+      return -rv;
+    *nread = count;
+    return 0;
+  }
+  random_pool_lock();
+  if (count > g_random_pool_left) {
+    int rv = get_random_bytes(g_random_pool, RANDOM_POOL_SIZE);
+    if (rv != 0) {
+      random_pool_unlock();
+      return -rv;
+    }
+    g_random_pool_left = RANDOM_POOL_SIZE;
+  }
+  uint8_t *bytes = g_random_pool + RANDOM_POOL_SIZE - g_random_pool_left;
+  memcpy(buf, bytes, count);
+  memset(bytes, 0, count);
+  g_random_pool_left -= count;
+  random_pool_unlock();
   *nread = count;
   return 0;
 }
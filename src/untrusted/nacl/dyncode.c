@@ -64,3 +64,39 @@ int nacl_dyncode_delete(void *dest, size_t size) {
   }
   return 0;
 }
+
+/*
+ * The batch call is in a later version of the interface.  If the IRT does
+ * not provide it, load the regions one by one.
+ */
+static struct nacl_irt_dyncode_v0_2 irt_dyncode_v0_2;
+static int irt_dyncode_v0_2_queried;
+
+int nacl_dyncode_create_batch(const struct nacl_dyncode_region *regions,
+                              size_t count) {
+  int error = 0;
+  if (!irt_dyncode_v0_2_queried) {
+    if (nacl_interface_query(NACL_IRT_DYNCODE_v0_2, &irt_dyncode_v0_2,
+                             sizeof(irt_dyncode_v0_2)) !=
+        sizeof(irt_dyncode_v0_2)) {
+      irt_dyncode_v0_2.dyncode_create_batch = NULL;
+    }
+    irt_dyncode_v0_2_queried = 1;
+  }
+  if (NULL != irt_dyncode_v0_2.dyncode_create_batch) {
+    error = irt_dyncode_v0_2.dyncode_create_batch(
+        (const struct nacl_irt_dyncode_region *) regions, count);
+  } else {
+    size_t i;
+    if (NULL == irt_dyncode.dyncode_create)
+      setup_irt_dyncode();
+    for (i = 0; i < count && 0 == error; i++)
+      error = irt_dyncode.dyncode_create(regions[i].dest, regions[i].src,
+                                         regions[i].size);
+  }
+  if (error) {
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
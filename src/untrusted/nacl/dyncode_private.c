@@ -36,3 +36,13 @@ int nacl_dyncode_delete(void *dest, size_t size) {
   }
   return 0;
 }
+
+int nacl_dyncode_create_batch(const struct nacl_dyncode_region *regions,
+                              size_t count) {
+  int error = -NACL_SYSCALL(dyncode_create_batch)(regions, count);
+  if (error) {
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
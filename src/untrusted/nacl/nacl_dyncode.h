@@ -53,6 +53,27 @@ extern int nacl_dyncode_modify(void *dest, const void *src, size_t size);
  */
 extern int nacl_dyncode_delete(void *dest, size_t size);
 
+struct nacl_dyncode_region {
+  void *dest;
+  const void *src;
+  size_t size;
+};
+
+/**
+ *  @nacl
+ *  Validates and dynamically loads several pieces of code at once.
+ *  Each region has the same requirements as the arguments of
+ *  nacl_dyncode_create, and the regions must not overlap.
+ *  @param regions Array of regions to load.
+ *  @param count Number of regions.
+ *  @return Returns zero on success, -1 on failure.
+ *  Either all the regions are loaded or none is, unless the IRT predates
+ *  the batch interface, in which case the regions are loaded one at a
+ *  time.  Sets errno as nacl_dyncode_create does.
+ */
+extern int nacl_dyncode_create_batch(const struct nacl_dyncode_region *regions,
+                                     size_t count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -259,6 +259,9 @@ typedef int (*TYPE_nacl_dyncode_modify) (void *dest, const void *src,
 
 typedef int (*TYPE_nacl_dyncode_delete) (void *dest, size_t size);
 
+typedef int (*TYPE_nacl_dyncode_create_batch) (const void *regions,
+                                             size_t count);
+
 typedef int (*TYPE_nacl_exception_handler) (
     void (*handler)(struct NaClExceptionContext *context),
     void (**old_handler)(struct NaClExceptionContext *context));
@@ -0,0 +1,457 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * A thread-caching malloc for untrusted code, layered over dlmalloc.
+ *
+ * This file is not compiled on its own.  An allocator translation unit
+ * defines the dlmalloc configuration macros it wants (see irt_malloc.c)
+ * and then #includes this file, which brings in dlmalloc with
+ * USE_DL_PREFIX and defines malloc() et al on top of it.
+ *
+ * Requests of up to TC_MAX_SIZE bytes are rounded up to one of a few
+ * size classes and served from a per-thread free list for the class,
+ * without taking any lock.  When a thread's list runs dry it takes a
+ * batch of objects from the central list for the class, and when it
+ * holds too many it gives a batch back, so the central lock is taken
+ * once per batch rather than once per call.  Objects of a class are
+ * carved out of 64KB spans, and spans out of chunks that are mmap()ed
+ * with geometrically growing sizes, so that a thread allocating many
+ * small objects makes few mmap() calls.  Spans are never returned to
+ * the system; only the dlmalloc heap can be trimmed.
+ *
+ * Larger requests, and any request made before TLS is set up, go
+ * straight to dlmalloc.  So does every request if TC_NO_THREAD_CACHE,
+ * which the allocator translation unit may define to an expression that
+ * is evaluated once, in the allocator's constructor, is nonzero.  It
+ * must be when several threads can share one thread pointer, as they do
+ * in dyn_ldr sandboxes: the thread caches are then not per-thread, and
+ * their lists take no lock.  free() tells the two kinds of block apart
+ * with a table that maps every 64KB of the (32-bit) address space to
+ * the size class of the span there, if any.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define USE_DL_PREFIX           1
+#ifndef USE_LOCKS
+# define USE_LOCKS              1
+#endif
+#ifndef USE_SPIN_LOCKS
+# define USE_SPIN_LOCKS         1
+#endif
+
+/* @IGNORE_LINES_FOR_CODE_HYGIENE[1] */
+#include "native_client/src/third_party/dlmalloc/malloc.c"
+
+#if !USE_LOCKS
+# error "thread_cache_malloc.c needs dlmalloc's locks"
+#endif
+
+#ifndef TC_NO_THREAD_CACHE
+# define TC_NO_THREAD_CACHE     0
+#endif
+
+#define TC_SPAN_SHIFT           16
+#define TC_SPAN_SIZE            ((size_t) 1 << TC_SPAN_SHIFT)
+#define TC_NUM_SPANS            ((size_t) 1 << (32 - TC_SPAN_SHIFT))
+#define TC_MIN_CHUNK_SIZE       ((size_t) 256 << 10)
+#define TC_MAX_CHUNK_SIZE       ((size_t) 4 << 20)
+#define TC_MAX_SIZE             1024
+#define TC_NUM_CLASSES          20
+/* Roughly how many bytes move between a thread and the central lists. */
+#define TC_BATCH_BYTES          4096
+#define TC_MIN_BATCH            4
+#define TC_MAX_BATCH            64
+
+static const uint16_t tc_class_size[TC_NUM_CLASSES] = {
+  16, 32, 48, 64, 80, 96, 112, 128,
+  160, 192, 224, 256,
+  320, 384, 448, 512,
+  640, 768, 896, 1024,
+};
+
+/* Size classes are multiples of 16 bytes, so objects are 16-aligned. */
+#define TC_ALIGNMENT            16
+
+struct tc_central_list {
+  MLOCK_T lock;
+  /* Free objects, linked through their first word. */
+  void *head;
+  size_t count;
+  /* The part of the newest span for the class not yet handed out. */
+  char *span_next;
+  char *span_end;
+} __attribute__((aligned(64)));
+
+struct tc_thread_cache {
+  void *head[TC_NUM_CLASSES];
+  uint16_t count[TC_NUM_CLASSES];
+  /* Set once the thread exit hook is registered for this thread. */
+  int registered;
+  /* Set by the thread exit hook; later calls bypass the cache. */
+  int disabled;
+};
+
+static struct tc_central_list tc_central[TC_NUM_CLASSES];
+
+/* Size class plus one of the span at each 64KB of address space. */
+static uint8_t tc_span_class[TC_NUM_SPANS];
+
+static MLOCK_T tc_chunk_lock;
+static char *tc_chunk_next;
+static char *tc_chunk_end;
+static size_t tc_next_chunk_size = TC_MIN_CHUNK_SIZE;
+
+/*
+ * Thread caches are only used once TLS is set up, which both the IRT
+ * and libnacl do before running constructors, and only if
+ * TC_NO_THREAD_CACHE was zero then.
+ */
+static int tc_thread_cache_ready;
+static __thread struct tc_thread_cache tc_thread_cache;
+
+/*
+ * Threads only flush their caches when they exit if libpthread (or
+ * the IRT's private copy of it) is linked in.  Without it there is
+ * only one thread.
+ */
+int pthread_key_create(pthread_key_t *key, void (*dtor)(void *))
+    __attribute__((weak));
+int pthread_setspecific(pthread_key_t key, const void *value)
+    __attribute__((weak));
+static pthread_key_t tc_thread_exit_key;
+static int tc_have_thread_exit_key;
+
+static inline unsigned tc_size_to_class(size_t size) {
+  if (size <= 128)
+    return size == 0 ? 0 : (unsigned) (size - 1) / 16;
+  if (size <= 256)
+    return 8 + (unsigned) (size - 129) / 32;
+  if (size <= 512)
+    return 12 + (unsigned) (size - 257) / 64;
+  return 16 + (unsigned) (size - 513) / 128;
+}
+
+static unsigned tc_batch_size(unsigned cls) {
+  unsigned batch = TC_BATCH_BYTES / tc_class_size[cls];
+  if (batch < TC_MIN_BATCH)
+    return TC_MIN_BATCH;
+  if (batch > TC_MAX_BATCH)
+    return TC_MAX_BATCH;
+  return batch;
+}
+
+/*
+ * Returns the size class plus one of the span that ptr points into, or
+ * 0 if ptr came from dlmalloc.
+ */
+static inline unsigned tc_ptr_class(void *ptr) {
+  uintptr_t addr = (uintptr_t) ptr;
+  if (sizeof(addr) > 4 && (addr >> 16 >> 16) != 0)
+    return 0;
+  return tc_span_class[addr >> TC_SPAN_SHIFT];
+}
+
+static inline struct tc_thread_cache *tc_get_thread_cache(void) {
+  struct tc_thread_cache *cache;
+  if (!tc_thread_cache_ready)
+    return NULL;
+  cache = &tc_thread_cache;
+  return cache->disabled ? NULL : cache;
+}
+
+/*
+ * Hands out a new span for the class, carving a new chunk if need be.
+ * Called with the central lock for the class held.
+ */
+static char *tc_new_span(unsigned cls) {
+  char *span = NULL;
+
+  if (ACQUIRE_LOCK(&tc_chunk_lock))
+    return NULL;
+  if (tc_chunk_next == tc_chunk_end) {
+    size_t size = tc_next_chunk_size;
+    char *chunk = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uintptr_t start;
+    uintptr_t end;
+    if (chunk == MAP_FAILED)
+      goto done;
+    /* NaCl's mmap() is 64KB-aligned already, but do not rely on it. */
+    start = ((uintptr_t) chunk + TC_SPAN_SIZE - 1) & ~(TC_SPAN_SIZE - 1);
+    end = ((uintptr_t) chunk + size) & ~(TC_SPAN_SIZE - 1);
+    if (start >= end ||
+        (sizeof(end) > 4 && ((end - 1) >> 16 >> 16) != 0)) {
+      munmap(chunk, size);
+      goto done;
+    }
+    tc_chunk_next = (char *) start;
+    tc_chunk_end = (char *) end;
+    if (tc_next_chunk_size < TC_MAX_CHUNK_SIZE)
+      tc_next_chunk_size *= 2;
+  }
+  span = tc_chunk_next;
+  tc_chunk_next += TC_SPAN_SIZE;
+  tc_span_class[(uintptr_t) span >> TC_SPAN_SHIFT] = (uint8_t) (cls + 1);
+ done:
+  RELEASE_LOCK(&tc_chunk_lock);
+  return span;
+}
+
+/*
+ * Moves a batch of objects from the central list for the class into the
+ * thread's cache, and returns one more.  Returns NULL if there is no
+ * memory for spans.
+ */
+static void *tc_refill(struct tc_thread_cache *cache, unsigned cls) {
+  struct tc_central_list *central = &tc_central[cls];
+  size_t size = tc_class_size[cls];
+  unsigned want = tc_batch_size(cls) + 1;
+  unsigned got = 0;
+  void *head = NULL;
+  void *result;
+
+  if (ACQUIRE_LOCK(&central->lock))
+    return NULL;
+  while (got < want && central->head != NULL) {
+    void *obj = central->head;
+    central->head = *(void **) obj;
+    *(void **) obj = head;
+    head = obj;
+    ++got;
+  }
+  central->count -= got;
+  while (got < want) {
+    void *obj;
+    if (central->span_next == central->span_end) {
+      char *span = tc_new_span(cls);
+      if (span == NULL)
+        break;
+      central->span_next = span;
+      central->span_end = span + TC_SPAN_SIZE - TC_SPAN_SIZE % size;
+    }
+    obj = central->span_next;
+    central->span_next += size;
+    *(void **) obj = head;
+    head = obj;
+    ++got;
+  }
+  RELEASE_LOCK(&central->lock);
+
+  if (head == NULL)
+    return NULL;
+  result = head;
+  cache->head[cls] = *(void **) head;
+  cache->count[cls] = (uint16_t) (got - 1);
+
+  /*
+   * pthread_setspecific() may allocate, so only register the exit hook
+   * once the cache is in a consistent state.
+   */
+  if (!cache->registered) {
+    cache->registered = 1;
+    if (tc_have_thread_exit_key)
+      pthread_setspecific(tc_thread_exit_key, cache);
+  }
+  return result;
+}
+
+/* Gives the first count objects of a list back to the central list. */
+static void tc_release(unsigned cls, void *head, void *tail, size_t count) {
+  struct tc_central_list *central = &tc_central[cls];
+
+  ACQUIRE_LOCK(&central->lock);
+  *(void **) tail = central->head;
+  central->head = head;
+  central->count += count;
+  RELEASE_LOCK(&central->lock);
+}
+
+static void tc_release_batch(struct tc_thread_cache *cache, unsigned cls) {
+  unsigned batch = tc_batch_size(cls);
+  void *head = cache->head[cls];
+  void *tail = head;
+  unsigned i;
+
+  for (i = 1; i < batch; ++i)
+    tail = *(void **) tail;
+  cache->head[cls] = *(void **) tail;
+  cache->count[cls] -= batch;
+  tc_release(cls, head, tail, batch);
+}
+
+static void tc_thread_exit(void *arg) {
+  struct tc_thread_cache *cache = arg;
+  unsigned cls;
+
+  /* free() calls from later destructors go to the central lists. */
+  cache->disabled = 1;
+  for (cls = 0; cls < TC_NUM_CLASSES; ++cls) {
+    void *head = cache->head[cls];
+    void *tail = head;
+    if (head == NULL)
+      continue;
+    while (*(void **) tail != NULL)
+      tail = *(void **) tail;
+    tc_release(cls, head, tail, cache->count[cls]);
+    cache->head[cls] = NULL;
+    cache->count[cls] = 0;
+  }
+}
+
+static void __attribute__((constructor)) tc_init(void) {
+  if (pthread_key_create != NULL &&
+      pthread_setspecific != NULL &&
+      pthread_key_create(&tc_thread_exit_key, tc_thread_exit) == 0)
+    tc_have_thread_exit_key = 1;
+  tc_thread_cache_ready = !(TC_NO_THREAD_CACHE);
+}
+
+static void *tc_malloc_small(size_t size) {
+  struct tc_thread_cache *cache = tc_get_thread_cache();
+  unsigned cls = tc_size_to_class(size);
+  void *obj;
+
+  if (cache != NULL) {
+    obj = cache->head[cls];
+    if (obj != NULL) {
+      cache->head[cls] = *(void **) obj;
+      --cache->count[cls];
+      return obj;
+    }
+    obj = tc_refill(cache, cls);
+    if (obj != NULL)
+      return obj;
+  }
+  return dlmalloc(size);
+}
+
+static void tc_free_small(void *ptr, unsigned cls) {
+  struct tc_thread_cache *cache = tc_get_thread_cache();
+
+  if (cache == NULL) {
+    *(void **) ptr = NULL;
+    tc_release(cls, ptr, ptr, 1);
+    return;
+  }
+  *(void **) ptr = cache->head[cls];
+  cache->head[cls] = ptr;
+  if (++cache->count[cls] > 2 * tc_batch_size(cls))
+    tc_release_batch(cache, cls);
+}
+
+void *malloc(size_t size) {
+  if (size <= TC_MAX_SIZE)
+    return tc_malloc_small(size);
+  return dlmalloc(size);
+}
+
+void free(void *ptr) {
+  unsigned cls;
+
+  if (ptr == NULL)
+    return;
+  cls = tc_ptr_class(ptr);
+  if (cls == 0) {
+    dlfree(ptr);
+    return;
+  }
+  tc_free_small(ptr, cls - 1);
+}
+
+void *calloc(size_t n, size_t size) {
+  size_t total = n * size;
+  void *ptr;
+
+  if (size != 0 && total / size != n) {
+    MALLOC_FAILURE_ACTION;
+    return NULL;
+  }
+  if (total > TC_MAX_SIZE)
+    return dlcalloc(n, size);
+  ptr = tc_malloc_small(total);
+  if (ptr != NULL)
+    memset(ptr, 0, total);
+  return ptr;
+}
+
+size_t malloc_usable_size(void *ptr) {
+  unsigned cls;
+
+  if (ptr == NULL)
+    return 0;
+  cls = tc_ptr_class(ptr);
+  if (cls == 0)
+    return dlmalloc_usable_size(ptr);
+  return tc_class_size[cls - 1];
+}
+
+void *realloc(void *ptr, size_t size) {
+  unsigned cls;
+  size_t old_size;
+  void *new_ptr;
+
+  if (ptr == NULL)
+    return malloc(size);
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+  cls = tc_ptr_class(ptr);
+  if (cls == 0) {
+    if (size > TC_MAX_SIZE)
+      return dlrealloc(ptr, size);
+    old_size = dlmalloc_usable_size(ptr);
+  } else {
+    if (size <= TC_MAX_SIZE && tc_size_to_class(size) == cls - 1)
+      return ptr;
+    old_size = tc_class_size[cls - 1];
+  }
+  new_ptr = malloc(size);
+  if (new_ptr == NULL)
+    return NULL;
+  memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+  free(ptr);
+  return new_ptr;
+}
+
+void *memalign(size_t alignment, size_t size) {
+  if (alignment <= TC_ALIGNMENT && size <= TC_MAX_SIZE)
+    return tc_malloc_small(size);
+  return dlmemalign(alignment, size);
+}
+
+int posix_memalign(void **result, size_t alignment, size_t size) {
+  if (alignment <= TC_ALIGNMENT && size <= TC_MAX_SIZE &&
+      alignment % sizeof(void *) == 0 && (alignment & (alignment - 1)) == 0) {
+    void *ptr = tc_malloc_small(size);
+    if (ptr == NULL)
+      return ENOMEM;
+    *result = ptr;
+    return 0;
+  }
+  return dlposix_memalign(result, alignment, size);
+}
+
+void *valloc(size_t size) {
+  return dlvalloc(size);
+}
+
+void *pvalloc(size_t size) {
+  return dlpvalloc(size);
+}
+
+int mallopt(int param, int value) {
+  return dlmallopt(param, value);
+}
+
+int malloc_trim(size_t pad) {
+  return dlmalloc_trim(pad);
+}
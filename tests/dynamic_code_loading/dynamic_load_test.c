@@ -568,6 +568,96 @@ void test_demand_alloc_of_fragmented_pages(void) {
   assert(rc == 0);
 }
 
+int nacl_load_code_batch(const struct nacl_dyncode_region *regions,
+                         size_t count) {
+  int rc = nacl_dyncode_create_batch(regions, count);
+  return rc == 0 ? 0 : -errno;
+}
+
+/* Check that we can load several pieces of code at once and run them. */
+void test_batch_loading_code(void) {
+  char *load_area = allocate_code_space(2);
+  uint8_t buf[BUF_SIZE];
+  struct nacl_dyncode_region regions[4];
+  int rc;
+  int i;
+
+  copy_and_pad_fragment(buf, sizeof(buf), &template_func, &template_func_end);
+  /* Out of order, with gaps, and spanning two pages. */
+  regions[0].dest = load_area + DYNAMIC_CODE_PAGE_SIZE + BUF_SIZE * 3;
+  regions[1].dest = load_area;
+  regions[2].dest = load_area + BUF_SIZE * 5;
+  regions[3].dest = load_area + DYNAMIC_CODE_PAGE_SIZE - BUF_SIZE;
+  for (i = 0; i < 4; i++) {
+    regions[i].src = buf;
+    regions[i].size = sizeof(buf);
+  }
+
+  rc = nacl_load_code_batch(regions, 4);
+  assert(rc == 0);
+  for (i = 0; i < 4; i++) {
+    int (*func)(void) = (int (*)(void)) (uintptr_t) regions[i].dest;
+    assert(memcmp(regions[i].dest, buf, sizeof(buf)) == 0);
+    assert(func() == MARKER_OLD);
+  }
+  /* The space between the regions is filled with halts. */
+  check_region_is_filled_with_hlts(load_area + BUF_SIZE, BUF_SIZE * 4);
+}
+
+/* A batch with one invalid region must not load any of its regions. */
+void test_batch_fail_on_validation_error(void) {
+  char *load_area = allocate_code_space(1);
+  uint8_t good[BUF_SIZE];
+  uint8_t bad[BUF_SIZE];
+  struct nacl_dyncode_region regions[2];
+  int rc;
+
+  copy_and_pad_fragment(good, sizeof(good), &template_func,
+                        &template_func_end);
+  copy_and_pad_fragment(bad, sizeof(bad), &invalid_code, &invalid_code_end);
+  regions[0].dest = load_area;
+  regions[0].src = good;
+  regions[0].size = sizeof(good);
+  regions[1].dest = load_area + BUF_SIZE;
+  regions[1].src = bad;
+  regions[1].size = sizeof(bad);
+
+  rc = nacl_load_code_batch(regions, 2);
+  assert(rc == -EINVAL);
+
+  rc = nacl_load_code(load_area, good, sizeof(good));
+  assert(rc == 0);
+  rc = nacl_load_code(load_area + BUF_SIZE, good, sizeof(good));
+  assert(rc == 0);
+}
+
+void test_batch_fail_on_overlap(void) {
+  char *load_area = allocate_code_space(1);
+  uint8_t buf[BUF_SIZE * 2];
+  struct nacl_dyncode_region regions[2];
+  int rc;
+
+  fill_nops(buf, sizeof(buf));
+  regions[0].dest = load_area;
+  regions[0].src = buf;
+  regions[0].size = BUF_SIZE * 2;
+  regions[1].dest = load_area + BUF_SIZE;
+  regions[1].src = buf;
+  regions[1].size = BUF_SIZE;
+
+  rc = nacl_load_code_batch(regions, 2);
+  assert(rc == -EINVAL);
+
+  /* Nor may a batch overlap code that is already loaded. */
+  rc = nacl_load_code(load_area + BUF_SIZE, buf, BUF_SIZE);
+  assert(rc == 0);
+  rc = nacl_load_code_batch(regions, 1);
+  assert(rc == -EINVAL);
+
+  rc = nacl_load_code(load_area, buf, BUF_SIZE);
+  assert(rc == 0);
+}
+
 void run_test(const char *test_name, void (*test_func)(void)) {
   printf("Running %s...\n", test_name);
   test_func();
@@ -595,6 +685,9 @@ int TestMain(void) {
   RUN_TEST(test_branches_outside_chunk);
   RUN_TEST(test_end_of_code_region);
   RUN_TEST(test_hlt_filled_bundle);
+  RUN_TEST(test_batch_loading_code);
+  RUN_TEST(test_batch_fail_on_validation_error);
+  RUN_TEST(test_batch_fail_on_overlap);
   /*
    * dyncode_delete() tests have been broken inside Chromium by the
    * switch to the new Chrome-IPC-based PPAPI proxy.  The new proxy
@@ -31,6 +31,9 @@
  */
 #define NUM_BUNDLES_FOR_HLT 3
 
+/* Number of functions in the region test_replacing_code_in_large_range uses */
+#define NUM_COPIES 8
+
 struct code_section {
   char *name;
   char *start;
@@ -163,6 +166,53 @@ void test_replacing_code_unaligned(void) {
   assert(rc == MARKER_NEW);
 }
 
+/*
+ * Check that a replacement covering many unchanged bundles is accepted and
+ * still checked: only the bundles that differ from the existing code are
+ * revalidated.
+ */
+void test_replacing_code_in_large_range(void) {
+  uint8_t *load_area = allocate_code_space(1);
+  uint8_t buf[BUF_SIZE * NUM_COPIES];
+  int rc;
+  int i;
+  int (*func)(void);
+
+  for (i = 0; i < NUM_COPIES; i++) {
+    copy_and_pad_fragment(buf + i * BUF_SIZE, BUF_SIZE,
+                          &template_func, &template_func_end);
+  }
+  rc = nacl_dyncode_create(load_area, buf, sizeof(buf));
+  assert(rc == 0);
+
+  /* Rewriting the range with identical code succeeds trivially. */
+  rc = nacl_dyncode_modify(load_area, buf, sizeof(buf));
+  assert(rc == 0);
+
+  /* An illegal change in one copy fails the whole modification. */
+  copy_and_pad_fragment(buf + 5 * BUF_SIZE, BUF_SIZE,
+                        &template_func_illegal_register_replacement,
+                        &template_func_illegal_register_replacement_end);
+  rc = nacl_dyncode_modify(load_area, buf, sizeof(buf));
+  assert(rc != 0);
+  for (i = 0; i < NUM_COPIES; i++) {
+    func = (int (*)(void)) (uintptr_t) (load_area + i * BUF_SIZE);
+    assert(func() == MARKER_OLD);
+  }
+
+  /* A legal change in one copy only touches that copy. */
+  copy_and_pad_fragment(buf + 5 * BUF_SIZE, BUF_SIZE,
+                        &template_func_replacement,
+                        &template_func_replacement_end);
+  rc = nacl_dyncode_modify(load_area, buf, sizeof(buf));
+  assert(rc == 0);
+  for (i = 0; i < NUM_COPIES; i++) {
+    func = (int (*)(void)) (uintptr_t) (load_area + i * BUF_SIZE);
+    assert(func() == (i == 5 ? MARKER_NEW : MARKER_OLD));
+  }
+  assert(memcmp(load_area, buf, sizeof(buf)) == 0);
+}
+
 #if defined(__i386__) || defined(__x86_64__)
 /* Check that we can rewrite instruction that crosses align boundaries. */
 void test_replacing_code_slowpaths(void) {
@@ -202,6 +252,46 @@ void test_replacing_code_slowpaths(void) {
 }
 #endif
 
+#if defined(__i386__) || defined(__x86_64__)
+/* A call must end at a bundle boundary, and its target can be changed. */
+#define CALL_OFFSET (NACL_BUNDLE_SIZE - 5)
+
+static void put_call(uint8_t *buf, int target) {
+  int32_t rel = target - (CALL_OFFSET + 5);
+  buf[CALL_OFFSET] = 0xe8; /* CALL rel32 */
+  memcpy(buf + CALL_OFFSET + 1, &rel, sizeof(rel));
+}
+
+/*
+ * Check that a changed direct call may target an unchanged bundle of the
+ * same request, even though only the changed bundles are revalidated when
+ * they validate on their own.
+ */
+void test_call_into_unchanged_bundle(void) {
+  uint8_t *load_area = allocate_code_space(1);
+  uint8_t buf[NACL_BUNDLE_SIZE * 3];
+  int rc;
+
+  fill_nops(buf, sizeof(buf));
+  put_call(buf, NACL_BUNDLE_SIZE * 2 + 1);
+  rc = nacl_dyncode_create(load_area, buf, sizeof(buf));
+  assert(rc == 0);
+
+  /* Retarget the call; the bundle it calls into is unchanged. */
+  put_call(buf, NACL_BUNDLE_SIZE * 2 + 3);
+  rc = nacl_dyncode_modify(load_area, buf, sizeof(buf));
+  assert(rc == 0);
+  assert(memcmp(load_area, buf, sizeof(buf)) == 0);
+
+  /* A call out of the request still has to target a bundle boundary. */
+  put_call(buf, NACL_BUNDLE_SIZE * 3 + 1);
+  rc = nacl_dyncode_modify(load_area, buf, sizeof(buf));
+  assert(rc != 0);
+  put_call(buf, NACL_BUNDLE_SIZE * 2 + 3);
+  assert(memcmp(load_area, buf, sizeof(buf)) == 0);
+}
+#endif
+
 /* Check code replacement constraints */
 void test_illegal_code_replacment(void) {
   uint8_t *load_area = allocate_code_space(1);
@@ -429,8 +519,10 @@ int TestMain(void) {
 
   RUN_TEST(test_replacing_code);
   RUN_TEST(test_replacing_code_unaligned);
+  RUN_TEST(test_replacing_code_in_large_range);
 #if defined(__i386__) || defined(__x86_64__)
   RUN_TEST(test_replacing_code_slowpaths);
+  RUN_TEST(test_call_into_unchanged_bundle);
   RUN_TEST(test_jump_into_super_inst_create);
   RUN_TEST(test_start_with_super_inst_replace);
   RUN_TEST(test_jump_into_super_inst_replace);
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Compares loading many small pieces of code with one dyncode_create
+ * call each against loading them with a single dyncode_create_batch
+ * call.  This is the pattern of a loader installing the functions of a
+ * large library, one region per function.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <nacl/nacl_dyncode.h>
+
+#include "native_client/tests/dynamic_code_loading/dynamic_segment.h"
+
+#define REGION_SIZE 256
+#define REGIONS_PER_RUN 1024
+/* Regions are spaced out so that the runs touch many pages. */
+#define REGION_STRIDE (REGION_SIZE * 4)
+
+static uint8_t code[REGION_SIZE];
+static struct nacl_dyncode_region regions[REGIONS_PER_RUN];
+
+static double get_time(void) {
+  struct timespec ts;
+  int rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+  assert(rc == 0);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *next_addr;
+
+static void setup_regions(void) {
+  int i;
+  for (i = 0; i < REGIONS_PER_RUN; i++) {
+    regions[i].dest = next_addr + i * REGION_STRIDE;
+    regions[i].src = code;
+    regions[i].size = REGION_SIZE;
+  }
+  next_addr += REGIONS_PER_RUN * REGION_STRIDE;
+  assert(next_addr <= (char *) DYNAMIC_CODE_SEGMENT_END);
+}
+
+static double time_individual(void) {
+  double start;
+  int i;
+  setup_regions();
+  start = get_time();
+  for (i = 0; i < REGIONS_PER_RUN; i++) {
+    int rc = nacl_dyncode_create(regions[i].dest, regions[i].src,
+                                 regions[i].size);
+    assert(rc == 0);
+  }
+  return get_time() - start;
+}
+
+static double time_batch(void) {
+  double start;
+  int rc;
+  setup_regions();
+  start = get_time();
+  rc = nacl_dyncode_create_batch(regions, REGIONS_PER_RUN);
+  assert(rc == 0);
+  return get_time() - start;
+}
+
+int main(void) {
+  double individual;
+  double batch;
+
+  memset(code, 0x90, sizeof(code));  /* NOPs */
+  code[sizeof(code) - 1] = 0xf4;  /* HLT */
+  next_addr = (char *) DYNAMIC_CODE_SEGMENT_START;
+
+  individual = time_individual();
+  batch = time_batch();
+
+  printf("RESULT DyncodeCreate: individual= %.6f seconds\n", individual);
+  printf("RESULT DyncodeCreate: batch= %.6f seconds\n", batch);
+  printf("%d regions of %d bytes: batch is %.2fx faster\n",
+         REGIONS_PER_RUN, REGION_SIZE, individual / batch);
+  return 0;
+}
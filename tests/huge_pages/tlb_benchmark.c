@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Follows a random cycle of pointers through a large anonymous mapping,
+ * one pointer per 4KB page, so that nearly every load misses the TLB
+ * unless the mapping is backed by huge pages.  Run with and without
+ * NACL_HUGE_PAGES set in sel_ldr's environment to compare.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define REGION_SIZE (256 << 20)
+#define PAGE_SIZE 4096
+#define NUM_PAGES (REGION_SIZE / PAGE_SIZE)
+#define LOADS (4 * NUM_PAGES)
+
+static double get_time(void) {
+  struct timespec ts;
+  int rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+  assert(rc == 0);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t next_random(uint32_t *seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+int main(void) {
+  static uint32_t order[NUM_PAGES];
+  char *region;
+  void **p;
+  uint32_t seed = 1;
+  double start;
+  double seconds;
+  int i;
+
+  region = mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(region != MAP_FAILED);
+
+  /* Link the pages into one cycle in a random order. */
+  for (i = 0; i < NUM_PAGES; i++)
+    order[i] = i;
+  for (i = NUM_PAGES - 1; i > 0; i--) {
+    uint32_t j = next_random(&seed) % (i + 1);
+    uint32_t tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+  for (i = 0; i < NUM_PAGES; i++) {
+    void **from = (void **) (region + order[i] * PAGE_SIZE);
+    *from = region + order[(i + 1) % NUM_PAGES] * PAGE_SIZE;
+  }
+
+  p = (void **) (region + order[0] * PAGE_SIZE);
+  start = get_time();
+  for (i = 0; i < LOADS; i++)
+    p = (void **) *p;
+  seconds = get_time() - start;
+  /* Keep the loop from being optimized away. */
+  assert(p != NULL);
+
+  printf("RESULT TlbBenchmark: load= %.2f ns\n", seconds * 1e9 / LOADS);
+  printf("region at %p, %d dependent loads over %d pages\n",
+         (void *) region, LOADS, NUM_PAGES);
+
+  assert(munmap(region, REGION_SIZE) == 0);
+  return 0;
+}
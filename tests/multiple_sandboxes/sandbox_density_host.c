@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * This benchmark loads one executable into as many NaCl sandboxes as the
+ * host process can hold, to measure sandbox density and the cost of
+ * creating a sandbox.  With "packed", the address space for all the
+ * sandboxes is reserved up front and neighbouring sandboxes share their
+ * guard regions (see NaClAddrSpacePackingInit()).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_client/src/include/build_config.h"
+#include "native_client/src/include/portability.h"
+#include "native_client/src/shared/platform/nacl_check.h"
+#include "native_client/src/shared/platform/nacl_exit.h"
+#include "native_client/src/shared/platform/nacl_log.h"
+#include "native_client/src/shared/platform/nacl_sync_checked.h"
+#include "native_client/src/shared/platform/nacl_time.h"
+#include "native_client/src/trusted/desc/nacl_desc_base.h"
+#include "native_client/src/trusted/desc/nacl_desc_io.h"
+#include "native_client/src/trusted/service_runtime/include/sys/fcntl.h"
+#include "native_client/src/trusted/service_runtime/nacl_all_modules.h"
+#include "native_client/src/trusted/service_runtime/nacl_app.h"
+#include "native_client/src/trusted/service_runtime/sel_addrspace.h"
+#include "native_client/src/trusted/service_runtime/sel_ldr.h"
+
+
+static double NowSeconds(void) {
+  return NaClGetTimeOfDayMicroseconds() / 1e6;
+}
+
+int main(int argc, char **argv) {
+  struct NaClApp *apps;
+  struct NaClDesc *nd;
+  int max_sandboxes;
+  int packed;
+  int count;
+  double start_time;
+  double total_time;
+
+  if (argc != 4) {
+    NaClLog(LOG_FATAL, "Usage: %s <nexe> <max-sandboxes> packed|unpacked\n",
+            argv[0]);
+  }
+  max_sandboxes = atoi(argv[2]);
+  CHECK(max_sandboxes > 0);
+  packed = strcmp(argv[3], "packed") == 0;
+
+  NaClAllModulesInit();
+
+  nd = (struct NaClDesc *) NaClDescIoDescOpen(argv[1], NACL_ABI_O_RDONLY, 0);
+  CHECK(NULL != nd);
+  apps = malloc(max_sandboxes * sizeof(*apps));
+  CHECK(NULL != apps);
+
+  start_time = NowSeconds();
+  if (packed) {
+#if NACL_ADDRSPACE_PACKING
+    /* Ask for fewer slots until the reservation fits. */
+    int slots = max_sandboxes;
+    while (slots > 0 && !NaClAddrSpacePackingInit(slots, NACL_DISABLE_ASLR))
+      slots = slots * 3 / 4;
+    printf("Reserved %d packed sandbox slots\n", slots);
+#else
+    NaClLog(LOG_FATAL, "Address space packing is not supported here\n");
+#endif
+  }
+
+  /* Stop at the first sandbox that cannot be created. */
+  for (count = 0; count < max_sandboxes; count++) {
+    CHECK(NaClAppCtor(&apps[count]));
+    NaClXMutexLock(&apps[count].mu);
+    if (NaClAppLoadFileAslr(nd, &apps[count], NACL_DISABLE_ASLR) != LOAD_OK) {
+      NaClXMutexUnlock(&apps[count].mu);
+      break;
+    }
+    NaClXMutexUnlock(&apps[count].mu);
+  }
+  total_time = NowSeconds() - start_time;
+
+  printf("RESULT SandboxDensity: %s= %d sandboxes\n", argv[3], count);
+  printf("RESULT SandboxCreate: %s= %.6f seconds\n", argv[3],
+         count > 0 ? total_time / count : 0.0);
+
+  /*
+   * Avoid calling exit() because it runs process-global destructors;
+   * the sandboxes are torn down with the process.
+   */
+  NaClExit(0);
+  return 0;
+}
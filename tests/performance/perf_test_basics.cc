@@ -38,6 +38,28 @@ class TestNaClSyscall : public PerfTest {
   }
 };
 PERF_TEST_DECLARE(TestNaClSyscall)
+
+// The following go through the x86-64 register-argument syscall fast
+// path.  Comparing against a run with NACL_DISABLE_SYSCALL_FAST_PATH set
+// gives the cost of the generic syscall dispatch.
+class TestNaClSyscallClockGetTime : public PerfTest {
+ public:
+  virtual void run() {
+    struct timespec time;
+    ASSERT_EQ(NACL_SYSCALL(clock_gettime)(CLOCK_MONOTONIC, &time), 0);
+  }
+};
+PERF_TEST_DECLARE(TestNaClSyscallClockGetTime)
+
+class TestNaClSyscallFutexWake : public PerfTest {
+ public:
+  virtual void run() {
+    // Nothing waits on this, so this does not wake anything.
+    static volatile int futex_value;
+    ASSERT_EQ(NACL_SYSCALL(futex_wake)(&futex_value, 1), 0);
+  }
+};
+PERF_TEST_DECLARE(TestNaClSyscallFutexWake)
 #endif
 
 #if NACL_LINUX || NACL_OSX
@@ -4,8 +4,10 @@
  * found in the LICENSE file.
  */
 
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <nacl/nacl_random.h>
@@ -110,8 +112,96 @@ int TestSecureRandom(void) {
   return result;
 }
 
+/*
+ * Small reads are served from a pool in the IRT.  Any byte it hands out
+ * twice, or wipes before handing out, shows up as a repeated 8-byte value,
+ * which random bytes are very unlikely to produce.
+ */
+#define POOL_TEST_BYTES 8192
+#define POOL_TEST_MAX_READ 64
+#define POOL_TEST_THREADS 4
+#define POOL_TEST_READS 512
+
+static int CompareUint64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+static int AllDistinct(uint64_t *values, size_t count) {
+  size_t i;
+  qsort(values, count, sizeof(*values), CompareUint64);
+  for (i = 1; i < count; i++) {
+    if (values[i] == values[i - 1]) {
+      fprintf(stderr, "Value %#llx read twice\n",
+              (unsigned long long) values[i]);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Reads of every size up to the largest the pool serves span refills. */
+int TestSecureRandomPool(void) {
+  static uint8_t bytes[POOL_TEST_BYTES];
+  static uint64_t windows[POOL_TEST_BYTES - 7];
+  size_t offset = 0;
+  size_t size = 1;
+  size_t nread;
+  size_t i;
+
+  while (offset < sizeof(bytes)) {
+    if (size > sizeof(bytes) - offset)
+      size = sizeof(bytes) - offset;
+    ASSERT_EQ(nacl_secure_random(bytes + offset, size, &nread), 0);
+    ASSERT_EQ(nread, size);
+    offset += size;
+    size = size % POOL_TEST_MAX_READ + 1;
+  }
+  for (i = 0; i < sizeof(bytes) - 7; i++)
+    memcpy(&windows[i], bytes + i, sizeof(windows[i]));
+  return AllDistinct(windows, sizeof(bytes) - 7) ? 0 : 1;
+}
+
+static uint64_t g_thread_values[POOL_TEST_THREADS][POOL_TEST_READS];
+
+static void *ReadValues(void *arg) {
+  uint64_t *values = arg;
+  size_t nread;
+  int i;
+
+  for (i = 0; i < POOL_TEST_READS; i++) {
+    if (nacl_secure_random(&values[i], sizeof(values[i]), &nread) != 0 ||
+        nread != sizeof(values[i])) {
+      /* Shows up as a repeated value. */
+      values[i] = 0;
+    }
+  }
+  return NULL;
+}
+
+/* Threads reading at the same time never get the same bytes. */
+int TestSecureRandomPoolThreads(void) {
+  pthread_t threads[POOL_TEST_THREADS];
+  int i;
+
+  for (i = 0; i < POOL_TEST_THREADS; i++)
+    ASSERT_EQ(pthread_create(&threads[i], NULL, ReadValues,
+                             g_thread_values[i]), 0);
+  for (i = 0; i < POOL_TEST_THREADS; i++)
+    ASSERT_EQ(pthread_join(threads[i], NULL), 0);
+  return AllDistinct(&g_thread_values[0][0],
+                     POOL_TEST_THREADS * POOL_TEST_READS) ? 0 : 1;
+}
+
 int main(void) {
   int rtn = RunTests(TestSecureRandom);
+  if (rtn)
+    return rtn;
+  rtn = RunTests(TestSecureRandomPool);
+  if (rtn)
+    return rtn;
+  rtn = RunTests(TestSecureRandomPoolThreads);
   if (rtn)
     return rtn;
   return RunTests(TestRand);
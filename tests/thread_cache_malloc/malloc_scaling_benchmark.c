@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Measures how malloc() and free() throughput scales with the number of
+ * threads calling them.  Each thread keeps a set of live blocks of mixed
+ * sizes, mostly small, and replaces them at random, which is roughly the
+ * pattern of a sandboxed library doing work on behalf of several callers.
+ *
+ * This file is built as is, with libnacl's allocator, and from
+ * thread_cache_malloc_scaling_benchmark.c with the thread-caching one.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef ALLOCATOR_NAME
+# define ALLOCATOR_NAME "dlmalloc"
+#endif
+
+#define MAX_THREADS 16
+#define LIVE_BLOCKS 256
+#define OPS_PER_THREAD 200000
+
+static double get_time(void) {
+  struct timespec ts;
+  int rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+  assert(rc == 0);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Three quarters of the blocks are at most 128 bytes, the rest up to 4KB. */
+static size_t block_size(uint32_t random) {
+  if ((random & 3) != 0)
+    return 1 + (random >> 2) % 128;
+  return 1 + (random >> 2) % 4096;
+}
+
+static void *thread_func(void *arg) {
+  uint32_t seed = (uint32_t) (uintptr_t) arg;
+  unsigned char *blocks[LIVE_BLOCKS];
+  int i;
+
+  memset(blocks, 0, sizeof(blocks));
+  for (i = 0; i < OPS_PER_THREAD; i++) {
+    unsigned slot;
+    seed = seed * 1103515245 + 12345;
+    slot = (seed >> 8) % LIVE_BLOCKS;
+    if (blocks[slot] != NULL) {
+      /* Check that no other thread was handed the same block. */
+      assert(blocks[slot][0] == (unsigned char) slot);
+      free(blocks[slot]);
+      blocks[slot] = NULL;
+    } else {
+      blocks[slot] = malloc(block_size(seed >> 12));
+      assert(blocks[slot] != NULL);
+      blocks[slot][0] = (unsigned char) slot;
+    }
+  }
+  for (i = 0; i < LIVE_BLOCKS; i++)
+    free(blocks[i]);
+  return NULL;
+}
+
+static double run(int num_threads) {
+  pthread_t threads[MAX_THREADS];
+  double start;
+  int i;
+
+  start = get_time();
+  for (i = 0; i < num_threads; i++) {
+    int rc = pthread_create(&threads[i], NULL, thread_func,
+                            (void *) (uintptr_t) (i + 1));
+    assert(rc == 0);
+  }
+  for (i = 0; i < num_threads; i++) {
+    int rc = pthread_join(threads[i], NULL);
+    assert(rc == 0);
+  }
+  return get_time() - start;
+}
+
+int main(void) {
+  double base_rate = 0;
+  int num_threads;
+
+  /* Warm up, so that the first run does not pay for growing the heap. */
+  run(1);
+
+  for (num_threads = 1; num_threads <= MAX_THREADS; num_threads *= 2) {
+    double seconds = run(num_threads);
+    double rate = num_threads * (double) OPS_PER_THREAD / seconds;
+    if (num_threads == 1)
+      base_rate = rate;
+    printf("RESULT MallocScaling_%s: threads_%d= %.0f ops/second\n",
+           ALLOCATOR_NAME, num_threads, rate);
+    printf("%s, %d threads: %.2fx the throughput of 1 thread\n",
+           ALLOCATOR_NAME, num_threads, rate / base_rate);
+  }
+  return 0;
+}
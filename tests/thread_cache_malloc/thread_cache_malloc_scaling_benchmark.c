@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2017 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * malloc_scaling_benchmark.c, with the thread-caching allocator used by
+ * the IRT in place of libnacl's, configured as libnacl configures
+ * dlmalloc.
+ */
+
+#define LACKS_TIME_H            1
+#define HAVE_MORECORE           0
+#define HAVE_MMAP               1
+#define HAVE_MREMAP             0
+
+/* @IGNORE_LINES_FOR_CODE_HYGIENE[1] */
+#include "native_client/src/untrusted/nacl/thread_cache_malloc.c"
+
+/* Keep newlib internals from pulling in libnacl's allocator too. */
+
+void *_malloc_r(struct _reent *ignored, size_t size) {
+  return malloc(size);
+}
+
+void *_calloc_r(struct _reent *ignored, size_t n, size_t size) {
+  return calloc(n, size);
+}
+
+void *_realloc_r(struct _reent *ignored, void *ptr, size_t size) {
+  return realloc(ptr, size);
+}
+
+void _free_r(struct _reent *ignored, void *ptr) {
+  free(ptr);
+}
+
+#define ALLOCATOR_NAME "thread_cache"
+/* @IGNORE_LINES_FOR_CODE_HYGIENE[1] */
+#include "native_client/tests/thread_cache_malloc/malloc_scaling_benchmark.c"